@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "batch.h"
+#include "parser.h"
+
+// Initial number of slots of the table of process names. Must be a power of 2.
+#define NAMES_INITIAL_SIZE 64
+
+// Effect of a command on the process tree, used to compute dependencies.
+typedef enum cmd_kind {
+  // Does not access the tree (e.g. phelp).
+  KIND_NONE,
+  // Reads a single process (e.g. pinfo).
+  KIND_READ,
+  // Creates or removes a single process (e.g. pnew, pclose).
+  KIND_WRITE,
+  // Reads all processes (e.g. plist, ptree).
+  KIND_READ_ALL,
+  // Unknown effect or affecting unknown processes (e.g. pspawn, prmall):
+  // the command runs alone, after all previous commands.
+  KIND_BARRIER
+} cmd_kind;
+
+// A growable array of command indexes.
+typedef struct index_list {
+  int * items;
+  int count;
+  int size;
+} index_list;
+
+// State of a process name during dependency analysis.
+typedef struct name_entry {
+  // Name of the process (points to an argument of a command).
+  const char * name;
+  // Generation of the entry. Entries of older generations are considered
+  // empty: this allows clearing the table in constant time on a barrier.
+  int gen;
+  // Last command that created or removed the process.
+  int last_writer;
+  // Commands that read the process after last_writer.
+  index_list readers;
+} name_entry;
+
+// State of the dependency analysis.
+typedef struct analysis_t {
+  // Hash table of process names.
+  name_entry * names;
+  int names_size;
+  int names_count;
+  // Current generation of the table.
+  int gen;
+  // Last barrier command, or -1.
+  int last_barrier;
+  // Commands after last_barrier.
+  index_list since_barrier;
+  // Commands writing any process after last_barrier.
+  index_list writers;
+  // Commands reading all processes after last_barrier.
+  index_list global_readers;
+} analysis_t;
+
+// Private functions.
+// Appends an index to a list.
+void list_push(index_list * list, int index);
+// Returns the kind of a command and the name of the process it accesses.
+cmd_kind classify(char ** argv, const char ** name);
+// Adds dependency: command to depends on command from.
+void add_edge(batch_t * batch, int from, int to);
+// Adds dependencies from all the commands in list to command to.
+void add_edges(batch_t * batch, const index_list * list, int to);
+// Finds (or inserts) the entry of a process name.
+name_entry * find_name(analysis_t * analysis, const char * name);
+// Computes the dependencies of a command.
+void analyze(batch_t * batch, analysis_t * analysis, int index);
+// Appends a copy of a command to a batch.
+int batch_append(batch_t * batch, char ** argv, int argc);
+
+// Appends an index to a list, growing it if necessary.
+//
+// list: the list
+// index: the index to append
+void list_push(index_list * list, int index) {
+  if (list->count == list->size) {
+    list->size = (list->size == 0) ? 4 : 2 * list->size;
+    list->items = realloc(list->items, sizeof(int) * list->size);
+  }
+  list->items[list->count++] = index;
+}
+
+// Returns the kind of a command and the name of the process it accesses. The
+// name is the last argument which is not an option.
+//
+// argv: the arguments of the command
+// name: where a pointer to the name of the process is stored, or NULL
+//
+// Returns: the kind of the command.
+cmd_kind classify(char ** argv, const char ** name) {
+  *name = NULL;
+  int i;
+  for (i = 1; argv[i] != NULL; i++) {
+    if (argv[i][0] != '-') {
+      *name = argv[i];
+    }
+  }
+  const char * command = argv[0];
+  if (strcmp(command, "phelp") == 0 || strcmp(command, "jobs") == 0) {
+    return KIND_NONE;
+  }
+  if (strcmp(command, "plist") == 0 || strcmp(command, "ptree") == 0) {
+    return KIND_READ_ALL;
+  }
+  int read = strcmp(command, "pinfo") == 0;
+  int write = strcmp(command, "pnew") == 0 || strcmp(command, "pclose") == 0;
+  if (read || write) {
+    // Without a process name, the command only prints its help.
+    if (*name == NULL) {
+      return KIND_NONE;
+    }
+    return read ? KIND_READ : KIND_WRITE;
+  }
+  return KIND_BARRIER;
+}
+
+// Adds dependency: command to depends on command from.
+//
+// batch: the batch
+// from: the index of the command that must complete first, or -1 (no-op)
+// to: the index of the dependent command
+void add_edge(batch_t * batch, int from, int to) {
+  if (from < 0 || from == to) {
+    return;
+  }
+  batch_cmd * cmd = &batch->cmds[from];
+  // Skip duplicated edges added consecutively.
+  if (cmd->dependents_count > 0 && cmd->dependents[cmd->dependents_count - 1] == to) {
+    return;
+  }
+  if (cmd->dependents_count == cmd->dependents_size) {
+    cmd->dependents_size = (cmd->dependents_size == 0) ? 2 : 2 * cmd->dependents_size;
+    cmd->dependents = realloc(cmd->dependents, sizeof(int) * cmd->dependents_size);
+  }
+  cmd->dependents[cmd->dependents_count++] = to;
+  batch->cmds[to].pending++;
+}
+
+// Adds dependencies from all the commands in list to command to.
+void add_edges(batch_t * batch, const index_list * list, int to) {
+  int i;
+  for (i = 0; i < list->count; i++) {
+    add_edge(batch, list->items[i], to);
+  }
+}
+
+// Finds the entry of a process name in the hash table, inserting it if not
+// present. Entries of older generations are reset.
+//
+// analysis: the state of the analysis
+// name: the name of the process
+//
+// Returns: the entry of the name.
+name_entry * find_name(analysis_t * analysis, const char * name) {
+  // Grow table when it is half full.
+  if (2 * (analysis->names_count + 1) > analysis->names_size) {
+    name_entry * old = analysis->names;
+    int old_size = analysis->names_size;
+    analysis->names_size = (old_size == 0) ? NAMES_INITIAL_SIZE : 2 * old_size;
+    analysis->names = calloc(analysis->names_size, sizeof(name_entry));
+    analysis->names_count = 0;
+    int i;
+    for (i = 0; i < old_size; i++) {
+      if (old[i].name != NULL) {
+        name_entry * entry = find_name(analysis, old[i].name);
+        *entry = old[i];
+      }
+    }
+    free(old);
+  }
+  // FNV-1a hash.
+  unsigned int hash = 2166136261u;
+  const char * c;
+  for (c = name; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char) *c) * 16777619u;
+  }
+  unsigned int mask = analysis->names_size - 1;
+  unsigned int i = hash & mask;
+  while (analysis->names[i].name != NULL && strcmp(analysis->names[i].name, name) != 0) {
+    i = (i + 1) & mask;
+  }
+  name_entry * entry = &analysis->names[i];
+  if (entry->name == NULL) {
+    entry->name = name;
+    entry->gen = analysis->gen - 1;
+    analysis->names_count++;
+  }
+  if (entry->gen != analysis->gen) {
+    entry->gen = analysis->gen;
+    entry->last_writer = -1;
+    entry->readers.count = 0;
+  }
+  return entry;
+}
+
+// Computes the dependencies of a command, given the commands preceding it.
+// Two commands depend on each other if they access the same process and at
+// least one of them modifies it; a barrier depends on everything before it,
+// and everything after it depends on the barrier.
+//
+// batch: the batch
+// analysis: the state of the analysis
+// index: the index of the command
+void analyze(batch_t * batch, analysis_t * analysis, int index) {
+  const char * name;
+  cmd_kind kind = classify(batch->cmds[index].argv, &name);
+
+  if (kind == KIND_BARRIER) {
+    add_edge(batch, analysis->last_barrier, index);
+    add_edges(batch, &analysis->since_barrier, index);
+    // Forget everything before the barrier.
+    analysis->last_barrier = index;
+    analysis->since_barrier.count = 0;
+    analysis->writers.count = 0;
+    analysis->global_readers.count = 0;
+    analysis->gen++;
+    return;
+  }
+
+  add_edge(batch, analysis->last_barrier, index);
+  list_push(&analysis->since_barrier, index);
+
+  if (kind == KIND_READ) {
+    name_entry * entry = find_name(analysis, name);
+    add_edge(batch, entry->last_writer, index);
+    list_push(&entry->readers, index);
+  } else if (kind == KIND_WRITE) {
+    name_entry * entry = find_name(analysis, name);
+    add_edge(batch, entry->last_writer, index);
+    add_edges(batch, &entry->readers, index);
+    add_edges(batch, &analysis->global_readers, index);
+    entry->last_writer = index;
+    entry->readers.count = 0;
+    list_push(&analysis->writers, index);
+  } else if (kind == KIND_READ_ALL) {
+    add_edges(batch, &analysis->writers, index);
+    list_push(&analysis->global_readers, index);
+  }
+}
+
+// Appends a copy of a command to a batch.
+//
+// batch: the batch
+// argv: the arguments of the command
+// argc: the number of arguments
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int batch_append(batch_t * batch, char ** argv, int argc) {
+  batch_cmd * cmds = realloc(batch->cmds, sizeof(batch_cmd) * (batch->count + 1));
+  if (cmds == NULL) {
+    return -1;
+  }
+  batch->cmds = cmds;
+  char ** copy = malloc(sizeof(char *) * (argc + 1));
+  if (copy == NULL) {
+    return -1;
+  }
+  int i;
+  for (i = 0; i < argc; i++) {
+    copy[i] = strdup(argv[i]);
+  }
+  copy[argc] = NULL;
+  batch_cmd * cmd = &batch->cmds[batch->count];
+  cmd->argv = copy;
+  cmd->dependents = NULL;
+  cmd->dependents_count = 0;
+  cmd->dependents_size = 0;
+  cmd->pending = 0;
+  batch->count++;
+  return 0;
+}
+
+// Parses all the commands in stream and builds their dependency graph.
+// Parsing stops at EOF or at the "quit" command. A trailing "&" is ignored,
+// since all commands are scheduled according to their dependencies.
+//
+// stream: the stream to parse
+//
+// Returns: the new batch, or NULL on failure.
+batch_t * batch_load(FILE * stream) {
+  batch_t * batch = calloc(1, sizeof(batch_t));
+  parser_t * parser = parser_init(fileno(stream));
+  if (batch == NULL || parser == NULL) {
+    free(batch);
+    parser_deinit(parser);
+    return NULL;
+  }
+
+  char ** argv;
+  int argc;
+  int error = 0;
+  while (!error && (argc = parser_next(parser, &argv)) >= 0) {
+    // Commands run in parallel anyway: a trailing "&" is ignored.
+    parser_background(argv, &argc);
+    if (argc == 0) {
+      continue;
+    }
+    if (strcmp(argv[0], "quit") == 0) {
+      break;
+    }
+    error = batch_append(batch, argv, argc) != 0;
+  }
+  parser_deinit(parser);
+  if (error || argc == -2) {
+    batch_deinit(batch);
+    return NULL;
+  }
+
+  // Build dependency graph.
+  analysis_t analysis;
+  memset(&analysis, 0, sizeof(analysis_t));
+  analysis.last_barrier = -1;
+  int i;
+  for (i = 0; i < batch->count; i++) {
+    analyze(batch, &analysis, i);
+  }
+  for (i = 0; i < analysis.names_size; i++) {
+    free(analysis.names[i].readers.items);
+  }
+  free(analysis.names);
+  free(analysis.since_barrier.items);
+  free(analysis.writers.items);
+  free(analysis.global_readers.items);
+
+  // Queue commands without dependencies.
+  batch->ready = malloc(sizeof(int) * (batch->count + 1));
+  batch->remaining = batch->count;
+  for (i = 0; i < batch->count; i++) {
+    if (batch->cmds[i].pending == 0) {
+      batch->ready[batch->ready_tail++] = i;
+    }
+  }
+
+  return batch;
+}
+
+// Frees a batch.
+//
+// batch: the batch to free
+void batch_deinit(batch_t * batch) {
+  if (batch == NULL) {
+    return;
+  }
+  int i;
+  for (i = 0; i < batch->count; i++) {
+    int j;
+    for (j = 0; batch->cmds[i].argv[j] != NULL; j++) {
+      free(batch->cmds[i].argv[j]);
+    }
+    free(batch->cmds[i].argv);
+    free(batch->cmds[i].dependents);
+  }
+  free(batch->cmds);
+  free(batch->ready);
+  free(batch);
+}
+
+// Returns the index of a command ready to run, removing it from the queue.
+//
+// batch: the batch
+//
+// Returns: the index of the command, or -1 if no command is ready.
+int batch_next(batch_t * batch) {
+  if (batch->ready_head == batch->ready_tail) {
+    return -1;
+  }
+  return batch->ready[batch->ready_head++];
+}
+
+// Marks a command as completed. Commands whose dependencies are now all
+// completed are added to the ready queue.
+//
+// batch: the batch
+// index: the index of the completed command
+void batch_done(batch_t * batch, int index) {
+  batch_cmd * cmd = &batch->cmds[index];
+  int i;
+  for (i = 0; i < cmd->dependents_count; i++) {
+    int dependent = cmd->dependents[i];
+    if (--batch->cmds[dependent].pending == 0) {
+      batch->ready[batch->ready_tail++] = dependent;
+    }
+  }
+  batch->remaining--;
+}
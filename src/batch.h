@@ -0,0 +1,40 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+// Represents a command of a batch, with its dependencies.
+typedef struct batch_cmd {
+  // Arguments of the command, terminated by a NULL pointer.
+  char ** argv;
+  // Indexes of the commands that depend on this command.
+  int * dependents;
+  int dependents_count;
+  int dependents_size;
+  // Number of dependencies not completed yet.
+  int pending;
+} batch_cmd;
+
+// Represents a whole command file, parsed up front.
+typedef struct batch_t {
+  // Commands in file order.
+  batch_cmd * cmds;
+  int count;
+  // Queue of commands whose dependencies are all completed.
+  int * ready;
+  int ready_head;
+  int ready_tail;
+  // Number of commands not completed yet.
+  int remaining;
+} batch_t;
+
+// Parses all the commands in stream and builds their dependency graph.
+batch_t * batch_load(FILE * stream);
+// Frees a batch.
+void batch_deinit(batch_t * batch);
+// Returns the index of a command ready to run, or -1 if there is none.
+int batch_next(batch_t * batch);
+// Marks a command as completed, making ready the commands depending on it.
+void batch_done(batch_t * batch, int index);
+
+#endif
@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "message.h"
+#include "proc_tree.h"
+#include "handlers.h"
+
+// Microbenchmarks of the messaging layer (message.c), run against a server
+// process forked by the benchmark, without pmanager:
+// - pingpong: round trips of a small message (message_send() and
+//   message_wait() on both sides)
+// - throughput: one-way messages of several payload sizes, with the latency
+//   measured by the server from the send time carried by each message
+// - fanin: round trips from several concurrent clients to the server
+// - list: message_list() of a tree of several nodes, served by
+//   msg_list_handler() as in pmanager
+// Results can be printed as a table, or as CSV or JSON to compare runs.
+//
+// Usage: bench_ipc [-n COUNT] [-c CLIENTS] [-l NODES] [-f text|csv|json]
+// It must be run from the directory containing pmanager.
+
+// Default number of messages of each benchmark.
+#define DEFAULT_COUNT 20000
+// Default number of concurrent clients for fanin.
+#define DEFAULT_CLIENTS 4
+// Default number of nodes for list.
+#define DEFAULT_NODES 1000
+// Number of lists received for list.
+#define LIST_ROUNDS 50
+// Message types used by the server: MSG_INFO is echoed, MSG_ADD is counted,
+// MSG_PRUNE ends a throughput run, MSG_LIST is served as by pmanager and
+// MSG_REMOVE stops the server.
+#define MSG_ECHO MSG_INFO
+#define MSG_DATA MSG_ADD
+#define MSG_END MSG_PRUNE
+#define MSG_QUIT MSG_REMOVE
+
+// Payload sizes of throughput, in bytes. The largest one fits in PIPE_BUF with
+// the header of the message.
+const int payload_sizes[] = {16, 256, 1024, 4000};
+
+// Represents the result of a benchmark.
+typedef struct bench_result {
+  char name[16];
+  // Parameter of the benchmark (payload size, clients or nodes), or 0.
+  int param;
+  long long ops;
+  double seconds;
+  // Bytes received by the server per second, for throughput.
+  double bytes_per_sec;
+  // Percentiles 50, 99 and 99.9 of latencies, in nanoseconds.
+  long long latency[3];
+} bench_result;
+
+// Global variables.
+// PID of the server process.
+pid_t server_pid = -1;
+// Flag set if FIFO_DIR was created by the benchmark.
+int fifo_dir_created = 0;
+// Results of the benchmarks run so far.
+bench_result results[16];
+int results_count = 0;
+
+// Utility functions.
+// Forks the server, which serves messages until MSG_QUIT.
+pid_t start_server(int nodes);
+// Main loop of the server.
+void serve(int nodes);
+// Measures round trips from a single client.
+void bench_pingpong(int count);
+// Measures one-way messages of a payload size.
+void bench_throughput(int count, int size);
+// Measures round trips from concurrent clients.
+void bench_fanin(int count, int clients);
+// Measures lists of the tree of the server.
+void bench_list(int nodes);
+// Sends count requests to the server and stores their latencies.
+int round_trips(int count, long long * samples);
+// Adds a result, computing percentiles from samples (sorted in place).
+void add_result(const char * name, int param, long long ops, long long elapsed,
+                long long * samples, int count);
+// Prints the results in the given format.
+void print_results(const char * format);
+// Callback of message_list(), counting the nodes received.
+void count_node(const char * proc_str, void * arg);
+// Prints usage and exits.
+void usage();
+
+void main(int argc, char ** argv) {
+
+  int count = DEFAULT_COUNT;
+  int clients = DEFAULT_CLIENTS;
+  int nodes = DEFAULT_NODES;
+  const char * format = "text";
+  int option;
+  while ((option = getopt(argc, argv, "n:c:l:f:")) != -1) {
+    switch (option) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'c':
+        clients = atoi(optarg);
+        break;
+      case 'l':
+        nodes = atoi(optarg);
+        break;
+      case 'f':
+        format = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind != argc || count <= 0 || clients <= 0 || nodes <= 0 ||
+      (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0 &&
+       strcmp(format, "json") != 0)) {
+    usage();
+  }
+
+  // Inboxes are created in FIFO_DIR, as when pmanager runs.
+  if (mkdir(FIFO_DIR, 0700) == 0) {
+    fifo_dir_created = 1;
+  } else if (errno != EEXIST) {
+    fprintf(stderr, "Error: failed to create FIFO directory.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (message_setup() != 0 || start_server(nodes) == -1) {
+    fprintf(stderr, "Error: failed to start server.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  bench_pingpong(count);
+  int i;
+  for (i = 0; i < sizeof(payload_sizes) / sizeof(payload_sizes[0]); i++) {
+    bench_throughput(count, payload_sizes[i]);
+  }
+  bench_fanin(count, clients);
+  bench_list(nodes);
+  print_results(format);
+
+  message_send(server_pid, MSG_QUIT, NULL);
+  waitpid(server_pid, NULL, 0);
+  message_teardown();
+  if (fifo_dir_created) {
+    rmdir(FIFO_DIR);
+  }
+  exit(EXIT_SUCCESS);
+}
+
+// Forks the server and waits until it replies, i.e. until its inbox exists.
+//
+// nodes: the number of nodes of the tree listed by the server
+//
+// Returns: the PID of the server, or -1 on failure.
+pid_t start_server(int nodes) {
+  server_pid = fork();
+  if (server_pid == 0) {
+    serve(nodes);
+    _exit(EXIT_SUCCESS);
+  }
+  if (server_pid == -1) {
+    return -1;
+  }
+  long long deadline = time_ns() + 5000000000LL;
+  while (time_ns() < deadline) {
+    if (message_send(server_pid, MSG_ECHO, "ready") == 0) {
+      message_t * response = message_wait(server_pid);
+      message_deinit(response);
+      return (response != NULL) ? server_pid : -1;
+    }
+    usleep(1000);
+  }
+  kill(server_pid, SIGKILL);
+  return -1;
+}
+
+// Main loop of the server. The tree listed contains the server and nodes - 1
+// children, whose names are as long as those given by pnew and pspawn.
+//
+// nodes: the number of nodes of the tree
+void serve(int nodes) {
+  if (message_setup() != 0) {
+    return;
+  }
+  proc_node * root = proc_node_init(getpid(), getppid(), "pmanager");
+  int i;
+  for (i = 1; i < nodes; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "process_%d", i);
+    proc_node * node = proc_node_init(1000000 + i, getpid(), name);
+    proc_node_add(root, node);
+    proc_node_deinit(node);
+  }
+
+  // One-way latencies of the current throughput run.
+  long long * samples = NULL;
+  int samples_count = 0;
+  int samples_size = 0;
+  int quit = 0;
+  while (!quit) {
+    message_t * msg = message_wait(-1);
+    if (msg == NULL) {
+      break;
+    }
+    if (strcmp(msg->type, MSG_ECHO) == 0) {
+      message_send(msg->pid_sender, MSG_SUCCESS, msg->content);
+    } else if (strcmp(msg->type, MSG_DATA) == 0) {
+      if (samples_count == samples_size) {
+        samples_size = (samples_size == 0) ? 1024 : samples_size * 2;
+        samples = realloc(samples, sizeof(long long) * samples_size);
+      }
+      samples[samples_count++] = time_ns() - msg->time_sent;
+    } else if (strcmp(msg->type, MSG_END) == 0) {
+      // Reply with <count>;<p50>;<p99>;<p999>.
+      char reply[96];
+      long long p[3] = {0, 0, 0};
+      if (samples_count > 0) {
+        qsort(samples, samples_count, sizeof(long long), compare_ll);
+        p[0] = samples[samples_count / 2];
+        p[1] = samples[(samples_count * 99LL) / 100];
+        p[2] = samples[(samples_count * 999LL) / 1000];
+      }
+      snprintf(reply, sizeof(reply), "%d;%lld;%lld;%lld", samples_count, p[0], p[1], p[2]);
+      message_send(msg->pid_sender, MSG_SUCCESS, reply);
+      samples_count = 0;
+    } else if (strcmp(msg->type, MSG_LIST) == 0) {
+      msg_list_handler(msg, root);
+    } else if (strcmp(msg->type, MSG_QUIT) == 0) {
+      quit = 1;
+    }
+    message_deinit(msg);
+  }
+  free(samples);
+  proc_node_deinit(root);
+  message_teardown();
+}
+
+// Sends count echo requests to the server, one at a time, and stores the
+// round trip time of each one.
+//
+// count: the number of requests
+// samples: where the latencies are stored
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int round_trips(int count, long long * samples) {
+  int i;
+  for (i = 0; i < count; i++) {
+    long long start = time_ns();
+    if (message_send(server_pid, MSG_ECHO, "ping") != 0) {
+      return -1;
+    }
+    message_t * response = message_wait(server_pid);
+    if (response == NULL) {
+      return -1;
+    }
+    message_deinit(response);
+    samples[i] = time_ns() - start;
+  }
+  return 0;
+}
+
+// Measures round trips between this process and the server.
+//
+// count: the number of round trips
+void bench_pingpong(int count) {
+  long long * samples = malloc(sizeof(long long) * count);
+  long long start = time_ns();
+  if (samples != NULL && round_trips(count, samples) == 0) {
+    add_result("pingpong", 0, count, time_ns() - start, samples, count);
+  } else {
+    fprintf(stderr, "Error: pingpong failed.\n");
+  }
+  free(samples);
+}
+
+// Sends count messages with a payload of size bytes to the server, without
+// waiting for replies, then a message ending the run. The server replies with
+// the one-way latencies it measured.
+//
+// count: the number of messages
+// size: the size of the payload
+void bench_throughput(int count, int size) {
+  char * payload = malloc(size + 1);
+  if (payload == NULL) {
+    return;
+  }
+  memset(payload, 'x', size);
+  payload[size] = '\0';
+  long long start = time_ns();
+  int i;
+  int error = 0;
+  for (i = 0; i < count && !error; i++) {
+    error = message_send(server_pid, MSG_DATA, payload) != 0;
+  }
+  message_t * response = NULL;
+  if (!error && message_send(server_pid, MSG_END, NULL) == 0) {
+    response = message_wait(server_pid);
+  }
+  long long elapsed = time_ns() - start;
+  free(payload);
+  bench_result * result = &results[results_count];
+  if (response == NULL ||
+      sscanf(response->content, "%lld;%lld;%lld;%lld", &result->ops, &result->latency[0],
+             &result->latency[1], &result->latency[2]) != 4) {
+    fprintf(stderr, "Error: throughput failed.\n");
+    message_deinit(response);
+    return;
+  }
+  message_deinit(response);
+  strcpy(result->name, "throughput");
+  result->param = size;
+  result->seconds = elapsed / 1e9;
+  result->bytes_per_sec = (double) result->ops * size / result->seconds;
+  results_count++;
+}
+
+// Measures round trips from clients processes sending count requests in
+// total, at the same time, to the server. Latencies are collected in shared
+// memory.
+//
+// count: the number of round trips
+// clients: the number of client processes
+void bench_fanin(int count, int clients) {
+  int per_client = count / clients;
+  if (per_client == 0) {
+    per_client = 1;
+  }
+  size_t size = sizeof(long long) * per_client * clients;
+  long long * samples = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (samples == MAP_FAILED) {
+    return;
+  }
+  pid_t * pids = malloc(sizeof(pid_t) * clients);
+  if (pids == NULL) {
+    munmap(samples, size);
+    return;
+  }
+  long long start = time_ns();
+  int started = 0;
+  int failed = 0;
+  int i;
+  for (i = 0; i < clients; i++) {
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      // Each client has its own inbox.
+      int status = message_setup() == 0 &&
+                   round_trips(per_client, samples + i * per_client) == 0;
+      message_teardown();
+      _exit(status ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    started += pids[i] != -1;
+  }
+  // The server is a child too: wait only for the clients.
+  for (i = 0; i < clients; i++) {
+    int status;
+    if (pids[i] != -1 &&
+        (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) ||
+         WEXITSTATUS(status) != EXIT_SUCCESS)) {
+      failed++;
+    }
+  }
+  long long elapsed = time_ns() - start;
+  free(pids);
+  if (started == clients && failed == 0) {
+    add_result("fanin", clients, per_client * clients, elapsed, samples,
+               per_client * clients);
+  } else {
+    fprintf(stderr, "Error: fanin failed.\n");
+  }
+  munmap(samples, size);
+}
+
+// Measures lists of the whole tree of the server, as done by plist and ptree
+// when the shared tree is not available.
+//
+// nodes: the number of nodes of the tree
+void bench_list(int nodes) {
+  long long samples[LIST_ROUNDS];
+  long long start = time_ns();
+  int i;
+  for (i = 0; i < LIST_ROUNDS; i++) {
+    long long list_start = time_ns();
+    int received = 0;
+    if (message_list(server_pid, "pmanager", count_node, &received) != 0 ||
+        received != nodes) {
+      fprintf(stderr, "Error: list failed.\n");
+      return;
+    }
+    samples[i] = time_ns() - list_start;
+  }
+  // Operations are nodes received.
+  add_result("list", nodes, (long long) nodes * LIST_ROUNDS, time_ns() - start,
+             samples, LIST_ROUNDS);
+}
+
+// Callback of message_list(), counting the nodes received.
+void count_node(const char * proc_str, void * arg) {
+  (*(int *) arg)++;
+}
+
+// Adds a result. Percentiles are computed from the latencies of operations.
+//
+// name: the name of the benchmark
+// param: the parameter of the benchmark, or 0
+// ops: the number of operations
+// elapsed: the time taken by the operations, in nanoseconds
+// samples: the latencies, sorted by this function
+// count: the number of latencies
+void add_result(const char * name, int param, long long ops, long long elapsed,
+                long long * samples, int count) {
+  bench_result * result = &results[results_count++];
+  strcpy(result->name, name);
+  result->param = param;
+  result->ops = ops;
+  result->seconds = elapsed / 1e9;
+  result->bytes_per_sec = 0;
+  qsort(samples, count, sizeof(long long), compare_ll);
+  result->latency[0] = samples[count / 2];
+  result->latency[1] = samples[(count * 99LL) / 100];
+  result->latency[2] = samples[(count * 999LL) / 1000];
+}
+
+// Prints the results as a table ("text"), as CSV with a header ("csv"), or as
+// a JSON array ("json"). Latencies are in microseconds.
+//
+// format: the output format
+void print_results(const char * format) {
+  int i;
+  if (strcmp(format, "csv") == 0) {
+    printf("benchmark,param,ops,seconds,ops_per_sec,bytes_per_sec,p50_us,p99_us,p999_us\n");
+  } else if (strcmp(format, "json") == 0) {
+    printf("[\n");
+  } else {
+    printf("%-10s %6s %9s %12s %10s %9s %9s %9s\n", "BENCHMARK", "PARAM", "OPS",
+           "OPS/S", "MB/S", "P50 (us)", "P99 (us)", "P999 (us)");
+  }
+  for (i = 0; i < results_count; i++) {
+    const bench_result * r = &results[i];
+    double rate = (r->seconds > 0) ? r->ops / r->seconds : 0;
+    if (strcmp(format, "csv") == 0) {
+      printf("%s,%d,%lld,%.6f,%.1f,%.1f,%.3f,%.3f,%.3f\n", r->name, r->param, r->ops,
+             r->seconds, rate, r->bytes_per_sec, r->latency[0] / 1e3,
+             r->latency[1] / 1e3, r->latency[2] / 1e3);
+    } else if (strcmp(format, "json") == 0) {
+      printf("  {\"benchmark\":\"%s\",\"param\":%d,\"ops\":%lld,\"seconds\":%.6f,"
+             "\"ops_per_sec\":%.1f,\"bytes_per_sec\":%.1f,\"p50_us\":%.3f,"
+             "\"p99_us\":%.3f,\"p999_us\":%.3f}%s\n", r->name, r->param, r->ops,
+             r->seconds, rate, r->bytes_per_sec, r->latency[0] / 1e3,
+             r->latency[1] / 1e3, r->latency[2] / 1e3,
+             (i == results_count - 1) ? "" : ",");
+    } else {
+      printf("%-10s %6d %9lld %12.1f %10.2f %9.1f %9.1f %9.1f\n", r->name, r->param,
+             r->ops, rate, r->bytes_per_sec / 1e6, r->latency[0] / 1e3,
+             r->latency[1] / 1e3, r->latency[2] / 1e3);
+    }
+  }
+  if (strcmp(format, "json") == 0) {
+    printf("]\n");
+  }
+}
+
+// Prints usage and exits.
+void usage() {
+  fprintf(stderr, "Usage: bench_ipc [-n COUNT] [-c CLIENTS] [-l NODES] [-f text|csv|json]\n");
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "launcher.h"
+
+// Benchmark of the per-command launch overhead of pmanager. It compares the
+// original launch path of exec_command() (path concatenation, access(),
+// fork() and execvp()) with the launcher (cached fd and posix_spawn()). Both
+// paths wait for the termination of the command, as exec_command() does.
+//
+// Usage: bench_launch [COUNT] [COMMAND]
+// It must be run from the directory containing PATH.
+
+// Default number of launches for each path.
+#define DEFAULT_COUNT 1000
+// Default command to launch. Its output is discarded.
+#define DEFAULT_COMMAND "phelp"
+
+// Utility functions.
+// Launches command as the original exec_command() did.
+int legacy_launch(const char * command, char ** argv);
+// Launches command through the launcher.
+int launcher_launch(const char * command, char ** argv);
+// Runs count launches with launch() and prints statistics.
+void run(const char * label, int (*launch)(const char *, char **),
+         const char * command, int count, int out_fd);
+
+void main(int argc, char ** argv) {
+
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_COUNT;
+  const char * command = (argc > 2) ? argv[2] : DEFAULT_COMMAND;
+  if (count <= 0) {
+    fprintf(stderr, "Usage: bench_launch [COUNT] [COMMAND]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Use the same PATH as pmanager.
+  if (setenv("PATH", PATH, 1) != 0 || launcher_init(PATH) != 0) {
+    fprintf(stderr, "Error: failed to setup launcher.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Discard the output of launched commands, keeping a copy of stdout for
+  // printing results.
+  fflush(stdout);
+  int out_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (out_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+    fprintf(stderr, "Error: failed to redirect output.\n");
+    exit(EXIT_FAILURE);
+  }
+  close(null_fd);
+
+  dprintf(out_fd, "Launching \"%s\" %d times per path.\n", command, count);
+  dprintf(out_fd, "%-10s %12s %12s %12s\n", "PATH", "MEAN (us)", "P50 (us)", "P99 (us)");
+  run("fork+exec", legacy_launch, command, count, out_fd);
+  run("launcher", launcher_launch, command, count, out_fd);
+
+  launcher_deinit();
+  exit(EXIT_SUCCESS);
+}
+
+// Launches command as the original exec_command() did, waiting for its
+// termination.
+//
+// Returns: 0 on success, -1 on failure.
+int legacy_launch(const char * command, char ** argv) {
+  char * pathname = malloc(sizeof(char) * (strlen(PATH) + strlen(command) + 1));
+  pathname[0] = '\0';
+  strcat(pathname, PATH);
+  strcat(pathname, command);
+  int x_ok = access(pathname, X_OK);
+  free(pathname);
+  if (x_ok != 0) {
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    return -1;
+  } else if (pid == 0) {
+    execvp(command, argv);
+    _exit(EXIT_FAILURE);
+  }
+  while (waitpid(pid, NULL, 0) <= 0);
+  return 0;
+}
+
+// Launches command through the launcher, waiting for its termination.
+//
+// Returns: 0 on success, -1 on failure.
+int launcher_launch(const char * command, char ** argv) {
+  pid_t pid;
+  if (launcher_spawn(command, argv, &pid) != 0) {
+    return -1;
+  }
+  while (waitpid(pid, NULL, 0) <= 0);
+  return 0;
+}
+
+// Runs count launches of command with launch() and prints mean, median and
+// 99th percentile of the launch time.
+//
+// label: the name of the launch path
+// launch: the function used to launch the command
+// command: the command to launch
+// count: the number of launches
+// out_fd: the file descriptor where results are printed
+void run(const char * label, int (*launch)(const char *, char **),
+         const char * command, int count, int out_fd) {
+  long long * samples = malloc(sizeof(long long) * count);
+  char * argv[] = { (char *) command, NULL };
+  long long total = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    long long start = time_ns();
+    if (launch(command, argv) != 0) {
+      dprintf(out_fd, "Error: failed to launch \"%s\".\n", command);
+      free(samples);
+      return;
+    }
+    samples[i] = time_ns() - start;
+    total += samples[i];
+  }
+  qsort(samples, count, sizeof(long long), compare_ll);
+  dprintf(out_fd, "%-10s %12.1f %12.1f %12.1f\n", label,
+          total / (double) count / 1000.0,
+          samples[count / 2] / 1000.0,
+          samples[(int) (count * 0.99)] / 1000.0);
+  free(samples);
+}
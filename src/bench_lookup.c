@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "message.h"
+#include "shm_tree.h"
+
+// Benchmark of the name to PID resolution used by pclose and pspawn. It
+// compares the original path (popen() of "pinfo --pid-only", which starts a
+// shell and pinfo) with message_lookup_pid(), a single round trip to pmanager,
+// and with shm_tree_lookup_pid(), which reads the tree published by pmanager.
+// A pmanager instance with one process is started for the measurement.
+//
+// Usage: bench_lookup [COUNT]
+// It must be run from the directory containing pmanager.
+
+// Default number of lookups for each path.
+#define DEFAULT_COUNT 500
+// Name of the process created for the lookups.
+#define TARGET_NAME "bench_target"
+// Maximum time to wait for pmanager to be ready, in milliseconds.
+#define STARTUP_TIMEOUT_MS 5000
+
+// PID of the pmanager instance.
+pid_t pmanager_pid = -1;
+
+// Utility functions.
+// Starts pmanager and returns a stream connected to its input.
+FILE * start_pmanager();
+// Resolves TARGET_NAME by running pinfo, as the original tools did.
+pid_t legacy_lookup();
+// Resolves TARGET_NAME with message_lookup_pid().
+pid_t direct_lookup();
+// Resolves TARGET_NAME with shm_tree_lookup_pid().
+pid_t shared_lookup();
+// Runs count lookups with lookup() and prints statistics.
+void run(const char * label, pid_t (*lookup)(), int count);
+
+void main(int argc, char ** argv) {
+
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_COUNT;
+  if (count <= 0) {
+    fprintf(stderr, "Usage: bench_lookup [COUNT]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // pinfo is found through the same PATH as pmanager.
+  if (setenv("PATH", PATH, 1) != 0) {
+    fprintf(stderr, "Error: failed to set PATH.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  FILE * input = start_pmanager();
+  if (input == NULL) {
+    fprintf(stderr, "Error: failed to start pmanager.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The inbox can be created only once pmanager created FIFO_DIR, and the
+  // target is registered asynchronously: retry until it is found.
+  long long deadline = time_ns() + STARTUP_TIMEOUT_MS * 1000000LL;
+  int setup = 0;
+  int ready = 0;
+  while (!ready && time_ns() < deadline) {
+    setup = setup || message_setup() == 0;
+    ready = setup && direct_lookup() != -1;
+    if (!ready) {
+      usleep(1000);
+    }
+  }
+  if (!ready) {
+    fprintf(stderr, "Error: pmanager is not responding.\n");
+  } else {
+    printf("Resolving \"%s\" %d times per path.\n", TARGET_NAME, count);
+    printf("%-10s %12s %12s %12s\n", "PATH", "MEAN (us)", "P50 (us)", "P99 (us)");
+    run("popen", legacy_lookup, count);
+    run("message", direct_lookup, count);
+    run("shm", shared_lookup, count);
+  }
+
+  message_teardown();
+  fprintf(input, "quit\n");
+  pclose(input);
+  exit(ready ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Starts pmanager reading commands from a pipe, discarding its output, and
+// creates the target process.
+//
+// Returns: the stream connected to the input of pmanager, or NULL on failure.
+FILE * start_pmanager() {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return NULL;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    return NULL;
+  }
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(fds[0], STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execl("./pmanager", "pmanager", NULL);
+    _exit(EXIT_FAILURE);
+  }
+  close(fds[0]);
+  pmanager_pid = pid;
+  FILE * input = fdopen(fds[1], "w");
+  if (input != NULL) {
+    fprintf(input, "pnew %s\n", TARGET_NAME);
+    fflush(input);
+  }
+  return input;
+}
+
+// Resolves TARGET_NAME by running pinfo through popen(), as pclose and pspawn
+// originally did.
+//
+// Returns: the PID of the target, or -1 on failure.
+pid_t legacy_lookup() {
+  char * cmd;
+  if (asprintf(&cmd, "pinfo --pid-pmanager %ld --pid-only %s 2>/dev/null",
+      (long) pmanager_pid, TARGET_NAME) == -1) {
+    return -1;
+  }
+  FILE * output = popen(cmd, "r");
+  free(cmd);
+  if (output == NULL) {
+    return -1;
+  }
+  char * pid_str = NULL;
+  size_t n = 0;
+  pid_t pid = -1;
+  if (getline(&pid_str, &n, output) != -1) {
+    pid = atol(pid_str);
+  }
+  free(pid_str);
+  pclose(output);
+  return pid;
+}
+
+// Resolves TARGET_NAME with message_lookup_pid().
+//
+// Returns: the PID of the target, or -1 on failure.
+pid_t direct_lookup() {
+  return message_lookup_pid(pmanager_pid, TARGET_NAME);
+}
+
+// Resolves TARGET_NAME with shm_tree_lookup_pid().
+//
+// Returns: the PID of the target, or -1 on failure.
+pid_t shared_lookup() {
+  return shm_tree_lookup_pid(pmanager_pid, TARGET_NAME);
+}
+
+// Runs count lookups and prints mean, median and 99th percentile latencies.
+//
+// label: the name of the lookup path
+// lookup: the function performing a lookup
+// count: the number of lookups
+void run(const char * label, pid_t (*lookup)(), int count) {
+  long long * samples = malloc(sizeof(long long) * count);
+  long long total = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    long long start = time_ns();
+    if (lookup() == -1) {
+      printf("%-10s %12s\n", label, "failed");
+      free(samples);
+      return;
+    }
+    samples[i] = time_ns() - start;
+    total += samples[i];
+  }
+  qsort(samples, count, sizeof(long long), compare_ll);
+  printf("%-10s %12.1f %12.1f %12.1f\n", label,
+         total / (double) count / 1000.0,
+         samples[count / 2] / 1000.0,
+         samples[(count * 99) / 100] / 1000.0);
+  free(samples);
+}
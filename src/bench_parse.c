@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "parser.h"
+
+// Benchmark of the per-line cost of parsing command files. It compares the
+// original input path of parse_commands() (getline(), tokenize() and a copy of
+// every token) with the parser, both on a mapped file and on a pipe. Then it
+// runs pmanager on the same file: lines only contain builtins, so the result
+// is not dominated by process creation.
+//
+// Usage: bench_parse [LINES]
+// It must be run from the directory containing pmanager.
+
+// Default number of lines of the command file.
+#define DEFAULT_LINES 1000000
+
+// Lines written to the command file, in rotation. Builtins print nothing when
+// there are no background jobs.
+const char * lines[] = {
+  "jobs\n",
+  "wait\n",
+  "jobs   \n",
+  "jobs a b c d e f g h\n"
+};
+
+// Number of lines of the command file.
+long line_count = 0;
+
+// Utility functions.
+// Writes a command file with count lines and returns its path.
+char * write_file(int count);
+// Parses path as the original parse_commands() did.
+long legacy_parse(const char * path);
+// Parses all the lines read from fd with a parser.
+long parse_fd(int fd);
+// Parses path with a parser reading from a mapped file.
+long mapped_parse(const char * path);
+// Parses path with a parser reading from a pipe.
+long piped_parse(const char * path);
+// Runs pmanager on path.
+long pmanager_run(const char * path);
+// Runs parse() on path and prints the number of lines per second.
+void run(const char * label, long (*parse)(const char *), const char * path);
+
+void main(int argc, char ** argv) {
+
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_LINES;
+  if (count <= 0) {
+    fprintf(stderr, "Usage: bench_parse [LINES]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char * path = write_file(count);
+  if (path == NULL) {
+    fprintf(stderr, "Error: failed to write command file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Parsing %d lines of builtins.\n", count);
+  printf("%-10s %12s %14s\n", "PATH", "TIME (ms)", "LINES/S");
+  run("getline", legacy_parse, path);
+  run("mmap", mapped_parse, path);
+  run("pipe", piped_parse, path);
+  run("pmanager", pmanager_run, path);
+
+  unlink(path);
+  free(path);
+  exit(EXIT_SUCCESS);
+}
+
+// Writes a command file with count lines in a temporary directory.
+//
+// count: the number of lines
+//
+// Returns: the path of the file, or NULL on failure.
+char * write_file(int count) {
+  char * path = strdup("/tmp/bench_parse.XXXXXX");
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    free(path);
+    return NULL;
+  }
+  FILE * file = fdopen(fd, "w");
+  int i;
+  for (i = 0; i < count; i++) {
+    fputs(lines[i % (sizeof(lines) / sizeof(lines[0]))], file);
+  }
+  if (fclose(file) != 0) {
+    unlink(path);
+    free(path);
+    return NULL;
+  }
+  line_count = count;
+  return path;
+}
+
+// Parses path as the original parse_commands() did: each line is read with
+// getline(), split with tokenize() and copied into a new argv array.
+//
+// Returns: the number of lines parsed, or -1 on failure.
+long legacy_parse(const char * path) {
+  FILE * stream = fopen(path, "r");
+  if (stream == NULL) {
+    return -1;
+  }
+  char * buffer = NULL;
+  size_t bufsize = 0;
+  long count = 0;
+  while (getline(&buffer, &bufsize, stream) != -1) {
+    int i;
+    char ** tokens = NULL;
+    int tokens_count = tokenize(buffer, &tokens, "\n ");
+    if (tokens_count != 0) {
+      char * argv[tokens_count + 1];
+      for (i = 0; i < tokens_count; i++) {
+        argv[i] = malloc(sizeof(char) * (strlen(tokens[i]) + 1));
+        strcpy(argv[i], tokens[i]);
+      }
+      argv[i] = NULL;
+      for (i = 0; i < tokens_count + 1; i++) {
+        free(argv[i]);
+      }
+    }
+    for (i = 0; i < tokens_count; i++) {
+      free(tokens[i]);
+    }
+    free(tokens);
+    count++;
+  }
+  free(buffer);
+  fclose(stream);
+  return count;
+}
+
+// Parses all the lines read from fd with a parser.
+//
+// Returns: the number of lines parsed, or -1 on failure.
+long parse_fd(int fd) {
+  parser_t * parser = parser_init(fd);
+  if (parser == NULL) {
+    return -1;
+  }
+  char ** argv;
+  long count = 0;
+  while (parser_next(parser, &argv) >= 0) {
+    count++;
+  }
+  parser_deinit(parser);
+  return count;
+}
+
+// Parses path with a parser reading from a mapped file.
+//
+// Returns: the number of lines parsed, or -1 on failure.
+long mapped_parse(const char * path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  long count = parse_fd(fd);
+  close(fd);
+  return count;
+}
+
+// Parses path with a parser reading from a pipe, which is filled by cat.
+//
+// Returns: the number of lines parsed, or -1 on failure.
+long piped_parse(const char * path) {
+  char * command;
+  if (asprintf(&command, "cat %s", path) == -1) {
+    return -1;
+  }
+  FILE * pipe = popen(command, "r");
+  free(command);
+  if (pipe == NULL) {
+    return -1;
+  }
+  long count = parse_fd(fileno(pipe));
+  pclose(pipe);
+  return count;
+}
+
+// Runs pmanager on path, discarding its output, and waits for its
+// termination.
+//
+// Returns: the number of lines of path, or -1 on failure.
+long pmanager_run(const char * path) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    return -1;
+  }
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    execl("./pmanager", "pmanager", path, NULL);
+    _exit(EXIT_FAILURE);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS) {
+    return -1;
+  }
+  return line_count;
+}
+
+// Runs parse() on path and prints the elapsed time and the number of lines
+// per second.
+//
+// label: the name of the input path
+// parse: the function to measure
+// path: the path of the command file
+void run(const char * label, long (*parse)(const char *), const char * path) {
+  long long start = time_ns();
+  long count = parse(path);
+  long long elapsed = time_ns() - start;
+  if (count == -1) {
+    printf("%-10s %12s %14s\n", label, "failed", "-");
+    return;
+  }
+  printf("%-10s %12.1f %14.0f\n", label, elapsed / 1e6, count / (elapsed / 1e9));
+}
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "common.h"
+#include "proc_tree.h"
+
+// Benchmark of the operations of proc_tree.c on synthetic trees, as a
+// baseline for changes to its data structure. Trees have one of these shapes:
+// - wide: all the processes are children of the root
+// - deep: a chain, each process being the child of the previous one
+// - random: the parent of each process is chosen uniformly among the previous
+//   ones
+// - kary: a balanced tree, each process having ARITY children
+// Trees are built directly, since building them with proc_node_add() takes a
+// time quadratic in their size. Then each operation is timed on the tree:
+// proc_node_add() and proc_node_remove() of new leaves, proc_node_find_by_pid()
+// and proc_node_find_by_name() of random processes, proc_node_get_array(),
+// proc_node_tostr() and proc_node_fromstr(), and proc_node_print_tree() (to
+// /dev/null). Operations walking the tree are repeated fewer times on larger
+// trees. Results are printed as CSV.
+//
+// Usage: bench_tree [-n SIZES] [-s SHAPES] [-k ARITY] [-r SEED]
+// SIZES and SHAPES are comma-separated lists, e.g. -n 1000,10000 -s wide,deep.
+
+// Default sizes and shapes of the trees.
+#define DEFAULT_SIZES "1000,10000,100000,1000000"
+#define DEFAULT_SHAPES "wide,deep,random,kary"
+// Default number of children of each process in kary trees.
+#define DEFAULT_ARITY 4
+// Maximum number of repetitions of an operation.
+#define MAX_OPS 1000
+// Repetitions of operations walking the tree are limited so that each of them
+// visits about this many nodes in total, but at least MIN_OPS times.
+#define VISITS_PER_OPERATION 10000000LL
+#define MIN_OPS 10
+// Trees with more nodes than this are not printed: the indentation of deep
+// trees makes the output quadratic in their size.
+#define MAX_PRINT_NODES 10000
+// Stack size of the thread running the benchmark. The functions of
+// proc_tree.c are recursive, so deep trees need a large stack.
+#define STACK_SIZE (1024L * 1024 * 1024)
+
+// Represents the arguments of the benchmark.
+typedef struct bench_args {
+  char ** sizes;
+  int sizes_count;
+  char ** shapes;
+  int shapes_count;
+  int arity;
+} bench_args;
+
+// Global variables.
+// State of the random number generator (xorshift64), set by -r.
+unsigned long long rng_state = 1;
+// Nodes of the tree being measured, in order of creation (index 0 is the
+// root), and their number.
+proc_node ** nodes = NULL;
+int nodes_count = 0;
+
+// Utility functions.
+// Main function of the thread running the benchmark.
+void * run_all(void * arg);
+// Builds a tree with the given shape and size.
+int build_tree(const char * shape, int size, int arity);
+// Adds a child to parent without searching the tree.
+proc_node * attach(proc_node * parent, pid_t pid);
+// Times the operations on the tree built.
+void measure(const char * shape, int size);
+// Prints a line of CSV.
+void report(const char * shape, int size, const char * operation, int ops,
+            long long elapsed);
+// Returns the number of repetitions of an operation visiting the whole tree.
+int operations_for(int size);
+// Returns a random number between 0 and bound - 1.
+unsigned long long random_below(unsigned long long bound);
+
+void main(int argc, char ** argv) {
+
+  const char * sizes = DEFAULT_SIZES;
+  const char * shapes = DEFAULT_SHAPES;
+  bench_args args;
+  args.arity = DEFAULT_ARITY;
+  int option;
+  while ((option = getopt(argc, argv, "n:s:k:r:")) != -1) {
+    switch (option) {
+      case 'n':
+        sizes = optarg;
+        break;
+      case 's':
+        shapes = optarg;
+        break;
+      case 'k':
+        args.arity = atoi(optarg);
+        break;
+      case 'r':
+        rng_state = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "Usage: bench_tree [-n SIZES] [-s SHAPES] [-k ARITY] [-r SEED]\n");
+        exit(EXIT_FAILURE);
+    }
+  }
+  // xorshift never leaves 0.
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+  args.sizes_count = tokenize(sizes, &args.sizes, ",");
+  args.shapes_count = tokenize(shapes, &args.shapes, ",");
+  if (args.arity <= 0 || args.sizes_count <= 0 || args.shapes_count <= 0) {
+    fprintf(stderr, "Error: invalid arguments.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Run the benchmark in a thread with a large stack.
+  pthread_attr_t attr;
+  pthread_t thread;
+  void * status = NULL;
+  if (pthread_attr_init(&attr) != 0 || pthread_attr_setstacksize(&attr, STACK_SIZE) != 0 ||
+      pthread_create(&thread, &attr, run_all, &args) != 0 ||
+      pthread_join(thread, &status) != 0) {
+    fprintf(stderr, "Error: failed to start benchmark thread.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_attr_destroy(&attr);
+
+  exit((status == NULL) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Builds and measures a tree for each shape and size.
+//
+// arg: the bench_args
+//
+// Returns: NULL on success, or a non-NULL value if a tree could not be built.
+void * run_all(void * arg) {
+  const bench_args * args = arg;
+  printf("shape,nodes,operation,ops,total_ms,ns_per_op\n");
+  int i, j;
+  for (i = 0; i < args->shapes_count; i++) {
+    for (j = 0; j < args->sizes_count; j++) {
+      int size = atoi(args->sizes[j]);
+      if (size <= 0 || build_tree(args->shapes[i], size, args->arity) != 0) {
+        fprintf(stderr, "Error: failed to build %s tree of %s nodes.\n", args->shapes[i],
+                args->sizes[j]);
+        return arg;
+      }
+      measure(args->shapes[i], size);
+      proc_node_deinit(nodes[0]);
+      free(nodes);
+      nodes = NULL;
+      nodes_count = 0;
+    }
+  }
+  return NULL;
+}
+
+// Builds a tree of size nodes with the given shape. The root has PID 1, and
+// process i has PID i + 1 and name "proc_<i>".
+//
+// shape: "wide", "deep", "random" or "kary"
+// size: the number of nodes, including the root
+// arity: the number of children of each node, for "kary"
+//
+// Returns: on success, 0 is returned; on failure (e.g. unknown shape), -1 is
+// returned.
+int build_tree(const char * shape, int size, int arity) {
+  nodes = malloc(sizeof(proc_node *) * size);
+  if (nodes == NULL) {
+    return -1;
+  }
+  nodes[0] = proc_node_init(1, 0, "proc_0");
+  nodes_count = 1;
+  int i;
+  for (i = 1; i < size; i++) {
+    proc_node * parent;
+    if (strcmp(shape, "wide") == 0) {
+      parent = nodes[0];
+    } else if (strcmp(shape, "deep") == 0) {
+      parent = nodes[i - 1];
+    } else if (strcmp(shape, "random") == 0) {
+      parent = nodes[random_below(i)];
+    } else if (strcmp(shape, "kary") == 0) {
+      parent = nodes[(i - 1) / arity];
+    } else {
+      return -1;
+    }
+    nodes[nodes_count++] = attach(parent, i + 1);
+  }
+  return 0;
+}
+
+// Adds a child to parent as proc_node_add() does, without searching the
+// parent in the tree.
+//
+// parent: the parent of the new node
+// pid: the PID of the new node
+//
+// Returns: the new node.
+proc_node * attach(proc_node * parent, pid_t pid) {
+  char name[24];
+  snprintf(name, sizeof(name), "proc_%d", pid - 1);
+  proc_node * child = proc_node_init(pid, parent->pid, name);
+  child->depth = parent->depth + 1;
+  if (parent->children_size == parent->children_count) {
+    parent->children_size = (parent->children_size == 0) ? 2 : 2 * parent->children_size;
+    parent->children = realloc(parent->children, sizeof(proc_node *) * parent->children_size);
+  }
+  parent->children[parent->children_count++] = child;
+  return child;
+}
+
+// Times each operation on the tree built, and prints the results.
+//
+// shape: the shape of the tree
+// size: the number of nodes
+void measure(const char * shape, int size) {
+  proc_node * root = nodes[0];
+  int ops = operations_for(size);
+  int i;
+
+  // Add new leaves under random processes, then remove them.
+  pid_t * added = malloc(sizeof(pid_t) * ops);
+  long long start = time_ns();
+  for (i = 0; i < ops; i++) {
+    char name[24];
+    added[i] = size + i + 1;
+    snprintf(name, sizeof(name), "proc_%d", size + i);
+    proc_node * node = proc_node_init(added[i], nodes[random_below(size)]->pid, name);
+    proc_node_add(root, node);
+    proc_node_deinit(node);
+  }
+  report(shape, size, "add", ops, time_ns() - start);
+  start = time_ns();
+  for (i = ops - 1; i >= 0; i--) {
+    proc_node_remove(root, added[i]);
+  }
+  report(shape, size, "remove", ops, time_ns() - start);
+  free(added);
+
+  start = time_ns();
+  for (i = 0; i < ops; i++) {
+    proc_node_find_by_pid(root, nodes[random_below(size)]->pid);
+  }
+  report(shape, size, "find_by_pid", ops, time_ns() - start);
+
+  start = time_ns();
+  for (i = 0; i < ops; i++) {
+    proc_node_find_by_name(root, nodes[random_below(size)]->name);
+  }
+  report(shape, size, "find_by_name", ops, time_ns() - start);
+
+  start = time_ns();
+  for (i = 0; i < ops; i++) {
+    int count;
+    proc_node ** array = proc_node_get_array(root, &count);
+    int j;
+    for (j = 0; j < count; j++) {
+      proc_node_deinit(array[j]);
+    }
+    free(array);
+  }
+  report(shape, size, "get_array", ops, time_ns() - start);
+
+  // Conversions do not depend on the tree: they are repeated MAX_OPS times.
+  char ** strings = malloc(sizeof(char *) * MAX_OPS);
+  start = time_ns();
+  for (i = 0; i < MAX_OPS; i++) {
+    proc_node_tostr(nodes[random_below(size)], &strings[i]);
+  }
+  report(shape, size, "tostr", MAX_OPS, time_ns() - start);
+  start = time_ns();
+  for (i = 0; i < MAX_OPS; i++) {
+    proc_node_deinit(proc_node_fromstr(strings[i]));
+  }
+  report(shape, size, "fromstr", MAX_OPS, time_ns() - start);
+  for (i = 0; i < MAX_OPS; i++) {
+    free(strings[i]);
+  }
+  free(strings);
+
+  // Print the tree once to /dev/null, restoring stdout afterwards.
+  if (size <= MAX_PRINT_NODES) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved != -1 && null_fd != -1) {
+      dup2(null_fd, STDOUT_FILENO);
+      start = time_ns();
+      proc_node_print_tree(root);
+      fflush(stdout);
+      long long elapsed = time_ns() - start;
+      dup2(saved, STDOUT_FILENO);
+      report(shape, size, "print", 1, elapsed);
+    }
+    if (saved != -1) {
+      close(saved);
+    }
+    if (null_fd != -1) {
+      close(null_fd);
+    }
+  }
+}
+
+// Prints a line of CSV with the total and per-operation times.
+//
+// shape: the shape of the tree
+// size: the number of nodes
+// operation: the name of the operation
+// ops: the number of operations
+// elapsed: the total time, in nanoseconds
+void report(const char * shape, int size, const char * operation, int ops,
+            long long elapsed) {
+  printf("%s,%d,%s,%d,%.3f,%.1f\n", shape, size, operation, ops, elapsed / 1e6,
+         (double) elapsed / ops);
+  fflush(stdout);
+}
+
+// Returns the number of repetitions of an operation that visits up to the
+// whole tree (e.g. a search), so that it visits about VISITS_PER_OPERATION
+// nodes in total, between MIN_OPS and MAX_OPS.
+//
+// size: the number of nodes
+int operations_for(int size) {
+  long long ops = VISITS_PER_OPERATION / size;
+  if (ops > MAX_OPS) {
+    return MAX_OPS;
+  }
+  return (ops < MIN_OPS) ? MIN_OPS : ops;
+}
+
+// Returns a random number between 0 and bound - 1, from a xorshift64
+// generator seeded with -r, so that runs are reproducible.
+//
+// bound: the upper bound, greater than 0
+unsigned long long random_below(unsigned long long bound) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state % bound;
+}
@@ -1,27 +1,86 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "child.h"
 #include "message.h"
 #include "proc_tree.h"
+#include "common.h"
+#include "trace.h"
 
-// Keeps track of how many times this process has been cloned.
-int clones_count = 0;
 // PID of pmanager.
 pid_t pid_pmanager;
 // Name of this process.
 char * child_name = NULL;
 // Flag for SIGTERM handler.
 int sigterm_flag = 0;
+// Set by the SIGTERM handler if the signal was queued by pmanager on exit.
+int sigterm_shutdown = 0;
 // PID of the last process that sent SIGTERM to this process.
 pid_t sigterm_sender;
 
+// Shape of a subtree being cloned by child_clone_tree(). Nodes are indexed in
+// the pre-order received from pmanager, so node 0 is the root. The arrays are
+// copied by fork(), except pids and names, which are shared by all the
+// processes of the new subtree.
+typedef struct tree_shape {
+  // Number of nodes.
+  int count;
+  // Size of the arrays.
+  int size;
+  // PIDs of the original processes, used while receiving the subtree.
+  pid_t * orig_pids;
+  // Index of the parent of each node (-1 for the root).
+  int * parent;
+  // Number of nodes in the subtree rooted at each node.
+  int * subtree_size;
+  // Children of node i are children[children_start[i]] ...
+  // children[children_start[i + 1] - 1].
+  int * children_start;
+  int * children;
+  // PIDs of the new processes (shared), set by their parents. 0 if fork()
+  // failed.
+  pid_t * pids;
+  // Names of the new processes (shared), one slot of size slot each. Empty if
+  // the process could not be registered.
+  char * names;
+  size_t slot;
+  // Size of the shared mapping containing pids and names.
+  size_t shared_size;
+  // Pipe written by each new process once it forked its children.
+  int done_pipe[2];
+  // Pipe used to release new processes once they are registered.
+  int ready_pipe[2];
+} tree_shape;
+
+// Shape of the subtree being cloned.
+tree_shape shape;
+
 // Private functions.
 // Terminates child.
 void child_terminate();
-// Creates a clone of child.
-void child_clone(pid_t sender);
+// Creates count clones of child.
+void child_clone(pid_t sender, int count);
+// Registers clones in pmanager and stores the names assigned to them.
+int register_clones(const pid_t * pids, int count, char * names, size_t slot);
+// Waits for the name assigned to a clone and sets it.
+void clone_init(const char * name, int ready_fd);
+// Creates a copy of the subtree rooted at this child.
+void child_clone_tree(pid_t sender);
+// Adds a process received from pmanager to the shape of a subtree.
+void add_to_shape(const char * proc_str, void * shape);
+// Forks the subtree rooted at a node of the shape, in the new process.
+int fork_subtree(int node);
+// Registers the processes of a new subtree in pmanager and sets their names.
+int register_subtree();
+// Frees the shape of the subtree.
+void shape_deinit();
 // Removes zombie child process.
 void remove_zombie(int sig);
 // Resumes a process waiting for MSG_SUCCESS from this child.
@@ -34,18 +93,20 @@ int get_sigterm_flag();
 pid_t get_sigterm_sender();
 // SIGTERM signal handler.
 void sigterm_handler(int signum, siginfo_t * siginfo, void * context);
-// Sends information about a new clone to pmanager.
-int send_proc_to_pmanager(const char * name, pid_t pid, pid_t ppid);
 
 // Handler for SIGTERM. It sets sigterm_flag to true and saves the PID of the
-// process that sent the signal in sigterm_sender.
+// process that sent the signal in sigterm_sender. A signal queued by pmanager
+// with CHILD_SHUTDOWN_VALUE also sets sigterm_shutdown.
 //
 // signum: signal number that was received
 // siginfo: contains information about received signal (PID)
 // context: not used. See `man sigaction`.
 void sigterm_handler(int signum, siginfo_t * siginfo, void * context) {
+  trace_record_async(TRACE_SIGNAL_RECV, siginfo->si_pid, 0, signum);
   sigterm_flag = 1;
   sigterm_sender = siginfo->si_pid;
+  sigterm_shutdown = siginfo->si_code == SI_QUEUE && siginfo->si_pid == pid_pmanager &&
+                     siginfo->si_value.sival_int == CHILD_SHUTDOWN_VALUE;
 }
 
 // Returns the PID of the last process that sent SIGTERM to this process.
@@ -65,10 +126,10 @@ int get_sigterm_flag() {
   return sigterm_flag;
 }
 
-// Removes any child of this process that is in zombie state. This is done by
-// calling wait() once.
+// Removes any child of this process that is in zombie state. Several
+// terminations can be notified by a single SIGCHLD, so all of them are reaped.
 void remove_zombie(int sig) {
-  wait(NULL);
+  while (waitpid(-1, NULL, WNOHANG) > 0);
 }
 
 // Resumes a process that is waiting for MSG_SUCCESS.
@@ -86,6 +147,7 @@ void resume_process(pid_t pid) {
 void child_set_name(const char * name) {
   child_name = realloc(child_name, sizeof(char) * (strlen(name) + 1));
   strcpy(child_name, name);
+  trace_set_name(name);
 }
 
 // Sets the value of pid_pmanager.
@@ -95,8 +157,8 @@ void child_set_pmanager(pid_t pmanager) {
   pid_pmanager = pmanager;
 }
 
-// Sets child_name, pid_pmanager, and signal SIGTERM, SIGCHLD handlers. Puts
-// child in wait for signals/messages.
+// Sets child_name, pid_pmanager, and signal SIGTERM, SIGCHLD handlers. Creates
+// the inbox of the child and puts it in wait for signals/messages.
 //
 // name: the name of the child process
 // pmanager: the PID of pmanager
@@ -107,6 +169,12 @@ void child_init(const char * name, pid_t pmanager) {
   // Set PID of pmanager.
   child_set_pmanager(pmanager);
 
+  // Create inbox for this process.
+  if (message_setup() != 0) {
+    fprintf(stderr, "%s: Error: failed to setup process communication.\n", child_name);
+    exit(EXIT_FAILURE);
+  }
+
   // Register SIGCHLD handler to wait terminated children. This is necessary to
   // remove zombie processes.
   struct sigaction action_chld;
@@ -117,42 +185,104 @@ void child_init(const char * name, pid_t pmanager) {
 
   // Register SIGTERM handler.
   struct sigaction action_term;
+  sigemptyset(&action_term.sa_mask);
   action_term.sa_sigaction = sigterm_handler;
   action_term.sa_flags = SA_SIGINFO;
   sigaction(SIGTERM, &action_term, NULL);
 
-  // Signal mask for sigsuspend.
+  // SIGTERM and SIGCHLD are blocked, and only delivered while waiting in
+  // ppoll(). This way, a signal received just before waiting is not missed.
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &blocked, NULL);
+  // Signal mask for ppoll.
   sigset_t mask;
   sigemptyset(&mask);
   while (1) {
-    // Suspend the process until delivery of a signal. Normally, these will be:
-    // - SIGUSR1 for a new message (FIFO)
+    // Suspend the process until a new message is received or a signal is
+    // delivered. Signals will normally be:
     // - SIGTERM for a termination request by pclose/prmall
     // - SIGCHLD for a terminated child
-    sigsuspend(&mask);
-    // At this point, a signal was received.
+    // The inbox is retrieved on each iteration, because a clone creates its
+    // own inbox.
+    // Messages received before entering the loop (e.g. by a zygote) are
+    // already queued, so only pending signals are checked for them.
+    struct pollfd pfd;
+    pfd.fd = message_fd();
+    pfd.events = POLLIN;
+    struct timespec no_wait = {0, 0};
+    ppoll(&pfd, 1, message_unread() ? &no_wait : NULL, &mask);
     // If signal is SIGTERM, terminate the process.
     if (get_sigterm_flag() == 1) {
       child_terminate();
     }
-    // If there is a message, read it.
-    if (message_unread()) {
-      message_t * msg = message_read();
-      // If type of message is MSG_SPAWN, clone this process.
+    // Read all messages received.
+    message_t * msg;
+    while ((msg = message_read()) != NULL) {
+      // If type of message is MSG_SPAWN, clone this process. The content is
+      // the number of clones to create.
       if(strcmp(msg->type, MSG_SPAWN) == 0) {
-        child_clone(msg->pid_sender);
+        child_clone(msg->pid_sender, atoi(msg->content));
+      } else if (strcmp(msg->type, MSG_SPAWN_TREE) == 0) {
+        child_clone_tree(msg->pid_sender);
       }
       message_deinit(msg);
     }
   }
 }
 
+// Puts a zygote, i.e. an idle process kept by pzygote, in wait for its name.
+// The zygote announces itself to pmanager with MSG_ZYGOTE; when pnew claims it,
+// pmanager registers it and sends MSG_NAME, and the zygote becomes a normal
+// child. SIGTERM stays blocked, so a termination request received right after
+// the claim is handled by child_init(). This function never returns.
+//
+// pmanager: the PID of pmanager
+void child_zygote(pid_t pmanager) {
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGTERM);
+  sigprocmask(SIG_BLOCK, &blocked, NULL);
+
+  if (message_setup() != 0) {
+    _exit(EXIT_FAILURE);
+  }
+  if (message_send(pmanager, MSG_ZYGOTE, NULL) != 0) {
+    message_teardown();
+    _exit(EXIT_FAILURE);
+  }
+  while (1) {
+    message_t * msg = message_wait(pmanager);
+    if (msg == NULL) {
+      message_teardown();
+      _exit(EXIT_FAILURE);
+    }
+    if (strcmp(msg->type, MSG_NAME) == 0) {
+      // Lead a new process group, as processes forked by pnew.
+      setpgid(0, 0);
+      char * name = strdup(msg->content);
+      message_deinit(msg);
+      child_init(name, pmanager);
+    }
+    message_deinit(msg);
+  }
+}
+
 // Terminates child after requesting pmanager its removal from tree. If pmanager
 // replies with MSG_SUCCESS, this process can be safely killed; if MSG_ERROR is
 // received, it means that removal from tree failed, and this process cannot be
 // killed. MSG_ERROR is received if, for example, this process has children.
 void child_terminate() {
 
+  // SIGTERM queued by pmanager on exit means that the whole tree is being
+  // terminated: there is nothing to remove it from.
+  if (sigterm_shutdown) {
+    free(child_name);
+    exit(EXIT_SUCCESS);
+  }
+
   // Send MSG_REMOVE to pmanager.
   if (message_send(pid_pmanager, MSG_REMOVE, NULL) != 0) {
     fprintf(stderr, "%s: Error: failed to send message.\n", child_name);
@@ -161,11 +291,13 @@ void child_terminate() {
   }
 
   // Read response from pmanager.
-  message_t * response = message_wait(pid_pmanager);
+  message_t * response = message_wait_timeout(pid_pmanager, message_default_timeout());
   // If reply is MSG_SUCCESS, it means that this node is a leaf, and pmanager
   // already removed this node from tree. We can exit().
   int success = 0;
-  if (strcmp(response->type, MSG_SUCCESS) == 0) {
+  if (response == NULL) {
+    fprintf(stderr, "%s: Error: pmanager did not reply.\n", child_name);
+  } else if (strcmp(response->type, MSG_SUCCESS) == 0) {
     printf("%s: Killing myself...\n", child_name);
     success = 1;
   } else if (strcmp(response->type, MSG_ERROR) == 0) {
@@ -188,14 +320,19 @@ void child_terminate() {
 
 }
 
-// Sends information about a new process to pmanager.
+// Registers a new process in pmanager's process tree with a single MSG_ADD
+// request. pmanager adds the process only if its name is not used yet, so the
+// process is expected to be already forked: if the name is rejected, it must
+// be killed with child_abort().
 //
 // name: the name of the new process
 // pid: the PID of the new process
 // ppid: the PPID of the new process
+// pmanager: the PID of pmanager
 //
-// Returns: on success, 0 is returned; on failure, -1 is returned.
-int send_proc_to_pmanager(const char * name, pid_t pid, pid_t ppid) {
+// Returns: on success, 0 is returned; if the name is already used, -2 is
+// returned; on other failures, -1 is returned.
+int child_register(const char * name, pid_t pid, pid_t ppid, pid_t pmanager) {
 
   // Create proc_node.
   proc_node * proc = proc_node_init(pid, ppid, name);
@@ -212,102 +349,485 @@ int send_proc_to_pmanager(const char * name, pid_t pid, pid_t ppid) {
   }
 
   // Request pmanager to add the new process to its process tree.
-  status = message_send(pid_pmanager, MSG_ADD, proc_str);
+  status = message_send(pmanager, MSG_ADD, proc_str);
   free(proc_str);
   if (status != 0) {
     return -1;
   }
 
   // Wait response from pmanager.
-  message_t * response = message_wait(pid_pmanager);
+  message_t * response = message_wait_timeout(pmanager, message_default_timeout());
   if (response == NULL) {
     return -1;
   }
-  status = strcmp(response->type, MSG_SUCCESS);
+  if (strcmp(response->type, MSG_SUCCESS) == 0) {
+    status = 0;
+  } else if (strcmp(response->type, MSG_ERROR) == 0 &&
+             strcmp(response->content, MSG_ERROR_EXISTS) == 0) {
+    status = -2;
+  } else {
+    status = -1;
+  }
   message_deinit(response);
-  // If type of message is not MSG_SUCCESS, return failure.
-  if (status != 0) {
-    return -1;
+
+  return status;
+
+}
+
+// Kills a forked process that was not registered by pmanager. SIGKILL is used
+// because the SIGTERM handler of an unregistered process cannot obtain its
+// removal from the tree, and would keep running. The inbox that the process
+// may have created is removed too.
+//
+// pid: the PID of the process, which must be a child of the caller
+void child_abort(pid_t pid) {
+  if (kill(pid, SIGKILL) != 0) {
+    return;
   }
+  waitpid(pid, NULL, 0);
+  message_discard(pid);
+}
 
-  return 0;
+// Registers clones of this process in pmanager with MSG_ADD_BATCH requests of
+// up to MSG_BATCH_MAX clones each. pmanager assigns the names, which are
+// stored in names: one slot of size slot for each clone, left empty if the
+// clone could not be registered.
+//
+// pids: the PIDs of the clones
+// count: the number of clones
+// names: the array of names, initially empty
+// slot: the size of each name
+//
+// Returns: the number of clones registered.
+int register_clones(const pid_t * pids, int count, char * names, size_t slot) {
+  int registered = 0;
+  int start;
+  for (start = 0; start < count; start += MSG_BATCH_MAX) {
+    int end = (start + MSG_BATCH_MAX < count) ? start + MSG_BATCH_MAX : count;
+    // Content: PIDs separated by ','.
+    char content[MSG_BATCH_MAX * 12];
+    size_t len = 0;
+    int i;
+    for (i = start; i < end; i++) {
+      len += sprintf(content + len, (i == start) ? "%ld" : ",%ld", (long) pids[i]);
+    }
+    if (message_send(pid_pmanager, MSG_ADD_BATCH, content) != 0) {
+      continue;
+    }
+    message_t * response = message_wait_timeout(pid_pmanager, message_default_timeout());
+    if (response == NULL) {
+      continue;
+    }
+    // Reply: numbers of the names assigned, separated by ','.
+    if (strcmp(response->type, MSG_SUCCESS) == 0) {
+      char ** numbers;
+      int numbers_count = tokenize(response->content, &numbers, ",");
+      for (i = 0; i < numbers_count; i++) {
+        int number = atoi(numbers[i]);
+        if (number > 0 && start + i < end) {
+          snprintf(names + (start + i) * slot, slot, "%s_%d", child_name, number);
+          registered++;
+        }
+        free(numbers[i]);
+      }
+      free(numbers);
+    }
+    message_deinit(response);
+  }
+  return registered;
+}
 
+// Initializes a clone: waits until its parent registered it and sets the name
+// assigned by pmanager. The clone exits if it could not be registered.
+//
+// name: the slot of the shared names array reserved to the clone
+// ready_fd: the read end of the pipe used by the parent to release clones
+void clone_init(const char * name, int ready_fd) {
+  // Create inbox for the clone before waiting, so that it can receive
+  // messages as soon as it is registered.
+  if (message_setup() != 0) {
+    fprintf(stderr, "%s: Error: failed to setup process communication.\n", child_name);
+    exit(EXIT_FAILURE);
+  }
+  char byte;
+  ssize_t count;
+  do {
+    count = read(ready_fd, &byte, 1);
+  } while (count == -1 && errno == EINTR);
+  close(ready_fd);
+  if (count != 1 || name[0] == '\0') {
+    message_teardown();
+    exit(EXIT_FAILURE);
+  }
+  child_set_name(name);
 }
 
-// Creates a clone of this child by calling fork(). If the name for the new
-// process already exists, fork() is aborted.
+// Creates count clones of this child by calling fork(). All the clones are
+// registered at once in pmanager, which assigns their names: the cost of a
+// clone is dominated by fork() instead of by round trips to pmanager. Names
+// are passed to the clones through a shared memory mapping, and the clones
+// wait on a pipe until their parent received the names.
 //
 // sender: the PID of the process that requested clonation
-void child_clone(pid_t sender) {
+// count: the number of clones to create. If not positive, one clone is
+// created.
+void child_clone(pid_t sender, int count) {
 
   printf("%s: Clonation request received.\n", child_name);
+  // Flush output, otherwise clones would print it again.
+  fflush(stdout);
 
-  // Create name for the new process.
-  char * new_name;
-  if (asprintf(&new_name, "%s_%i", child_name, clones_count + 1) == -1) {
-    fprintf(stderr, "%s: Error: failed create name for clone. Clonation aborted.\n", child_name);
-    // Resume process that sent clone request.
+  if (count <= 0) {
+    count = 1;
+  }
+
+  // Names are formatted as <name>_<number>.
+  size_t slot = strlen(child_name) + 16;
+  char * names = mmap(NULL, slot * count, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  pid_t * pids = malloc(sizeof(pid_t) * count);
+  int ready_pipe[2] = { -1, -1 };
+  if (names == MAP_FAILED || pids == NULL || pipe(ready_pipe) != 0) {
+    fprintf(stderr, "%s: Error: failed to prepare clonation. Clonation aborted.\n", child_name);
+    if (names != MAP_FAILED) {
+      munmap(names, slot * count);
+    }
+    free(pids);
     resume_process(sender);
     return;
   }
 
-  // Check if a process with name new_name already exists by requesting pmanager
-  // information (MSG_INFO) about a process with name new_name.
-  if (message_send(pid_pmanager, MSG_INFO, new_name) != 0) {
-    fprintf(stderr, "%s: Error: unable to check for duplicates. Clonation aborted.\n",
-            child_name);
-    resume_process(sender);
-    free(new_name);
+  // Fork all clones.
+  int forked;
+  for (forked = 0; forked < count; forked++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      fprintf(stderr, "%s: Error: failed to fork.\n", child_name);
+      break;
+    } else if (pid == 0) {
+      // Child
+      free(pids);
+      close(ready_pipe[1]);
+      clone_init(names + forked * slot, ready_pipe[0]);
+      munmap(names, slot * count);
+      return;
+    }
+    pids[forked] = pid;
+  }
+  close(ready_pipe[0]);
+
+  // Register clones in pmanager.
+  int registered = register_clones(pids, forked, names, slot);
+
+  // Clones that were not added to the tree are killed to avoid inconsistency
+  // between tree in pmanager and processes that are actually alive.
+  int i;
+  for (i = 0; i < forked; i++) {
+    if (names[i * slot] == '\0') {
+      child_abort(pids[i]);
+    }
+  }
+  // Release the remaining clones, one byte each.
+  for (i = 0; i < registered; i++) {
+    write(ready_pipe[1], "", 1);
+  }
+  close(ready_pipe[1]);
+
+  if (registered < forked) {
+    fprintf(stderr, "%s: Error: failed to register %d clones in pmanager.\n",
+            child_name, forked - registered);
+  }
+  if (count == 1 && registered == 1) {
+    printf("%s: Process \"%s\" successfully created.\n", child_name, names);
+  } else if (registered > 0) {
+    printf("%s: %d clones successfully created.\n", child_name, registered);
+  }
+
+  munmap(names, slot * count);
+  free(pids);
+  resume_process(sender);
+
+}
+
+// Adds a process received from pmanager to the shape of a subtree. Processes
+// are received in pre-order, so the parent of a process is the nearest
+// previous process with its PID.
+//
+// proc_str: the string representation of the process
+// arg: not used
+void add_to_shape(const char * proc_str, void * arg) {
+  proc_node * proc = proc_node_fromstr(proc_str);
+  if (proc == NULL) {
     return;
   }
+  if (shape.count == shape.size) {
+    shape.size = (shape.size == 0) ? 16 : 2 * shape.size;
+    shape.orig_pids = realloc(shape.orig_pids, sizeof(pid_t) * shape.size);
+    shape.parent = realloc(shape.parent, sizeof(int) * shape.size);
+  }
+  int parent = shape.count - 1;
+  while (parent >= 0 && shape.orig_pids[parent] != proc->ppid) {
+    parent = shape.parent[parent];
+  }
+  shape.orig_pids[shape.count] = proc->pid;
+  shape.parent[shape.count] = parent;
+  shape.count++;
+  proc_node_deinit(proc);
+}
 
-  // Wait response from pmanager.
-  message_t * response = message_wait(pid_pmanager);
-  // If response type is MSG_INFO, it means that a process with name new_name
-  // already exists and we must abort clonation.
-  int exists = strcmp(response->type, MSG_INFO) == 0;
-  message_deinit(response);
-  if (exists) {
-    fprintf(stderr, "%s: Error: a process with name \"%s\" already exists. "
-            "Clonation aborted.\n",
-            child_name, new_name);
-    free(new_name);
+// Forks the subtree rooted at node. Called by the new process of node, which
+// forks its children one by one: each child does the same as soon as it
+// starts, so the subtree is created in waves, one level at a time, in
+// parallel. When all its children were forked, the process notifies the
+// collector through done_pipe. If fork() fails, the nodes that will never be
+// created are notified on their behalf.
+//
+// node: the index of the node of the calling process
+//
+// Returns: the index of the node of the calling process, which changes in
+// forked children.
+int fork_subtree(int node) {
+  int i = shape.children_start[node];
+  while (i < shape.children_start[node + 1]) {
+    int child = shape.children[i++];
+    pid_t pid = fork();
+    if (pid == 0) {
+      // Child: fork its own children.
+      node = child;
+      i = shape.children_start[node];
+    } else if (pid == -1) {
+      char bytes[256] = { 0 };
+      int missing = shape.subtree_size[child];
+      while (missing > 0) {
+        int n = (missing < sizeof(bytes)) ? missing : sizeof(bytes);
+        write(shape.done_pipe[1], bytes, n);
+        missing -= n;
+      }
+    } else {
+      shape.pids[child] = pid;
+    }
+  }
+  write(shape.done_pipe[1], "", 1);
+  return node;
+}
+
+// Registers the processes of a new subtree in pmanager, with MSG_ADD_BATCH
+// requests of up to MSG_BATCH_MAX entries <pid>/<ppid>. Entries are sent in
+// breadth-first order, so parents are registered before their children. The
+// names assigned by pmanager are stored in shape.names.
+//
+// Returns: the number of processes registered.
+int register_subtree() {
+  // Breadth-first order of nodes.
+  int * order = malloc(sizeof(int) * shape.count);
+  if (order == NULL) {
+    return 0;
+  }
+  int head = 0;
+  int tail = 0;
+  order[tail++] = 0;
+  while (head < tail) {
+    int node = order[head++];
+    int i;
+    for (i = shape.children_start[node]; i < shape.children_start[node + 1]; i++) {
+      order[tail++] = shape.children[i];
+    }
+  }
+
+  int registered = 0;
+  int start;
+  for (start = 0; start < shape.count; start += MSG_BATCH_MAX) {
+    int end = (start + MSG_BATCH_MAX < shape.count) ? start + MSG_BATCH_MAX : shape.count;
+    char content[MSG_BATCH_MAX * 24];
+    size_t len = 0;
+    int i;
+    for (i = start; i < end; i++) {
+      int node = order[i];
+      pid_t ppid = (node == 0) ? getpid() : shape.pids[shape.parent[node]];
+      len += sprintf(content + len, (i == start) ? "%ld/%ld" : ",%ld/%ld",
+                     (long) shape.pids[node], (long) ppid);
+    }
+    if (message_send(pid_pmanager, MSG_ADD_BATCH, content) != 0) {
+      continue;
+    }
+    message_t * response = message_wait_timeout(pid_pmanager, message_default_timeout());
+    if (response == NULL) {
+      continue;
+    }
+    if (strcmp(response->type, MSG_SUCCESS) == 0) {
+      char ** numbers;
+      int numbers_count = tokenize(response->content, &numbers, ",");
+      for (i = 0; i < numbers_count; i++) {
+        int number = atoi(numbers[i]);
+        if (number > 0 && start + i < end) {
+          // Names are derived from the name of the new parent.
+          int node = order[start + i];
+          const char * parent_name = (node == 0) ? child_name :
+                                     shape.names + shape.parent[node] * shape.slot;
+          snprintf(shape.names + node * shape.slot, shape.slot, "%s_%d",
+                   parent_name, number);
+          registered++;
+        }
+        free(numbers[i]);
+      }
+      free(numbers);
+    }
+    message_deinit(response);
+  }
+  free(order);
+  return registered;
+}
+
+// Frees the shape of the subtree. The shared mapping is unmapped too.
+void shape_deinit() {
+  free(shape.orig_pids);
+  free(shape.parent);
+  free(shape.subtree_size);
+  free(shape.children_start);
+  free(shape.children);
+  if (shape.pids != NULL) {
+    munmap(shape.pids, shape.shared_size);
+  }
+  memset(&shape, 0, sizeof(tree_shape));
+}
+
+// Creates a copy of the subtree rooted at this child, with the same shape.
+// The copy of this child is a new clone of it, and the other processes are
+// named after their new parent, as clones are. The subtree is requested to
+// pmanager, then the new processes fork themselves level by level (see
+// fork_subtree()), and finally all of them are registered with batched
+// requests. Processes wait on a pipe until they are registered, and the ones
+// that could not be registered exit.
+//
+// sender: the PID of the process that requested clonation
+void child_clone_tree(pid_t sender) {
+
+  printf("%s: Subtree clonation request received.\n", child_name);
+  // Flush output, otherwise new processes would print it again.
+  fflush(stdout);
+
+  memset(&shape, 0, sizeof(tree_shape));
+  int error = message_list(pid_pmanager, child_name, add_to_shape, NULL) != 0 ||
+              shape.count == 0;
+
+  // Compute children lists and subtree sizes.
+  int i;
+  if (!error) {
+    shape.subtree_size = malloc(sizeof(int) * shape.count);
+    shape.children_start = calloc(shape.count + 1, sizeof(int));
+    shape.children = malloc(sizeof(int) * shape.count);
+    error = shape.subtree_size == NULL || shape.children_start == NULL ||
+            shape.children == NULL;
+  }
+  if (!error) {
+    for (i = 1; i < shape.count; i++) {
+      shape.children_start[shape.parent[i] + 1]++;
+    }
+    for (i = 0; i < shape.count; i++) {
+      shape.children_start[i + 1] += shape.children_start[i];
+    }
+    int * next = malloc(sizeof(int) * shape.count);
+    memcpy(next, shape.children_start, sizeof(int) * shape.count);
+    for (i = 1; i < shape.count; i++) {
+      shape.children[next[shape.parent[i]]++] = i;
+    }
+    free(next);
+    // In pre-order, children follow their parent.
+    int depth = 0;
+    int * level = malloc(sizeof(int) * shape.count);
+    for (i = 0; i < shape.count; i++) {
+      shape.subtree_size[i] = 1;
+      level[i] = (i == 0) ? 0 : level[shape.parent[i]] + 1;
+      if (level[i] > depth) {
+        depth = level[i];
+      }
+    }
+    free(level);
+    for (i = shape.count - 1; i > 0; i--) {
+      shape.subtree_size[shape.parent[i]] += shape.subtree_size[i];
+    }
+    // Each level adds "_<number>" to the name of the parent.
+    shape.slot = strlen(child_name) + (depth + 1) * 12 + 1;
+    shape.shared_size = (sizeof(pid_t) + shape.slot) * shape.count;
+    void * shared = mmap(NULL, shape.shared_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+      error = 1;
+    } else {
+      shape.pids = shared;
+      shape.names = (char *) shared + sizeof(pid_t) * shape.count;
+    }
+  }
+  if (!error && pipe(shape.done_pipe) != 0) {
+    error = 1;
+  } else if (!error && pipe(shape.ready_pipe) != 0) {
+    close(shape.done_pipe[0]);
+    close(shape.done_pipe[1]);
+    error = 1;
+  }
+  if (error) {
+    fprintf(stderr, "%s: Error: failed to prepare subtree clonation. Clonation aborted.\n",
+            child_name);
+    shape_deinit();
     resume_process(sender);
     return;
   }
 
-  // Fork process.
+  // Fork the copy of the root, which forks the rest of the subtree.
   pid_t pid = fork();
+  if (pid == 0) {
+    close(shape.done_pipe[0]);
+    close(shape.ready_pipe[1]);
+    int node = fork_subtree(0);
+    close(shape.done_pipe[1]);
+    clone_init(shape.names + node * shape.slot, shape.ready_pipe[0]);
+    shape_deinit();
+    return;
+  }
+  close(shape.done_pipe[1]);
+  close(shape.ready_pipe[0]);
 
+  int forked = 0;
   if (pid == -1) {
-    // Fork failed.
     fprintf(stderr, "%s: Error: failed to fork.\n", child_name);
-  } else if (pid == 0) {
-    // Child
-    // Reset number of clones.
-    clones_count = 0;
-    // Set child name.
-    child_set_name(new_name);
-    free(new_name);
   } else {
-    // Parent
-    // Send process to pmanager.
-    if (send_proc_to_pmanager(new_name, pid, getpid()) != 0) {
-      fprintf(stderr, "%s: Error: failed to send process information to pmanager. "
-                      "Killing the new clone...", child_name);
-      // If pmanager failed to add the new process, we need to kill it to avoid
-      // inconsistency between tree in pmanager and processes that are actually alive.
-      if (kill(pid, SIGTERM) != 0) {
-        printf("%s: Failed to send SIGTERM to the new clone. Information shown "
-               "by pmanager are now inconsistent.\n", child_name);
+    shape.pids[0] = pid;
+    // Wait until every node was forked (or failed).
+    char bytes[256];
+    int notified = 0;
+    while (notified < shape.count) {
+      ssize_t n = read(shape.done_pipe[0], bytes, sizeof(bytes));
+      if (n == -1 && errno == EINTR) {
+        continue;
       }
-    } else {
-      // Update number of clones.
-      clones_count++;
-      printf("%s: Process \"%s\" successfully created.\n", child_name, new_name);
-      free(new_name);
+      if (n <= 0) {
+        break;
+      }
+      notified += n;
+    }
+    for (i = 0; i < shape.count; i++) {
+      forked += shape.pids[i] != 0;
     }
-    resume_process(sender);
   }
+  close(shape.done_pipe[0]);
+
+  int registered = (forked > 0) ? register_subtree() : 0;
+
+  // Release all new processes: the ones without a name exit.
+  for (i = 0; i < forked; i++) {
+    write(shape.ready_pipe[1], "", 1);
+  }
+  close(shape.ready_pipe[1]);
+
+  if (registered < shape.count) {
+    fprintf(stderr, "%s: Error: failed to create %d processes of the subtree.\n",
+            child_name, shape.count - registered);
+  }
+  if (registered > 0) {
+    printf("%s: Subtree of %d processes successfully created.\n", child_name, registered);
+  }
+
+  shape_deinit();
+  resume_process(sender);
 
 }
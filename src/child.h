@@ -1,12 +1,27 @@
 #ifndef CHILD_H
 #define CHILD_H
 
+#include <sys/types.h>
+
+// Value carried by the SIGTERM that pmanager queues to every process when it
+// exits (see shutdown_tree()). A child receiving it exits without requesting
+// its removal from the tree, which is being freed; any other SIGTERM, even
+// from pmanager (e.g. from a plugin), is a request to close the process.
+#define CHILD_SHUTDOWN_VALUE 0x73687574
+
 // Sets child name, pmanager PID, and signal handlers. Puts child in wait for
 // signal/messages.
 void child_init(const char * name, pid_t pmanager);
+// Waits in the pool of zygotes until pmanager assigns a name, then behaves as
+// child_init().
+void child_zygote(pid_t pmanager);
 // Sets name for child process.
 void child_set_name(const char * name);
 // Sets PID of pmanager for child process.
 void child_set_pmanager(pid_t pid);
+// Registers a new process in pmanager, if its name is not used yet.
+int child_register(const char * name, pid_t pid, pid_t ppid, pid_t pmanager);
+// Kills a forked process that was not registered by pmanager.
+void child_abort(pid_t pid);
 
 #endif
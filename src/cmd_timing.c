@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "cmd_timing.h"
+#include "histogram.h"
+#include "common.h"
+
+// Maximum number of marks of a command: the start and the marks of pmanager,
+// and those reported by the command.
+#define CMD_MARKS (TIMING_PHASES + 3)
+// Maximum length of the breakdown of a command.
+#define CMD_LINE_MAX 1024
+
+// Represents a mark: the end of a phase.
+typedef struct cmd_mark {
+  char name[TIMING_NAME_MAX];
+  long long time;
+} cmd_mark;
+
+// Represents the durations of a phase, collected for a command name.
+typedef struct phase_stats {
+  char name[TIMING_NAME_MAX];
+  long long sum;
+  histogram durations;
+} phase_stats;
+
+// Represents the durations collected for a command name. The last phase is
+// the total.
+typedef struct cmd_stats {
+  char name[32];
+  unsigned long long count;
+  phase_stats * phases[CMD_MARKS];
+  int phases_count;
+} cmd_stats;
+
+// Command being timed: its name and arguments, its PID (-1 before it is
+// started), and its marks.
+char cmd_line[CMD_LINE_MAX];
+char cmd_name[32];
+pid_t cmd_pid = -1;
+cmd_mark cmd_marks[CMD_MARKS];
+int cmd_marks_count = 0;
+// Durations collected for each command name.
+cmd_stats * cmd_stats_list = NULL;
+int cmd_stats_count = 0;
+
+// Private functions.
+// Adds a mark to the command being timed.
+void add_mark(const char * name, long long time);
+// Records the duration of a phase of a command name.
+void record_phase(cmd_stats * stats, const char * name, long long duration);
+// Returns the durations collected for a command name, adding them if needed.
+cmd_stats * find_stats(const char * name);
+// Comparison function for qsort(), sorting marks by time.
+int compare_mark(const void * a, const void * b);
+
+// Starts timing a command. Any command still being timed is discarded.
+//
+// argv: the arguments of the command, terminated by NULL
+void cmd_timing_begin(char ** argv) {
+  cmd_pid = -1;
+  cmd_marks_count = 0;
+  snprintf(cmd_name, sizeof(cmd_name), "%s", argv[0]);
+  size_t len = 0;
+  int i;
+  cmd_line[0] = '\0';
+  for (i = 0; argv[i] != NULL && len < sizeof(cmd_line); i++) {
+    len += snprintf(cmd_line + len, sizeof(cmd_line) - len, (i == 0) ? "%s" : " %s", argv[i]);
+  }
+  add_mark("start", time_ns());
+}
+
+// Marks the start of the process of the command, whose phases are accepted
+// from now on.
+//
+// pid: the PID of the process
+void cmd_timing_spawned(pid_t pid) {
+  add_mark("spawn", time_ns());
+  cmd_pid = pid;
+}
+
+void msg_timing_handler(const message_t * msg) {
+
+  // Phases of background jobs, or reported too late, are ignored.
+  if (cmd_pid == -1 || msg->pid_sender != cmd_pid) {
+    return;
+  }
+
+  // The content is formatted as <phase>=<time>,<phase>=<time>,...
+  const char * entry = msg->content;
+  while (*entry != '\0') {
+    char name[TIMING_NAME_MAX];
+    long long time;
+    int len;
+    if (sscanf(entry, "%15[^=,]=%lld%n", name, &time, &len) != 2) {
+      fprintf(stderr, "Error: invalid timing message.\n");
+      return;
+    }
+    add_mark(name, time);
+    entry += len;
+    if (*entry == ',') {
+      entry++;
+    }
+  }
+
+}
+
+// Marks the termination of the command, and prints the time spent in each of
+// its phases, in chronological order. Messages from the command must be
+// handled before. The durations are collected for cmd_timing_summary().
+//
+// output: the stream where the breakdown is printed
+void cmd_timing_end(FILE * output) {
+  if (cmd_marks_count == 0) {
+    return;
+  }
+  add_mark("reap", time_ns());
+  qsort(cmd_marks, cmd_marks_count, sizeof(cmd_mark), compare_mark);
+  cmd_stats * stats = find_stats(cmd_name);
+  long long total = cmd_marks[cmd_marks_count - 1].time - cmd_marks[0].time;
+  fprintf(output, "timing: %s: %.3f ms =", cmd_line, total / 1e6);
+  int i;
+  for (i = 1; i < cmd_marks_count; i++) {
+    long long duration = cmd_marks[i].time - cmd_marks[i - 1].time;
+    fprintf(output, "%s %s %.3f", (i == 1) ? "" : " +", cmd_marks[i].name, duration / 1e6);
+    if (stats != NULL) {
+      record_phase(stats, cmd_marks[i].name, duration);
+    }
+  }
+  fprintf(output, "\n");
+  if (stats != NULL) {
+    record_phase(stats, "total", total);
+    stats->count++;
+  }
+  cmd_pid = -1;
+  cmd_marks_count = 0;
+}
+
+// Prints a table for each command name timed, with the number of executions
+// and the mean, 50th and 99th percentiles of each phase, in milliseconds.
+// Phases appear in the order they were first seen.
+//
+// output: the stream where the tables are printed
+void cmd_timing_summary(FILE * output) {
+  int i;
+  for (i = 0; i < cmd_stats_count; i++) {
+    const cmd_stats * stats = &cmd_stats_list[i];
+    fprintf(output, "\n%s (%llu)\n", stats->name, stats->count);
+    fprintf(output, "%-16s %8s %10s %10s %10s\n", "PHASE", "COUNT", "MEAN (ms)",
+            "p50 (ms)", "p99 (ms)");
+    int j;
+    for (j = 0; j < stats->phases_count; j++) {
+      const phase_stats * phase = stats->phases[j];
+      unsigned long long count = phase->durations.total;
+      fprintf(output, "%-16s %8llu %10.3f %10.3f %10.3f\n", phase->name, count,
+              (count > 0) ? phase->sum / 1e6 / count : 0.0,
+              histogram_percentile(&phase->durations, 0.5) / 1e6,
+              histogram_percentile(&phase->durations, 0.99) / 1e6);
+    }
+  }
+}
+
+// Frees the durations collected for each command name.
+void cmd_timing_deinit() {
+  int i;
+  for (i = 0; i < cmd_stats_count; i++) {
+    int j;
+    for (j = 0; j < cmd_stats_list[i].phases_count; j++) {
+      free(cmd_stats_list[i].phases[j]);
+    }
+  }
+  free(cmd_stats_list);
+  cmd_stats_list = NULL;
+  cmd_stats_count = 0;
+}
+
+// Adds a mark to the command being timed. Marks beyond CMD_MARKS are dropped.
+//
+// name: the name of the phase ending
+// time: the time of the mark (see time_ns())
+void add_mark(const char * name, long long time) {
+  if (cmd_marks_count == CMD_MARKS) {
+    return;
+  }
+  cmd_mark * mark = &cmd_marks[cmd_marks_count++];
+  snprintf(mark->name, sizeof(mark->name), "%s", name);
+  mark->time = time;
+}
+
+// Records the duration of a phase of a command name. A phase seen twice in the
+// same execution (e.g. "claim" retried) is recorded twice.
+//
+// stats: the durations collected for the command name
+// name: the name of the phase
+// duration: the duration, in nanoseconds
+void record_phase(cmd_stats * stats, const char * name, long long duration) {
+  phase_stats * phase = NULL;
+  int i;
+  for (i = 0; i < stats->phases_count && phase == NULL; i++) {
+    if (strcmp(stats->phases[i]->name, name) == 0) {
+      phase = stats->phases[i];
+    }
+  }
+  if (phase == NULL) {
+    if (stats->phases_count == CMD_MARKS ||
+        (phase = calloc(1, sizeof(phase_stats))) == NULL) {
+      return;
+    }
+    snprintf(phase->name, sizeof(phase->name), "%s", name);
+    stats->phases[stats->phases_count++] = phase;
+  }
+  phase->sum += duration;
+  histogram_record(&phase->durations, duration);
+}
+
+// Returns the durations collected for a command name, adding an empty entry if
+// the name was never timed.
+//
+// name: the name of the command
+//
+// Returns: the entry, or NULL on failure.
+cmd_stats * find_stats(const char * name) {
+  int i;
+  for (i = 0; i < cmd_stats_count; i++) {
+    if (strcmp(cmd_stats_list[i].name, name) == 0) {
+      return &cmd_stats_list[i];
+    }
+  }
+  cmd_stats * tmp = realloc(cmd_stats_list, sizeof(cmd_stats) * (cmd_stats_count + 1));
+  if (tmp == NULL) {
+    return NULL;
+  }
+  cmd_stats_list = tmp;
+  cmd_stats * stats = &cmd_stats_list[cmd_stats_count++];
+  memset(stats, 0, sizeof(cmd_stats));
+  snprintf(stats->name, sizeof(stats->name), "%s", name);
+  return stats;
+}
+
+// Comparison function for qsort(), sorting marks by time.
+int compare_mark(const void * a, const void * b) {
+  const cmd_mark * x = a;
+  const cmd_mark * y = b;
+  return (x->time > y->time) - (x->time < y->time);
+}
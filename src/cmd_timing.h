@@ -0,0 +1,29 @@
+#ifndef CMD_TIMING_H
+#define CMD_TIMING_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "message.h"
+#include "timing.h"
+
+// Timing of the commands executed in foreground by pmanager --timing. pmanager
+// marks the start of a command, the return of launcher_spawn() ("spawn") and
+// the termination of the process ("reap"), while the command marks its own
+// phases (see timing.h). The time between two consecutive marks is attributed
+// to the later one, and a breakdown is printed after each command. Durations
+// are also collected for each command name, and summarized on exit.
+
+// Starts timing a command, before it is started.
+void cmd_timing_begin(char ** argv);
+// Marks the start of the process of the command.
+void cmd_timing_spawned(pid_t pid);
+// Records the phases reported by the command with MSG_TIMING.
+void msg_timing_handler(const message_t * msg);
+// Marks the termination of the command, and prints its breakdown.
+void cmd_timing_end(FILE * output);
+// Prints a table of the phases of each command name.
+void cmd_timing_summary(FILE * output);
+// Frees the durations collected.
+void cmd_timing_deinit();
+
+#endif
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 // Copy tokens separated by delimiters found in str into the array pointed by
 // tokens_ptr.
@@ -56,3 +57,19 @@ int tokenize(const char * str, char *** tokens_ptr, const char * delimiters) {
 
   return tokens_count;
 }
+
+// Returns the current time of CLOCK_MONOTONIC in nanoseconds. The clock is
+// shared by all the processes, so times taken by different processes can be
+// compared.
+long long time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Comparison function for qsort(), sorting long long values in ascending order.
+int compare_ll(const void * a, const void * b) {
+  long long x = *(const long long *) a;
+  long long y = *(const long long *) b;
+  return (x > y) - (x < y);
+}
@@ -3,12 +3,23 @@
 
 // Custom PATH environment variable.
 #define PATH "./bin/"
-// Default name for FIFO.
-#define FIFO_NAME "tmp"
+// Directory containing command plugins (shared objects) loaded by pmanager.
+#define PLUGIN_PATH "./plugins/"
+// Directory containing the FIFOs used for exchanging messages. Each process
+// reads messages from its own FIFO, named after its PID.
+#define FIFO_DIR "tmp"
+// Helper keeping the pool of zygotes, i.e. idle processes claimed by pnew.
+#define ZYGOTE_PATH "./pzygote"
+// Environment variable set by pmanager when the pool of zygotes is enabled.
+#define ZYGOTE_ENV "CUSTOMSHELL_ZYGOTES"
 
 // Utility functions.
 // Copy tokens separated by delimiters found in str into the array pointed by
 // tokens_ptr.
 int tokenize(const char * str, char *** tokens_ptr, const char * delimiters);
+// Returns the current time of CLOCK_MONOTONIC in nanoseconds.
+long long time_ns();
+// Comparison function for qsort(), sorting long long values in ascending order.
+int compare_ll(const void * a, const void * b);
 
 #endif
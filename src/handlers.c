@@ -1,37 +1,95 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "proc_tree.h"
 #include "message.h"
+#include "common.h"
+#include "read_pool.h"
 
 void msg_add_handler(const message_t * msg, proc_node * root) {
 
-  int success = 0;
+  const char * error = NULL;
 
+  // Names are checked and registered in a single step, so that concurrent
+  // creators cannot both obtain the same name.
   proc_node * new_proc = proc_node_fromstr(msg->content);
   if (new_proc == NULL) {
     fprintf(stderr, "Error: failed to create node for process.\n");
+    error = "malformed process";
   } else {
-    if (proc_node_add(root, new_proc) != 0) {
+    int status = proc_node_add_unique(root, new_proc);
+    if (status == 1) {
+      error = MSG_ERROR_EXISTS;
+    } else if (status != 0) {
       fprintf(stderr, "Error: failed to add new process to the process tree.\n");
-    } else {
-      success = 1;
+      error = "failed to add process";
     }
     proc_node_deinit(new_proc);
   }
 
   // Send result of add to msg->pid_sender
-  char * reply_type = (success) ? MSG_SUCCESS : MSG_ERROR;
-  message_send(msg->pid_sender, reply_type, NULL);
+  if (error == NULL) {
+    message_send(msg->pid_sender, MSG_SUCCESS, NULL);
+  } else {
+    message_send(msg->pid_sender, MSG_ERROR, error);
+  }
+
+}
+
+void msg_add_batch_handler(const message_t * msg, proc_node * root) {
+
+  // By default, the sender is the parent of the clones.
+  proc_node * sender = proc_node_find_by_pid(root, msg->pid_sender);
+
+  // Register each clone, replying with the numbers of their names (e.g. 3 for
+  // <parent name>_3), or 0 for clones that could not be added. Entries are
+  // formatted as <pid> or <pid>/<ppid>: the parent of an entry must precede
+  // it, so consecutive entries often share the parent.
+  char ** entries;
+  int entries_count = tokenize(msg->content, &entries, ",");
+  char * reply = malloc(sizeof(char) * (entries_count * 12 + 1));
+  size_t reply_len = 0;
+  reply[0] = '\0';
+  proc_node * parent = NULL;
+  int i;
+  for (i = 0; i < entries_count; i++) {
+    pid_t pid = atol(entries[i]);
+    char * ppid_str = strchr(entries[i], '/');
+    if (ppid_str == NULL) {
+      parent = sender;
+    } else if (parent == NULL || parent->pid != atol(ppid_str + 1)) {
+      parent = proc_node_find_by_pid(root, atol(ppid_str + 1));
+    }
+    proc_node * clone = NULL;
+    if (pid > 0 && parent != NULL) {
+      clone = proc_node_add_clone(root, parent, pid);
+      if (clone == NULL) {
+        fprintf(stderr, "Error: failed to add new process to the process tree.\n");
+      }
+    }
+    reply_len += sprintf(reply + reply_len, (i == 0) ? "%d" : ",%d",
+                         (clone == NULL) ? 0 : parent->clones_count);
+    free(entries[i]);
+  }
+  free(entries);
+
+  message_send(msg->pid_sender, MSG_SUCCESS, reply);
+  free(reply);
 
 }
 
-void msg_info_handler(const message_t * msg, proc_node * root) {
-  const proc_node * proc = (const proc_node *) proc_node_find_by_name(root, msg->content);
+void msg_info_handler(const message_t * msg, const proc_node * root) {
+  // The reply is formatted while holding the lock, and sent after releasing
+  // it.
+  tree_read_lock();
+  const proc_node * proc = proc_node_find_by_name((proc_node *) root, msg->content);
   char * proc_str = NULL;
+  int tostr_status = (proc == NULL) ? 0 : proc_node_tostr(proc, &proc_str);
+  tree_read_unlock();
   int send_status;
   if (proc == NULL) {
     send_status = message_send(msg->pid_sender, MSG_ERROR, "process not found");
-  } else if (proc_node_tostr(proc, &proc_str) == -1) {
+  } else if (tostr_status == -1) {
     send_status = message_send(msg->pid_sender, MSG_ERROR, "failed to get process string");
   } else {
     send_status = message_send(msg->pid_sender, MSG_INFO, proc_str);
@@ -55,9 +113,18 @@ void msg_remove_handler(const message_t * msg, proc_node * root) {
   }
 }
 
-void msg_list_handler(const message_t * msg, proc_node * root) {
+void msg_list_handler(const message_t * msg, const proc_node * root) {
 
-  proc_node * initial_node = proc_node_find_by_name(root, msg->content);
+  // The subtree is copied while holding the lock, and sent after releasing it,
+  // so that a slow client does not delay changes to the tree.
+  tree_read_lock();
+  proc_node * initial_node = proc_node_find_by_name((proc_node *) root, msg->content);
+  int count = 0;
+  proc_node ** procs = NULL;
+  if (initial_node != NULL) {
+    procs = proc_node_get_array(initial_node, &count);
+  }
+  tree_read_unlock();
 
   if (initial_node == NULL) {
     if (message_send(msg->pid_sender, MSG_ERROR, "process not found") != 0) {
@@ -66,9 +133,6 @@ void msg_list_handler(const message_t * msg, proc_node * root) {
     return;
   }
 
-  int count;
-  proc_node ** procs = proc_node_get_array(initial_node, &count);
-
   if (procs == NULL) {
     if (message_send(msg->pid_sender, MSG_ERROR, "failed to get process list") != 0) {
       fprintf(stderr, "Error: failed to send message.\n");
@@ -76,7 +140,9 @@ void msg_list_handler(const message_t * msg, proc_node * root) {
     return;
   }
 
-  // Send processes to plist/ptree.
+  // Send processes to plist/ptree. Sending blocks while the inbox of the
+  // client is full, so entries are not acknowledged.
+  // The list ends at the first error.
   int i;
   for (i = 0; i < count; i++) {
     char * proc_str = NULL;
@@ -90,13 +156,13 @@ void msg_list_handler(const message_t * msg, proc_node * root) {
     if (send_status != 0) {
       fprintf(stderr, "Error: failed to send message.\n");
     }
-    // Wait read confirmation from plist/ptree before sending next process.
-    message_t * response = message_wait(msg->pid_sender);
-    message_deinit(response);
+    if (proc_str == NULL || send_status != 0) {
+      break;
+    }
   }
 
   // Inform plist/ptree that there are no more processes left.
-  if (message_send(msg->pid_sender, MSG_SUCCESS, NULL) != 0) {
+  if (i == count && message_send(msg->pid_sender, MSG_SUCCESS, NULL) != 0) {
     fprintf(stderr, "Error: failed to send message.\n");
   }
 
@@ -107,3 +173,28 @@ void msg_list_handler(const message_t * msg, proc_node * root) {
   free(procs);
 
 }
+
+// Removes the inboxes of the processes in the subtree rooted at node, which
+// were terminated without removing them.
+void discard_inboxes(const proc_node * node) {
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    discard_inboxes(node->children[i]);
+  }
+  message_discard(node->pid);
+}
+
+void msg_prune_handler(const message_t * msg, proc_node * root) {
+  proc_node * proc = proc_node_find_by_name(root, msg->content);
+  int send_status;
+  if (proc == NULL || proc == root) {
+    send_status = message_send(msg->pid_sender, MSG_ERROR, "process not found");
+  } else {
+    discard_inboxes(proc);
+    proc_node_remove_subtree(root, proc->pid);
+    send_status = message_send(msg->pid_sender, MSG_SUCCESS, NULL);
+  }
+  if (send_status != 0) {
+    fprintf(stderr, "Error: failed to send message.\n");
+  }
+}
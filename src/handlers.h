@@ -2,8 +2,10 @@
 #define HANDLERS_H
 
 void msg_add_handler(const message_t * msg, proc_node * root);
+void msg_add_batch_handler(const message_t * msg, proc_node * root);
 void msg_info_handler(const message_t * msg, const proc_node * root);
 void msg_remove_handler(const message_t * msg, proc_node * root);
 void msg_list_handler(const message_t * msg, const proc_node * root);
+void msg_prune_handler(const message_t * msg, proc_node * root);
 
 #endif
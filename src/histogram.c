@@ -0,0 +1,106 @@
+#include <string.h>
+#include "histogram.h"
+
+// Private functions.
+// Returns the index of the bucket containing value.
+int histogram_index(unsigned long long value);
+// Returns the highest value contained in a bucket.
+long long histogram_value(int index);
+
+// Returns the index of the bucket containing value. Values below
+// HISTOGRAM_SUB_COUNT have a bucket each; larger values are grouped by their
+// most significant bit, and then by the following HISTOGRAM_SUB_BITS bits.
+//
+// value: the value
+int histogram_index(unsigned long long value) {
+  if (value < HISTOGRAM_SUB_COUNT) {
+    return value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) + (int) ((value >> shift) - HISTOGRAM_SUB_COUNT);
+}
+
+// Returns the highest value contained in a bucket, i.e. the inverse of
+// histogram_index() rounded up.
+//
+// index: the index of the bucket
+long long histogram_value(int index) {
+  if (index < HISTOGRAM_SUB_COUNT) {
+    return index;
+  }
+  int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+  unsigned long long low = (unsigned long long) (HISTOGRAM_SUB_COUNT + (index % HISTOGRAM_SUB_COUNT)) << shift;
+  return low + (1ULL << shift) - 1;
+}
+
+// Records a value, using atomic increments so that threads can share the
+// histogram.
+//
+// hist: the histogram
+// value: the value, negative values being recorded as 0
+void histogram_record(histogram * hist, long long value) {
+  int index = histogram_index((value < 0) ? 0 : value);
+  __atomic_fetch_add(&hist->counts[index], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+}
+
+// Returns the value below which the given fraction of the recorded values
+// fall, e.g. the median for 0.5.
+//
+// hist: the histogram
+// fraction: the fraction of values, between 0 and 1
+//
+// Returns: the highest value of the bucket reaching fraction, or 0 if no value
+// was recorded.
+long long histogram_percentile(const histogram * hist, double fraction) {
+  unsigned long long total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+  if (total == 0) {
+    return 0;
+  }
+  unsigned long long rank = (unsigned long long) (fraction * total + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  unsigned long long seen = 0;
+  int i;
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+    if (seen >= rank) {
+      return histogram_value(i);
+    }
+  }
+  return histogram_value(HISTOGRAM_BUCKETS - 1);
+}
+
+// Returns the number of values recorded not greater than value, e.g. for the
+// cumulative buckets of Prometheus histograms. Values sharing a bucket with
+// value are counted only if the whole bucket is below it, so the result is
+// exact when value is the highest value of a bucket, and an underestimate by
+// less than a bucket otherwise.
+//
+// hist: the histogram
+// value: the upper bound
+unsigned long long histogram_count_below(const histogram * hist, long long value) {
+  unsigned long long count = 0;
+  int i;
+  for (i = 0; i < HISTOGRAM_BUCKETS && histogram_value(i) <= value; i++) {
+    count += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+  }
+  return count;
+}
+
+// Returns the highest value of the bucket containing value: counting the
+// values not greater than it with histogram_count_below() is exact.
+//
+// value: the value
+long long histogram_bucket_max(long long value) {
+  return histogram_value(histogram_index((value < 0) ? 0 : value));
+}
+
+// Removes all the values recorded. Values recorded concurrently may be lost.
+//
+// hist: the histogram
+void histogram_reset(histogram * hist) {
+  memset(hist, 0, sizeof(histogram));
+}
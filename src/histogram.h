@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// Log-linear histogram of non-negative values (e.g. latencies in nanoseconds),
+// in the style of HdrHistogram: each power of two is split into
+// 2^HISTOGRAM_SUB_BITS buckets of equal width, so that every value is
+// recorded with a relative error below 1 / 2^HISTOGRAM_SUB_BITS (about 6%),
+// with a fixed amount of memory and no allocation.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+typedef struct histogram {
+  // Number of values recorded in each bucket.
+  unsigned long long counts[HISTOGRAM_BUCKETS];
+  // Number of values recorded.
+  unsigned long long total;
+} histogram;
+
+// Records a value. It can be called concurrently by several threads.
+void histogram_record(histogram * hist, long long value);
+// Returns the value below which the given fraction of values fall.
+long long histogram_percentile(const histogram * hist, double fraction);
+// Returns the number of values recorded not greater than value.
+unsigned long long histogram_count_below(const histogram * hist, long long value);
+// Returns the highest value of the bucket containing value.
+long long histogram_bucket_max(long long value);
+// Removes all the values recorded.
+void histogram_reset(histogram * hist);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "jobs.h"
+#include "record.h"
+#include "common.h"
+
+// Job table.
+job_t * jobs = NULL;
+// Number of running jobs.
+int jobs_size = 0;
+// Id assigned to the next job. Ids restart from 1 when the table is empty.
+int next_job_id = 1;
+
+// Private functions.
+// Removes the job at index i from the table.
+void jobs_remove(int i);
+
+// Returns a file descriptor that becomes readable when pid terminates. The
+// process must be a child of the caller.
+//
+// pid: the PID of the process
+//
+// Returns: the file descriptor, or -1 if pidfds are not supported.
+int pidfd_open_pid(pid_t pid) {
+#ifdef SYS_pidfd_open
+  int fd = syscall(SYS_pidfd_open, pid, 0);
+  if (fd != -1) {
+    return fd;
+  }
+#endif
+  return -1;
+}
+
+// Joins argv into a single string, separating arguments with spaces.
+//
+// argv: the array of strings, terminated by a NULL pointer
+//
+// Returns: the new string, or NULL if memory allocation failed.
+char * join_argv(char ** argv) {
+  size_t len = 1;
+  int i;
+  for (i = 0; argv[i] != NULL; i++) {
+    len += strlen(argv[i]) + 1;
+  }
+  char * str = malloc(sizeof(char) * len);
+  if (str == NULL) {
+    return NULL;
+  }
+  str[0] = '\0';
+  for (i = 0; argv[i] != NULL; i++) {
+    if (i > 0) {
+      strcat(str, " ");
+    }
+    strcat(str, argv[i]);
+  }
+  return str;
+}
+
+// Adds a command started in background to the job table.
+//
+// pid: the PID of the process executing the command
+// argv: the arguments of the command, terminated by a NULL pointer
+// quiet: if true, no notification is printed when the job terminates
+//
+// Returns: the id of the job, or -1 on failure.
+int jobs_add(pid_t pid, char ** argv, int quiet) {
+  job_t * tmp = realloc(jobs, sizeof(job_t) * (jobs_size + 1));
+  if (tmp == NULL) {
+    return -1;
+  }
+  jobs = tmp;
+  if (jobs_size == 0) {
+    next_job_id = 1;
+  }
+  job_t * job = &jobs[jobs_size];
+  job->id = next_job_id++;
+  job->pid = pid;
+  job->pidfd = pidfd_open_pid(pid);
+  job->command = join_argv(argv);
+  job->quiet = quiet;
+  job->started = time_ns();
+  jobs_size++;
+  return job->id;
+}
+
+// Returns the number of running jobs.
+int jobs_count() {
+  return jobs_size;
+}
+
+// Returns true if the job with the given id is running.
+//
+// id: the id of the job
+int jobs_running(int id) {
+  int i;
+  for (i = 0; i < jobs_size; i++) {
+    if (jobs[i].id == id) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Fills fds with one entry for each job, in the same order as the job table.
+// The entry of a job without pidfd has a negative fd, so it is ignored by
+// poll().
+//
+// fds: an array with room for at least jobs_count() entries
+//
+// Returns: the number of entries filled.
+int jobs_pollfds(struct pollfd * fds) {
+  int i;
+  for (i = 0; i < jobs_size; i++) {
+    fds[i].fd = jobs[i].pidfd;
+    fds[i].events = POLLIN;
+    fds[i].revents = 0;
+  }
+  return jobs_size;
+}
+
+// Removes the job at index i from the table.
+//
+// i: the index of the job
+void jobs_remove(int i) {
+  if (jobs[i].pidfd != -1) {
+    close(jobs[i].pidfd);
+  }
+  free(jobs[i].command);
+  memmove(&jobs[i], &jobs[i + 1], sizeof(job_t) * (jobs_size - i - 1));
+  jobs_size--;
+}
+
+// Reaps terminated jobs and prints a notification for each of them, except
+// quiet ones. Only the jobs whose pidfd is readable in fds are checked, plus
+// the jobs without a pidfd. If fds is NULL, all the jobs are checked.
+//
+// fds: the array filled by jobs_pollfds() and passed to poll(), or NULL
+//
+// Returns: the number of jobs reaped.
+int jobs_reap(const struct pollfd * fds) {
+  int reaped = 0;
+  int notified = 0;
+  // Index in fds of the current job. Entries in fds are not shifted when a
+  // job is removed from the table.
+  int fd_index = 0;
+  int i = 0;
+  while (i < jobs_size) {
+    int check = (fds == NULL) || jobs[i].pidfd == -1 || fds[fd_index].revents != 0;
+    fd_index++;
+    int status;
+    if (check && waitpid(jobs[i].pid, &status, WNOHANG) == jobs[i].pid) {
+      // Quiet jobs are commands run in parallel by -j, not in background.
+      if (jobs[i].command != NULL) {
+        record_command(jobs[i].command, !jobs[i].quiet, jobs[i].started,
+                       record_status(status));
+      }
+      if (!jobs[i].quiet) {
+        printf("[%d] Done\t%s\n", jobs[i].id, jobs[i].command);
+        notified = 1;
+      }
+      jobs_remove(i);
+      reaped++;
+    } else {
+      i++;
+    }
+  }
+  if (notified) {
+    fflush(stdout);
+  }
+  return reaped;
+}
+
+// Prints running jobs.
+void jobs_print() {
+  int i;
+  for (i = 0; i < jobs_size; i++) {
+    printf("[%d] %ld Running\t%s\n", jobs[i].id, (long) jobs[i].pid, jobs[i].command);
+  }
+}
+
+// Frees the job table.
+void jobs_deinit() {
+  while (jobs_size > 0) {
+    jobs_remove(jobs_size - 1);
+  }
+  free(jobs);
+  jobs = NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <poll.h>
+
+// Represents a command running in background.
+typedef struct job_t {
+  // Number used to refer to the job.
+  int id;
+  // PID of the process executing the command.
+  pid_t pid;
+  // File descriptor referring to the process, or -1 if not available.
+  int pidfd;
+  // Command line of the job.
+  char * command;
+  // True if no notification is printed when the job terminates.
+  int quiet;
+  // Time the job was added (see time_ns()), for the record of commands.
+  long long started;
+} job_t;
+
+// Returns a file descriptor that becomes readable when pid terminates.
+int pidfd_open_pid(pid_t pid);
+// Joins argv into a single string, separating arguments with spaces.
+char * join_argv(char ** argv);
+// Adds a command started in background to the job table.
+int jobs_add(pid_t pid, char ** argv, int quiet);
+// Returns the number of running jobs.
+int jobs_count();
+// Returns true if the job with the given id is running.
+int jobs_running(int id);
+// Fills fds with one entry for each job, in the same order as the job table.
+int jobs_pollfds(struct pollfd * fds);
+// Reaps terminated jobs and prints a notification for each of them.
+int jobs_reap(const struct pollfd * fds);
+// Prints running jobs.
+void jobs_print();
+// Frees the job table.
+void jobs_deinit();
+
+#endif
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include "launcher.h"
+
+// Events that invalidate the cache of executables.
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+extern char ** environ;
+
+// Represents an executable found in the launcher directory.
+typedef struct launcher_entry {
+  // Name of the command.
+  char * name;
+  // File descriptor kept open on the executable.
+  int fd;
+  // Path used by posix_spawn(), which refers to fd through /proc.
+  char * spawn_path;
+} launcher_entry;
+
+// Directory containing executables.
+char * launcher_path = NULL;
+// Cached executables.
+launcher_entry * entries = NULL;
+// Number of cached executables.
+int entries_count = 0;
+// Inotify instance watching launcher_path, or -1 if not available.
+int inotify_fd = -1;
+// True if spawning through /proc/self/fd is supported.
+int proc_fd_ok = 1;
+
+// Private functions.
+// Scans launcher_path and rebuilds the cache of executables.
+void launcher_scan();
+// Frees the cache of executables.
+void launcher_clear();
+// Returns true if the directory changed since the last scan.
+int launcher_changed();
+// Finds a cached executable by name.
+launcher_entry * launcher_find(const char * command);
+
+// Resolves the executables contained in directory path and starts watching it
+// for changes, so that the cache is rebuilt only when needed.
+//
+// path: the directory containing executables. It must end with '/'.
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int launcher_init(const char * path) {
+  launcher_path = strdup(path);
+  if (launcher_path == NULL) {
+    return -1;
+  }
+  // If inotify is not available, the cache is rebuilt on each miss.
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd != -1 && inotify_add_watch(inotify_fd, path, WATCH_EVENTS) == -1) {
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  // Spawning through /proc/self/fd requires procfs.
+  proc_fd_ok = access("/proc/self/fd", X_OK) == 0;
+  launcher_scan();
+  return 0;
+}
+
+// Closes cached executables and stops watching the directory.
+void launcher_deinit() {
+  launcher_clear();
+  if (inotify_fd != -1) {
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  free(launcher_path);
+  launcher_path = NULL;
+}
+
+// Frees the cache of executables.
+void launcher_clear() {
+  int i;
+  for (i = 0; i < entries_count; i++) {
+    close(entries[i].fd);
+    free(entries[i].name);
+    free(entries[i].spawn_path);
+  }
+  free(entries);
+  entries = NULL;
+  entries_count = 0;
+}
+
+// Scans launcher_path and rebuilds the cache of executables. Only regular
+// files that are executable are cached. Symbolic links are followed, as
+// execv() does, and so are entries whose type is not reported by readdir().
+void launcher_scan() {
+  launcher_clear();
+  DIR * dir = opendir(launcher_path);
+  if (dir == NULL) {
+    return;
+  }
+  int dir_fd = dirfd(dir);
+  struct dirent * file;
+  while ((file = readdir(dir)) != NULL) {
+    struct stat st;
+    if (file->d_type != DT_REG &&
+        (fstatat(dir_fd, file->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))) {
+      continue;
+    }
+    if (faccessat(dir_fd, file->d_name, X_OK, 0) != 0) {
+      continue;
+    }
+    int fd = openat(dir_fd, file->d_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      continue;
+    }
+    launcher_entry * tmp = realloc(entries, sizeof(launcher_entry) * (entries_count + 1));
+    if (tmp == NULL) {
+      close(fd);
+      break;
+    }
+    entries = tmp;
+    launcher_entry * entry = &entries[entries_count];
+    entry->fd = fd;
+    entry->name = strdup(file->d_name);
+    // Without procfs, fall back to the pathname of the executable.
+    int status = proc_fd_ok ?
+                 asprintf(&entry->spawn_path, "/proc/self/fd/%d", fd) :
+                 asprintf(&entry->spawn_path, "%s%s", launcher_path, file->d_name);
+    if (entry->name == NULL || status == -1) {
+      close(fd);
+      free(entry->name);
+      continue;
+    }
+    entries_count++;
+  }
+  closedir(dir);
+}
+
+// Returns true if the directory changed since the last call, consuming all
+// pending inotify events.
+int launcher_changed() {
+  if (inotify_fd == -1) {
+    return 0;
+  }
+  int changed = 0;
+  char buffer[4096];
+  while (read(inotify_fd, buffer, sizeof(buffer)) > 0) {
+    changed = 1;
+  }
+  return changed;
+}
+
+// Finds a cached executable by name.
+//
+// command: the name of the command
+//
+// Returns: a pointer to the entry, or NULL if not found.
+launcher_entry * launcher_find(const char * command) {
+  int i;
+  for (i = 0; i < entries_count; i++) {
+    if (strcmp(entries[i].name, command) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+// Starts command with arguments argv without waiting for its termination. The
+// executable is started with posix_spawn(), which avoids copying the address
+// space of the caller, from the file descriptor cached by launcher_scan(), so
+// neither PATH nor the directory are searched again.
+//
+// command: the name of the command
+// argv: the arguments passed to the program, terminated by a NULL pointer. If
+//       NULL, the command is started with command as the only argument.
+// pid: where the PID of the new process is stored
+//
+// Returns:
+//  -2 : spawn failed
+//  -1 : command not found
+//   0 : command started successfully
+int launcher_spawn(const char * command, char ** argv, pid_t * pid) {
+  // Commands cannot contain a path.
+  if (strchr(command, '/') != NULL) {
+    return -1;
+  }
+  // Rebuild cache if the directory changed or, when changes cannot be
+  // detected, if the command is not found.
+  if (launcher_changed()) {
+    launcher_scan();
+  }
+  launcher_entry * entry = launcher_find(command);
+  if (entry == NULL && inotify_fd == -1) {
+    launcher_scan();
+    entry = launcher_find(command);
+  }
+  if (entry == NULL) {
+    return -1;
+  }
+  char * default_argv[] = { (char *) command, NULL };
+  if (argv == NULL) {
+    argv = default_argv;
+  }
+  // Signals ignored by the caller (e.g. SIGPIPE) are restored to default.
+  posix_spawnattr_t attr;
+  sigset_t default_signals;
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  if (posix_spawnattr_init(&attr) != 0) {
+    return -2;
+  }
+  posix_spawnattr_setsigdefault(&attr, &default_signals);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+  int status = posix_spawn(pid, entry->spawn_path, NULL, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  return (status == 0) ? 0 : -2;
+}
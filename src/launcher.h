@@ -0,0 +1,14 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <sys/types.h>
+
+// Resolves the executables contained in directory path and starts watching it
+// for changes.
+int launcher_init(const char * path);
+// Closes cached executables and stops watching the directory.
+void launcher_deinit();
+// Starts command with arguments argv without waiting for its termination.
+int launcher_spawn(const char * command, char ** argv, pid_t * pid);
+
+#endif
@@ -1,80 +1,168 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <sys/types.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include "message.h"
 #include "common.h"
+#include "trace.h"
+
+// Size of the chunks read from the inbox.
+#define READ_CHUNK 4096
+
+// A message received but not consumed yet.
+typedef struct pending_msg {
+  message_t * msg;
+  struct pending_msg * next;
+} pending_msg;
 
-// File descriptor associated to FIFO used for exchanging messages.
-int fd;
-// Flag for unread messages.
-int unread_flag = 0;
-// PID of the last process that sent a message.
-pid_t message_sender = -1;
+// File descriptor of the inbox of this process.
+int inbox_fd = -1;
+// PID of the process that created the inbox. After fork(), it differs from
+// getpid() until message_setup() is called again.
+pid_t inbox_pid = -1;
+// Buffer of bytes read from the inbox and not yet parsed.
+char * recv_buffer = NULL;
+// Number of bytes stored in recv_buffer.
+size_t recv_count = 0;
+// Size of recv_buffer.
+size_t recv_size = 0;
+// Queue of messages received but not consumed yet.
+pending_msg * pending_head = NULL;
+pending_msg * pending_tail = NULL;
+// Last inbox opened for writing, kept open for following messages. Each
+// thread has its own, so that threads of pmanager can send replies
+// concurrently.
+__thread pid_t send_pid = -1;
+__thread int send_fd = -1;
+// Number of bytes sent by each thread.
+__thread unsigned long long sent_bytes = 0;
+// Number of waits that timed out, in any thread.
+unsigned long long wait_timeouts = 0;
+// Timeout returned by message_default_timeout(), -2 until it is read.
+int default_timeout = -2;
 
 // Private functions.
 // Initializes a message_t struct.
 message_t * message_init(pid_t pid_sender, const char * type, const char * content);
-// Sets unread_flag to true.
-void set_unread_flag(int signum, siginfo_t * siginfo, void * context);
-// Sets unread_flag to false.
-void reset_unread_flag();
-// Sets message_sender value.
-void set_message_sender(pid_t pid);
-// Returns the current value of message_sender.
-pid_t get_message_sender();
+// Parses a message string.
+message_t * message_parse(const char * msg_str);
+// Returns the path of the inbox of pid.
+int inbox_path(pid_t pid, char * path, size_t size);
+// Reads available bytes from the inbox and queues complete messages.
+int inbox_fill();
+// Adds a message to the pending queue.
+void pending_push(message_t * msg);
+// Removes the first pending message sent by from (or any, if from is -1).
+message_t * pending_take(pid_t from);
+// Frees all pending messages.
+void pending_clear();
+// Opens the inbox of pid for writing.
+int open_inbox(pid_t pid);
+// Closes the cached inbox opened for writing.
+void close_send_fd();
+// Sends a message, waiting at most timeout milliseconds if the inbox is full.
+int send_timeout(pid_t pid, const char * type, const char * content, int timeout);
 
-// Handler for SIGUSR1. It sets unread_flag to true and saves the PID of the
-// process that sent the signal in message_sender.
+// Returns the path of the inbox of pid: <FIFO_DIR>/<pid>.
 //
-// signum: signal number that was received
-// siginfo: contains information about received signal (PID)
-// context: not used. See `man sigaction`.
-void set_unread_flag(int signum, siginfo_t * siginfo, void * context) {
-  unread_flag = 1;
-  message_sender = siginfo->si_pid;
+// pid: the PID of the owner of the inbox
+// path: the buffer where the path is written
+// size: the size of path
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int inbox_path(pid_t pid, char * path, size_t size) {
+  int len = snprintf(path, size, "%s/%ld", FIFO_DIR, (long) pid);
+  return (len < 0 || len >= size) ? -1 : 0;
 }
 
-// Sets unread_flag to false.
-void reset_unread_flag() {
-  unread_flag = 0;
-}
+// Creates and opens the FIFO used as inbox by the calling process. Any state
+// inherited from the parent (inbox, unread messages) is discarded, so a forked
+// child must call this function again before exchanging messages. Nothing is
+// done if the calling process already created its inbox, so messages received
+// before a later call are kept.
+// SIGPIPE is ignored, so that writing to the inbox of a terminated process
+// results in an error instead of killing the sender.
+//
+// Returns: on success, 0 is returned; on failure -1 is returned.
+int message_setup() {
+  if (inbox_fd != -1 && inbox_pid == getpid()) {
+    return 0;
+  }
+  // Discard state inherited from parent.
+  if (inbox_fd != -1) {
+    close(inbox_fd);
+    inbox_fd = -1;
+  }
+  close_send_fd();
+  pending_clear();
+  recv_count = 0;
 
-// Returns the current value of unread_flag.
-int message_unread() {
-  return unread_flag;
-}
+  char path[PATH_MAX];
+  if (inbox_path(getpid(), path, sizeof(path)) != 0) {
+    return -1;
+  }
+  // A FIFO left by a terminated process with the same PID is replaced.
+  unlink(path);
+  if (mkfifo(path, 0600) != 0) {
+    return -1;
+  }
+  // Opening for reading and writing keeps the FIFO open even when there are
+  // no writers.
+  inbox_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (inbox_fd == -1) {
+    unlink(path);
+    return -1;
+  }
+  inbox_pid = getpid();
+  // Open the trace ring before any signal handler records an event.
+  trace_init();
 
-// Sets the value of message_sender.
-void set_message_sender(pid_t pid) {
-  message_sender = pid;
+  struct sigaction action;
+  action.sa_handler = SIG_IGN;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = 0;
+  return sigaction(SIGPIPE, &action, NULL);
 }
 
-// Returns the value of message_sender.
-pid_t get_message_sender() {
-  return message_sender;
+// Closes and removes the inbox of the calling process. Nothing is done if the
+// inbox was created by another process (e.g. the parent before fork()).
+void message_teardown() {
+  close_send_fd();
+  pending_clear();
+  if (inbox_fd == -1 || inbox_pid != getpid()) {
+    return;
+  }
+  close(inbox_fd);
+  inbox_fd = -1;
+  char path[PATH_MAX];
+  if (inbox_path(inbox_pid, path, sizeof(path)) == 0) {
+    unlink(path);
+  }
 }
 
-// Sets file descriptor of the FIFO used for exchanging messages, and registers
-// handler for SIGUSR1.
-//
-// fifo_fd: the file descriptor of the FIFO to use for exchanging messages.
+// Removes the inbox of another process, which terminated without calling
+// message_teardown() (e.g. killed by SIGKILL).
 //
-// Returns: on success, 0 is returned; on failure -1 is returned.
-int message_setup(int fifo_fd) {
-  // Set global file descriptor.
-  fd = fifo_fd;
-  // Register signal handler for SIGUSR1.
-  struct sigaction new_action;
-  new_action.sa_sigaction = set_unread_flag;
-  sigemptyset(&new_action.sa_mask);
-  new_action.sa_flags = SA_SIGINFO;
-  return sigaction(SIGUSR1, &new_action, NULL);
+// pid: the PID of the terminated process
+void message_discard(pid_t pid) {
+  char path[PATH_MAX];
+  if (inbox_path(pid, path, sizeof(path)) == 0) {
+    unlink(path);
+  }
+}
+
+// Returns the file descriptor of the inbox. It becomes readable when a new
+// message is received, so it can be used with poll().
+int message_fd() {
+  return inbox_fd;
 }
 
 // Initializes a message_t struct.
@@ -103,6 +191,7 @@ message_t * message_init(pid_t pid_sender, const char * type, const char * conte
   }
   strcpy(msg->content, content);
   msg->pid_sender = pid_sender;
+  msg->time_sent = 0;
   return msg;
 }
 
@@ -117,117 +206,472 @@ void message_deinit(message_t * msg) {
   }
 }
 
+// Adds a message to the tail of the pending queue.
+//
+// msg: the message to add
+void pending_push(message_t * msg) {
+  pending_msg * item = malloc(sizeof(pending_msg));
+  if (item == NULL) {
+    message_deinit(msg);
+    return;
+  }
+  item->msg = msg;
+  item->next = NULL;
+  if (pending_tail == NULL) {
+    pending_head = item;
+  } else {
+    pending_tail->next = item;
+  }
+  pending_tail = item;
+}
+
+// Removes the first pending message sent by from. Messages from other
+// processes are left in the queue, in the order they were received.
+//
+// from: the PID of the sender, or -1 for any sender
+//
+// Returns: the message, or NULL if there is no such message.
+message_t * pending_take(pid_t from) {
+  pending_msg * prev = NULL;
+  pending_msg * item = pending_head;
+  while (item != NULL && from != -1 && item->msg->pid_sender != from) {
+    prev = item;
+    item = item->next;
+  }
+  if (item == NULL) {
+    return NULL;
+  }
+  if (prev == NULL) {
+    pending_head = item->next;
+  } else {
+    prev->next = item->next;
+  }
+  if (pending_tail == item) {
+    pending_tail = prev;
+  }
+  message_t * msg = item->msg;
+  free(item);
+  return msg;
+}
+
+// Frees all pending messages.
+void pending_clear() {
+  message_t * msg;
+  while ((msg = pending_take(-1)) != NULL) {
+    message_deinit(msg);
+  }
+}
+
+// Reads all the bytes available in the inbox, and adds every complete message
+// to the pending queue. Malformed messages are discarded.
+//
+// Returns: the number of messages queued, or -1 on read() error. If no data
+// is available, 0 is returned.
+int inbox_fill() {
+  if (inbox_fd == -1) {
+    errno = EBADF;
+    return -1;
+  }
+  int queued = 0;
+  while (1) {
+    // Realloc memory pointed by recv_buffer if necessary.
+    if (recv_size - recv_count < READ_CHUNK) {
+      char * tmp = realloc(recv_buffer, recv_size + READ_CHUNK);
+      if (tmp == NULL) {
+        return -1;
+      }
+      recv_buffer = tmp;
+      recv_size += READ_CHUNK;
+    }
+    ssize_t count = read(inbox_fd, recv_buffer + recv_count, recv_size - recv_count);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      if (count == -1 && errno != EAGAIN) {
+        return -1;
+      }
+      break;
+    }
+    recv_count += count;
+  }
+  // Split buffer into null-terminated strings.
+  size_t start = 0;
+  size_t i;
+  for (i = 0; i < recv_count; i++) {
+    if (recv_buffer[i] == '\0') {
+      message_t * msg = message_parse(recv_buffer + start);
+      if (msg != NULL) {
+        trace_record(TRACE_RECV, msg->pid_sender, msg->type[0],
+                     (msg->time_sent > 0) ? (time_ns() - msg->time_sent) / 1000 : 0);
+        pending_push(msg);
+        queued++;
+      }
+      start = i + 1;
+    }
+  }
+  // Keep the incomplete message, if any, at the beginning of the buffer.
+  memmove(recv_buffer, recv_buffer + start, recv_count - start);
+  recv_count -= start;
+  return queued;
+}
+
+// Returns true if a message was received and not read yet.
+int message_unread() {
+  if (pending_head == NULL) {
+    inbox_fill();
+  }
+  return pending_head != NULL;
+}
+
 // Waits a message from PID. If a message was already received, the function
 // returns immediately. If from is set to -1, a message from *any* pid is
-// waited.
+// waited. Messages from other processes received in the meantime are kept and
+// returned by later calls.
 //
 // from: the PID of the process from which a message is waited
 //
 // Returns: a pointer to the message received. If there was an error in reading
 // the message, NULL is returned.
 message_t * message_wait(pid_t from) {
-  sigset_t mask;
-  sigemptyset(&mask);
-  // While unread_flag is false or message_sender is *not* equal to from, wait.
-  // If from equals to -1 and there is an unread message, stop waiting.
-  while (!message_unread() || (from != get_message_sender() && from != -1)) {
-    sigsuspend(&mask);
+  return message_wait_timeout(from, -1);
+}
+
+// Waits a message from PID, as message_wait() does, for at most timeout
+// milliseconds. The deadline holds across interruptions by signals and
+// messages from other processes. A wait that times out is counted and, unless
+// pmanager itself is the silent peer, reported to pmanager with MSG_TIMEOUT.
+//
+// from: the PID of the process from which a message is waited
+// timeout: the maximum time to wait, in milliseconds, or -1 to wait forever
+//
+// Returns: a pointer to the message received. On timeout, NULL is returned and
+// errno is set to ETIMEDOUT; on error in reading the message, NULL is
+// returned.
+message_t * message_wait_timeout(pid_t from, int timeout) {
+  struct pollfd pfd;
+  pfd.fd = inbox_fd;
+  pfd.events = POLLIN;
+  long long deadline = (timeout < 0) ? -1 : time_ns() + timeout * 1000000LL;
+  // Set once the process blocks, which is traced.
+  int blocked = 0;
+  int timed_out = 0;
+  message_t * msg = NULL;
+  while (1) {
+    msg = pending_take(from);
+    if (msg != NULL) {
+      break;
+    }
+    int queued = inbox_fill();
+    if (queued == -1) {
+      break;
+    }
+    // Wait for new data only if nothing was read.
+    if (queued == 0) {
+      int remaining = -1;
+      if (deadline != -1) {
+        long long now = time_ns();
+        if (now >= deadline) {
+          timed_out = 1;
+          break;
+        }
+        // Round up, so that poll() does not return just before the deadline.
+        remaining = (deadline - now + 999999) / 1000000;
+      }
+      if (!blocked) {
+        trace_record(TRACE_WAIT_BEGIN, from, 0, 0);
+        blocked = 1;
+      }
+      if (poll(&pfd, 1, remaining) == -1 && errno != EINTR) {
+        break;
+      }
+    }
+  }
+  if (blocked) {
+    trace_record(TRACE_WAIT_END, from, 0, 0);
+  }
+  if (timed_out) {
+    __atomic_fetch_add(&wait_timeouts, 1, __ATOMIC_RELAXED);
+    // A stalled pmanager would not read the report, and pmanager counts its
+    // own timeouts. The report is dropped if the inbox of pmanager is full.
+    pid_t pmanager = message_pmanager_pid();
+    if (from != pmanager && pmanager != getpid()) {
+      char content[16];
+      snprintf(content, sizeof(content), "%ld", (long) from);
+      send_timeout(pmanager, MSG_TIMEOUT, content, 0);
+    }
+    errno = ETIMEDOUT;
   }
-  return message_read();
+  return msg;
+}
+
+// Returns the timeout used by commands waiting for a reply: the value of
+// TIMEOUT_ENV if it is set, or MSG_TIMEOUT_MS.
+//
+// Returns: the timeout in milliseconds, or -1 to wait forever.
+int message_default_timeout() {
+  // The environment is read once: every message sent needs the timeout.
+  if (default_timeout == -2) {
+    const char * timeout = getenv(TIMEOUT_ENV);
+    int value = MSG_TIMEOUT_MS;
+    if (timeout != NULL && *timeout != '\0') {
+      value = atoi(timeout);
+    }
+    default_timeout = (value < 0) ? -1 : value;
+  }
+  return default_timeout;
+}
+
+// Returns the number of calls to message_wait_timeout() of the calling
+// process that timed out.
+unsigned long long message_timeouts() {
+  return __atomic_load_n(&wait_timeouts, __ATOMIC_RELAXED);
+}
+
+// Returns the PID of pmanager, to which commands send their requests: the
+// value of PMANAGER_ENV if it is set, or the parent of the calling process.
+pid_t message_pmanager_pid() {
+  const char * pmanager = getenv(PMANAGER_ENV);
+  if (pmanager != NULL && *pmanager != '\0') {
+    return atol(pmanager);
+  }
+  return getppid();
+}
+
+// Resolves the name of a process into its PID, asking pmanager with a single
+// MSG_INFO round trip. The reply is formatted by proc_node_tostr() as
+// <pid>;<ppid>;<name>.
+//
+// pmanager: the PID of pmanager
+// name: the name of the process
+//
+// Returns: the PID of the process, or -1 on failure. If pmanager replied that
+// the process does not exist, errno is set to ESRCH; if it did not reply in
+// time, errno is set to ETIMEDOUT.
+pid_t message_lookup_pid(pid_t pmanager, const char * name) {
+  if (message_send(pmanager, MSG_INFO, name) != 0) {
+    return -1;
+  }
+  message_t * response = message_wait_timeout(pmanager, message_default_timeout());
+  if (response == NULL) {
+    return -1;
+  }
+  pid_t pid = -1;
+  if (strcmp(response->type, MSG_INFO) == 0) {
+    pid = atol(response->content);
+  } else {
+    errno = ESRCH;
+  }
+  message_deinit(response);
+  return (pid > 0) ? pid : -1;
+}
+
+// Requests pmanager the list of the processes in the subtree rooted at the
+// process with the given name, calling callback for each process received.
+// Processes are received in pre-order, so parents come before children.
+//
+// pmanager: the PID of pmanager
+// name: the name of the root of the subtree
+// callback: the function called with the string representation of each
+//           process (see proc_node_tostr()) and arg
+// arg: the argument passed to callback
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned. If pmanager
+// replied with an error (e.g. process not found), errno is set to ESRCH; if it
+// did not reply in time, errno is set to ETIMEDOUT.
+int message_list(pid_t pmanager, const char * name,
+                 void (*callback)(const char * proc_str, void * arg), void * arg) {
+  if (message_send(pmanager, MSG_LIST, name) != 0) {
+    return -1;
+  }
+  // Receive entries until pmanager sends MSG_SUCCESS or an error occurs.
+  while (1) {
+    message_t * response = message_wait_timeout(pmanager, message_default_timeout());
+    if (response == NULL) {
+      return -1;
+    }
+    int status = 1;
+    if (strcmp(response->type, MSG_INFO) == 0) {
+      callback(response->content, arg);
+    } else if (strcmp(response->type, MSG_SUCCESS) == 0) {
+      status = 0;
+    } else {
+      errno = ESRCH;
+      status = -1;
+    }
+    message_deinit(response);
+    if (status != 1) {
+      return status;
+    }
+  }
+}
+
+// Opens the inbox of pid for writing. The last inbox opened is cached, since
+// messages are usually exchanged in conversations with the same process.
+//
+// pid: the PID of the owner of the inbox
+//
+// Returns: the file descriptor of the inbox, or -1 on error (for example if
+// pid is not running).
+int open_inbox(pid_t pid) {
+  if (pid == send_pid && send_fd != -1) {
+    return send_fd;
+  }
+  close_send_fd();
+  char path[PATH_MAX];
+  if (inbox_path(pid, path, sizeof(path)) != 0) {
+    return -1;
+  }
+  // Opening a FIFO without readers fails with ENXIO: the owner terminated
+  // without removing its inbox.
+  send_fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (send_fd != -1) {
+    send_pid = pid;
+  }
+  return send_fd;
+}
+
+// Closes the cached inbox opened for writing.
+void close_send_fd() {
+  if (send_fd != -1) {
+    close(send_fd);
+  }
+  send_fd = -1;
+  send_pid = -1;
 }
 
 // Sends a message to process. The message string is encoded as follows:
-// <pid_sender>:<type>:<content>.
-// The string is written to the FIFO associated to fd file descriptor, and the
-// receiver is notified about the new message by sending SIGUSR1.
+// <pid_sender>/<time_sent>:<type>:<content>.
+// The string is written to the inbox of the receiver, which is woken up by the
+// data becoming available. Messages are limited to PIPE_BUF bytes, so that
+// each one is written atomically even with concurrent senders. If the inbox is
+// full, the sender waits for the receiver to read it, for at most the default
+// timeout: a receiver that stopped reading cannot block the sender forever.
 //
 // pid: the pid of the process to which the message is sent
 // type: the type of the message
 // content: the content of the message
 //
-// Returns: on success, 0 is returned; on error, -1 is returned.
+// Returns: on success, 0 is returned; on error, -1 is returned. If the inbox
+// stayed full until the timeout, errno is set to ETIMEDOUT.
 int message_send(pid_t pid, const char * type, const char * content) {
-  // Assume failure.
-  int status = -1;
+  return send_timeout(pid, type, content, message_default_timeout());
+}
+
+// Sends a message as message_send() does, waiting at most timeout milliseconds
+// for room in the inbox of the receiver.
+//
+// pid: the pid of the process to which the message is sent
+// type: the type of the message
+// content: the content of the message
+// timeout: the maximum time to wait, in milliseconds: -1 waits forever, 0
+//          drops the message if the inbox is full
+//
+// Returns: on success, 0 is returned; on error, -1 is returned. If the inbox
+// stayed full until the timeout, errno is set to ETIMEDOUT (EAGAIN if timeout
+// is 0).
+int send_timeout(pid_t pid, const char * type, const char * content, int timeout) {
   // Encode message.
   char * msg_str;
   // If content is NULL, replace content field with a default padding.
   const char * content_ok = (content == NULL) ? "NULL" : content;
   // Return error if asprintf() failed.
-  if (asprintf(&msg_str, "%ld:%s:%s", (long) getpid(), type, content_ok) == -1) {
-    return status;
+  int len = asprintf(&msg_str, "%ld/%lld:%s:%s", (long) getpid(), time_ns(),
+                     type, content_ok);
+  if (len == -1) {
+    return -1;
   }
-  // Write string to FIFO and notify receiver about message by sendining SIGUSR1.
-  if ((write(fd, msg_str, strlen(msg_str) + 1) != -1) &&
-      (kill(pid, SIGUSR1) == 0)) {
-    // Success.
-    status = 0;
+  // Include null character.
+  len++;
+  if (len > PIPE_BUF) {
+    free(msg_str);
+    errno = EMSGSIZE;
+    return -1;
+  }
+  int fd = open_inbox(pid);
+  if (fd == -1) {
+    free(msg_str);
+    return -1;
+  }
+  // Write string to FIFO. If the inbox is full, wait until the receiver reads,
+  // or until the deadline.
+  long long deadline = (timeout < 0) ? -1 : time_ns() + timeout * 1000000LL;
+  ssize_t count;
+  while ((count = write(fd, msg_str, len)) == -1 &&
+         (errno == EAGAIN || errno == EINTR)) {
+    int remaining = -1;
+    if (deadline != -1) {
+      long long now = time_ns();
+      if (now >= deadline) {
+        errno = (timeout == 0) ? EAGAIN : ETIMEDOUT;
+        break;
+      }
+      remaining = (deadline - now + 999999) / 1000000;
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    poll(&pfd, 1, remaining);
   }
   free(msg_str);
-  return status;
+  if (count != len) {
+    // The receiver is probably gone: do not reuse this file descriptor.
+    int error = errno;
+    close_send_fd();
+    errno = error;
+    return -1;
+  }
+  sent_bytes += len;
+  trace_record(TRACE_SEND, pid, type[0], len);
+  return 0;
 }
 
-// Reads a null-terminated string from fifo into a message_t. This function is
-// blocking unless the file descriptor has been opened with the O_NONBLOCK flag.
+// Returns the number of bytes sent by the calling thread with message_send().
+// Differences between two calls measure the bytes sent in between.
+unsigned long long message_bytes_sent() {
+  return sent_bytes;
+}
+
+// Returns the next message received, without blocking.
 //
-// Returns: on success, a pointer to message_t is returned. On error (malformed
-// message string or read() error, NULL is returned. Please check errno for any
-// error set by read() system call.
+// Returns: on success, a pointer to message_t is returned. If no message is
+// available, NULL is returned and errno is set to EAGAIN. Malformed messages
+// are discarded.
 message_t * message_read() {
-
-  int read_count = 0;
-  int msg_size = 100; // Default size for msg_str
-  char * msg_str = malloc(sizeof(char) * msg_size);
-
-  char tmp; // Single character read from FIFO.
-  int str_end = 0; // Flag for end of string.
-
-  // Read one character at a time until null character or EOF/error.
-  while (str_end == 0 && read(fd, &tmp, 1) > 0) {
-    // Realloc memory pointed by msg_str if necessary.
-    if (read_count == msg_size) {
-      msg_size *= 2;
-      msg_str = realloc(msg_str, sizeof(char) * msg_size);
-    }
-    // Copy character to msg_str.
-    msg_str[read_count] = tmp;
-    read_count++;
-    // If it was null character, stop reading.
-    if (tmp == '\0') {
-      str_end = 1;
-    }
+  message_t * msg = pending_take(-1);
+  if (msg == NULL && inbox_fill() > 0) {
+    msg = pending_take(-1);
   }
-
-  // If end of string was not reached, return NULL.
-  if (!str_end) {
-    free(msg_str);
-    return NULL;
+  if (msg == NULL) {
+    errno = EAGAIN;
   }
+  return msg;
+}
 
-  // Parse string.
+// Parses a message string encoded by message_send().
+//
+// msg_str: the null-terminated message string
+//
+// Returns: the message, or NULL if the string is malformed.
+message_t * message_parse(const char * msg_str) {
   message_t * msg = NULL;
   char ** msg_fields;
   // Split message into fields.
   int fields_count = tokenize(msg_str, &msg_fields, ":");
-  // We expect the message to have exactly 3 fields (pid_sender, type, content).
+  // We expect the message to have exactly 3 fields (pid_sender/time_sent,
+  // type, content).
   if (fields_count == 3) {
-    // Return a non-NULL message.
     msg = message_init(atol(msg_fields[0]), msg_fields[1], msg_fields[2]);
+    char * time_str = strchr(msg_fields[0], '/');
+    if (msg != NULL && time_str != NULL) {
+      msg->time_sent = atoll(time_str + 1);
+    }
   }
-
   // Free msg_fields.
   int i;
   for (i = 0; i < fields_count; i++) {
     free(msg_fields[i]);
   }
   free(msg_fields);
-  // Free msg_str.
-  free(msg_str);
-
-  // Set unread_flag to false.
-  reset_unread_flag();
-  // Reset message_sender flag.
-  set_message_sender(-1);
-
   return msg;
 }
@@ -4,6 +4,21 @@
 #include <sys/types.h>
 
 // Message types used in message_t.
+// MSG_ADD registers a process only if its name is not used yet, replying with
+// MSG_SUCCESS or with MSG_ERROR (content MSG_ERROR_EXISTS for duplicates).
+// MSG_ADD_BATCH registers clones of the sender (or of the given parents),
+// whose names are assigned by pmanager. MSG_SPAWN_TREE asks a process to clone
+// its whole subtree.
+// MSG_ZYGOTE is sent by an idle zygote to announce itself to pmanager, and by
+// pmanager to pzygote to report a claimed zygote. MSG_CLAIM asks pmanager to
+// name and register an idle zygote, which receives its name with MSG_NAME.
+// MSG_PRUNE removes a subtree whose processes were killed by a signal.
+// MSG_STATS requests the statistics of pmanager, sent as one MSG_INFO per
+// message type and a final MSG_SUCCESS; with content MSG_STATS_RESET, they are
+// reset after the reply.
+// MSG_TIMING reports the phases of a command to pmanager (see timing.h).
+// MSG_TIMEOUT reports to pmanager that a wait for a reply from the process in
+// its content timed out; pmanager counts it and does not reply.
 #define MSG_ADD "a"
 #define MSG_REMOVE "r"
 #define MSG_INFO "i"
@@ -11,6 +26,41 @@
 #define MSG_SUCCESS "s"
 #define MSG_LIST "l"
 #define MSG_SPAWN "p"
+#define MSG_ADD_BATCH "b"
+#define MSG_SPAWN_TREE "t"
+#define MSG_ZYGOTE "z"
+#define MSG_CLAIM "c"
+#define MSG_NAME "n"
+#define MSG_PRUNE "x"
+#define MSG_STATS "m"
+#define MSG_TIMING "k"
+#define MSG_TIMEOUT "o"
+
+// Content of MSG_STATS asking pmanager to reset its statistics.
+#define MSG_STATS_RESET "reset"
+
+// Maximum number of processes registered by a single MSG_ADD_BATCH. The
+// content is a list of entries <pid> or <pid>/<ppid> separated by ',', and the
+// reply lists the numbers of the names assigned, so both fit in an atomic
+// message.
+#define MSG_BATCH_MAX 200
+
+// Content of MSG_ERROR replied to MSG_ADD when the name is already used.
+#define MSG_ERROR_EXISTS "process already exists"
+// Content of MSG_ERROR replied to MSG_CLAIM when no zygote is idle.
+#define MSG_ERROR_NO_ZYGOTE "no idle zygote"
+
+// Environment variable holding the PID of pmanager, set by pmanager for the
+// commands it runs and by pload for commands that are not its children.
+// Without it, pmanager is the parent of the calling process.
+#define PMANAGER_ENV "CUSTOMSHELL_PMANAGER"
+
+// Default time waited for a reply by commands, and for room in a full inbox by
+// any sender, in milliseconds. A peer that dies or stops reading in the middle
+// of a conversation would otherwise block the other forever.
+#define MSG_TIMEOUT_MS 10000
+// Environment variable overriding MSG_TIMEOUT_MS (-1 waits forever).
+#define TIMEOUT_ENV "CUSTOMSHELL_TIMEOUT"
 
 // Represents a message exchanged between processes.
 typedef struct message_t {
@@ -20,17 +70,29 @@ typedef struct message_t {
   char * type;
   // The content of this message.
   char * content;
+  // The time at which the message was sent (see time_ns()).
+  long long time_sent;
 } message_t;
 
-// Sets file descriptor of the FIFO used for exchanging messages, and registers
-// handler for SIGUSR1.
-int message_setup(int fd);
+// Creates and opens the FIFO used as inbox by the calling process. Must be
+// called again by a forked child before exchanging messages.
+int message_setup();
+// Closes and removes the inbox of the calling process.
+void message_teardown();
+// Removes the inbox of a process that terminated without removing it.
+void message_discard(pid_t pid);
+// Returns the file descriptor of the inbox, which becomes readable when a new
+// message is received.
+int message_fd();
 // Frees memory allocated for a message_t struct.
 void message_deinit(message_t *msg);
 // Send a message to pid. The message string is encoded as:
-// <pid_sender>:<type>:<content>.
+// <pid_sender>/<time_sent>:<type>:<content>. If the inbox of pid stays full
+// for the default timeout, -1 is returned with errno set to ETIMEDOUT.
 int message_send(pid_t pid, const char * type, const char * content);
-// Reads a message from FIFO.
+// Returns the number of bytes sent by the calling thread.
+unsigned long long message_bytes_sent();
+// Returns the next message received, without blocking.
 message_t * message_read();
 // Returns true if a message was received; otherwise, it returns false.
 int message_unread();
@@ -38,5 +100,20 @@ int message_unread();
 // any pid is waited. If a message was already received, the function returns
 // immediatly.
 message_t * message_wait(pid_t from);
+// Same as message_wait(), but gives up after timeout milliseconds (-1 waits
+// forever), returning NULL with errno set to ETIMEDOUT.
+message_t * message_wait_timeout(pid_t from, int timeout);
+// Returns the timeout used by commands waiting for a reply, in milliseconds.
+int message_default_timeout();
+// Returns the number of waits of the calling process that timed out.
+unsigned long long message_timeouts();
+// Returns the PID of pmanager, to which commands send their requests.
+pid_t message_pmanager_pid();
+// Resolves the name of a process into its PID, asking pmanager.
+pid_t message_lookup_pid(pid_t pmanager, const char * name);
+// Requests pmanager the processes in the subtree rooted at name, calling
+// callback for each of them.
+int message_list(pid_t pmanager, const char * name,
+                 void (*callback)(const char * proc_str, void * arg), void * arg);
 
 #endif
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include "metrics.h"
+#include "stats.h"
+#include "message.h"
+
+// Represents the number of executions of a command name.
+typedef struct command_count {
+  char name[32];
+  unsigned long long count;
+} command_count;
+
+// Path of the metrics file, and of the temporary file renamed to it.
+char * metrics_path = NULL;
+char * metrics_tmp_path = NULL;
+// Interval between two writes, in seconds.
+int metrics_interval = METRICS_INTERVAL;
+// Thread writing the metrics, and the condition used to stop it.
+pthread_t metrics_thread;
+pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t metrics_cond = PTHREAD_COND_INITIALIZER;
+int metrics_running = 0;
+int metrics_stopping = 0;
+// Counters updated by the main thread and read by the metrics thread, without
+// locks so that they can be updated from any context (e.g. during exit).
+// Number of nodes in the tree at each depth.
+unsigned long long depth_counts[METRICS_DEPTHS];
+// Executions of each command name. Names are written before commands_count is
+// increased, and never change.
+command_count commands[METRICS_COMMANDS];
+int commands_count = 0;
+unsigned long long commands_other = 0;
+// Processes that could not be started.
+unsigned long long failed_forks = 0;
+// Waits for a reply that timed out, as reported by commands with MSG_TIMEOUT.
+unsigned long long reported_timeouts = 0;
+
+// Private functions.
+// Main function of the thread.
+void * metrics_worker(void * arg);
+// Writes the metrics to the temporary file, then renames it.
+int metrics_write();
+// Writes the metrics about the tree.
+void write_tree_metrics(FILE * output);
+// Writes the metrics about commands.
+void write_command_metrics(FILE * output);
+// Returns the number of children of pmanager in zombie state.
+int count_zombies();
+// Counts a node added to the tree.
+void metrics_node_added(const proc_node * node);
+// Counts a node removed from the tree.
+void metrics_node_removed(const proc_node * node);
+
+// Starts a thread writing the metrics to path every interval seconds. The
+// nodes of the tree are counted from now on, as they are added and removed.
+// Signals are blocked in the thread, so that they are always delivered to the
+// main thread.
+//
+// path: the path of the metrics file
+// interval: the interval between two writes, in seconds
+// root: the root of the process tree, the only node it contains
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int metrics_start(const char * path, int interval, const proc_node * root) {
+  metrics_path = strdup(path);
+  if (metrics_path == NULL || asprintf(&metrics_tmp_path, "%s.tmp", path) == -1) {
+    free(metrics_path);
+    metrics_path = NULL;
+    metrics_tmp_path = NULL;
+    return -1;
+  }
+  metrics_interval = interval;
+  metrics_node_added(root);
+  proc_tree_observe(metrics_node_added, metrics_node_removed);
+  // The file is written once before returning, so that errors are reported.
+  if (metrics_write() != 0) {
+    return -1;
+  }
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  metrics_running = pthread_create(&metrics_thread, NULL, metrics_worker, NULL) == 0;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return metrics_running ? 0 : -1;
+}
+
+// Stops the thread, then writes the metrics a last time. Called on exit.
+void metrics_stop() {
+  if (metrics_running) {
+    pthread_mutex_lock(&metrics_mutex);
+    metrics_stopping = 1;
+    pthread_cond_signal(&metrics_cond);
+    pthread_mutex_unlock(&metrics_mutex);
+    pthread_join(metrics_thread, NULL);
+    metrics_running = 0;
+  }
+  if (metrics_path != NULL) {
+    metrics_write();
+  }
+  proc_tree_observe(NULL, NULL);
+  free(metrics_path);
+  free(metrics_tmp_path);
+  metrics_path = NULL;
+  metrics_tmp_path = NULL;
+}
+
+// Main function of the thread: writes the metrics every metrics_interval
+// seconds, until metrics_stop() is called.
+void * metrics_worker(void * arg) {
+  pthread_mutex_lock(&metrics_mutex);
+  while (!metrics_stopping) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += metrics_interval;
+    while (!metrics_stopping &&
+           pthread_cond_timedwait(&metrics_cond, &metrics_mutex, &deadline) == 0) {
+    }
+    if (!metrics_stopping) {
+      pthread_mutex_unlock(&metrics_mutex);
+      if (metrics_write() != 0) {
+        fprintf(stderr, "Error: failed to write metrics to \"%s\".\n", metrics_path);
+      }
+      pthread_mutex_lock(&metrics_mutex);
+    }
+  }
+  pthread_mutex_unlock(&metrics_mutex);
+  return NULL;
+}
+
+// Writes the metrics to a temporary file in the same directory as the metrics
+// file, then renames it, which atomically replaces the previous file.
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int metrics_write() {
+  FILE * output = fopen(metrics_tmp_path, "w");
+  if (output == NULL) {
+    return -1;
+  }
+  write_tree_metrics(output);
+  write_command_metrics(output);
+  stats_write_metrics(output);
+  int error = ferror(output);
+  if (fclose(output) != 0 || error || rename(metrics_tmp_path, metrics_path) != 0) {
+    unlink(metrics_tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+// Writes the number of nodes of the tree, in total and at each depth, and the
+// depth of the tree (0 if it only contains pmanager).
+//
+// output: the stream where metrics are written
+void write_tree_metrics(FILE * output) {
+  unsigned long long nodes = 0;
+  int depth = 0;
+  int i;
+  fprintf(output, "# HELP pmanager_tree_depth_nodes Processes in the tree by depth.\n");
+  fprintf(output, "# TYPE pmanager_tree_depth_nodes gauge\n");
+  for (i = 0; i < METRICS_DEPTHS; i++) {
+    unsigned long long count = __atomic_load_n(&depth_counts[i], __ATOMIC_RELAXED);
+    if (count > 0) {
+      fprintf(output, "pmanager_tree_depth_nodes{depth=\"%d\"} %llu\n", i, count);
+      nodes += count;
+      depth = i;
+    }
+  }
+  fprintf(output, "# HELP pmanager_tree_nodes Processes in the tree, including pmanager.\n");
+  fprintf(output, "# TYPE pmanager_tree_nodes gauge\n");
+  fprintf(output, "pmanager_tree_nodes %llu\n", nodes);
+  fprintf(output, "# HELP pmanager_tree_depth Depth of the tree.\n");
+  fprintf(output, "# TYPE pmanager_tree_depth gauge\n");
+  fprintf(output, "pmanager_tree_depth %d\n", depth);
+  fprintf(output, "# HELP pmanager_zombies Children of pmanager not reaped yet.\n");
+  fprintf(output, "# TYPE pmanager_zombies gauge\n");
+  fprintf(output, "pmanager_zombies %d\n", count_zombies());
+}
+
+// Writes the number of executions of each command name, the number of
+// processes that could not be started, and the number of waits for a reply
+// that timed out.
+//
+// output: the stream where metrics are written
+void write_command_metrics(FILE * output) {
+  fprintf(output, "# HELP pmanager_commands_total Commands executed by name.\n");
+  fprintf(output, "# TYPE pmanager_commands_total counter\n");
+  int count = __atomic_load_n(&commands_count, __ATOMIC_ACQUIRE);
+  int i;
+  for (i = 0; i < count; i++) {
+    fprintf(output, "pmanager_commands_total{command=\"%s\"} %llu\n", commands[i].name,
+            __atomic_load_n(&commands[i].count, __ATOMIC_RELAXED));
+  }
+  fprintf(output, "pmanager_commands_total{command=\"other\"} %llu\n",
+          __atomic_load_n(&commands_other, __ATOMIC_RELAXED));
+  fprintf(output, "# HELP pmanager_failed_forks_total Processes that could not be started.\n");
+  fprintf(output, "# TYPE pmanager_failed_forks_total counter\n");
+  fprintf(output, "pmanager_failed_forks_total %llu\n",
+          __atomic_load_n(&failed_forks, __ATOMIC_RELAXED));
+  fprintf(output, "# HELP pmanager_message_timeouts_total Waits for a reply that timed out, "
+          "in pmanager and in the processes it manages.\n");
+  fprintf(output, "# TYPE pmanager_message_timeouts_total counter\n");
+  fprintf(output, "pmanager_message_timeouts_total %llu\n",
+          __atomic_load_n(&reported_timeouts, __ATOMIC_RELAXED) + message_timeouts());
+}
+
+// Returns the number of children of pmanager (commands and pzygote) that
+// terminated but were not reaped yet, read from /proc. Only the direct
+// children are listed, so the cost does not depend on the size of the tree.
+//
+// Returns: the number of zombies, or 0 if /proc is not available.
+int count_zombies() {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%ld/task/%ld/children", (long) getpid(),
+           (long) getpid());
+  FILE * children = fopen(path, "r");
+  if (children == NULL) {
+    return 0;
+  }
+  int zombies = 0;
+  long pid;
+  while (fscanf(children, "%ld", &pid) == 1) {
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    FILE * stat = fopen(path, "r");
+    char state;
+    // The state follows the name, which is enclosed in parentheses.
+    if (stat != NULL && fscanf(stat, "%*d (%*[^)]) %c", &state) == 1 && state == 'Z') {
+      zombies++;
+    }
+    if (stat != NULL) {
+      fclose(stat);
+    }
+  }
+  fclose(children);
+  return zombies;
+}
+
+// Counts a command executed by pmanager, whether it is an executable, a plugin
+// or a builtin. Unknown commands are not counted.
+//
+// name: the name of the command
+void metrics_command(const char * name) {
+  int count = commands_count;
+  int i;
+  for (i = 0; i < count; i++) {
+    if (strcmp(commands[i].name, name) == 0) {
+      __atomic_fetch_add(&commands[i].count, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  // Names that would need escaping in labels are not counted separately.
+  if (count == METRICS_COMMANDS || strlen(name) >= sizeof(commands[count].name) ||
+      strpbrk(name, "\"\\\n") != NULL) {
+    __atomic_fetch_add(&commands_other, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  strcpy(commands[count].name, name);
+  commands[count].count = 1;
+  __atomic_store_n(&commands_count, count + 1, __ATOMIC_RELEASE);
+}
+
+// Counts a process that could not be started by pmanager.
+void metrics_failed_fork() {
+  __atomic_fetch_add(&failed_forks, 1, __ATOMIC_RELAXED);
+}
+
+// Counts a wait for a reply that timed out in another process, reported with
+// MSG_TIMEOUT.
+void metrics_message_timeout() {
+  __atomic_fetch_add(&reported_timeouts, 1, __ATOMIC_RELAXED);
+}
+
+// Counts a node added to the tree at its depth.
+//
+// node: the node added
+void metrics_node_added(const proc_node * node) {
+  int depth = (node->depth < METRICS_DEPTHS) ? node->depth : METRICS_DEPTHS - 1;
+  __atomic_fetch_add(&depth_counts[depth], 1, __ATOMIC_RELAXED);
+}
+
+// Counts a node removed from the tree at its depth.
+//
+// node: the node removed
+void metrics_node_removed(const proc_node * node) {
+  int depth = (node->depth < METRICS_DEPTHS) ? node->depth : METRICS_DEPTHS - 1;
+  __atomic_fetch_sub(&depth_counts[depth], 1, __ATOMIC_RELAXED);
+}
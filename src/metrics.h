@@ -0,0 +1,32 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "proc_tree.h"
+
+// Metrics exported by pmanager --metrics FILE, in the text format of
+// Prometheus (e.g. for the textfile collector of node_exporter). A thread
+// writes them every interval seconds to a temporary file, renamed to FILE so
+// that readers never see a partial file. Numbers come from counters updated
+// as the tree changes and as commands are executed, never from walks of the
+// tree, so the main thread is not delayed.
+
+// Maximum depth counted separately. Deeper nodes are counted at this depth.
+#define METRICS_DEPTHS 4096
+// Maximum number of command names counted separately. Further names are
+// counted as "other".
+#define METRICS_COMMANDS 64
+// Default interval between two writes, in seconds.
+#define METRICS_INTERVAL 10
+
+// Starts writing the metrics of the tree rooted at root to path.
+int metrics_start(const char * path, int interval, const proc_node * root);
+// Writes the metrics a last time and stops the thread.
+void metrics_stop();
+// Counts a command executed by pmanager.
+void metrics_command(const char * name);
+// Counts a process that could not be started.
+void metrics_failed_fork();
+// Counts a wait that timed out in another process.
+void metrics_message_timeout();
+
+#endif
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "parser.h"
+
+// Initial size of the read buffer, used for input that cannot be mapped.
+#define PARSER_BLOCK_SIZE 65536
+
+// Private functions.
+// Returns the next line of input, terminated by a null byte.
+char * parser_line(parser_t * parser);
+// Reads more input into the read buffer.
+int parser_fill(parser_t * parser);
+
+// Creates a parser reading from file descriptor fd, starting from its current
+// offset. If fd refers to a regular file, the rest of the file is mapped
+// privately in memory, so that lines can be terminated in place without
+// modifying the file.
+//
+// fd: the file descriptor of the input
+//
+// Returns: the new parser, or NULL on failure.
+parser_t * parser_init(int fd) {
+  parser_t * parser = calloc(1, sizeof(parser_t));
+  if (parser == NULL) {
+    return NULL;
+  }
+  parser->fd = fd;
+
+  struct stat st;
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && offset != -1 &&
+      st.st_size > offset) {
+    char * data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      parser->data = data;
+      parser->size = st.st_size;
+      parser->pos = offset;
+      parser->mapped = 1;
+      parser->eof = 1;
+    }
+  }
+
+  // Fall back to reading in blocks.
+  if (!parser->mapped) {
+    parser->capacity = PARSER_BLOCK_SIZE;
+    parser->data = malloc(sizeof(char) * parser->capacity);
+  }
+
+  parser->argv_size = 8;
+  parser->argv = malloc(sizeof(char *) * parser->argv_size);
+
+  if (parser->data == NULL || parser->argv == NULL) {
+    parser_deinit(parser);
+    return NULL;
+  }
+  return parser;
+}
+
+// Frees a parser. The file descriptor is not closed.
+//
+// parser: the parser to free
+void parser_deinit(parser_t * parser) {
+  if (parser == NULL) {
+    return;
+  }
+  if (parser->mapped) {
+    munmap(parser->data, parser->size);
+  } else {
+    free(parser->data);
+  }
+  free(parser->tail);
+  free(parser->argv);
+  free(parser);
+}
+
+// Reads more input at the end of the read buffer. Data already parsed is
+// discarded first, and the buffer grows if it is full. One byte is always
+// left free, so that a last line without newline can be terminated.
+//
+// parser: the parser
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int parser_fill(parser_t * parser) {
+  if (parser->pos > 0) {
+    memmove(parser->data, parser->data + parser->pos, parser->size - parser->pos);
+    parser->size -= parser->pos;
+    parser->pos = 0;
+  }
+  if (parser->size + 1 >= parser->capacity) {
+    char * tmp = realloc(parser->data, sizeof(char) * parser->capacity * 2);
+    if (tmp == NULL) {
+      return -1;
+    }
+    parser->data = tmp;
+    parser->capacity *= 2;
+  }
+  ssize_t count;
+  do {
+    count = read(parser->fd, parser->data + parser->size,
+                 parser->capacity - parser->size - 1);
+  } while (count == -1 && errno == EINTR);
+  if (count == -1) {
+    return -1;
+  }
+  if (count == 0) {
+    parser->eof = 1;
+  }
+  parser->size += count;
+  return 0;
+}
+
+// Returns the next line of input, terminated by a null byte instead of the
+// newline. Reads more input only if no whole line is buffered.
+//
+// parser: the parser
+//
+// Returns: the line, or NULL at the end of input or on failure (errno is set
+// to 0 at the end of input).
+char * parser_line(parser_t * parser) {
+  while (1) {
+    char * start = parser->data + parser->pos;
+    char * newline = memchr(start, '\n', parser->size - parser->pos);
+    if (newline != NULL) {
+      *newline = '\0';
+      parser->pos = newline - parser->data + 1;
+      return start;
+    }
+    if (parser->eof) {
+      if (parser->pos == parser->size) {
+        errno = 0;
+        return NULL;
+      }
+      // Last line without newline. A mapping may end exactly at a page
+      // boundary, so the line is copied instead of terminated in place.
+      size_t len = parser->size - parser->pos;
+      parser->pos = parser->size;
+      if (parser->mapped) {
+        free(parser->tail);
+        parser->tail = strndup(start, len);
+        return parser->tail;
+      }
+      start[len] = '\0';
+      return start;
+    }
+    if (parser_fill(parser) != 0) {
+      return NULL;
+    }
+  }
+}
+
+// Parses the next line of input, splitting it into arguments separated by
+// spaces. Arguments point into the input data and the argv array is reused,
+// so they are valid only until the next call.
+//
+// parser: the parser
+// argv: where a pointer to the arguments is stored. The array is terminated
+//       by a NULL pointer.
+//
+// Returns: the number of arguments (0 for a blank line), -1 at the end of
+// input, or -2 on failure.
+int parser_next(parser_t * parser, char *** argv) {
+  char * line = parser_line(parser);
+  if (line == NULL) {
+    return (errno == 0) ? -1 : -2;
+  }
+  int argc = 0;
+  char * c = line;
+  while (1) {
+    while (*c == ' ') {
+      c++;
+    }
+    if (*c == '\0') {
+      break;
+    }
+    // Keep room for the terminating NULL pointer.
+    if (argc + 1 == parser->argv_size) {
+      char ** tmp = realloc(parser->argv, sizeof(char *) * parser->argv_size * 2);
+      if (tmp == NULL) {
+        return -2;
+      }
+      parser->argv = tmp;
+      parser->argv_size *= 2;
+    }
+    parser->argv[argc++] = c;
+    while (*c != ' ' && *c != '\0') {
+      c++;
+    }
+    if (*c == '\0') {
+      break;
+    }
+    *c++ = '\0';
+  }
+  parser->argv[argc] = NULL;
+  *argv = parser->argv;
+  return argc;
+}
+
+// Returns true if parser_next() can return without reading the input, i.e. a
+// whole line is buffered or the end of input was reached. When false, the
+// caller can wait for the file descriptor to become readable.
+//
+// parser: the parser
+int parser_buffered(const parser_t * parser) {
+  return parser->eof ||
+         memchr(parser->data + parser->pos, '\n', parser->size - parser->pos) != NULL;
+}
+
+// Removes the trailing "&" requesting background execution from the arguments
+// of a line. It can be a separate token, which is removed, or the last
+// character of the last token.
+//
+// argv: the arguments, as returned by parser_next()
+// argc: the number of arguments, decremented if a token is removed
+//
+// Returns: true if the line ended with "&".
+int parser_background(char ** argv, int * argc) {
+  if (*argc == 0) {
+    return 0;
+  }
+  char * last = argv[*argc - 1];
+  size_t last_len = strlen(last);
+  if (last[last_len - 1] != '&') {
+    return 0;
+  }
+  last[last_len - 1] = '\0';
+  if (last_len == 1) {
+    argv[--(*argc)] = NULL;
+  }
+  return 1;
+}
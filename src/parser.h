@@ -0,0 +1,45 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+
+// Reads commands from a file descriptor, one per line, and splits them into
+// arguments without copying. Regular files are mapped in memory; other files
+// (e.g. terminals and pipes) are read in large blocks.
+typedef struct parser_t {
+  // File descriptor of the input.
+  int fd;
+  // Input data: the mapped file or the read buffer.
+  char * data;
+  // Number of valid bytes in data.
+  size_t size;
+  // Size of the read buffer (unused if mapped).
+  size_t capacity;
+  // Offset of the first byte not parsed yet.
+  size_t pos;
+  // True if data is a memory mapping of the whole file.
+  int mapped;
+  // True if the end of the input was reached.
+  int eof;
+  // Copy of a last line not terminated by a newline, when it cannot be
+  // terminated in place.
+  char * tail;
+  // Arguments of the current line, terminated by a NULL pointer. Reused for
+  // each line.
+  char ** argv;
+  // Size of argv.
+  int argv_size;
+} parser_t;
+
+// Creates a parser reading from file descriptor fd.
+parser_t * parser_init(int fd);
+// Frees a parser. The file descriptor is not closed.
+void parser_deinit(parser_t * parser);
+// Parses the next line, returning its number of arguments.
+int parser_next(parser_t * parser, char *** argv);
+// Returns true if a whole line can be parsed without reading the input.
+int parser_buffered(const parser_t * parser);
+// Removes a trailing "&" from the arguments of a line, returning true if found.
+int parser_background(char ** argv, int * argc);
+
+#endif
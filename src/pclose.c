@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -6,12 +8,11 @@
 #include <getopt.h>
 #include "common.h"
 #include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
+#include "trace.h"
 
-// Global variables accessed by cleanup().
-// Output stream of pinfo.
-FILE * pinfo_output = NULL;
-// File descriptor of FIFO.
-int fifo_fd = -1;
+// Global variables.
 // Flag for --help
 int help_flag = 0;
 
@@ -32,6 +33,9 @@ void cleanup();
 
 void main(int argc, char ** argv) {
 
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
   // Check argv options.
   char * proc_name = parse_args(argc, argv);
 
@@ -44,63 +48,59 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
-  }
-
   // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
+  if (message_setup() != 0) {
     fprintf(stderr, "Error: failed to setup process communication.\n");
     exit(EXIT_FAILURE);
   }
-
-  // Execute pinfo to obtain pid of the process to close.
-  // stderr is redirected to /dev/null to ensure that the only output pinfo
-  // can print is the pid of the requested process.
-
-  // Create string of command to execute.
-  char * cmd;
-  if (asprintf(&cmd, "pinfo --pid-pmanager %ld --pid-only %s 2>/dev/null",
-      (long) getppid(), proc_name) == -1) {
-    fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n", proc_name);
-    exit(EXIT_FAILURE);
+  timing_mark("setup");
+
+  // Read the pid of the process to close from the tree published by pmanager
+  // (the parent process), or ask pmanager if it is not available or lacks the
+  // process: it is published after the replies to the messages handled, so a
+  // process just created may be missing.
+  pid_t pid = shm_tree_lookup_pid(message_pmanager_pid(), proc_name);
+  if (pid == -1) {
+    pid = message_lookup_pid(message_pmanager_pid(), proc_name);
   }
-
-  // Execute pinfo and read its output.
-  pinfo_output = popen(cmd, "r");
-  free(cmd);
-  if (pinfo_output == NULL) {
-    fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n", proc_name);
-    exit(EXIT_FAILURE);
-  }
-  // Read a single line from output.
-  char * pid_str;
-  size_t n = 0;
-  ssize_t count = getline(&pid_str, &n, pinfo_output);
-  // If there is no output, it means that pinfo did not found the requested
-  // process, because stderr is redirected to /dev/null.
-  if (count == -1) {
-    fprintf(stderr, "Error: process not found.\n");
+  timing_mark("lookup");
+  if (pid == -1) {
+    if (errno == ESRCH) {
+      fprintf(stderr, "Error: process not found.\n");
+    } else if (errno == ETIMEDOUT) {
+      fprintf(stderr, "Error: pmanager did not reply in time.\n");
+    } else {
+      fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n",
+              proc_name);
+    }
     exit(EXIT_FAILURE);
   }
 
   // Send SIGTERM to process.
   int success = 0;
-  // Convert string to pid_t.
-  pid_t pid = atol(pid_str);
-  free(pid_str);
   printf("Sending SIGTERM to %ld...\n", (long) pid);
+  trace_record(TRACE_SIGNAL_SEND, pid, 0, SIGTERM);
   if (kill(pid, SIGTERM) == 0) {
+    // A process stopped by pstop handles SIGTERM only once resumed.
+    kill(pid, SIGCONT);
     success = 1;
   } else {
     fprintf(stderr, "Error: failed to send SIGTERM.\n");
   }
+  timing_mark("signal");
 
   // By default, the process' SIGTERM handler will reply with a MSG_SUCCESS.
-  message_t * response =  message_wait(pid);
-  message_deinit(response);
+  // No reply comes if the signal was not sent, or if the process died before
+  // handling it.
+  if (success) {
+    message_t * response = message_wait_timeout(pid, message_default_timeout());
+    if (response == NULL) {
+      fprintf(stderr, "Error: process %ld did not reply in time.\n", (long) pid);
+      success = 0;
+    }
+    message_deinit(response);
+  }
+  timing_mark("reply");
 
   exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
 
@@ -143,12 +143,6 @@ void print_help() {
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
-  // Close pinfo output stream.
-  if (pinfo_output != NULL) {
-    pclose(pinfo_output);
-  }
+  // Close and remove inbox.
+  message_teardown();
 }
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include "plugin.h"
+
+// Example plugin: prints the number of processes contained in a subtree. It is
+// loaded by pmanager from PLUGIN_PATH and runs without fork/exec.
+
+// ABI version implemented by this plugin.
+const int plugin_abi_version = PLUGIN_ABI_VERSION;
+
+// Utility functions.
+// Prints help about this command.
+void print_help();
+
+// Entry point called by pmanager.
+//
+// api: the interface provided by pmanager
+// argc: the number of arguments
+// argv: the array of strings containing arguments
+//
+// Returns: 0 on success, 1 on failure.
+int plugin_main(const plugin_api * api, int argc, char ** argv) {
+  if (argc > 2) {
+    print_help();
+    return 1;
+  }
+  // Count all processes started by the shell by default.
+  const char * name = (argc == 2) ? argv[1] : "pmanager";
+  if (name[0] == '-') {
+    print_help();
+    return 1;
+  }
+  int count;
+  proc_node ** procs = api->list(api->tree, name, &count);
+  if (procs == NULL) {
+    fprintf(stderr, "Error: process not found.\n");
+    return 1;
+  }
+  api->free_nodes(procs, count);
+  // pmanager itself is not a process started by the shell.
+  if (argc == 1) {
+    count--;
+  }
+  printf("%d\n", count);
+  return 0;
+}
+
+// Prints help about this command. Called on any option.
+void print_help() {
+  printf("Usage:\n");
+  printf(" pcount [NAME]\n");
+  printf(" Count processes started by the shell, or only the children of <NAME>,\n");
+  printf(" including <NAME> itself.\n");
+}
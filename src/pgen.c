@@ -0,0 +1,478 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "common.h"
+
+// Generates a file of random commands for pmanager (test mode), and the tree
+// that pmanager is expected to hold once all of them are executed. The
+// generator is seeded, so runs are reproducible, and it simulates the effect
+// of each command on the tree as pmanager applies it:
+// - pnew NAME adds a child of pmanager (names are never reused)
+// - pspawn [-c N] NAME adds N children of NAME, named <NAME>_<i> with i
+//   incremented on each clone of NAME (see proc_node_add_clone())
+// - pclose NAME removes NAME if it is a leaf, and does nothing otherwise
+// - prmall NAME removes NAME and its whole subtree
+// - pinfo, plist, ptree and phelp do not change the tree
+// Since pnew names are never reused and the clone counter of a process never
+// decreases, clone names never collide, so each clone gets the first number
+// tried by pmanager.
+// The number of live processes is kept around a target: processes are only
+// created below it. The shape controls which process is cloned by pspawn.
+//
+// Usage: pgen [OPTIONS] <FILE>
+// The expected tree (-e) has a line per process, "<name> <parent name>",
+// sorted by name, as written by pmanager --dump-tree.
+
+// Commands generated.
+#define CMD_PNEW 0
+#define CMD_PSPAWN 1
+#define CMD_PCLOSE 2
+#define CMD_PRMALL 3
+#define CMD_PINFO 4
+#define CMD_PLIST 5
+#define CMD_PTREE 6
+#define CMD_PHELP 7
+#define CMD_COUNT 8
+// Default weights of the commands, in the order above.
+#define DEFAULT_WEIGHTS "pnew=4,pspawn=2,pclose=3,prmall=1,pinfo=2,plist=1,ptree=1,phelp=0"
+// Default number of commands.
+#define DEFAULT_COUNT 1000
+// Default target of live processes.
+#define DEFAULT_LIVE 100
+// Shapes: which process is cloned by pspawn.
+// SHAPE_RANDOM: any process
+// SHAPE_WIDE: a process created by pnew, so that the tree stays shallow
+// SHAPE_DEEP: the newest process, so that the tree grows in depth
+#define SHAPE_RANDOM 0
+#define SHAPE_WIDE 1
+#define SHAPE_DEEP 2
+
+// Represents a live process of the expected tree.
+typedef struct gen_node {
+  char * name;
+  struct gen_node * parent;
+  struct gen_node ** children;
+  int children_count;
+  int children_size;
+  // Number of clone names assigned to children (see proc_node).
+  int clones_count;
+  // Position in live.
+  int index;
+} gen_node;
+
+// Names of the commands, in the order of CMD_* macros.
+const char * const command_names[CMD_COUNT] = {
+  "pnew", "pspawn", "pclose", "prmall", "pinfo", "plist", "ptree", "phelp"
+};
+
+// Global variables.
+// State of the random number generator (xorshift64), set by -s.
+unsigned long long rng_state = 1;
+// Root of the expected tree, i.e. pmanager.
+gen_node * root = NULL;
+// Live processes (root excluded), in no particular order.
+gen_node ** live = NULL;
+int live_count = 0;
+int live_size = 0;
+// Newest live process, cloned with SHAPE_DEEP.
+gen_node * newest = NULL;
+// Number of processes created by pnew, used for their names.
+long pnew_count = 0;
+
+// Option arguments.
+const char * short_options = "s:n:w:l:S:c:e:h";
+const struct option long_options[] = {
+  {"seed", required_argument, NULL, 's'},
+  {"count", required_argument, NULL, 'n'},
+  {"weights", required_argument, NULL, 'w'},
+  {"live", required_argument, NULL, 'l'},
+  {"shape", required_argument, NULL, 'S'},
+  {"clones", required_argument, NULL, 'c'},
+  {"expected", required_argument, NULL, 'e'},
+  {"help", no_argument, NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+// Utility functions.
+// Parses weights formatted as <command>=<weight>,...
+int parse_weights(const char * weights_str, int * weights);
+// Picks a command according to weights and to the state of the tree.
+int pick_command(const int * weights, int target);
+// Picks the process cloned by pspawn.
+gen_node * pick_parent(int shape);
+// Adds a process to the expected tree.
+gen_node * add_node(gen_node * parent, char * name);
+// Removes a process and its subtree from the expected tree.
+void remove_subtree(gen_node * node);
+// Writes the expected tree.
+int write_expected(const char * path);
+// Adds the names of the processes in the subtree of node to lines.
+void collect_lines(const gen_node * node, char ** lines, int * count);
+// Comparison function for qsort(), sorting strings.
+int compare_str(const void * a, const void * b);
+// Returns a random number between 0 and bound - 1.
+unsigned long long random_below(unsigned long long bound);
+// Prints help about this command.
+void print_help();
+
+void main(int argc, char ** argv) {
+
+  long count = DEFAULT_COUNT;
+  int target = DEFAULT_LIVE;
+  int shape = SHAPE_RANDOM;
+  int max_clones = 1;
+  const char * expected_path = NULL;
+  int weights[CMD_COUNT];
+  parse_weights(DEFAULT_WEIGHTS, weights);
+  int option;
+  while ((option = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (option) {
+      case 's':
+        rng_state = strtoull(optarg, NULL, 10);
+        break;
+      case 'n':
+        count = atol(optarg);
+        break;
+      case 'w':
+        if (parse_weights(optarg, weights) != 0) {
+          fprintf(stderr, "Error: invalid weights \"%s\".\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'l':
+        target = atoi(optarg);
+        break;
+      case 'S':
+        if (strcmp(optarg, "random") == 0) {
+          shape = SHAPE_RANDOM;
+        } else if (strcmp(optarg, "wide") == 0) {
+          shape = SHAPE_WIDE;
+        } else if (strcmp(optarg, "deep") == 0) {
+          shape = SHAPE_DEEP;
+        } else {
+          fprintf(stderr, "Error: invalid shape \"%s\".\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'c':
+        max_clones = atoi(optarg);
+        break;
+      case 'e':
+        expected_path = optarg;
+        break;
+      default:
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc - 1 || count < 0 || target <= 0 || max_clones <= 0) {
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+  // xorshift never leaves 0.
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+
+  FILE * output = fopen(argv[optind], "w");
+  if (output == NULL) {
+    fprintf(stderr, "Error: cannot open \"%s\" for writing.\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+  root = add_node(NULL, strdup("pmanager"));
+
+  long i;
+  for (i = 0; i < count; i++) {
+    int cmd = pick_command(weights, target);
+    if (cmd == -1) {
+      fprintf(stderr, "Error: no command can be generated with these weights.\n");
+      exit(EXIT_FAILURE);
+    }
+    gen_node * node = NULL;
+    char * name;
+    switch (cmd) {
+      case CMD_PNEW:
+        if (asprintf(&name, "dummy%ld", ++pnew_count) == -1) {
+          exit(EXIT_FAILURE);
+        }
+        fprintf(output, "pnew %s\n", name);
+        newest = add_node(root, name);
+        break;
+      case CMD_PSPAWN: {
+        node = pick_parent(shape);
+        int clones = 1 + random_below(max_clones);
+        if (clones > target - live_count) {
+          clones = target - live_count;
+        }
+        if (clones == 1) {
+          fprintf(output, "pspawn %s\n", node->name);
+        } else {
+          fprintf(output, "pspawn -c %d %s\n", clones, node->name);
+        }
+        int j;
+        for (j = 0; j < clones; j++) {
+          if (asprintf(&name, "%s_%d", node->name, ++node->clones_count) == -1) {
+            exit(EXIT_FAILURE);
+          }
+          newest = add_node(node, name);
+        }
+        break;
+      }
+      case CMD_PCLOSE:
+        node = live[random_below(live_count)];
+        fprintf(output, "pclose %s\n", node->name);
+        // Processes with children refuse to terminate.
+        if (node->children_count == 0) {
+          remove_subtree(node);
+        }
+        break;
+      case CMD_PRMALL:
+        node = live[random_below(live_count)];
+        fprintf(output, "prmall %s\n", node->name);
+        remove_subtree(node);
+        break;
+      case CMD_PINFO:
+        fprintf(output, "pinfo %s\n", live[random_below(live_count)]->name);
+        break;
+      default:
+        fprintf(output, "%s\n", command_names[cmd]);
+    }
+  }
+  if (fclose(output) != 0) {
+    fprintf(stderr, "Error: failed to write \"%s\".\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (expected_path != NULL && write_expected(expected_path) != 0) {
+    fprintf(stderr, "Error: failed to write \"%s\".\n", expected_path);
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+// Parses weights formatted as <command>=<weight>,... Commands not listed keep
+// their weight.
+//
+// weights_str: the string to parse
+// weights: the weights, indexed by CMD_* macros
+//
+// Returns: on success, 0 is returned; on failure (e.g. unknown command), -1 is
+// returned.
+int parse_weights(const char * weights_str, int * weights) {
+  char ** entries;
+  int entries_count = tokenize(weights_str, &entries, ",");
+  int error = entries_count <= 0;
+  int i;
+  for (i = 0; i < entries_count; i++) {
+    char * value = strchr(entries[i], '=');
+    int cmd = -1;
+    if (value != NULL) {
+      *value++ = '\0';
+      int j;
+      for (j = 0; j < CMD_COUNT; j++) {
+        if (strcmp(entries[i], command_names[j]) == 0) {
+          cmd = j;
+        }
+      }
+    }
+    if (cmd == -1 || atoi(value) < 0) {
+      error = 1;
+    } else {
+      weights[cmd] = atoi(value);
+    }
+    free(entries[i]);
+  }
+  if (entries_count > 0) {
+    free(entries);
+  }
+  return error ? -1 : 0;
+}
+
+// Picks a command with a probability proportional to its weight, among the
+// commands that make sense: processes are created only below the target, and
+// commands taking a name only if a process is alive.
+//
+// weights: the weights, indexed by CMD_* macros
+// target: the target number of live processes
+//
+// Returns: the command picked, or -1 if no command can be picked.
+int pick_command(const int * weights, int target) {
+  int allowed[CMD_COUNT];
+  long total = 0;
+  int i;
+  for (i = 0; i < CMD_COUNT; i++) {
+    allowed[i] = weights[i];
+    if ((i == CMD_PNEW || i == CMD_PSPAWN) && live_count >= target) {
+      allowed[i] = 0;
+    }
+    if ((i == CMD_PSPAWN || i == CMD_PCLOSE || i == CMD_PRMALL || i == CMD_PINFO) &&
+        live_count == 0) {
+      allowed[i] = 0;
+    }
+    total += allowed[i];
+  }
+  if (total == 0) {
+    return -1;
+  }
+  long pick = random_below(total);
+  for (i = 0; pick >= allowed[i]; i++) {
+    pick -= allowed[i];
+  }
+  return i;
+}
+
+// Picks the process cloned by pspawn, according to shape.
+//
+// shape: the shape of the tree (see SHAPE_* macros)
+//
+// Returns: a live process.
+gen_node * pick_parent(int shape) {
+  if (shape == SHAPE_DEEP && newest != NULL) {
+    return newest;
+  }
+  gen_node * node = live[random_below(live_count)];
+  if (shape == SHAPE_WIDE) {
+    while (node->parent != root) {
+      node = node->parent;
+    }
+  }
+  return node;
+}
+
+// Adds a process to the expected tree, and to the live processes if it is not
+// the root.
+//
+// parent: the parent of the process, or NULL for the root
+// name: the name of the process, owned by the node
+//
+// Returns: the new node.
+gen_node * add_node(gen_node * parent, char * name) {
+  gen_node * node = calloc(1, sizeof(gen_node));
+  if (node == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  node->name = name;
+  node->parent = parent;
+  if (parent == NULL) {
+    return node;
+  }
+  if (parent->children_count == parent->children_size) {
+    parent->children_size = (parent->children_size == 0) ? 2 : 2 * parent->children_size;
+    parent->children = realloc(parent->children, sizeof(gen_node *) * parent->children_size);
+  }
+  parent->children[parent->children_count++] = node;
+  if (live_count == live_size) {
+    live_size = (live_size == 0) ? 64 : 2 * live_size;
+    live = realloc(live, sizeof(gen_node *) * live_size);
+  }
+  if (parent->children == NULL || live == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  node->index = live_count;
+  live[live_count++] = node;
+  return node;
+}
+
+// Removes a process and its subtree from the expected tree and from the live
+// processes. If the newest process is removed, its parent becomes the newest.
+//
+// node: the root of the subtree
+void remove_subtree(gen_node * node) {
+  while (node->children_count > 0) {
+    remove_subtree(node->children[node->children_count - 1]);
+  }
+  gen_node * parent = node->parent;
+  int i;
+  for (i = 0; parent->children[i] != node; i++);
+  parent->children_count--;
+  memmove(parent->children + i, parent->children + i + 1,
+          sizeof(gen_node *) * (parent->children_count - i));
+  live[node->index] = live[--live_count];
+  live[node->index]->index = node->index;
+  if (newest == node) {
+    newest = (parent == root) ? NULL : parent;
+  }
+  free(node->children);
+  free(node->name);
+  free(node);
+}
+
+// Writes the expected tree: a line "<name> <parent name>" for each live
+// process, sorted by name.
+//
+// path: the path of the file
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int write_expected(const char * path) {
+  FILE * output = fopen(path, "w");
+  char ** lines = malloc(sizeof(char *) * (live_count + 1));
+  if (output == NULL || lines == NULL) {
+    return -1;
+  }
+  int count = 0;
+  collect_lines(root, lines, &count);
+  qsort(lines, count, sizeof(char *), compare_str);
+  int i;
+  for (i = 0; i < count; i++) {
+    fprintf(output, "%s\n", lines[i]);
+    free(lines[i]);
+  }
+  free(lines);
+  return (fclose(output) == 0) ? 0 : -1;
+}
+
+// Adds a line "<name> <parent name>" for each process in the subtree of node,
+// node excluded.
+//
+// node: the root of the subtree
+// lines: the array of lines
+// count: the number of lines, updated by this function
+void collect_lines(const gen_node * node, char ** lines, int * count) {
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    if (asprintf(&lines[(*count)++], "%s %s", node->children[i]->name, node->name) == -1) {
+      exit(EXIT_FAILURE);
+    }
+    collect_lines(node->children[i], lines, count);
+  }
+}
+
+// Comparison function for qsort(), sorting strings with strcmp().
+int compare_str(const void * a, const void * b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Returns a random number between 0 and bound - 1, from a xorshift64
+// generator seeded with -s.
+//
+// bound: the upper bound, greater than 0
+unsigned long long random_below(unsigned long long bound) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state % bound;
+}
+
+// Prints help about this command.
+void print_help() {
+  printf("Usage:\n");
+  printf(" pgen [OPTIONS] <FILE>\n");
+  printf(" Write random commands for pmanager to <FILE>, tracking the process tree\n");
+  printf(" they produce.\n");
+  printf("\n");
+  printf("Options:\n");
+  printf(" -s, --seed=N        seed of the random generator (default: 1)\n");
+  printf(" -n, --count=N       number of commands (default: %d)\n", DEFAULT_COUNT);
+  printf(" -w, --weights=LIST  weights of commands, e.g. pnew=4,pclose=3 (default:\n");
+  printf("                     %s)\n", DEFAULT_WEIGHTS);
+  printf(" -l, --live=N        target number of live processes (default: %d)\n", DEFAULT_LIVE);
+  printf(" -S, --shape=SHAPE   process cloned by pspawn: random, wide (a process\n");
+  printf("                     created by pnew) or deep (the newest process)\n");
+  printf(" -c, --clones=N      clone up to N processes per pspawn (default: 1)\n");
+  printf(" -e, --expected=FILE write the expected tree to FILE, as written by\n");
+  printf("                     pmanager --dump-tree\n");
+  printf(" -h, --help          show this help\n");
+}
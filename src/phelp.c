@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <string.h>
 #include "common.h"
 
+// Suffix of plugin files.
+#define PLUGIN_SUFFIX ".so"
+
 void main() {
 
   // Change directory to default PATH from common.h
@@ -14,9 +18,25 @@ void main() {
 
   // Print help information.
   printf("Usage:\n");
-  printf(" pmanager [FILE]\n");
+  printf(" pmanager [-j N] [-z N] [-t N] [-T DIR] [--timing]\n");
+  printf("          [--metrics FILE [--metrics-interval N]] [--dump-tree FILE]\n");
+  printf("          [--record FILE] [FILE | --replay FILE [--timed]]\n");
   printf(" Execute commands from standard input or [FILE].\n");
+  printf(" With -j, --parallel=N, all commands are read first and up to N\n");
+  printf(" independent commands are executed in parallel.\n");
+  printf(" With -z, --zygotes=N, N idle processes are kept ready for pnew.\n");
+  printf(" With -t, --threads=N, N threads serve requests reading the tree.\n");
+  printf(" With -T, --trace=DIR, all processes record their events in DIR.\n");
+  printf(" With --timing, the phases of each command are timed.\n");
+  printf(" With --metrics=FILE, metrics are written to FILE every N seconds\n");
+  printf(" (--metrics-interval=N, default 10) in Prometheus text format.\n");
+  printf(" With --dump-tree=FILE, the final process tree is written to FILE.\n");
+  printf(" With --record=FILE, each command executed is logged to FILE with its\n");
+  printf(" start time, duration and exit status. With --replay=FILE, the commands\n");
+  printf(" logged are executed again (at their original times with --timed), and\n");
+  printf(" their latencies are compared with the logged ones.\n");
   printf(" To show help about a command, you can use the -h option.\n");
+  printf(" Append \"&\" to a command to run it in background.\n");
   printf("\n");
   printf("Commands:\n");
 
@@ -35,5 +55,26 @@ void main() {
     exit(EXIT_FAILURE);
   }
 
+  // List plugins, if any. PLUGIN_PATH is relative to pmanager's directory,
+  // which is the parent of the current one.
+  DIR *plugins_dir = opendir("../" PLUGIN_PATH);
+  if (plugins_dir != NULL) {
+    while ((file = readdir(plugins_dir)) != NULL) {
+      size_t len = strlen(file->d_name);
+      size_t suffix_len = strlen(PLUGIN_SUFFIX);
+      if (len > suffix_len &&
+          strcmp(file->d_name + len - suffix_len, PLUGIN_SUFFIX) == 0) {
+        printf(" %.*s (plugin)\n", (int) (len - suffix_len), file->d_name);
+      }
+    }
+    closedir(plugins_dir);
+  }
+
+  // List builtins, executed by pmanager itself.
+  printf("\nBuiltins:\n");
+  printf(" jobs                list commands running in background\n");
+  printf(" wait [ID]           wait for background command ID, or for all of them\n");
+  printf(" quit                exit the shell\n");
+
   exit(EXIT_SUCCESS);
 }
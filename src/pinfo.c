@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -7,11 +10,11 @@
 #include <getopt.h>
 #include "common.h"
 #include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
 #include "proc_tree.h"
 
 // Global variables accessed by cleanup().
-// File descriptor of FIFO.
-int fifo_fd = -1;
 // Flag for --pid-only
 int pid_only_flag = 0;
 // Flag for --help
@@ -35,11 +38,17 @@ void cleanup();
 char * parse_args();
 // Prints help about this command.
 void print_help();
+// Prints information about a process.
+int print_proc(const char * proc_str);
 
 void main(int argc, char ** argv) {
 
-  // Default PID of pmanager is assumed to be the the PPID of this process.
-  pid_pmanager = getppid();
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
+  // Default PID of pmanager is the PPID of this process, unless PMANAGER_ENV is
+  // set.
+  pid_pmanager = message_pmanager_pid();
 
   // Check argv options.
   char * proc_name = parse_args(argc, argv);
@@ -53,17 +62,22 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
+  // Read information about process with name proc_name from the tree
+  // published by pmanager, if available.
+  char * proc_str = shm_tree_info(pid_pmanager, proc_name);
+  if (proc_str != NULL) {
+    timing_mark("lookup");
+    int status = print_proc(proc_str);
+    free(proc_str);
+    exit(status);
   }
 
   // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
+  if (message_setup() != 0) {
     fprintf(stderr, "Error: failed to setup process communication.\n");
     exit(EXIT_FAILURE);
   }
+  timing_mark("setup");
 
   // Request information about process with name proc_name to pmanager.
   if (message_send(pid_pmanager, MSG_INFO, proc_name) != 0) {
@@ -72,11 +86,13 @@ void main(int argc, char ** argv) {
   }
 
   // Wait response from pmanager.
-  message_t * response = message_wait(pid_pmanager);
+  message_t * response = message_wait_timeout(pid_pmanager, message_default_timeout());
+  timing_mark("request");
 
   // If message is not valid, exit.
   if (response == NULL) {
-    fprintf(stderr, "Error: failed to read message.\n");
+    fprintf(stderr, (errno == ETIMEDOUT) ? "Error: pmanager did not reply in time.\n" :
+                                           "Error: failed to read message.\n");
     exit(EXIT_FAILURE);
   }
   if (strcmp(response->type, MSG_ERROR) == 0) {
@@ -88,11 +104,24 @@ void main(int argc, char ** argv) {
     exit(EXIT_FAILURE);
   }
 
+  // Print process information.
+  int status = print_proc(response->content);
+  message_deinit(response);
+
+  exit(status);
+}
+
+// Prints information about a process based on pid_only_flag.
+//
+// proc_str: the string representation of the process
+//
+// Returns: EXIT_SUCCESS, or EXIT_FAILURE if proc_str is not valid.
+int print_proc(const char * proc_str) {
   // Convert process string to proc_node.
-  proc_node * proc = proc_node_fromstr(response->content);
+  proc_node * proc = proc_node_fromstr(proc_str);
   if (proc == NULL) {
     fprintf(stderr, "Error: failed to get process node from string.\n");
-    exit(EXIT_FAILURE);
+    return EXIT_FAILURE;
   }
   // Print process information based on pid_only_flag.
   if (pid_only_flag) {
@@ -103,9 +132,7 @@ void main(int argc, char ** argv) {
 
   // Free memory.
   proc_node_deinit(proc);
-  message_deinit(response);
-
-  exit(EXIT_SUCCESS);
+  return EXIT_SUCCESS;
 }
 
 // Parses arguments from main()'s argv and sets global flags.
@@ -150,8 +177,6 @@ void print_help() {
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
+  // Close and remove inbox.
+  message_teardown();
 }
@@ -2,15 +2,16 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include "common.h"
 #include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
 #include "proc_tree.h"
 
 // Global variables accessed by cleanup().
-// File descriptor of FIFO.
-int fifo_fd = -1;
 // Flag for --help
 int help_flag = 0;
 
@@ -29,10 +30,13 @@ void parse_args(int argc, char ** argv);
 // Prints help about this command.
 void print_help();
 // Prints process information formatted for a table.
-void print_proc_entry(const char * proc_str);
+void print_proc_entry(const char * proc_str, void * arg);
 
 void main(int argc, char ** argv) {
 
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
   // Check argv options.
   parse_args(argc, argv);
 
@@ -45,59 +49,24 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
-    fprintf(stderr, "Error: failed to setup process communication.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Ask pmanager to send information about *all* processes.
-  if (message_send(getppid(), MSG_LIST, "pmanager") != 0) {
-    fprintf(stderr, "Error: failed to send message.\n");
-    exit(EXIT_FAILURE);
-  }
-
   // Print table header.
   printf("%-6s %-6s %-20s\n\n", "PID", "PPID", "NAME");
 
-  int list_end = 0;
-  int error = 0;
-
-  // Print entries received by pmanager until there are no more processes left
-  // or an error is encountered.
-  while (!list_end && !error) {
-    // Wait response from pmanager.
-    message_t * response = message_wait(getppid());
-
-    // Check response type.
-    if (response == NULL) {
-      fprintf(stderr, "Error: failed to read message.\n");
-      error = 1;
-    } else if (strcmp(response->type, MSG_INFO) == 0) {
-      // Print process entry.
-      print_proc_entry(response->content);
-      // Inform pmanager that message was received.
-      if (message_send(getppid(), MSG_SUCCESS, NULL) != 0) {
-        fprintf(stderr, "Error: failed to send message.\n");
-        error = 1;
-      }
-    } else if (strcmp(response->type, MSG_SUCCESS) == 0) {
-      // MSG_SUCCESS means pmanager has finished sending processes, so end loop.
-      list_end = 1;
-    } else if (strcmp(response->type, MSG_ERROR) == 0) {
-      fprintf(stderr, "Error: %s.\n", response->content);
-      error = 1;
-    } else {
-      fprintf(stderr, "Error: unrecognized message.\n");
-      error = 1;
+  // Print an entry for *all* processes, read from the tree published by
+  // pmanager. If it is not available, ask pmanager to send them.
+  int error = shm_tree_list(message_pmanager_pid(), "pmanager", print_proc_entry, NULL) != 0;
+  if (error) {
+    // Setup process communication.
+    if (message_setup() != 0) {
+      fprintf(stderr, "Error: failed to setup process communication.\n");
+      exit(EXIT_FAILURE);
     }
-    message_deinit(response);
+    timing_mark("setup");
+    error = message_list(message_pmanager_pid(), "pmanager", print_proc_entry, NULL) != 0;
+  }
+  timing_mark("list");
+  if (error) {
+    fprintf(stderr, "Error: failed to get process list.\n");
   }
 
   exit(error ? EXIT_FAILURE : EXIT_SUCCESS);
@@ -107,7 +76,8 @@ void main(int argc, char ** argv) {
 // Prints process information formatted for table.
 //
 // proc_str: the string representing the process
-void print_proc_entry(const char * proc_str) {
+// arg: not used
+void print_proc_entry(const char * proc_str, void * arg) {
   // Convert string to proc_node.
   proc_node * proc = proc_node_fromstr(proc_str);
   if (proc == NULL) {
@@ -150,8 +120,6 @@ void print_help() {
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
+  // Close and remove inbox.
+  message_teardown();
 }
@@ -0,0 +1,753 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "message.h"
+#include "histogram.h"
+
+// Load driver for pmanager. It starts pmanager, then runs concurrent clients,
+// each executing the commands in "bin" one after the other with posix_spawn(),
+// as pmanager does, and measuring the time from the spawn to the termination
+// of each of them. Commands are picked with a probability proportional to
+// their weight. Each client works on its own processes, named
+// l<client>_<k>, and tracks the tree they form as pgen does, so that its
+// commands always target live processes: pclose is sent to leaves only, and
+// processes are created only while the client has fewer than LIVE of them.
+// Commands find pmanager through PMANAGER_ENV, since they are not its
+// children.
+// Every interval, the number of commands, their rate, the failures and the
+// percentiles of their latency are printed for each type of command, and for
+// the whole run at the end. A watchdog stops the run if a command takes longer
+// than the stall timeout (e.g. a lost reply) or if pmanager exits, reporting
+// the commands in progress, instead of hanging forever.
+//
+// Usage: pload [OPTIONS] [-- PMANAGER_OPTIONS]
+// It must be run from the directory containing pmanager.
+
+// Commands executed by clients.
+#define CMD_PNEW 0
+#define CMD_PINFO 1
+#define CMD_PLIST 2
+#define CMD_PSPAWN 3
+#define CMD_PCLOSE 4
+#define CMD_COUNT 5
+// Default weights of the commands, in the order above.
+#define DEFAULT_WEIGHTS "pnew=3,pinfo=4,plist=1,pspawn=1,pclose=2"
+// Default number of clients.
+#define DEFAULT_CLIENTS 4
+// Default duration of the run and interval between reports, in seconds.
+#define DEFAULT_DURATION 10
+#define DEFAULT_INTERVAL 1
+// Default maximum number of live processes of each client.
+#define DEFAULT_LIVE 20
+// Default time after which a command is considered stalled, in seconds.
+#define DEFAULT_STALL 10
+// Period of the checks of the watchdog, in milliseconds.
+#define WATCHDOG_PERIOD_MS 100
+// Time allowed to pmanager to start and to exit, in milliseconds.
+#define PMANAGER_TIMEOUT_MS 5000
+// Maximum length of the names of processes.
+#define LOAD_NAME_MAX 64
+
+// Represents a process created by a client.
+typedef struct load_node {
+  char name[LOAD_NAME_MAX];
+  struct load_node * parent;
+  struct load_node ** children;
+  int children_count;
+  int children_size;
+  // Number of clone names assigned to children (see proc_node).
+  int clones_count;
+  // Position in the live processes of the client.
+  int index;
+} load_node;
+
+// Represents a client, i.e. a thread executing commands one at a time.
+typedef struct load_client {
+  int id;
+  pthread_t thread;
+  // State of the random number generator (xorshift64).
+  unsigned long long rng_state;
+  // Live processes created by the client.
+  load_node ** live;
+  int live_count;
+  int live_size;
+  // Number of processes created by pnew, used for their names.
+  int pnew_count;
+  // Command in progress, read by the watchdog under lock: its PID (0 if
+  // none), start time and command line.
+  pthread_mutex_t lock;
+  pid_t running_pid;
+  long long running_since;
+  char running_cmd[LOAD_NAME_MAX + 16];
+} load_client;
+
+// Results of a type of command.
+typedef struct load_result {
+  // Latencies of the current interval and of the whole run, in nanoseconds.
+  histogram interval;
+  histogram total;
+  // Failed commands (spawn failure or non-zero exit status).
+  unsigned long long interval_errors;
+  unsigned long long total_errors;
+} load_result;
+
+// Names of the commands, in the order of CMD_* macros.
+const char * const command_names[CMD_COUNT] = {
+  "pnew", "pinfo", "plist", "pspawn", "pclose"
+};
+
+// Global variables.
+// Weights of the commands and maximum number of live processes per client.
+int weights[CMD_COUNT];
+int live_target = DEFAULT_LIVE;
+// Results of each command, protected by results_lock.
+load_result results[CMD_COUNT];
+pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+// Flag set to stop the clients.
+int stop_flag = 0;
+// Spawn attributes of commands: output discarded.
+posix_spawn_file_actions_t spawn_actions;
+
+// Option arguments.
+const char * short_options = "c:d:i:w:l:z:W:s:h";
+const struct option long_options[] = {
+  {"clients", required_argument, NULL, 'c'},
+  {"duration", required_argument, NULL, 'd'},
+  {"interval", required_argument, NULL, 'i'},
+  {"weights", required_argument, NULL, 'w'},
+  {"live", required_argument, NULL, 'l'},
+  {"zygotes", required_argument, NULL, 'z'},
+  {"stall", required_argument, NULL, 'W'},
+  {"seed", required_argument, NULL, 's'},
+  {"help", no_argument, NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+// Utility functions.
+// Starts pmanager with options, and waits until it is ready for messages.
+pid_t start_pmanager(char ** options, int options_count, const char * zygotes, int * input_fd);
+// Stops pmanager by closing its input, killing it if it does not exit.
+int stop_pmanager(pid_t pid, int input_fd);
+// Main function of the client threads.
+void * run_client(void * arg);
+// Executes a command and waits for its termination.
+int run_command(load_client * client, int cmd, const char * name, long long * elapsed);
+// Picks a command according to weights and to the processes of a client.
+int pick_command(load_client * client);
+// Picks a leaf among the processes of a client.
+load_node * pick_leaf(load_client * client);
+// Adds a process to the tree of a client.
+void add_node(load_client * client, load_node * parent, const char * name);
+// Removes a leaf from the tree of a client.
+void remove_node(load_client * client, load_node * node);
+// Checks the clients and pmanager, reporting stalls.
+int watchdog(load_client * clients, int count, pid_t pmanager, long long stall);
+// Prints the results of an interval or of the whole run.
+void print_results(const char * label, double seconds, int total);
+// Parses weights formatted as <command>=<weight>,...
+int parse_weights(const char * weights_str);
+// Returns a random number between 0 and bound - 1.
+unsigned long long random_below(load_client * client, unsigned long long bound);
+// Sleeps for a number of milliseconds.
+void sleep_ms(int ms);
+// Prints help about this command.
+void print_help();
+
+void main(int argc, char ** argv) {
+
+  int clients_count = DEFAULT_CLIENTS;
+  int duration = DEFAULT_DURATION;
+  int interval = DEFAULT_INTERVAL;
+  int stall = DEFAULT_STALL;
+  const char * zygotes = NULL;
+  unsigned long long seed = 1;
+  parse_weights(DEFAULT_WEIGHTS);
+  int option;
+  while ((option = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (option) {
+      case 'c':
+        clients_count = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'w':
+        if (parse_weights(optarg) != 0) {
+          fprintf(stderr, "Error: invalid weights \"%s\".\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'l':
+        live_target = atoi(optarg);
+        break;
+      case 'z':
+        zygotes = optarg;
+        break;
+      case 'W':
+        stall = atoi(optarg);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (clients_count <= 0 || duration <= 0 || interval <= 0 || live_target <= 0 ||
+      stall <= 0 || (zygotes != NULL && atoi(zygotes) <= 0)) {
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+
+  if (posix_spawn_file_actions_init(&spawn_actions) != 0 ||
+      posix_spawn_file_actions_addopen(&spawn_actions, STDOUT_FILENO, "/dev/null",
+                                       O_WRONLY, 0) != 0 ||
+      posix_spawn_file_actions_addopen(&spawn_actions, STDERR_FILENO, "/dev/null",
+                                       O_WRONLY, 0) != 0) {
+    fprintf(stderr, "Error: failed to set up spawn attributes.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Options after "--" are passed to pmanager.
+  int input_fd;
+  pid_t pmanager = start_pmanager(argv + optind, argc - optind, zygotes, &input_fd);
+  if (pmanager == -1) {
+    fprintf(stderr, "Error: failed to start pmanager.\n");
+    exit(EXIT_FAILURE);
+  }
+  // Commands inherit the PID of pmanager, and use zygotes if pmanager has.
+  char pmanager_str[16];
+  snprintf(pmanager_str, sizeof(pmanager_str), "%ld", (long) pmanager);
+  if (setenv(PMANAGER_ENV, pmanager_str, 1) != 0 ||
+      (zygotes != NULL && setenv(ZYGOTE_ENV, "1", 1) != 0)) {
+    fprintf(stderr, "Error: failed to set environment.\n");
+    stop_pmanager(pmanager, input_fd);
+    exit(EXIT_FAILURE);
+  }
+
+  load_client * clients = calloc(clients_count, sizeof(load_client));
+  if (clients == NULL) {
+    fprintf(stderr, "Error: failed to allocate memory.\n");
+    stop_pmanager(pmanager, input_fd);
+    exit(EXIT_FAILURE);
+  }
+  printf("pload: %d clients for %d s against pmanager (PID %ld).\n\n", clients_count,
+         duration, (long) pmanager);
+  printf("%8s %-8s %9s %9s %7s | %9s %9s %9s\n", "TIME (s)", "COMMAND", "COUNT",
+         "RATE/s", "ERRORS", "p50 (ms)", "p99 (ms)", "p999 (ms)");
+  fflush(stdout);
+  int started = 0;
+  int i;
+  for (i = 0; i < clients_count; i++) {
+    clients[i].id = i;
+    // xorshift never leaves 0.
+    clients[i].rng_state = (seed + i) * 0x9E3779B97F4A7C15ULL;
+    if (clients[i].rng_state == 0) {
+      clients[i].rng_state = 1;
+    }
+    pthread_mutex_init(&clients[i].lock, NULL);
+    if (pthread_create(&clients[i].thread, NULL, run_client, &clients[i]) != 0) {
+      fprintf(stderr, "Error: failed to start client %d.\n", i);
+      __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+      break;
+    }
+    started++;
+  }
+
+  // Report every interval, checking the clients in the meantime.
+  long long start = time_ns();
+  long long end = start + duration * 1000000000LL;
+  long long next_report = start + interval * 1000000000LL;
+  long long last_report = start;
+  int stalled = 0;
+  while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE)) {
+    sleep_ms(WATCHDOG_PERIOD_MS);
+    long long now = time_ns();
+    if (watchdog(clients, started, pmanager, stall * 1000000000LL) != 0) {
+      stalled = 1;
+      __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+    } else if (now >= end) {
+      __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+    }
+    if (now >= next_report || __atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE)) {
+      char label[16];
+      snprintf(label, sizeof(label), "%.1f", (now - start) / 1e9);
+      print_results(label, (now - last_report) / 1e9, 0);
+      last_report = now;
+      next_report += interval * 1000000000LL;
+    }
+  }
+  for (i = 0; i < started; i++) {
+    pthread_join(clients[i].thread, NULL);
+  }
+  long long elapsed = time_ns() - start;
+  printf("\n");
+  print_results("total", elapsed / 1e9, 1);
+
+  int error = stop_pmanager(pmanager, input_fd) != 0 || stalled;
+  posix_spawn_file_actions_destroy(&spawn_actions);
+  free(clients);
+
+  exit(error ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// Starts pmanager reading commands from a pipe, which is kept open until the
+// end of the run, with its output discarded. pmanager is ready once it created
+// its inbox.
+//
+// options: the options passed to pmanager
+// options_count: the number of options
+// zygotes: the number of zygotes of pmanager, or NULL
+// input_fd: set to the write end of the input of pmanager
+//
+// Returns: the PID of pmanager, or -1 on failure.
+pid_t start_pmanager(char ** options, int options_count, const char * zygotes, int * input_fd) {
+  char ** argv = malloc(sizeof(char *) * (options_count + 4));
+  int pipe_fds[2];
+  if (argv == NULL || pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    free(argv);
+    return -1;
+  }
+  int argc = 0;
+  argv[argc++] = "./pmanager";
+  if (zygotes != NULL) {
+    argv[argc++] = "-z";
+    argv[argc++] = (char *) zygotes;
+  }
+  memcpy(argv + argc, options, sizeof(char *) * options_count);
+  argv[argc + options_count] = NULL;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[0], STDIN_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  pid_t pid;
+  int status = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  free(argv);
+  close(pipe_fds[0]);
+  if (status != 0) {
+    close(pipe_fds[1]);
+    return -1;
+  }
+  *input_fd = pipe_fds[1];
+
+  // Wait for the inbox of pmanager, unless it exits first.
+  char inbox[32];
+  snprintf(inbox, sizeof(inbox), "%s/%ld", FIFO_DIR, (long) pid);
+  int waited;
+  for (waited = 0; waited < PMANAGER_TIMEOUT_MS; waited += 10) {
+    if (access(inbox, F_OK) == 0) {
+      return pid;
+    }
+    if (waitpid(pid, NULL, WNOHANG) != 0) {
+      close(*input_fd);
+      return -1;
+    }
+    sleep_ms(10);
+  }
+  stop_pmanager(pid, *input_fd);
+  return -1;
+}
+
+// Stops pmanager by closing its input: it exits at EOF, after terminating the
+// remaining processes. It is killed if it did not exit within
+// PMANAGER_TIMEOUT_MS.
+//
+// pid: the PID of pmanager
+// input_fd: the write end of the input of pmanager
+//
+// Returns: 0 if pmanager exited successfully, -1 otherwise.
+int stop_pmanager(pid_t pid, int input_fd) {
+  close(input_fd);
+  int status;
+  int waited;
+  for (waited = 0; waited < PMANAGER_TIMEOUT_MS; waited += 10) {
+    pid_t result = waitpid(pid, &status, WNOHANG);
+    if (result == pid) {
+      return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+    } else if (result == -1) {
+      return -1;
+    }
+    sleep_ms(10);
+  }
+  fprintf(stderr, "Error: pmanager did not exit within %d ms, killing it.\n",
+          PMANAGER_TIMEOUT_MS);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+// Executes commands until stop_flag is set, updating the tree of the client
+// after each successful command.
+//
+// arg: the load_client
+//
+// Returns: NULL.
+void * run_client(void * arg) {
+  load_client * client = arg;
+  while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE)) {
+    int cmd = pick_command(client);
+    if (cmd == -1) {
+      __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+      fprintf(stderr, "Error: no command can be executed with these weights.\n");
+      break;
+    }
+    // Room for a clone name: the name of the parent and "_<n>".
+    char name[LOAD_NAME_MAX + 12];
+    load_node * node = NULL;
+    if (cmd == CMD_PNEW) {
+      snprintf(name, sizeof(name), "l%d_%d", client->id, ++client->pnew_count);
+    } else if (cmd == CMD_PCLOSE) {
+      node = pick_leaf(client);
+    } else if (cmd != CMD_PLIST) {
+      node = client->live[random_below(client, client->live_count)];
+    }
+    // Clone names get longer at each generation: stop cloning those whose
+    // clones could not be named in LOAD_NAME_MAX, as pmanager names them.
+    if (cmd == CMD_PSPAWN && strlen(node->name) + 12 >= LOAD_NAME_MAX) {
+      cmd = CMD_PINFO;
+    }
+
+    long long elapsed;
+    int status = run_command(client, cmd, (node != NULL) ? node->name : name, &elapsed);
+    // Commands killed by the watchdog are not counted.
+    if (status == -2) {
+      break;
+    }
+    pthread_mutex_lock(&results_lock);
+    histogram_record(&results[cmd].interval, elapsed);
+    histogram_record(&results[cmd].total, elapsed);
+    if (status != 0) {
+      results[cmd].interval_errors++;
+      results[cmd].total_errors++;
+    }
+    pthread_mutex_unlock(&results_lock);
+    if (status != 0) {
+      continue;
+    }
+    if (cmd == CMD_PNEW) {
+      add_node(client, NULL, name);
+    } else if (cmd == CMD_PSPAWN) {
+      // A truncated name would make the tree diverge from pmanager's.
+      if (snprintf(name, sizeof(name), "%s_%d", node->name, ++node->clones_count) <
+          LOAD_NAME_MAX) {
+        add_node(client, node, name);
+      }
+    } else if (cmd == CMD_PCLOSE) {
+      remove_node(client, node);
+    }
+  }
+  // Processes left are terminated by pmanager on exit.
+  int i;
+  for (i = 0; i < client->live_count; i++) {
+    free(client->live[i]->children);
+    free(client->live[i]);
+  }
+  free(client->live);
+  return NULL;
+}
+
+// Executes a command with posix_spawn() and waits for its termination. The
+// command is reaped only after it is cleared from the client, so that the
+// watchdog never signals a reused PID.
+//
+// client: the client executing the command
+// cmd: the command (see CMD_* macros)
+// name: the argument of the command, ignored by plist
+// elapsed: set to the time from the spawn to the termination, in nanoseconds
+//
+// Returns: 0 if the command succeeded, -2 if it was killed by the watchdog,
+// -1 otherwise.
+int run_command(load_client * client, int cmd, const char * name, long long * elapsed) {
+  char path[16];
+  snprintf(path, sizeof(path), "%s%s", PATH, command_names[cmd]);
+  char * argv[3] = {path, (cmd == CMD_PLIST) ? NULL : (char *) name, NULL};
+
+  pthread_mutex_lock(&client->lock);
+  long long start = time_ns();
+  pid_t pid;
+  int status = posix_spawn(&pid, path, &spawn_actions, NULL, argv, environ);
+  if (status == 0) {
+    client->running_pid = pid;
+    client->running_since = start;
+    snprintf(client->running_cmd, sizeof(client->running_cmd), "%s%s%s",
+             command_names[cmd], (argv[1] != NULL) ? " " : "",
+             (argv[1] != NULL) ? argv[1] : "");
+  }
+  pthread_mutex_unlock(&client->lock);
+  if (status != 0) {
+    *elapsed = time_ns() - start;
+    return -1;
+  }
+
+  siginfo_t info;
+  while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR);
+  *elapsed = time_ns() - start;
+  pthread_mutex_lock(&client->lock);
+  client->running_pid = 0;
+  pthread_mutex_unlock(&client->lock);
+  waitpid(pid, NULL, 0);
+  if (info.si_code == CLD_KILLED && __atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE)) {
+    return -2;
+  }
+  return (info.si_code == CLD_EXITED && info.si_status == 0) ? 0 : -1;
+}
+
+// Picks a command with a probability proportional to its weight, among the
+// commands that make sense: processes are created only below live_target, and
+// commands taking a name only if the client has live processes.
+//
+// client: the client
+//
+// Returns: the command picked, or -1 if no command can be picked.
+int pick_command(load_client * client) {
+  int allowed[CMD_COUNT];
+  long total = 0;
+  int i;
+  for (i = 0; i < CMD_COUNT; i++) {
+    allowed[i] = weights[i];
+    if ((i == CMD_PNEW || i == CMD_PSPAWN) && client->live_count >= live_target) {
+      allowed[i] = 0;
+    }
+    if ((i == CMD_PINFO || i == CMD_PSPAWN || i == CMD_PCLOSE) && client->live_count == 0) {
+      allowed[i] = 0;
+    }
+    total += allowed[i];
+  }
+  if (total == 0) {
+    return -1;
+  }
+  long pick = random_below(client, total);
+  for (i = 0; pick >= allowed[i]; i++) {
+    pick -= allowed[i];
+  }
+  return i;
+}
+
+// Picks a leaf among the processes of a client: a random process, or its
+// newest descendant if it has children.
+//
+// client: the client, with at least a live process
+//
+// Returns: a live process without children.
+load_node * pick_leaf(load_client * client) {
+  load_node * node = client->live[random_below(client, client->live_count)];
+  while (node->children_count > 0) {
+    node = node->children[node->children_count - 1];
+  }
+  return node;
+}
+
+// Adds a process to the tree of a client.
+//
+// client: the client
+// parent: the parent of the process, or NULL for processes created by pnew
+// name: the name of the process
+void add_node(load_client * client, load_node * parent, const char * name) {
+  load_node * node = calloc(1, sizeof(load_node));
+  if (node == NULL) {
+    return;
+  }
+  strncpy(node->name, name, sizeof(node->name) - 1);
+  node->parent = parent;
+  if (parent != NULL) {
+    if (parent->children_count == parent->children_size) {
+      parent->children_size = (parent->children_size == 0) ? 2 : 2 * parent->children_size;
+      parent->children = realloc(parent->children,
+                                 sizeof(load_node *) * parent->children_size);
+    }
+    parent->children[parent->children_count++] = node;
+  }
+  if (client->live_count == client->live_size) {
+    client->live_size = (client->live_size == 0) ? 16 : 2 * client->live_size;
+    client->live = realloc(client->live, sizeof(load_node *) * client->live_size);
+  }
+  node->index = client->live_count;
+  client->live[client->live_count++] = node;
+}
+
+// Removes a leaf from the tree of a client.
+//
+// client: the client
+// node: the process, without children
+void remove_node(load_client * client, load_node * node) {
+  load_node * parent = node->parent;
+  if (parent != NULL) {
+    int i;
+    for (i = 0; parent->children[i] != node; i++);
+    parent->children_count--;
+    memmove(parent->children + i, parent->children + i + 1,
+            sizeof(load_node *) * (parent->children_count - i));
+  }
+  client->live[node->index] = client->live[--client->live_count];
+  client->live[node->index]->index = node->index;
+  free(node->children);
+  free(node);
+}
+
+// Checks that pmanager is alive and that no command has been running for
+// longer than stall. Otherwise, the commands in progress are printed and
+// killed, so that the clients terminate.
+//
+// clients: the clients
+// count: the number of clients
+// pmanager: the PID of pmanager
+// stall: the stall timeout, in nanoseconds
+//
+// Returns: 0 if no problem was found, -1 otherwise.
+int watchdog(load_client * clients, int count, pid_t pmanager, long long stall) {
+  siginfo_t info;
+  info.si_pid = 0;
+  int problem = 0;
+  if (waitid(P_PID, pmanager, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid != 0) {
+    fprintf(stderr, "Error: pmanager terminated.\n");
+    problem = 1;
+  }
+  long long now = time_ns();
+  int i;
+  for (i = 0; i < count && !problem; i++) {
+    pthread_mutex_lock(&clients[i].lock);
+    problem = clients[i].running_pid != 0 && now - clients[i].running_since > stall;
+    pthread_mutex_unlock(&clients[i].lock);
+  }
+  if (!problem) {
+    return 0;
+  }
+  // Set the flag first, so that clients do not start other commands.
+  __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+  fprintf(stderr, "Error: stall detected, commands in progress:\n");
+  for (i = 0; i < count; i++) {
+    pthread_mutex_lock(&clients[i].lock);
+    if (clients[i].running_pid != 0) {
+      fprintf(stderr, "  client %d: \"%s\" (PID %ld) running for %.3f s\n", i,
+              clients[i].running_cmd, (long) clients[i].running_pid,
+              (now - clients[i].running_since) / 1e9);
+      kill(clients[i].running_pid, SIGKILL);
+    }
+    pthread_mutex_unlock(&clients[i].lock);
+  }
+  return -1;
+}
+
+// Prints a line for each command executed during an interval or the run,
+// resetting the results of the interval.
+//
+// label: the label of the lines, e.g. the time since the start
+// seconds: the duration covered by the results
+// total: if true, the results of the whole run are printed
+void print_results(const char * label, double seconds, int total) {
+  pthread_mutex_lock(&results_lock);
+  int i;
+  for (i = 0; i < CMD_COUNT; i++) {
+    histogram * hist = total ? &results[i].total : &results[i].interval;
+    unsigned long long errors = total ? results[i].total_errors : results[i].interval_errors;
+    if (hist->total > 0) {
+      printf("%8s %-8s %9llu %9.1f %7llu | %9.3f %9.3f %9.3f\n", label,
+             command_names[i], hist->total, (seconds > 0) ? hist->total / seconds : 0.0,
+             errors, histogram_percentile(hist, 0.5) / 1e6,
+             histogram_percentile(hist, 0.99) / 1e6, histogram_percentile(hist, 0.999) / 1e6);
+    }
+    histogram_reset(&results[i].interval);
+    results[i].interval_errors = 0;
+  }
+  pthread_mutex_unlock(&results_lock);
+  fflush(stdout);
+}
+
+// Parses weights formatted as <command>=<weight>,... Commands not listed keep
+// their weight.
+//
+// weights_str: the string to parse
+//
+// Returns: on success, 0 is returned; on failure (e.g. unknown command), -1 is
+// returned.
+int parse_weights(const char * weights_str) {
+  char ** entries;
+  int entries_count = tokenize(weights_str, &entries, ",");
+  int error = entries_count <= 0;
+  int i;
+  for (i = 0; i < entries_count; i++) {
+    char * value = strchr(entries[i], '=');
+    int cmd = -1;
+    if (value != NULL) {
+      *value++ = '\0';
+      int j;
+      for (j = 0; j < CMD_COUNT; j++) {
+        if (strcmp(entries[i], command_names[j]) == 0) {
+          cmd = j;
+        }
+      }
+    }
+    if (cmd == -1 || atoi(value) < 0) {
+      error = 1;
+    } else {
+      weights[cmd] = atoi(value);
+    }
+    free(entries[i]);
+  }
+  if (entries_count > 0) {
+    free(entries);
+  }
+  return error ? -1 : 0;
+}
+
+// Returns a random number between 0 and bound - 1, from the xorshift64
+// generator of a client, seeded with -s.
+//
+// client: the client
+// bound: the upper bound, greater than 0
+unsigned long long random_below(load_client * client, unsigned long long bound) {
+  client->rng_state ^= client->rng_state << 13;
+  client->rng_state ^= client->rng_state >> 7;
+  client->rng_state ^= client->rng_state << 17;
+  return client->rng_state % bound;
+}
+
+// Sleeps for a number of milliseconds.
+//
+// ms: the number of milliseconds
+void sleep_ms(int ms) {
+  struct timespec duration = {ms / 1000, (ms % 1000) * 1000000L};
+  nanosleep(&duration, NULL);
+}
+
+// Prints help about this command.
+void print_help() {
+  printf("Usage:\n");
+  printf(" pload [OPTIONS] [-- PMANAGER_OPTIONS]\n");
+  printf(" Start pmanager with PMANAGER_OPTIONS and run concurrent clients executing\n");
+  printf(" pnew, pinfo, plist, pspawn and pclose on their own processes. Print the\n");
+  printf(" throughput and the latency of each command every interval.\n");
+  printf("\n");
+  printf("Options:\n");
+  printf(" -c, --clients=N     number of concurrent clients (default: %d)\n", DEFAULT_CLIENTS);
+  printf(" -d, --duration=N    duration of the run in seconds (default: %d)\n",
+         DEFAULT_DURATION);
+  printf(" -i, --interval=N    interval between reports in seconds (default: %d)\n",
+         DEFAULT_INTERVAL);
+  printf(" -w, --weights=LIST  weights of commands, e.g. pnew=3,pclose=2 (default:\n");
+  printf("                     %s)\n", DEFAULT_WEIGHTS);
+  printf(" -l, --live=N        maximum live processes per client (default: %d)\n",
+         DEFAULT_LIVE);
+  printf(" -z, --zygotes=N     start pmanager with N zygotes, used by pnew\n");
+  printf(" -W, --stall=N       stop if a command runs for more than N seconds\n");
+  printf("                     (default: %d)\n", DEFAULT_STALL);
+  printf(" -s, --seed=N        seed of the random generators (default: 1)\n");
+  printf(" -h, --help          show this help\n");
+}
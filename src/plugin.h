@@ -0,0 +1,57 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <sys/types.h>
+#include "message.h"
+#include "proc_tree.h"
+
+// Version of the plugin ABI. A plugin must export plugin_abi_version with this
+// value, otherwise pmanager refuses to load it.
+#define PLUGIN_ABI_VERSION 1
+
+// Names of the symbols looked up by pmanager in a plugin.
+#define PLUGIN_SYM_VERSION "plugin_abi_version"
+#define PLUGIN_SYM_MAIN "plugin_main"
+
+// Interface provided by pmanager to plugins. A plugin never receives pointers
+// into pmanager's process tree: nodes returned by find() and list() are copies
+// that must be released with free_nodes(), and the tree can only be modified
+// through add() and remove(), which apply the same rules used for messages.
+typedef struct plugin_api {
+  // Version of the ABI implemented by pmanager.
+  int abi_version;
+  // PID of pmanager.
+  pid_t pmanager;
+  // Opaque handle to the process tree, passed back to the functions below. It
+  // does not point to the tree, and other values are rejected.
+  void * tree;
+  // Returns a copy of the node with the given name, or NULL if not found.
+  proc_node * (*find)(void * tree, const char * name);
+  // Returns copies of all the nodes contained in the subtree rooted at name.
+  proc_node ** (*list)(void * tree, const char * name, int * count);
+  // Frees nodes returned by find() (count = 1) or list().
+  void (*free_nodes)(proc_node ** nodes, int count);
+  // Both functions below return 0 on success, and -1 on failure with errno set
+  // to EINVAL if tree is not the handle above.
+  // Adds a process to the tree. Fails with errno set to EEXIST if the name is
+  // already used, or ESRCH if the parent (ppid) is not in the tree.
+  int (*add)(void * tree, pid_t pid, pid_t ppid, const char * name);
+  // Removes a *leaf* process from the tree. Fails with errno set to EINVAL if
+  // the process is not in the tree, has children or is pmanager.
+  int (*remove)(void * tree, pid_t pid);
+  // Sends a message on behalf of pmanager.
+  int (*send)(pid_t pid, const char * type, const char * content);
+  // Waits a message from pid. Messages from other processes received in the
+  // meantime are handled by pmanager as usual. Returns NULL, with errno set to
+  // ETIMEDOUT, if no message arrived within the default timeout.
+  message_t * (*wait)(pid_t from);
+  // Frees a message returned by wait().
+  void (*free_message)(message_t * msg);
+} plugin_api;
+
+// Signature of the entry point of a plugin. It is called with the same argv
+// that would be passed to a command binary, and its return value is used as
+// exit status of the command.
+typedef int (*plugin_main_t)(const plugin_api * api, int argc, char ** argv);
+
+#endif
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include "common.h"
+#include "plugin.h"
+#include "plugin_host.h"
+#include "read_pool.h"
+#include "shm_tree.h"
+
+// Suffix of shared objects loaded as plugins.
+#define PLUGIN_SUFFIX ".so"
+
+// Represents a loaded plugin.
+typedef struct plugin_entry {
+  // Name of the command, i.e. the file name without PLUGIN_SUFFIX.
+  char * name;
+  // Handle returned by dlopen().
+  void * handle;
+  // Entry point of the plugin.
+  plugin_main_t main;
+} plugin_entry;
+
+// Loaded plugins.
+plugin_entry * plugins = NULL;
+// Number of loaded plugins.
+int plugins_count = 0;
+// Root of the process tree exposed to plugins.
+proc_node * plugin_tree_root = NULL;
+// Opaque handle passed to plugins as api.tree. Only its address is used: the
+// functions of the API check it and work on plugin_tree_root, so a plugin
+// never holds a pointer into the tree.
+char plugin_tree_handle;
+// Handler for messages received while a plugin is waiting.
+void (*plugin_message_handler)(const message_t * msg) = NULL;
+// Interface passed to plugins.
+plugin_api api;
+
+// Private functions.
+// Loads a single plugin from pathname.
+int plugin_load(const char * pathname, const char * name);
+// Implementation of plugin_api functions.
+proc_node * api_find(void * tree, const char * name);
+proc_node ** api_list(void * tree, const char * name, int * count);
+void api_free_nodes(proc_node ** nodes, int count);
+int api_add(void * tree, pid_t pid, pid_t ppid, const char * name);
+int api_remove(void * tree, pid_t pid);
+message_t * api_wait(pid_t from);
+
+// Loads all the plugins found in directory path. A plugin is a shared object
+// whose name ends with PLUGIN_SUFFIX; the command name is the file name
+// without the suffix. Plugins that cannot be loaded are skipped with a warning.
+//
+// path: the directory containing plugins
+// root: the root of the process tree exposed to plugins
+// handler: the function used to handle messages received while a plugin waits
+//
+// Returns: the number of plugins loaded, or -1 if the directory cannot be read.
+int plugin_host_init(const char * path, proc_node * root,
+                     void (*handler)(const message_t * msg)) {
+
+  plugin_tree_root = root;
+  plugin_message_handler = handler;
+
+  // Setup interface passed to plugins.
+  api.abi_version = PLUGIN_ABI_VERSION;
+  api.pmanager = getpid();
+  api.tree = &plugin_tree_handle;
+  api.find = api_find;
+  api.list = api_list;
+  api.free_nodes = api_free_nodes;
+  api.add = api_add;
+  api.remove = api_remove;
+  api.send = message_send;
+  api.wait = api_wait;
+  api.free_message = message_deinit;
+
+  DIR * dir = opendir(path);
+  if (dir == NULL) {
+    return -1;
+  }
+
+  struct dirent * file;
+  while ((file = readdir(dir)) != NULL) {
+    size_t len = strlen(file->d_name);
+    size_t suffix_len = strlen(PLUGIN_SUFFIX);
+    if (len <= suffix_len ||
+        strcmp(file->d_name + len - suffix_len, PLUGIN_SUFFIX) != 0) {
+      continue;
+    }
+    // Build command name and pathname of the plugin.
+    char * name = strndup(file->d_name, len - suffix_len);
+    char * pathname;
+    if (name == NULL || asprintf(&pathname, "%s%s", path, file->d_name) == -1) {
+      free(name);
+      continue;
+    }
+    if (plugin_load(pathname, name) != 0) {
+      fprintf(stderr, "Warning: failed to load plugin \"%s\".\n", file->d_name);
+      free(name);
+    }
+    free(pathname);
+  }
+  closedir(dir);
+
+  return plugins_count;
+}
+
+// Loads a single plugin and adds it to plugins. The plugin is rejected if it
+// does not export the expected symbols, or if its ABI version does not match.
+//
+// pathname: the path of the shared object
+// name: the command name of the plugin. On success, it is owned by plugins.
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int plugin_load(const char * pathname, const char * name) {
+  void * handle = dlopen(pathname, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    return -1;
+  }
+  const int * version = dlsym(handle, PLUGIN_SYM_VERSION);
+  plugin_main_t entry = (plugin_main_t) dlsym(handle, PLUGIN_SYM_MAIN);
+  if (version == NULL || *version != PLUGIN_ABI_VERSION || entry == NULL) {
+    dlclose(handle);
+    return -1;
+  }
+  plugin_entry * tmp = realloc(plugins, sizeof(plugin_entry) * (plugins_count + 1));
+  if (tmp == NULL) {
+    dlclose(handle);
+    return -1;
+  }
+  plugins = tmp;
+  plugins[plugins_count].name = (char *) name;
+  plugins[plugins_count].handle = handle;
+  plugins[plugins_count].main = entry;
+  plugins_count++;
+  return 0;
+}
+
+// Unloads all the plugins.
+void plugin_host_deinit() {
+  int i;
+  for (i = 0; i < plugins_count; i++) {
+    dlclose(plugins[i].handle);
+    free(plugins[i].name);
+  }
+  free(plugins);
+  plugins = NULL;
+  plugins_count = 0;
+}
+
+// Returns true if a plugin named command was loaded.
+//
+// command: the name of the command
+int plugin_host_has(const char * command) {
+  int i;
+  for (i = 0; i < plugins_count; i++) {
+    if (strcmp(plugins[i].name, command) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Runs the plugin named command. argv *must* be terminated by a NULL pointer.
+//
+// command: the name of the command
+// argv: the arguments passed to the plugin
+//
+// Returns: the exit status of the plugin, i.e. the value it returned truncated
+// to 8 bits as exit() does, or -1 if no plugin named command was loaded.
+int plugin_host_run(const char * command, char ** argv) {
+  int i;
+  for (i = 0; i < plugins_count; i++) {
+    if (strcmp(plugins[i].name, command) == 0) {
+      int argc = 0;
+      while (argv[argc] != NULL) {
+        argc++;
+      }
+      int status = plugins[i].main(&api, argc, argv);
+      // Plugins share stdout with pmanager: flush it so that the output is not
+      // mixed with the output of the next command.
+      fflush(stdout);
+      fflush(stderr);
+      return status & 0xff;
+    }
+  }
+  return -1;
+}
+
+// Returns a copy of the node with the given name.
+proc_node * api_find(void * tree, const char * name) {
+  if (tree != &plugin_tree_handle) {
+    return NULL;
+  }
+  proc_node * node = proc_node_find_by_name(plugin_tree_root, (char *) name);
+  if (node == NULL) {
+    return NULL;
+  }
+  return proc_node_init(node->pid, node->ppid, node->name);
+}
+
+// Returns copies of all the nodes in the subtree rooted at name.
+proc_node ** api_list(void * tree, const char * name, int * count) {
+  *count = 0;
+  if (tree != &plugin_tree_handle) {
+    return NULL;
+  }
+  proc_node * node = proc_node_find_by_name(plugin_tree_root, (char *) name);
+  if (node == NULL) {
+    return NULL;
+  }
+  return proc_node_get_array(node, count);
+}
+
+// Frees nodes returned by api_find() or api_list().
+void api_free_nodes(proc_node ** nodes, int count) {
+  if (nodes == NULL) {
+    return;
+  }
+  int i;
+  for (i = 0; i < count; i++) {
+    proc_node_deinit(nodes[i]);
+  }
+  free(nodes);
+}
+
+// Adds a process to the tree. Plugins run on the main thread, which reads the
+// tree without locking, but changes to it must exclude the threads serving
+// read-only requests.
+int api_add(void * tree, pid_t pid, pid_t ppid, const char * name) {
+  if (tree != &plugin_tree_handle) {
+    errno = EINVAL;
+    return -1;
+  }
+  proc_node * node = proc_node_init(pid, ppid, name);
+  if (node == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  tree_write_lock();
+  int status = proc_node_add_unique(plugin_tree_root, node);
+  tree_write_unlock();
+  proc_node_deinit(node);
+  if (status != 0) {
+    errno = (status == 1) ? EEXIST : ESRCH;
+    return -1;
+  }
+  shm_tree_changed();
+  return 0;
+}
+
+// Removes a leaf process from the tree.
+int api_remove(void * tree, pid_t pid) {
+  // The root node (pmanager) cannot be removed.
+  if (tree != &plugin_tree_handle || pid == plugin_tree_root->pid) {
+    errno = EINVAL;
+    return -1;
+  }
+  tree_write_lock();
+  int status = proc_node_remove(plugin_tree_root, pid);
+  tree_write_unlock();
+  if (status != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  shm_tree_changed();
+  return 0;
+}
+
+// Waits a message from pid, handling any other message received meanwhile.
+// This prevents deadlocks when the process the plugin is waiting for needs
+// pmanager to answer its own requests before replying. The default timeout
+// covers the whole wait, so that a plugin is not blocked by a process that
+// died, nor kept waiting by other senders.
+message_t * api_wait(pid_t from) {
+  int timeout = message_default_timeout();
+  long long deadline = time_ns() + timeout * 1000000LL;
+  while (1) {
+    int remaining = -1;
+    if (timeout >= 0) {
+      long long left = deadline - time_ns();
+      remaining = (left > 0) ? (left + 999999) / 1000000 : 0;
+    }
+    message_t * msg = message_wait_timeout(-1, remaining);
+    if (msg == NULL || from == -1 || msg->pid_sender == from) {
+      return msg;
+    }
+    plugin_message_handler(msg);
+    message_deinit(msg);
+  }
+}
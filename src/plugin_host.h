@@ -0,0 +1,18 @@
+#ifndef PLUGIN_HOST_H
+#define PLUGIN_HOST_H
+
+#include "message.h"
+#include "proc_tree.h"
+
+// Loads all the plugins found in directory path. Messages received while a
+// plugin waits for a reply are passed to handler.
+int plugin_host_init(const char * path, proc_node * root,
+                     void (*handler)(const message_t * msg));
+// Unloads all the plugins.
+void plugin_host_deinit();
+// Returns true if a plugin named command was loaded.
+int plugin_host_has(const char * command);
+// Runs the plugin named command with arguments argv.
+int plugin_host_run(const char * command, char ** argv);
+
+#endif
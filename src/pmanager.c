@@ -5,24 +5,83 @@
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <getopt.h>
+#include <time.h>
 #include "common.h"
 #include "message.h"
 #include "proc_tree.h"
 #include "handlers.h"
+#include "plugin_host.h"
+#include "launcher.h"
+#include "jobs.h"
+#include "batch.h"
+#include "parser.h"
+#include "zygote.h"
+#include "shutdown.h"
+#include "shm_tree.h"
+#include "read_pool.h"
+#include "stats.h"
+#include "trace.h"
+#include "cmd_timing.h"
+#include "metrics.h"
+#include "record.h"
+
+// Interval in milliseconds used to check processes for termination when
+// pidfds are not available.
+#define FALLBACK_POLL_MS 10
+// Number of buffered lines parsed before serving messages again.
+#define SERVE_INTERVAL 64
+// Time given to processes to terminate on exit, in milliseconds, before
+// killing them with SIGKILL.
+#define SHUTDOWN_TIMEOUT_MS 500
 
 // Global variables accessed by cleanup().
-// File descriptor of FIFO.
-int fifo_fd = -1;
+// Flag set once the directory of FIFOs has been created.
+int fifo_dir_created = 0;
 // Input stream (stdin or file).
 FILE * input_stream = NULL;
 // Tree of processes.
 proc_node * proc_tree_root = NULL;
+// File descriptors passed to poll() by serve().
+struct pollfd * poll_fds = NULL;
+// Size of poll_fds.
+int poll_fds_size = 0;
+// Flag for --timing: commands executed in foreground are timed.
+int timing_flag = 0;
 
 // Utility functions.
 // Parses and executes commands from stream.
 int parse_commands(FILE * stream);
-// Executes a command with arguments, waiting for command termination.
-int exec_command(const char * command, char ** argv);
+// Executes all the commands in stream, running independent ones in parallel.
+int run_batch(FILE * stream, int workers);
+// Executes a command with arguments, in foreground or in background.
+int exec_command(const char * command, char ** argv, int background);
+// Handles messages and background jobs until input is available.
+int serve(int input_fd, int pidfd, int timeout);
+// Waits for the termination of a foreground process, returning its status.
+int wait_process(pid_t pid);
+// Waits for the termination of background jobs.
+void wait_jobs(int id);
+// Executes builtin commands.
+int exec_builtin(const char * command, char ** argv);
+// Records a command that completed, if commands are recorded or replayed.
+void record_argv(char ** argv, int background, long long start, int status);
+// Executes a command read from a record.
+int replay_exec(char ** argv, int background);
+// Serves messages while a timed replay waits.
+void replay_idle(int timeout);
+// Writes the process tree to a file, one line per process.
+int dump_tree(const char * path);
+// Adds a line for each process in the subtree of node.
+void dump_tree_rec(const proc_node * node, char *** lines, int * size, int * count);
+// Comparison function for qsort(), sorting strings.
+int compare_lines(const void * a, const void * b);
+// Removes the directory of FIFOs and any FIFO left in it.
+void remove_fifo_dir();
 // Default handler for new messages, used as dispatcher.
 void message_handler(const message_t * msg);
 // Performs memory cleanup.
@@ -41,41 +100,161 @@ void main(int argc, char ** argv) {
     exit(EXIT_FAILURE);
   }
 
+  // Commands run by pmanager, and the processes they create, send their
+  // requests to this pmanager, whatever the value inherited.
+  char pmanager_str[16];
+  snprintf(pmanager_str, sizeof(pmanager_str), "%ld", (long) getpid());
+  if (setenv(PMANAGER_ENV, pmanager_str, 1) != 0) {
+    fprintf(stderr, "Error: failed to set environment.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Resolve commands once. The directory is watched for changes.
+  if (launcher_init(PATH) != 0) {
+    fprintf(stderr, "Error: failed to resolve commands.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Parse options.
+  // Maximum number of commands run in parallel. If 0, commands are executed
+  // one at a time, in order.
+  int workers = 0;
+  // Number of idle zygotes kept for pnew. If 0, pnew always forks.
+  int zygotes = 0;
+  // Number of threads serving read-only requests. If 0, all the requests are
+  // served by the main thread.
+  int threads = 0;
+  // Directory of the event rings, if tracing is enabled.
+  const char * trace_dir = NULL;
+  // File where metrics are written, if enabled, and interval between writes.
+  const char * metrics_file = NULL;
+  int metrics_interval = METRICS_INTERVAL;
+  // File where the final tree is written, if requested.
+  const char * dump_file = NULL;
+  // File where the commands executed are recorded, and record replayed, if
+  // requested. With --timed, the original times of commands are kept.
+  const char * record_file = NULL;
+  const char * replay_file = NULL;
+  int timed = 0;
+  struct option long_options[] = {
+    {"parallel", required_argument, NULL, 'j'},
+    {"zygotes", required_argument, NULL, 'z'},
+    {"threads", required_argument, NULL, 't'},
+    {"trace", required_argument, NULL, 'T'},
+    {"timing", no_argument, NULL, 'p'},
+    {"metrics", required_argument, NULL, 'M'},
+    {"metrics-interval", required_argument, NULL, 'I'},
+    {"dump-tree", required_argument, NULL, 'D'},
+    {"record", required_argument, NULL, 'R'},
+    {"replay", required_argument, NULL, 'P'},
+    {"timed", no_argument, NULL, 'd'},
+    {0, 0, 0, 0}
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "j:z:t:T:", long_options, NULL)) != -1) {
+    switch (option) {
+      case 'j':
+        workers = atoi(optarg);
+        if (workers <= 0) {
+          fprintf(stderr, "Error: invalid number of parallel commands.\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'z':
+        zygotes = atoi(optarg);
+        if (zygotes <= 0) {
+          fprintf(stderr, "Error: invalid number of zygotes.\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 't':
+        threads = atoi(optarg);
+        if (threads <= 0) {
+          fprintf(stderr, "Error: invalid number of threads.\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'T':
+        trace_dir = optarg;
+        break;
+      case 'p':
+        timing_flag = 1;
+        break;
+      case 'M':
+        metrics_file = optarg;
+        break;
+      case 'I':
+        metrics_interval = atoi(optarg);
+        if (metrics_interval <= 0) {
+          fprintf(stderr, "Error: invalid metrics interval.\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'D':
+        dump_file = optarg;
+        break;
+      case 'R':
+        record_file = optarg;
+        break;
+      case 'P':
+        replay_file = optarg;
+        break;
+      case 'd':
+        timed = 1;
+        break;
+      default:
+        exec_command("phelp", NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+  }
+
   // Check arguments.
-  if (argc == 1) {
+  if (replay_file != NULL || timed) {
+    // Commands are read from the record, one at a time.
+    if (replay_file == NULL || optind != argc || workers > 0) {
+      exec_command("phelp", NULL, 0);
+      exit(EXIT_FAILURE);
+    }
+  } else if (optind == argc) {
     // If there are no arguments, read commands from stdin.
 		input_stream = stdin;
-	} else if (argc == 2) {
+	} else if (optind == argc - 1) {
     // If there is an argument, use it as the name of file to open for reading
     // commands.
-		input_stream = fopen(argv[1], "r");
+		input_stream = fopen(argv[optind], "r");
 		if (input_stream == NULL) {
-			fprintf(stderr, "Error: cannot open \"%s\" for reading.\n", argv[1]);
+			fprintf(stderr, "Error: cannot open \"%s\" for reading.\n", argv[optind]);
 			exit(EXIT_FAILURE);
 		}
 	} else {
     // Syntax not recognized. Print help before exiting.
-		exec_command("phelp", NULL);
+		exec_command("phelp", NULL, 0);
 		exit(EXIT_FAILURE);
 	}
 
-  // Create FIFO for process communication.
-  // Defaul umask is 0002, thus final permissions will be: 0602 - 0002 = 0600.
-  mode_t mode = 0602;
-  if (mkfifo(FIFO_NAME, mode) != 0) {
-    fprintf(stderr, "Error: failed to create FIFO.\n");
+  // Enable tracing before any process is started, so that all of them record
+  // their events.
+  if (trace_dir != NULL && trace_start(trace_dir) != 0) {
+    fprintf(stderr, "Error: failed to enable tracing in \"%s\".\n", trace_dir);
     exit(EXIT_FAILURE);
   }
 
-  // Open FIFO.
-  fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK);
-  if (fifo_fd == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
+  // Commands report their phases only if they inherit TIMING_ENV.
+  if (timing_flag && setenv(TIMING_ENV, "1", 1) != 0) {
+    fprintf(stderr, "Error: failed to enable timing.\n");
     exit(EXIT_FAILURE);
   }
 
+  // Create directory containing the FIFOs used for process communication.
+  // Each process creates its own FIFO there, used as inbox.
+  if (mkdir(FIFO_DIR, 0700) != 0) {
+    fprintf(stderr, "Error: failed to create FIFO directory.\n");
+    exit(EXIT_FAILURE);
+  }
+  fifo_dir_created = 1;
+
   // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
+  if (message_setup() != 0) {
     fprintf(stderr, "Error: failed to setup process communication.\n");
     exit(EXIT_FAILURE);
   }
@@ -98,27 +277,93 @@ void main(int argc, char ** argv) {
     exit(EXIT_FAILURE);
   }
 
+  // Start the pool of zygotes. pnew falls back to fork() if it is empty.
+  if (zygotes > 0 && zygote_pool_start(zygotes) != 0) {
+    fprintf(stderr, "Error: failed to start zygotes.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Start the threads serving read-only requests.
+  if (threads > 0 && read_pool_start(threads, proc_tree_root) != 0) {
+    fprintf(stderr, "Error: failed to start threads.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Publish the tree for readers. Without it, they fall back to messages.
+  if (shm_tree_init() == 0) {
+    shm_tree_publish(proc_tree_root);
+  } else {
+    fprintf(stderr, "Warning: failed to publish process tree.\n");
+  }
+
+  // Export metrics, counting the nodes of the tree from now on.
+  if (metrics_file != NULL &&
+      metrics_start(metrics_file, metrics_interval, proc_tree_root) != 0) {
+    fprintf(stderr, "Error: failed to write metrics to \"%s\".\n", metrics_file);
+    exit(EXIT_FAILURE);
+  }
+
+  // Record the commands executed from now on.
+  if (record_file != NULL && record_start(record_file) != 0) {
+    fprintf(stderr, "Error: failed to record commands to \"%s\".\n", record_file);
+    exit(EXIT_FAILURE);
+  }
+
+  // Load command plugins. A missing plugin directory is not an error.
+  plugin_host_init(PLUGIN_PATH, proc_tree_root, message_handler);
+
   // Print welcome message if stream is stdin.
-  if (input_stream == stdin) {
+  if (input_stream == stdin && workers == 0) {
     printf("Welcome to CustomShell!\n\n");
     printf("Type \"phelp\" for information.\n");
   }
 
   // Parse and execute commands commands.
-  if (parse_commands(input_stream) != 0) {
+  int status;
+  if (replay_file != NULL) {
+    status = record_replay(replay_file, timed, replay_exec, replay_idle) != 0;
+  } else {
+    status = (workers == 0) ? parse_commands(input_stream) :
+                              run_batch(input_stream, workers);
+  }
+  if (status != 0) {
     fprintf(stderr, "Error: something went wrong before reaching EOF.\n");
     exit(EXIT_FAILURE);
   }
 
+  // Let background jobs complete before killing remaining processes.
+  wait_jobs(-1);
+
+  // Compare the latencies of the replay with the recorded ones.
+  if (replay_file != NULL) {
+    printf("\n");
+    record_summary(stdout);
+  }
+
+  // When reading a file, summarize the phases of each command.
+  if (timing_flag && input_stream != stdin) {
+    fprintf(stderr, "\nTiming of commands:\n");
+    cmd_timing_summary(stderr);
+  }
+
+  // Write the tree before remaining processes are killed, e.g. to compare it
+  // with the one expected by pgen.
+  if (dump_file != NULL && dump_tree(dump_file) != 0) {
+    fprintf(stderr, "Error: failed to write process tree to \"%s\".\n", dump_file);
+    exit(EXIT_FAILURE);
+  }
+
 	exit(EXIT_SUCCESS);
 
 }
 
-// Parses and executes commands from stream. This function blocks until one of
-// the following condition is true:
+// Parses and executes commands from stream. While waiting for input, messages
+// and background jobs are served. A command ending with "&" is executed in
+// background. This function blocks until one of the following condition is
+// true:
 // - "quit" command was read
 // - stream reached EOF
-// - getline() returned an error
+// - reading from stream failed
 //
 // stream: the FILE pointer of the stream to parse
 //
@@ -126,43 +371,53 @@ void main(int argc, char ** argv) {
 // 1 is returned.
 int parse_commands(FILE * stream) {
 
+  // Lines are read directly from the file descriptor, bypassing stdio.
+  parser_t * parser = parser_init(fileno(stream));
+  if (parser == NULL) {
+    return 1;
+  }
+
   // If stream is stdin, show prompt.
   if (stream == stdin) {
 		printf("> ");
+    fflush(stdout);
   }
 
-  // Buffer to store current input line.
-  char * buffer = NULL;
-  // Size of the buffer.
-  size_t bufsize = 0;
   // Flag for quit command.
   int quit = 0;
+  // Arguments of current line.
+  char ** argv;
+  // Number of arguments of current line, or negative value at EOF or on error.
+  int argc = 0;
+  // Number of lines parsed without serving messages.
+  int unserved = 0;
+
+  // Read input until EOF, read error, or quit command. If a whole line is
+  // already buffered, messages are served only every SERVE_INTERVAL lines.
+  while (!quit) {
+    int status = 0;
+    if (!parser_buffered(parser)) {
+      status = serve(parser->fd, -1, -1);
+      unserved = 0;
+    } else if (++unserved == SERVE_INTERVAL) {
+      status = serve(-1, -1, 0);
+      unserved = 0;
+    }
+    if (status == -1 || (argc = parser_next(parser, &argv)) < 0) {
+      break;
+    }
 
-  // Read input until EOF, getline() error, or quit command.
-  while (!quit && getline(&buffer, &bufsize, stream) != -1) {
-    // Used in for loops.
-    int i;
-    // Tokens in current line.
-    char ** tokens = NULL;
-    // Split line into tokens.
-    int tokens_count = tokenize(buffer, &tokens, "\n ");
+    // A trailing "&" requests background execution.
+    int background = parser_background(argv, &argc);
 
     // If there are tokens, try to execute command.
-    if (tokens_count != 0) {
-      // Copy tokens into a new NULL-terminated array. Required by exec_command().
-      char * argv[tokens_count + 1];
-      for (i = 0; i < tokens_count; i++) {
-        argv[i] = malloc(sizeof(char) * (strlen(tokens[i]) + 1));
-        strcpy(argv[i], tokens[i]);
-      }
-      argv[i] = NULL;
-
+    if (argc != 0) {
       // Execute command with arguments.
-      int status = exec_command(argv[0], argv);
+      int status = exec_command(argv[0], argv, background);
       // Print erros based on return value.
       switch (status) {
         case -2:
-          fprintf(stderr, "Error: failed to fork process.\n");
+          fprintf(stderr, "Error: failed to start process.\n");
           break;
         case -1:
           fprintf(stderr, "Error: command not found.\n");
@@ -171,84 +426,382 @@ int parse_commands(FILE * stream) {
           quit = 1;
           break;
       }
-
-      // Free tokens.
-      for (i = 0; i < tokens_count; i++) {
-        free(tokens[i]);
-      }
-      free(tokens);
-      // Free argv.
-      for (i = 0; i < tokens_count + 1; i++) {
-        free(argv[i]);
-      }
-
     }
 
     // If stream is stdin and last command was not quit, show prompt again.
     if (stream == stdin && !quit) {
       printf("> ");
+      fflush(stdout);
+    }
+
+  }
+
+  parser_deinit(parser);
+
+  return !(argc == -1 || quit);
+}
+
+// Executes all the commands in stream, up to EOF or "quit", running up to
+// workers independent commands in parallel. The whole stream is parsed first,
+// and commands are scheduled according to the dependencies computed by
+// batch_load(): commands accessing the same process keep their relative order
+// when at least one of them creates or removes it. Executables are started as
+// background jobs, while builtins and plugins run in pmanager itself.
+//
+// stream: the FILE pointer of the stream to parse
+// workers: the maximum number of commands running at the same time
+//
+// Returns: on success, the function returns 0. On error, 1 is returned.
+int run_batch(FILE * stream, int workers) {
+  batch_t * batch = batch_load(stream);
+  if (batch == NULL) {
+    return 1;
+  }
+
+  // Commands in execution, with the ids of their jobs.
+  int * running_cmds = malloc(sizeof(int) * workers);
+  int * running_jobs = malloc(sizeof(int) * workers);
+  int running = 0;
+  int error = (running_cmds == NULL || running_jobs == NULL);
+
+  while (!error && batch->remaining > 0) {
+    // Start ready commands while there are free workers.
+    int index;
+    while (running < workers && (index = batch_next(batch)) != -1) {
+      char ** argv = batch->cmds[index].argv;
+      long long start = time_ns();
+      if (exec_builtin(argv[0], argv) == 0) {
+        metrics_command(argv[0]);
+        record_argv(argv, 0, start, 0);
+        batch_done(batch, index);
+        continue;
+      }
+      if (plugin_host_has(argv[0])) {
+        metrics_command(argv[0]);
+        int status = plugin_host_run(argv[0], argv);
+        shm_tree_sync(proc_tree_root);
+        record_argv(argv, 0, start, status);
+        batch_done(batch, index);
+        continue;
+      }
+      pid_t pid;
+      int status = launcher_spawn(argv[0], argv, &pid);
+      if (status == -2) {
+        metrics_failed_fork();
+      }
+      if (status != 0) {
+        fprintf(stderr, (status == -1) ? "Error: command not found.\n" :
+                                         "Error: failed to start process.\n");
+        record_argv(argv, 0, start, (status == -1) ? RECORD_NOT_FOUND : RECORD_NOT_STARTED);
+        batch_done(batch, index);
+        continue;
+      }
+      metrics_command(argv[0]);
+      int id = jobs_add(pid, argv, 1);
+      if (id == -1) {
+        // Job table is full: wait for the command to terminate.
+        record_argv(argv, 0, start, record_status(wait_process(pid)));
+        batch_done(batch, index);
+        continue;
+      }
+      running_cmds[running] = index;
+      running_jobs[running] = id;
+      running++;
     }
 
+    // Every command depends only on previous ones, so this should never
+    // happen. Stop instead of waiting forever.
+    if (running == 0) {
+      if (batch->remaining > 0) {
+        error = 1;
+      }
+      break;
+    }
+
+    // Serve messages until some job terminates.
+    if (serve(-1, -1, -1) == -1) {
+      error = 1;
+      break;
+    }
+    int i = 0;
+    while (i < running) {
+      if (!jobs_running(running_jobs[i])) {
+        batch_done(batch, running_cmds[i]);
+        running--;
+        running_cmds[i] = running_cmds[running];
+        running_jobs[i] = running_jobs[running];
+      } else {
+        i++;
+      }
+    }
   }
 
-  free(buffer);
+  free(running_cmds);
+  free(running_jobs);
+  batch_deinit(batch);
 
-  return !(feof(stream) || quit);
+  return error;
 }
 
 // Executes command with arguments specified by argv. argv *must* be terminated
-// by a NULL pointer, just as exec() system call.
+// by a NULL pointer, just as exec() system call. If a plugin with the same name
+// was loaded, it is called directly instead of executing a binary. Plugins and
+// builtins are always executed in foreground.
 //
 // command: the name of the executable
 // argv: the arguments passed to the program
+// background: if true, the command is added to the job table and the function
+//             returns without waiting for its termination
 //
 // Returns:
-//  -2 : fork failed
+//  -2 : process could not be started
 //  -1 : command not found
-//   0 : command executed successfully
+//   0 : command executed successfully (or started, in background)
 //   1 : quit command
-int exec_command(const char * command, char ** argv) {
+//   2 : command executed, but it failed (non-zero exit status)
+int exec_command(const char * command, char ** argv, int background) {
 
   // Check if command is "quit".
   if (strcmp(command, "quit") == 0) {
     return 1;
   }
 
-  // Check if executable exists.
-  char * pathname = malloc(sizeof(char) * (strlen(PATH) + strlen(command) + 1));
-  pathname[0] = '\0';
-  strcat(pathname, PATH);
-  strcat(pathname, command);
-  int x_ok = access(pathname, X_OK);
-  free(pathname);
-  if (x_ok != 0) {
-    return -1;
+  // Check if command is a builtin.
+  long long start = time_ns();
+  if (exec_builtin(command, argv) == 0) {
+    metrics_command(command);
+    record_argv(argv, 0, start, 0);
+    return 0;
   }
 
-  // Fork and execute command.
-  pid_t pid = fork();
-  if (pid == -1) {
-    // Fork failed.
-    return -2;
-  } else if (pid == 0) {
-    // Child executes requested program.
-    if (execvp(command, argv) == -1) {
-      fprintf(stderr, "Error: failed to exec program.\n");
-      exit(EXIT_FAILURE);
+  // Check if command is provided by a plugin.
+  if (plugin_host_has(command)) {
+    metrics_command(command);
+    int status = plugin_host_run(command, argv);
+    // Publish the changes made by the plugin before the next command reads them.
+    shm_tree_sync(proc_tree_root);
+    record_argv(argv, 0, start, status);
+    return (status == 0) ? 0 : 2;
+  }
+
+  // Start command. With --timing, commands in foreground are timed.
+  int timed = timing_flag && !background;
+  if (timed) {
+    cmd_timing_begin(argv);
+  }
+  pid_t pid;
+  int status = launcher_spawn(command, argv, &pid);
+  if (status == -2) {
+    metrics_failed_fork();
+  }
+  if (status != 0) {
+    record_argv(argv, background, start,
+                (status == -1) ? RECORD_NOT_FOUND : RECORD_NOT_STARTED);
+    return status;
+  }
+  metrics_command(command);
+  if (timed) {
+    cmd_timing_spawned(pid);
+  }
+
+  // Add command to job table, or wait for its termination if not possible.
+  // Jobs are recorded when they are reaped.
+  if (background) {
+    int id = jobs_add(pid, argv, 0);
+    if (id != -1) {
+      printf("[%d] %ld\n", id, (long) pid);
+      return 0;
+    }
+  }
+  status = record_status(wait_process(pid));
+  record_argv(argv, background, start, status);
+
+  // The phases were sent before the process terminated: handle them, then
+  // print the breakdown.
+  if (timed) {
+    serve(-1, -1, 0);
+    cmd_timing_end(stderr);
+  }
+
+	return (status == 0) ? 0 : 2;
+}
+
+// Executes builtin commands:
+// - jobs: prints running background jobs
+// - wait [ID]: waits for the termination of job ID, or of all jobs
+//
+// command: the name of the command
+// argv: the arguments of the command
+//
+// Returns: 0 if command is a builtin, -1 otherwise.
+int exec_builtin(const char * command, char ** argv) {
+  if (strcmp(command, "jobs") == 0) {
+    jobs_print();
+  } else if (strcmp(command, "wait") == 0) {
+    if (argv != NULL && argv[0] != NULL && argv[1] != NULL) {
+      int id = atoi(argv[1]);
+      if (!jobs_running(id)) {
+        fprintf(stderr, "Error: no such job.\n");
+      } else {
+        wait_jobs(id);
+      }
+    } else {
+      wait_jobs(-1);
     }
   } else {
-    // Parent waits until command termination. Meanwhile, any message that is
-    // received is handled by message_handler().
-    do {
-      if (message_unread()) {
-        message_t * msg = message_read();
-        message_handler(msg);
-        message_deinit(msg);
+    return -1;
+  }
+  return 0;
+}
+
+// Records a command that completed, if commands are recorded or replayed. The
+// command line is built only in that case.
+//
+// argv: the arguments of the command, terminated by a NULL pointer
+// background: if true, the command was executed in background
+// start: the time the command was started (see time_ns())
+// status: the status of the command (see record_status())
+void record_argv(char ** argv, int background, long long start, int status) {
+  if (!record_active() || argv == NULL) {
+    return;
+  }
+  char * command = join_argv(argv);
+  if (command != NULL) {
+    record_command(command, background, start, status);
+    free(command);
+  }
+}
+
+// Executes a command read from a record, as if it was read from the input.
+//
+// argv: the arguments of the command, terminated by a NULL pointer
+// background: if true, the command is executed in background
+//
+// Returns: 1 for the quit command, 0 otherwise.
+int replay_exec(char ** argv, int background) {
+  int status = exec_command(argv[0], argv, background);
+  if (status == -2) {
+    fprintf(stderr, "Error: failed to start process.\n");
+  } else if (status == -1) {
+    fprintf(stderr, "Error: command not found.\n");
+  }
+  return status == 1;
+}
+
+// Serves messages and background jobs while a timed replay waits for the time
+// of the next command.
+//
+// timeout: the maximum time to wait, in milliseconds
+void replay_idle(int timeout) {
+  serve(-1, -1, timeout);
+}
+
+// Handles received messages and reaps terminated background jobs until one of
+// the following conditions is true:
+// - input_fd is readable (ignored if -1)
+// - the process referred by pidfd terminated (ignored if -1)
+// - a background job terminated
+// - timeout milliseconds elapsed (ignored if -1)
+//
+// input_fd: the file descriptor of the input stream
+// pidfd: the pidfd of the foreground process
+// timeout: the maximum time to wait, in milliseconds
+//
+// Returns: 1 if input_fd is readable or pidfd terminated, 0 if a job terminated
+// or timeout elapsed, -1 on error.
+int serve(int input_fd, int pidfd, int timeout) {
+  while (1) {
+    // Handle all the messages received.
+    message_t * msg;
+    while ((msg = message_read()) != NULL) {
+      message_handler(msg);
+      message_deinit(msg);
+    }
+
+    // Publish the changes made by the messages handled, once before waiting.
+    shm_tree_sync(proc_tree_root);
+
+    // Poll inbox, input, foreground process, and one pidfd for each job.
+    int count = 3 + jobs_count();
+    if (count > poll_fds_size) {
+      struct pollfd * tmp = realloc(poll_fds, sizeof(struct pollfd) * count);
+      if (tmp == NULL) {
+        return -1;
       }
-    } while (waitpid(pid, NULL, 0) <= 0);
+      poll_fds = tmp;
+      poll_fds_size = count;
+    }
+    poll_fds[0].fd = message_fd();
+    poll_fds[1].fd = input_fd;
+    poll_fds[2].fd = pidfd;
+    int i;
+    for (i = 0; i < 3; i++) {
+      poll_fds[i].events = POLLIN;
+      poll_fds[i].revents = 0;
+    }
+    jobs_pollfds(poll_fds + 3);
+
+    // Jobs without pidfd are checked periodically.
+    int wait_ms = timeout;
+    for (i = 3; i < count; i++) {
+      if (poll_fds[i].fd < 0 && (wait_ms == -1 || wait_ms > FALLBACK_POLL_MS)) {
+        wait_ms = FALLBACK_POLL_MS;
+      }
+    }
+
+    int ready = poll(poll_fds, count, wait_ms);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (jobs_reap(poll_fds + 3) > 0) {
+      return 0;
+    }
+    if (poll_fds[1].revents != 0 || poll_fds[2].revents != 0) {
+      return 1;
+    }
+    if (ready == 0 && timeout != -1) {
+      return 0;
+    }
   }
+}
 
-	return 0;
+// Waits for the termination of a foreground process, serving messages and
+// background jobs in the meantime.
+//
+// pid: the PID of the process
+//
+// Returns: the status of the process, as returned by waitpid().
+int wait_process(pid_t pid) {
+  int pidfd = pidfd_open_pid(pid);
+  // Without pidfd, check for termination periodically.
+  int timeout = (pidfd == -1) ? FALLBACK_POLL_MS : -1;
+  int status = 0;
+  while (waitpid(pid, &status, WNOHANG) == 0) {
+    if (serve(-1, pidfd, timeout) == -1) {
+      // Stop serving and just wait.
+      waitpid(pid, &status, 0);
+      break;
+    }
+  }
+  if (pidfd != -1) {
+    close(pidfd);
+  }
+  return status;
+}
+
+// Waits for the termination of background jobs, serving messages in the
+// meantime.
+//
+// id: the id of the job to wait, or -1 for all jobs
+void wait_jobs(int id) {
+  while ((id == -1) ? jobs_count() > 0 : jobs_running(id)) {
+    if (serve(-1, -1, -1) == -1) {
+      break;
+    }
+  }
 }
 
 // Generic message handler. It takes care of calling the suitable handler based
@@ -262,18 +815,61 @@ void message_handler(const message_t * msg) {
     return;
   }
 
+  // Read-only requests are served by the pool of threads, if started.
+  if (read_pool_accepts(msg) && read_pool_submit(msg) == 0) {
+    return;
+  }
+
+  // Time and bytes sent are recorded for pstats.
+  long long start = time_ns();
+  unsigned long long bytes = message_bytes_sent();
+
+  // Other handlers run while threads cannot read the tree.
+  int writer = strcmp(msg->type, MSG_INFO) != 0 && strcmp(msg->type, MSG_LIST) != 0 &&
+               strcmp(msg->type, MSG_STATS) != 0 && strcmp(msg->type, MSG_TIMING) != 0 &&
+               strcmp(msg->type, MSG_TIMEOUT) != 0;
+  if (writer) {
+    tree_write_lock();
+  }
+
   if (strcmp(msg->type, MSG_ADD) == 0) {
     // Add new process to tree.
     msg_add_handler(msg, proc_tree_root);
+    shm_tree_changed();
+  } else if (strcmp(msg->type, MSG_ADD_BATCH) == 0) {
+    // Add clones of the sender to tree, assigning their names.
+    msg_add_batch_handler(msg, proc_tree_root);
+    shm_tree_changed();
   } else if (strcmp(msg->type, MSG_INFO) == 0) {
     // Reply with information about process.
     msg_info_handler(msg, proc_tree_root);
   } else if (strcmp(msg->type, MSG_REMOVE) == 0) {
     // Remove process from tree.
     msg_remove_handler(msg, proc_tree_root);
+    shm_tree_changed();
   } else if (strcmp(msg->type, MSG_LIST) == 0) {
     // Reply with information about *all* processes.
     msg_list_handler(msg, proc_tree_root);
+  } else if (strcmp(msg->type, MSG_PRUNE) == 0) {
+    // Remove processes killed by a signal from tree.
+    msg_prune_handler(msg, proc_tree_root);
+    shm_tree_changed();
+  } else if (strcmp(msg->type, MSG_ZYGOTE) == 0) {
+    // Add zygote to the idle ones.
+    msg_zygote_handler(msg);
+  } else if (strcmp(msg->type, MSG_CLAIM) == 0) {
+    // Name and register an idle zygote.
+    msg_claim_handler(msg, proc_tree_root);
+    shm_tree_changed();
+  } else if (strcmp(msg->type, MSG_STATS) == 0) {
+    // Reply with statistics about the messages handled.
+    msg_stats_handler(msg);
+  } else if (strcmp(msg->type, MSG_TIMING) == 0) {
+    // Record the phases of the command in foreground.
+    msg_timing_handler(msg);
+  } else if (strcmp(msg->type, MSG_TIMEOUT) == 0) {
+    // Count a command that gave up waiting for a reply.
+    metrics_message_timeout();
   } else {
     // Reply with error message.
     if (message_send(msg->pid_sender, MSG_ERROR, "unrecognized message type") != 0) {
@@ -281,31 +877,137 @@ void message_handler(const message_t * msg) {
     }
   }
 
+  if (writer) {
+    tree_write_unlock();
+  }
+
+  long long end = time_ns();
+  stats_record(msg, start, end, message_bytes_sent() - bytes);
+  trace_record_at(start, TRACE_HANDLER, msg->pid_sender, msg->type[0], end - start);
+
 }
 
 // Performs cleanup operations. Called on normal exit.
 void cleanup() {
-  // Execute prmall to kill processes started by the shell.
+  // Stop the threads serving read-only requests, which read the tree.
+  read_pool_stop();
+  // Write the metrics a last time, before the tree is emptied.
+  metrics_stop();
+  // Terminate all the processes started by the shell at once.
   if (proc_tree_root != NULL) {
-    printf("Killing remaining processes...\n");
-    char * args[] = { "prmall", "pmanager", NULL};
-    if (exec_command(args[0], args) != 0) {
-      fprintf(stderr, "Failed to kill remaining processes.\n");
+    if (proc_tree_root->children_count > 0) {
+      printf("Killing remaining processes...\n");
+      fflush(stdout);
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      int killed;
+      int count = shutdown_tree(proc_tree_root, SHUTDOWN_TIMEOUT_MS, &killed);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      if (count == -1) {
+        fprintf(stderr, "Failed to kill remaining processes.\n");
+      } else {
+        printf("Terminated %d processes in %ld ms (%d killed).\n", count,
+               (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000,
+               killed);
+      }
     }
     proc_node_deinit(proc_tree_root);
   }
+  // Kill idle zygotes.
+  zygote_pool_stop();
+  // Remove the published tree.
+  shm_tree_deinit();
+  // Unload plugins.
+  plugin_host_deinit();
+  // Close cached commands.
+  launcher_deinit();
+  // Free job table.
+  jobs_deinit();
+  // Free the durations of commands.
+  cmd_timing_deinit();
+  // Flush the record, and free the results of the replay.
+  record_stop();
+  free(poll_fds);
   // Close stream.
   if (input_stream != NULL) {
     fclose(input_stream);
   }
-  // Close and unlink FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
+  // Close and unlink FIFOs.
+  message_teardown();
+  if (fifo_dir_created) {
+    remove_fifo_dir();
   }
-  unlink(FIFO_NAME);
   printf("Exiting...\n");
 }
 
+// Writes the process tree to a file: a line "<name> <parent name>" for each
+// process except pmanager, sorted by name, as pgen writes the expected tree.
+//
+// path: the path of the file
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int dump_tree(const char * path) {
+  FILE * output = fopen(path, "w");
+  if (output == NULL) {
+    return -1;
+  }
+  char ** lines = NULL;
+  int size = 0;
+  int count = 0;
+  dump_tree_rec(proc_tree_root, &lines, &size, &count);
+  qsort(lines, count, sizeof(char *), compare_lines);
+  int i;
+  for (i = 0; i < count; i++) {
+    fprintf(output, "%s\n", lines[i]);
+    free(lines[i]);
+  }
+  free(lines);
+  return (fclose(output) == 0) ? 0 : -1;
+}
+
+// Adds a line "<name> <parent name>" to *lines for each process in the
+// subtree of node, node excluded.
+//
+// node: the root of the subtree
+// lines: a pointer to the array of lines, grown as needed
+// size: the size of *lines
+// count: the number of lines in *lines
+void dump_tree_rec(const proc_node * node, char *** lines, int * size, int * count) {
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    if (*count == *size) {
+      *size = (*size == 0) ? 64 : 2 * *size;
+      *lines = realloc(*lines, sizeof(char *) * *size);
+    }
+    const char * name = node->children[i]->name;
+    char * line = malloc(sizeof(char) * (strlen(name) + strlen(node->name) + 2));
+    sprintf(line, "%s %s", name, node->name);
+    (*lines)[(*count)++] = line;
+    dump_tree_rec(node->children[i], lines, size, count);
+  }
+}
+
+// Comparison function for qsort(), sorting strings with strcmp().
+int compare_lines(const void * a, const void * b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Removes the directory of FIFOs. FIFOs left by processes that terminated
+// without removing their inbox are removed too.
+void remove_fifo_dir() {
+  DIR * dir = opendir(FIFO_DIR);
+  if (dir != NULL) {
+    struct dirent * file;
+    while ((file = readdir(dir)) != NULL) {
+      if (file->d_name[0] != '.') {
+        unlinkat(dirfd(dir), file->d_name, 0);
+      }
+    }
+    closedir(dir);
+  }
+  rmdir(FIFO_DIR);
+}
+
 // Signal handler for SIGTERM and SIGINT. Calling exit() also causes cleanup()
 // to be called, because of atexit() function registration in main().
 void terminate(int signum) {
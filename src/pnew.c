@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -9,12 +11,11 @@
 #include <signal.h>
 #include "common.h"
 #include "message.h"
+#include "timing.h"
 #include "proc_tree.h"
 #include "child.h"
 
 // Global variables accessed by cleanup().
-// File descriptor of FIFO.
-int fifo_fd = -1;
 // Flag for --help
 int help_flag = 0;
 
@@ -30,13 +31,16 @@ const struct option long_options[] = {
 char * parse_args(int argc, char ** argv);
 // Prints help about this command.
 void print_help();
+// Asks pmanager to assign a name to an idle zygote.
+int claim_zygote(const char * name, pid_t pmanager);
 // Performs cleanup operations on exit.
 void cleanup();
-// Kills forked process when it is not possible adding it in pmanager's process tree.
-void abort_fork(pid_t pid);
 
 void main(int argc, char ** argv) {
 
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
   // Check argv options.
   char * proc_name = parse_args(argc, argv);
 
@@ -49,80 +53,102 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
-  }
-
   // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
+  if (message_setup() != 0) {
     fprintf(stderr, "Error: failed to setup process communication.\n");
     exit(EXIT_FAILURE);
   }
+  timing_mark("setup");
 
   // Save pid of pmanager for use in the forked process.
-  pid_t pid_pmanager = getppid();
+  pid_t pid_pmanager = message_pmanager_pid();
 
-  // Before forking, check if a process with name proc_name already exists.
-  if (message_send(pid_pmanager, MSG_INFO, proc_name) != 0) {
-    fprintf(stderr, "Error: failed to send message.\n");
-    exit(EXIT_FAILURE);
+  // If pmanager keeps idle zygotes, claim one: it is named and registered by
+  // pmanager in a single round trip. Fork only if none is available.
+  if (getenv(ZYGOTE_ENV) != NULL) {
+    int status = claim_zygote(proc_name, pid_pmanager);
+    timing_mark("claim");
+    if (status == 0) {
+      printf("Process \"%s\" successfully started.\n", proc_name);
+      exit(EXIT_SUCCESS);
+    } else if (status == -2) {
+      fprintf(stderr, "Error: a process with name \"%s\" already exists.\n", proc_name);
+      exit(EXIT_FAILURE);
+    } else if (status == -3) {
+      // The claim may still be served: forking could create a second process.
+      fprintf(stderr, "Error: pmanager did not reply in time.\n");
+      exit(EXIT_FAILURE);
+    }
   }
-  // Wait response from pmanager.
-  message_t * response = message_wait(pid_pmanager);
-  int duplicate = strcmp(response->type, MSG_INFO) == 0;
-  message_deinit(response);
-  // If proc_name already exists, exit.
-  if (duplicate) {
-    fprintf(stderr, "Error: a process with name \"%s\" already exists.\n", proc_name);
+
+  // Fork process. The name is checked by pmanager when the new process is
+  // registered, in a single round trip. SIGTERM is blocked first, so that the
+  // child inherits it blocked: a pclose/prmall sent as soon as the process is
+  // registered waits for child_init() to handle it, instead of killing the
+  // process before its handler is set, without removing it from the tree.
+  // The child creates its inbox before it is registered, and signals it on
+  // ready_pipe: once registered, its name is visible to other commands, which
+  // may send it messages right away.
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGTERM);
+  sigprocmask(SIG_BLOCK, &blocked, NULL);
+  int ready_pipe[2];
+  if (pipe(ready_pipe) != 0) {
+    fprintf(stderr, "Error: failed to create pipe.\n");
     exit(EXIT_FAILURE);
   }
-
-  // Fork process.
   pid_t pid = fork();
   if (pid == -1) {
     fprintf(stderr, "Error: failed to fork process.\n");
     exit(EXIT_FAILURE);
   } else if (pid == 0) {
     // Child
+    close(ready_pipe[0]);
+    // Lead a new process group, shared by the clones created later, so that
+    // the whole subtree can be signaled at once.
+    setpgid(0, 0);
+    // Create inbox, which child_init() keeps.
+    if (message_setup() != 0) {
+      _exit(EXIT_FAILURE);
+    }
+    write(ready_pipe[1], "", 1);
+    close(ready_pipe[1]);
     // Wait for messages/signals.
     child_init(proc_name, pid_pmanager);
   } else {
     // Parent
-    // Send information about new process to pmanager.
-    // Create proc_node.
-    proc_node * proc = proc_node_init(pid, getppid(), proc_name);
-    if (proc == NULL) {
-      abort_fork(pid);
+    timing_mark("fork");
+    close(ready_pipe[1]);
+    // Set the group here too, so that it is set before pnew exits.
+    setpgid(pid, pid);
+    // Wait for the inbox of the child: the pipe is closed without a byte if
+    // it failed.
+    char byte;
+    ssize_t count;
+    do {
+      count = read(ready_pipe[0], &byte, 1);
+    } while (count == -1 && errno == EINTR);
+    close(ready_pipe[0]);
+    if (count != 1) {
+      child_abort(pid);
+      fprintf(stderr, "Error: failed to setup process communication.\n");
       exit(EXIT_FAILURE);
     }
-    // Convert proc_node to string.
-    char * proc_str;
-    int status = proc_node_tostr(proc, &proc_str);
-    proc_node_deinit(proc);
-    if (status == -1) {
-      abort_fork(pid);
-      exit(EXIT_FAILURE);
-    }
-    // Send message containing proc_str to pmanager.
-    status = message_send(getppid(), MSG_ADD, proc_str);
-    free(proc_str);
+    // Send information about new process to pmanager.
+    // The name is checked in the same round trip.
+    int status = child_register(proc_name, pid, pid_pmanager, pid_pmanager);
+    timing_mark("register");
     if (status != 0) {
-      abort_fork(pid);
-      exit(EXIT_FAILURE);
-    }
-    // Wait response from pmanager.
-    message_t * result = message_wait(getppid());
-    if (result == NULL) {
-      abort_fork(pid);
-      exit(EXIT_FAILURE);
-    }
-    // Check if add was successful.
-    status = strcmp(result->type, MSG_ERROR);
-    message_deinit(result);
-    if (status == 0) {
-      abort_fork(pid);
+      // The new process was not added to the tree: kill it to avoid
+      // inconsistency between tree in pmanager and processes that are
+      // actually alive.
+      child_abort(pid);
+      if (status == -2) {
+        fprintf(stderr, "Error: a process with name \"%s\" already exists.\n", proc_name);
+      } else {
+        fprintf(stderr, "Error: failed to add process in pmanager.\n");
+      }
       exit(EXIT_FAILURE);
     }
     printf("Process \"%s\" successfully started.\n", proc_name);
@@ -130,26 +156,6 @@ void main(int argc, char ** argv) {
   }
 }
 
-// Shows error and sends SIGTERM to pid. Called when fork() was successful but
-// it was not possibile to add the forked process in pmanager's process tree.
-// Killing the forked process is necessary to avoid inconsistency between
-// tree in pmanager and processes that are actually alive.
-//
-// pid: the pid of the process to kill
-void abort_fork(pid_t pid) {
-  fprintf(stderr, "Error: failed to add process in pmanager. Sending SIGTERM "
-          "to %ld...\n", (long) pid);
-  // Send SIGTERM to pid.
-  if (kill(pid, SIGTERM) != 0) {
-      fprintf(stderr, "Error: failed to send SIGTERM. Information shown by pmanager are "
-             "now inconsistent.\n");
-  } else {
-    // By default, the child's SIGTERM handler will reply with a MSG_SUCCESS.
-    message_t * response = message_wait(pid);
-    message_deinit(response);
-  }
-}
-
 // Parses arguments from main()'s argv and sets global flags.
 //
 // argc: the number of arguments
@@ -175,6 +181,32 @@ char * parse_args(int argc, char ** argv) {
   return argv[optind];
 }
 
+// Asks pmanager to assign name to an idle zygote and to register it.
+//
+// name: the name of the new process
+// pmanager: the PID of pmanager
+//
+// Returns: 0 on success, -2 if name is already used, -3 if pmanager did not
+// reply in time, -1 if no zygote was available or on failure.
+int claim_zygote(const char * name, pid_t pmanager) {
+  if (message_send(pmanager, MSG_CLAIM, name) != 0) {
+    return -1;
+  }
+  message_t * response = message_wait_timeout(pmanager, message_default_timeout());
+  if (response == NULL) {
+    return (errno == ETIMEDOUT) ? -3 : -1;
+  }
+  int status = -1;
+  if (strcmp(response->type, MSG_SUCCESS) == 0) {
+    status = 0;
+  } else if (strcmp(response->type, MSG_ERROR) == 0 &&
+             strcmp(response->content, MSG_ERROR_EXISTS) == 0) {
+    status = -2;
+  }
+  message_deinit(response);
+  return status;
+}
+
 // Prints help about this command. Called on -h (--help) option.
 void print_help() {
   printf("Usage:\n");
@@ -187,8 +219,6 @@ void print_help() {
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
+  // Close and remove inbox.
+  message_teardown();
 }
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -6,11 +8,18 @@
 #include <getopt.h>
 #include "common.h"
 #include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
 #include "proc_tree.h"
+#include "trace.h"
+
+// A process of the tree, with the height of its subtree (0 for leaves).
+typedef struct frontier_entry {
+  proc_node * node;
+  int height;
+} frontier_entry;
 
 // Global variables accessed by cleanup().
-// File descriptor of FIFO.
-int fifo_fd = -1;
 // Process tree.
 proc_node * proc_tree_root = NULL;
 // Flag for --help
@@ -31,12 +40,24 @@ void print_help();
 // Performs cleanup operations on exit.
 void cleanup();
 // Adds process to local process tree for later kill operation.
-void add_process_to_tree(proc_node ** root, const char * proc_str);
+void add_process_to_tree(const char * proc_str, void * root);
 // Sends SIGTERM to all processes in tree, starting from leaf nodes.
 void kill_proc_tree(proc_node * root);
+// Adds the processes of the subtree rooted at node to entries.
+int collect_entries(proc_node * node, frontier_entry * entries, int * count);
+// Sends SIGTERM to a frontier of processes and waits for all the replies.
+void kill_frontier(const frontier_entry * entries, int count);
+// Counts the processes in the subtree rooted at node.
+int count_nodes(const proc_node * node);
+// Comparison functions for qsort().
+int compare_height(const void * a, const void * b);
+int compare_pid(const void * a, const void * b);
 
 void main(int argc, char ** argv) {
 
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
   // Check argv options.
   char * proc_name = parse_args(argc, argv);
 
@@ -49,61 +70,29 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
-  }
-
   // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
+  if (message_setup() != 0) {
     fprintf(stderr, "Error: failed to setup process communication.\n");
     exit(EXIT_FAILURE);
   }
+  timing_mark("setup");
 
-  // Ask pmanager to send information about proc_name and its children.
-  if (message_send(getppid(), MSG_LIST, proc_name) != 0) {
-    fprintf(stderr, "Error: failed to send message.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  int list_end = 0;
-  int error = 0;
-
-  // Populate proc_tree_root with processes received from pmanager, until
-  // there are no more processes left or an error is encountered.
-  while (!list_end && !error) {
-    // Wait response from pmanager.
-    message_t * response = message_wait(getppid());
-
-    // Check response type.
-    if (response == NULL) {
-      fprintf(stderr, "Error: failed to read message.\n");
-      error = 1;
-    } else if (strcmp(response->type, MSG_INFO) == 0) {
-      // Add received process to process tree.
-      add_process_to_tree(&proc_tree_root, response->content);
-      // Inform pmanager that message was received.
-      if (message_send(getppid(), MSG_SUCCESS, NULL) != 0) {
-        fprintf(stderr, "Error: failed to send message.\n");
-        error = 1;
-      }
-    } else if (strcmp(response->type, MSG_SUCCESS) == 0) {
-      // MSG_SUCCESS means pmanager has finished sending processes, so end loop.
-      list_end = 1;
-    } else if (strcmp(response->type, MSG_ERROR) == 0) {
-      fprintf(stderr, "Error: %s.\n", response->content);
-      error = 1;
-    } else {
-      fprintf(stderr, "Error: unrecognized message.\n");
-      error = 1;
-    }
-    message_deinit(response);
+  // Populate proc_tree_root with proc_name and its children, read from the
+  // tree published by pmanager or, if not available, received from pmanager.
+  int list_end = shm_tree_list(message_pmanager_pid(), proc_name, add_process_to_tree,
+                               &proc_tree_root) == 0 ||
+                 message_list(message_pmanager_pid(), proc_name, add_process_to_tree,
+                              &proc_tree_root) == 0;
+  timing_mark("list");
+  if (!list_end) {
+    fprintf(stderr, (errno == ESRCH) ? "Error: process not found.\n" :
+                                       "Error: failed to get process list.\n");
   }
 
   // If end of list was reached, kill all the processes in the tree.
   if (list_end) {
     kill_proc_tree(proc_tree_root);
+    timing_mark("kill");
     exit(EXIT_SUCCESS);
   }
 
@@ -113,9 +102,10 @@ void main(int argc, char ** argv) {
 
 // Add process represented by proc_str to process tree pointed by *root.
 //
-// root: a pointer to the proc_node* to which the process is added
 // proc_str: the string representation of the process to add
-void add_process_to_tree(proc_node **root, const char * proc_str) {
+// root_ptr: a pointer to the proc_node* to which the process is added
+void add_process_to_tree(const char * proc_str, void * root_ptr) {
+  proc_node ** root = root_ptr;
   proc_node *new_node = proc_node_fromstr(proc_str);
   if(*root == NULL)
     *root = new_node;
@@ -125,30 +115,159 @@ void add_process_to_tree(proc_node **root, const char * proc_str) {
   }
 }
 
-// Sends SIGTERM to all processes contained in node recursively. The signal is
-// first sent to leaf nodes, because SIGTERM handler does not allow termination
-// of a process with children.
+// Sends SIGTERM to all processes contained in the tree rooted at root. The
+// signal is first sent to leaf nodes, because SIGTERM handler does not allow
+// termination of a process with children. Processes are grouped by the height
+// of their subtree: all the processes of a frontier are signaled at once, and
+// the next frontier (their parents) only after all of them replied. This way,
+// the teardown takes a number of steps equal to the height of the tree.
+//
+// root: the proc_node representing the process to kill recursively
+void kill_proc_tree(proc_node * root) {
+  if (root == NULL) {
+    return;
+  }
+  int total = count_nodes(root);
+  frontier_entry * entries = malloc(sizeof(frontier_entry) * total);
+  if (entries == NULL) {
+    fprintf(stderr, "Error: failed to allocate memory.\n");
+    return;
+  }
+  int count = 0;
+  collect_entries(root, entries, &count);
+  qsort(entries, count, sizeof(frontier_entry), compare_height);
+
+  int start = 0;
+  while (start < count) {
+    int end = start;
+    while (end < count && entries[end].height == entries[start].height) {
+      end++;
+    }
+    kill_frontier(entries + start, end - start);
+    start = end;
+  }
+  free(entries);
+}
+
+// Adds node and its descendants to entries, computing the height of each of
+// them.
+//
+// node: the root of the subtree
+// entries: the array where entries are added
+// count: the number of entries in the array, updated by this function
+//
+// Returns: the height of the subtree rooted at node.
+int collect_entries(proc_node * node, frontier_entry * entries, int * count) {
+  int height = 0;
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    int child_height = collect_entries(node->children[i], entries, count) + 1;
+    if (child_height > height) {
+      height = child_height;
+    }
+  }
+  entries[*count].node = node;
+  entries[*count].height = height;
+  (*count)++;
+  return height;
+}
+
+// Sends SIGTERM to all the processes of a frontier, then waits for a reply
+// from each of them. Replies can arrive in any order, and all of them must
+// arrive before the default timeout; processes that died without replying are
+// reported. pmanager, which is the parent of this process, is never signaled.
 //
-// node: the proc_node representing the process to kill recursively
-void kill_proc_tree(proc_node * node) {
-  if (node != NULL) {
-    int i;
-    // Kill children first.
-    for (i = 0; i < node->children_count; i++) {
-      kill_proc_tree(node->children[i]);
+// entries: the processes of the frontier
+// count: the number of processes
+void kill_frontier(const frontier_entry * entries, int count) {
+  // PIDs of the signaled processes, sorted so that replies can be matched with
+  // a binary search, and flags set for the processes that replied.
+  pid_t * waiting = malloc(sizeof(pid_t) * count);
+  char * replied = calloc(count, sizeof(char));
+  if (waiting == NULL || replied == NULL) {
+    free(waiting);
+    free(replied);
+    fprintf(stderr, "Error: failed to allocate memory.\n");
+    return;
+  }
+  int waiting_count = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    pid_t pid = entries[i].node->pid;
+    if (pid == message_pmanager_pid()) {
+      continue;
     }
-    // Send SIGTERM only if pid is not the parent process.
-    if (node->pid != getppid()) {
-      printf("Sending SIGTERM to %ld...\n", (long) node->pid);
-      if (kill(node->pid, SIGTERM) == 0) {
-        // Wait response from signaled process before going on.
-        message_t * response =  message_wait(node->pid);
-        message_deinit(response);
-      } else {
-        fprintf(stderr, "Failed to send SIGTERM to %ld.\n", (long) node->pid);
+    printf("Sending SIGTERM to %ld...\n", (long) pid);
+    trace_record(TRACE_SIGNAL_SEND, pid, 0, SIGTERM);
+    if (kill(pid, SIGTERM) == 0) {
+      // A process stopped by pstop handles SIGTERM only once resumed.
+      kill(pid, SIGCONT);
+      waiting[waiting_count++] = pid;
+    } else {
+      fprintf(stderr, "Failed to send SIGTERM to %ld.\n", (long) pid);
+    }
+  }
+
+  // Wait for the responses from the signaled processes before going on.
+  qsort(waiting, waiting_count, sizeof(pid_t), compare_pid);
+  int pending = waiting_count;
+  int timeout = message_default_timeout();
+  long long deadline = time_ns() + timeout * 1000000LL;
+  while (pending > 0) {
+    int remaining = -1;
+    if (timeout >= 0) {
+      long long left = deadline - time_ns();
+      remaining = (left > 0) ? (left + 999999) / 1000000 : 0;
+    }
+    message_t * response = message_wait_timeout(-1, remaining);
+    if (response == NULL && errno == ETIMEDOUT) {
+      for (i = 0; i < waiting_count; i++) {
+        if (!replied[i]) {
+          fprintf(stderr, "Error: process %ld did not reply in time.\n", (long) waiting[i]);
+        }
       }
+      break;
+    } else if (response == NULL) {
+      fprintf(stderr, "Error: failed to read message.\n");
+      break;
     }
+    pid_t * found = bsearch(&response->pid_sender, waiting, waiting_count,
+                            sizeof(pid_t), compare_pid);
+    if (found != NULL && !replied[found - waiting]) {
+      replied[found - waiting] = 1;
+      pending--;
+    }
+    message_deinit(response);
+  }
+  free(waiting);
+  free(replied);
+}
+
+// Counts the processes in the subtree rooted at node, including node itself.
+//
+// node: the root of the subtree
+//
+// Returns: the number of processes.
+int count_nodes(const proc_node * node) {
+  int count = 1;
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    count += count_nodes(node->children[i]);
   }
+  return count;
+}
+
+// Comparison function for qsort(), sorting entries by ascending height.
+int compare_height(const void * a, const void * b) {
+  return ((const frontier_entry *) a)->height - ((const frontier_entry *) b)->height;
+}
+
+// Comparison function for qsort() and bsearch(), sorting PIDs in ascending
+// order.
+int compare_pid(const void * a, const void * b) {
+  pid_t x = *(const pid_t *) a;
+  pid_t y = *(const pid_t *) b;
+  return (x > y) - (x < y);
 }
 
 // Parses arguments from main()'s argv and sets global flags.
@@ -188,10 +307,8 @@ void print_help() {
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
+  // Close and remove inbox.
+  message_teardown();
   // Free process tree.
   proc_node_deinit(proc_tree_root);
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -9,16 +10,20 @@
 #define BORDER_MODE "\x1b(0"
 #define NORMAL_MODE "\x1b(B"
 
+// Functions called for each node added to or removed from a tree, if set.
+proc_tree_observer observer_added = NULL;
+proc_tree_observer observer_removed = NULL;
+
 // Private functions.
 // Populates *array with all the nodes contained in node recursively.
 void proc_node_get_array_rec(const proc_node * node, proc_node *** array,
                              int * size, int * count);
 // Prints the names of all processes contained in node as a tree recursively.
 void proc_node_print_tree_rec(const proc_node * node, int depth);
-// Finds node in root by pid.
-proc_node * proc_node_find_by_pid(proc_node * root, pid_t pid);
 // Removes node from children array of another node.
 int remove_child(proc_node * node, pid_t pid);
+// Calls observer_removed for node and its descendants.
+void notify_removed(const proc_node * node);
 
 // Initializes a new node representing a process with pid, ppid and name.
 //
@@ -36,6 +41,8 @@ proc_node * proc_node_init(pid_t pid, pid_t ppid, const char * name) {
   new_node->children_size = 0;
   new_node->children_count = 0;
   new_node->children = NULL;
+  new_node->clones_count = 0;
+  new_node->depth = 0;
   return new_node;
 }
 
@@ -74,11 +81,60 @@ int proc_node_add(proc_node * root, const proc_node * node) {
   }
   // Add child node.
   proc_node *child = proc_node_init(node->pid, node->ppid, node->name);
+  child->depth = parent->depth + 1;
   parent->children[parent->children_count] = child;
   parent->children_count++;
+  if (observer_added != NULL) {
+    observer_added(child);
+  }
   return 0;
 }
 
+// Adds a node to the process tree represented by root, like proc_node_add(),
+// unless its name is already used by a process in root. Names identify
+// processes, so every addition requested from outside pmanager goes through
+// this check.
+//
+// root: the root node of the tree where the node is added
+// node: the node to add
+//
+// Returns: on success, 0 is returned; if the name is already used, 1 is
+// returned; if no suitable parent node is found, -1 is returned.
+int proc_node_add_unique(proc_node * root, const proc_node * node) {
+  if (proc_node_find_by_name(root, node->name) != NULL) {
+    return 1;
+  }
+  return proc_node_add(root, node);
+}
+
+// Adds a clone of parent to the tree represented by root. The clone is named
+// <parent name>_<i>, where i is the lowest number greater than the numbers
+// already assigned to clones of parent whose name is not used in root.
+//
+// root: the root node of the tree
+// parent: the node of the process that forked the clone
+// pid: the PID of the clone
+//
+// Returns: the node of the clone, or NULL on failure.
+proc_node * proc_node_add_clone(proc_node * root, proc_node * parent, pid_t pid) {
+  char * name = NULL;
+  do {
+    free(name);
+    parent->clones_count++;
+    if (asprintf(&name, "%s_%i", parent->name, parent->clones_count) == -1) {
+      return NULL;
+    }
+  } while (proc_node_find_by_name(root, name) != NULL);
+  proc_node * node = proc_node_init(pid, parent->pid, name);
+  free(name);
+  if (proc_node_add(root, node) != 0) {
+    proc_node_deinit(node);
+    return NULL;
+  }
+  proc_node_deinit(node);
+  return parent->children[parent->children_count - 1];
+}
+
 // Removes node from children array of another node.
 //
 // node: the node that contains the child to remove
@@ -95,6 +151,9 @@ int remove_child(proc_node * node, pid_t pid) {
   for (i = 0; (i < node->children_count) && !found; i++) {
     if (node->children[i]->pid == pid) {
       // Deallocate node.
+      if (observer_removed != NULL) {
+        notify_removed(node->children[i]);
+      }
       proc_node_deinit(node->children[i]);
       // Move elements after child one position left.
       int j;
@@ -110,6 +169,31 @@ int remove_child(proc_node * node, pid_t pid) {
   return !found;
 }
 
+// Calls observer_removed for node and all its descendants, which are about to
+// be removed from their tree.
+//
+// node: the root of the subtree being removed
+void notify_removed(const proc_node * node) {
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    notify_removed(node->children[i]);
+  }
+  observer_removed(node);
+}
+
+// Sets the functions called for each node added to a tree (by proc_node_add()
+// and proc_node_add_clone()) and for each node removed from it (by
+// proc_node_remove() and proc_node_remove_subtree()), e.g. to maintain
+// counters without walking the tree. Nodes freed with proc_node_deinit() are
+// not reported.
+//
+// added: the function called after a node is added, or NULL
+// removed: the function called before a node is removed, or NULL
+void proc_tree_observe(proc_tree_observer added, proc_tree_observer removed) {
+  observer_added = added;
+  observer_removed = removed;
+}
+
 // Removes a *leaf* node from the tree represented by root.
 //
 // root: the root node of the tree
@@ -135,6 +219,23 @@ int proc_node_remove(proc_node * root, pid_t pid) {
   return remove_child(parent, pid);
 }
 
+// Removes a node, with all its descendants, from the tree represented by root.
+// Used when the processes were terminated without their cooperation.
+//
+// root: the root node of the tree
+// pid: the pid of the node to remove
+//
+// Returns: on success, 0 is returned, on failure, 1 is returned. Failure
+// can occur if a node with specified pid does not exist in root, or if it is
+// root itself.
+int proc_node_remove_subtree(proc_node * root, pid_t pid) {
+  proc_node * node = proc_node_find_by_pid(root, pid);
+  if (node == NULL || node == root) {
+    return 1;
+  }
+  return remove_child(proc_node_find_by_pid(root, node->ppid), pid);
+}
+
 // Finds node by pid recursively.
 //
 // node: the node from which search is performed
@@ -9,8 +9,15 @@ typedef struct proc_node {
   struct proc_node ** children;
   int children_count;
   int children_size;
+  // Number of clone names assigned to children of this process.
+  int clones_count;
+  // Distance from the root of the tree, 0 for nodes not in a tree.
+  int depth;
 } proc_node;
 
+// Functions called when a node is added to or removed from a tree.
+typedef void (*proc_tree_observer)(const proc_node * node);
+
 // Initializes a new node representing a process with pid, ppid and name.
 proc_node * proc_node_init(pid_t pid, pid_t ppid, const char * name);
 // Frees memory allocated for a node recursively.
@@ -18,8 +25,18 @@ void proc_node_deinit(proc_node * node);
 // Adds a node to the process tree represented by root. The node is added as
 // child of the node in root whose pid equals the ppid of the node being added.
 int proc_node_add(proc_node * root, const proc_node * node);
+// Adds a node like proc_node_add(), unless its name is already used in root.
+int proc_node_add_unique(proc_node * root, const proc_node * node);
+// Adds a clone of parent with pid, assigning it the next free clone name.
+proc_node * proc_node_add_clone(proc_node * root, proc_node * parent, pid_t pid);
 // Removes a *leaf* node from the tree represented by root.
 int proc_node_remove(proc_node * root, pid_t pid);
+// Removes a node and all its descendants from the tree represented by root.
+int proc_node_remove_subtree(proc_node * root, pid_t pid);
+// Sets the functions called for each node added to or removed from a tree.
+void proc_tree_observe(proc_tree_observer added, proc_tree_observer removed);
+// Finds node by pid recursively.
+proc_node * proc_node_find_by_pid(proc_node * node, pid_t pid);
 // Finds node by name recursively.
 proc_node * proc_node_find_by_name(proc_node * node, char * name);
 // Returns an array of pointers to proc_node, representing all the nodes
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <libgen.h>
+#include <getopt.h>
+#include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
+#include "common.h"
+#include "trace.h"
+
+// Sends a signal to a process, or to its whole subtree. The same binary is
+// installed as pstop and pcont, which send SIGSTOP and SIGCONT.
+// Processes created by pnew lead their own process group, which contains their
+// whole subtree, so a subtree rooted at such a process is signaled with a
+// single killpg(). Other subtrees are listed by pmanager first.
+// A signal that terminates the processes removes them from the tree in
+// pmanager. SIGTERM is rejected, because it is the request of a clean
+// termination handled by pclose and prmall.
+
+// Represents a process of the subtree, when it is listed by pmanager.
+typedef struct subtree_proc {
+  pid_t pid;
+  char * name;
+  // Index of the parent in subtree_procs, or -1 for the root of the subtree.
+  int parent;
+  // Whether the signal was delivered to the process.
+  int signaled;
+} subtree_proc;
+
+// Represents a signal that can be given by name.
+typedef struct signal_name {
+  const char * name;
+  int signum;
+} signal_name;
+
+// Signals that can be given by name, with or without the "SIG" prefix.
+const signal_name signal_names[] = {
+  {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ABRT", SIGABRT},
+  {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM},
+  {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+  {"WINCH", SIGWINCH}, {NULL, 0}
+};
+
+// Global variables.
+// Flag for --help
+int help_flag = 0;
+// Flag for --subtree
+int subtree_flag = 0;
+// Name used to run this command: psignal, pstop or pcont.
+const char * command_name = "psignal";
+// Processes of the subtree, in the order listed by pmanager (each process
+// before its descendants).
+subtree_proc * subtree_procs = NULL;
+// Number of processes and size of subtree_procs.
+int subtree_count = 0;
+int subtree_size = 0;
+
+// Option arguments.
+const char * short_options = "sh";
+const struct option long_options[] = {
+    {"subtree", no_argument, NULL, 's'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0}
+};
+
+// Utility functions.
+// Parses arguments and sets global flags.
+char * parse_args(int argc, char ** argv, int * signum);
+// Converts a signal name or number into a signal number.
+int parse_signal(const char * str);
+// Returns true if signum terminates a managed process.
+int is_lethal(int signum);
+// Adds a process listed by pmanager to subtree_procs.
+void add_subtree_proc(const char * proc_str, void * arg);
+// Removes the signaled processes from the tree in pmanager.
+int prune_signaled();
+// Asks pmanager to remove the subtree rooted at name.
+int prune(const char * name);
+// Prints help about this command.
+void print_help();
+// Performs cleanup operations on exit.
+void cleanup();
+
+void main(int argc, char ** argv) {
+
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
+  // The signal is fixed for pstop and pcont.
+  command_name = basename(argv[0]);
+  int signum = -1;
+  if (strcmp(command_name, "pstop") == 0) {
+    signum = SIGSTOP;
+  } else if (strcmp(command_name, "pcont") == 0) {
+    signum = SIGCONT;
+  } else {
+    command_name = "psignal";
+  }
+
+  // Check argv options.
+  char * proc_name = parse_args(argc, argv, &signum);
+
+  // If help_flag was set by parse_args(), print help and exit.
+  if (help_flag || proc_name == NULL || signum < 0) {
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+  if (signum == SIGTERM) {
+    fprintf(stderr, "Error: use pclose or prmall to terminate processes.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Register cleanup function to be called at process termination.
+  atexit(cleanup);
+
+  // Setup process communication.
+  if (message_setup() != 0) {
+    fprintf(stderr, "Error: failed to setup process communication.\n");
+    exit(EXIT_FAILURE);
+  }
+  timing_mark("setup");
+
+  // Read the pid of the process to signal from the tree published by pmanager
+  // (the parent process), or ask pmanager if it is not available or lacks the
+  // process: it is published after the replies to the messages handled, so a
+  // process just created may be missing.
+  pid_t pid = shm_tree_lookup_pid(message_pmanager_pid(), proc_name);
+  if (pid == -1) {
+    pid = message_lookup_pid(message_pmanager_pid(), proc_name);
+  }
+  timing_mark("lookup");
+  if (pid == -1) {
+    if (errno == ESRCH) {
+      fprintf(stderr, "Error: process not found.\n");
+    } else if (errno == ETIMEDOUT) {
+      fprintf(stderr, "Error: pmanager did not reply in time.\n");
+    } else {
+      fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n",
+              proc_name);
+    }
+    exit(EXIT_FAILURE);
+  }
+  if (pid == message_pmanager_pid()) {
+    fprintf(stderr, "Error: cannot signal pmanager.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int lethal = is_lethal(signum);
+  int status;
+  int group = subtree_flag && getpgid(pid) == pid;
+  if (group) {
+    // The process group contains exactly the subtree.
+    printf("Sending signal %d to process group %ld...\n", signum, (long) pid);
+    trace_record(TRACE_SIGNAL_SEND, -pid, 0, signum);
+    status = killpg(pid, signum);
+  } else {
+    // The subtree is listed to signal each process. A single process is
+    // listed too if it would be terminated, because processes with children
+    // cannot be removed from the tree alone.
+    if (subtree_flag || lethal) {
+      if (shm_tree_list(message_pmanager_pid(), proc_name, add_subtree_proc, NULL) != 0 &&
+          message_list(message_pmanager_pid(), proc_name, add_subtree_proc, NULL) != 0) {
+        fprintf(stderr, "Error: failed to get process list.\n");
+        exit(EXIT_FAILURE);
+      }
+      if (!subtree_flag && subtree_count > 1) {
+        fprintf(stderr, "Error: process has children, use --subtree.\n");
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      add_subtree_proc(NULL, &pid);
+    }
+    printf("Sending signal %d to %d process%s...\n", signum, subtree_count,
+           (subtree_count == 1) ? "" : "es");
+    status = 0;
+    int i;
+    for (i = 0; i < subtree_count; i++) {
+      trace_record(TRACE_SIGNAL_SEND, subtree_procs[i].pid, 0, signum);
+      if (kill(subtree_procs[i].pid, signum) == 0) {
+        subtree_procs[i].signaled = 1;
+      } else {
+        status = -1;
+      }
+    }
+  }
+  timing_mark("signal");
+  if (status != 0) {
+    fprintf(stderr, "Error: failed to send signal.\n");
+  }
+
+  // Terminated processes are removed from the tree, with their subtree. Only
+  // the processes that received the signal are removed: the others are still
+  // alive and keep their names. A process group that could not be signaled is
+  // left untouched, as it is not known which of its processes were reached.
+  if (lethal) {
+    int prune_status = 0;
+    if (group) {
+      if (status == 0) {
+        prune_status = prune(proc_name);
+      }
+    } else {
+      prune_status = prune_signaled();
+    }
+    if (prune_status != 0) {
+      fprintf(stderr, "Error: failed to remove processes from tree.\n");
+      status = -1;
+    }
+    timing_mark("prune");
+  }
+
+  exit((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
+
+// Parses arguments from main()'s argv and sets global flags.
+//
+// argc: the number of arguments
+// argv: the array of strings containing arguments
+// signum: where the signal is stored. If it is already set (pstop, pcont), no
+//         signal argument is expected.
+//
+// Returns: the process name passed as argument, or NULL if not present.
+char * parse_args(int argc, char ** argv, int * signum) {
+  char option;
+  while ((option = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (option) {
+      case 's':
+        subtree_flag = 1;
+        break;
+      case 'h':
+        help_flag = 1;
+        break;
+    }
+  }
+  // Check that process name and signal were supplied.
+  int expected = (*signum == -1) ? 2 : 1;
+  if (argc - optind != expected) {
+    return NULL;
+  }
+  if (*signum == -1) {
+    *signum = parse_signal(argv[optind + 1]);
+  }
+  return argv[optind];
+}
+
+// Converts a signal name (e.g. "STOP" or "SIGSTOP") or number into a signal
+// number.
+//
+// str: the name or number of the signal
+//
+// Returns: the signal number, or -1 if str is not a valid signal.
+int parse_signal(const char * str) {
+  char * end;
+  long number = strtol(str, &end, 10);
+  if (*str != '\0' && *end == '\0') {
+    return (number > 0 && number <= SIGRTMAX) ? number : -1;
+  }
+  if (strncasecmp(str, "SIG", 3) == 0) {
+    str += 3;
+  }
+  int i;
+  for (i = 0; signal_names[i].name != NULL; i++) {
+    if (strcasecmp(str, signal_names[i].name) == 0) {
+      return signal_names[i].signum;
+    }
+  }
+  return -1;
+}
+
+// Returns true if the default action of signum terminates the process. Managed
+// processes only handle SIGTERM and SIGCHLD, and ignore SIGPIPE.
+//
+// signum: the signal number
+int is_lethal(int signum) {
+  switch (signum) {
+    case SIGCHLD:
+    case SIGCONT:
+    case SIGSTOP:
+    case SIGTSTP:
+    case SIGTTIN:
+    case SIGTTOU:
+    case SIGURG:
+    case SIGWINCH:
+    case SIGPIPE:
+      return 0;
+  }
+  return 1;
+}
+
+// Adds a process to subtree_procs.
+//
+// proc_str: the process listed by pmanager, formatted as <pid>;<ppid>;<name>,
+//           or NULL if arg points to the PID. The name is not known then, as
+//           it is only needed to remove terminated processes.
+// arg: a pointer to the PID, used if proc_str is NULL
+void add_subtree_proc(const char * proc_str, void * arg) {
+  if (subtree_count == subtree_size) {
+    int size = (subtree_size == 0) ? 16 : subtree_size * 2;
+    subtree_proc * tmp = realloc(subtree_procs, sizeof(subtree_proc) * size);
+    if (tmp == NULL) {
+      return;
+    }
+    subtree_procs = tmp;
+    subtree_size = size;
+  }
+  subtree_proc * proc = &subtree_procs[subtree_count];
+  proc->parent = -1;
+  proc->signaled = 0;
+  if (proc_str == NULL) {
+    proc->pid = *(pid_t *) arg;
+    proc->name = NULL;
+  } else {
+    char * end;
+    proc->pid = strtol(proc_str, &end, 10);
+    pid_t ppid = strtol(end + 1, &end, 10);
+    proc->name = strdup(end + 1);
+    // The parent was listed before the process, usually shortly before.
+    int i;
+    for (i = subtree_count - 1; i >= 0; i--) {
+      if (subtree_procs[i].pid == ppid) {
+        proc->parent = i;
+        break;
+      }
+    }
+  }
+  subtree_count++;
+}
+
+// Removes the signaled processes from the tree in pmanager. A process is
+// removed with its subtree, so only the processes whose whole subtree was
+// signaled are removed. If every process was signaled, the subtree is removed
+// with a single request.
+//
+// Returns: 0 on success, -1 if a request failed.
+int prune_signaled() {
+  // A process is complete if it and all its descendants were signaled. A
+  // process whose name could not be stored is never removed.
+  // Descendants are listed after their ancestors, so visiting the list
+  // backwards propagates incomplete processes up to the root.
+  int * complete = malloc(sizeof(int) * subtree_count);
+  if (complete == NULL) {
+    return -1;
+  }
+  int i;
+  for (i = 0; i < subtree_count; i++) {
+    complete[i] = subtree_procs[i].signaled && subtree_procs[i].name != NULL;
+  }
+  for (i = subtree_count - 1; i > 0; i--) {
+    if (!complete[i] && subtree_procs[i].parent != -1) {
+      complete[subtree_procs[i].parent] = 0;
+    }
+  }
+  // Remove the largest complete subtrees: complete processes whose parent is
+  // not complete.
+  int status = 0;
+  for (i = 0; i < subtree_count; i++) {
+    int parent = subtree_procs[i].parent;
+    if (complete[i] && (parent == -1 || !complete[parent])) {
+      if (prune(subtree_procs[i].name) != 0) {
+        status = -1;
+      }
+    }
+  }
+  free(complete);
+  return status;
+}
+
+// Asks pmanager to remove the subtree rooted at name, and waits for the reply.
+//
+// name: the name of the root of the subtree
+//
+// Returns: 0 on success, -1 on failure.
+int prune(const char * name) {
+  message_t * response = NULL;
+  if (message_send(message_pmanager_pid(), MSG_PRUNE, name) == 0) {
+    response = message_wait_timeout(message_pmanager_pid(), message_default_timeout());
+  }
+  int status = (response != NULL && strcmp(response->type, MSG_SUCCESS) == 0) ? 0 : -1;
+  message_deinit(response);
+  return status;
+}
+
+// Prints help about this command. Called on -h (--help) option.
+void print_help() {
+  printf("Usage:\n");
+  if (strcmp(command_name, "psignal") == 0) {
+    printf(" psignal [OPTIONS] <NAME> <SIGNAL>\n");
+    printf(" Send <SIGNAL> (a number, or a name such as KILL or SIGUSR1) to process\n");
+    printf(" with name <NAME>. Processes terminated by the signal are removed from\n");
+    printf(" the tree. Use pclose or prmall for SIGTERM.\n");
+  } else {
+    printf(" %s [OPTIONS] <NAME>\n", command_name);
+    printf(" %s process with name <NAME>.\n",
+           (strcmp(command_name, "pstop") == 0) ? "Stop" : "Resume");
+  }
+  printf("\n");
+  printf("Options:\n");
+  printf(" -s, --subtree       signal all the processes in the subtree of <NAME>\n");
+  printf(" -h, --help          show this help\n");
+}
+
+// Performs cleanup operations.
+void cleanup() {
+  // Close and remove inbox.
+  message_teardown();
+  int i;
+  for (i = 0; i < subtree_count; i++) {
+    free(subtree_procs[i].name);
+  }
+  free(subtree_procs);
+}
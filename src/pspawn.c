@@ -1,23 +1,29 @@
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
 #include "common.h"
 
-// Global variables accessed by cleanup().
-// Output stream of pinfo.
-FILE * pinfo_output = NULL;
-// File descriptor of FIFO.
-int fifo_fd = -1;
+// Global variables.
 // Flag for --help
 int help_flag = 0;
+// Value of --count
+int clones_count = 1;
+// Flag for --tree
+int tree_flag = 0;
 
 // Option arguments.
-const char * short_options = "h";
+const char * short_options = "c:th";
 const struct option long_options[] = {
+    {"count", required_argument, NULL, 'c'},
+    {"tree", no_argument, NULL, 't'},
     {"help", no_argument, NULL, 'h'},
     {0, 0, 0, 0}
 };
@@ -32,11 +38,15 @@ void cleanup();
 
 void main(int argc, char ** argv) {
 
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
   // Check argv options.
   char * proc_name = parse_args(argc, argv);
 
   // If help_flag was set by parse_args(), print help and exit.
-  if (help_flag || proc_name == NULL) {
+  if (help_flag || proc_name == NULL || clones_count <= 0 ||
+      (tree_flag && clones_count != 1)) {
     print_help();
     exit(EXIT_FAILURE);
   }
@@ -44,60 +54,53 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
-  }
-
   // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
+  if (message_setup() != 0) {
     fprintf(stderr, "Error: failed to setup process communication.\n");
     exit(EXIT_FAILURE);
   }
-
-  // Execute pinfo to obtain pid of the process to spawn.
-  // stderr is redirected to /dev/null to ensure that the only output pinfo
-  // can print is the pid of the requested process.
-
-  // Create string of command to execute.
-  char * cmd;
-  if (asprintf(&cmd, "pinfo --pid-pmanager %ld --pid-only %s 2>/dev/null",
-      (long) getppid(), proc_name) == -1) {
-    fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n",
-            proc_name);
-    exit(EXIT_FAILURE);
-  }
-
-  // Execute pinfo and read its output.
-  pinfo_output = popen(cmd, "r");
-  free(cmd);
-  if (pinfo_output == NULL) {
-    fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n",
-            proc_name);
-    exit(EXIT_FAILURE);
+  timing_mark("setup");
+
+  // Read the pid of the process to spawn from the tree published by pmanager
+  // (the parent process), or ask pmanager if it is not available or lacks the
+  // process: it is published after the replies to the messages handled, so a
+  // process just created may be missing.
+  pid_t pid = shm_tree_lookup_pid(message_pmanager_pid(), proc_name);
+  if (pid == -1) {
+    pid = message_lookup_pid(message_pmanager_pid(), proc_name);
   }
-  // Read a single line from output.
-  char * pid_str;
-  size_t n = 0;
-  ssize_t count = getline(&pid_str, &n, pinfo_output);
-  if (count == -1) {
-    fprintf(stderr, "Error: process not found.\n");
+  timing_mark("lookup");
+  if (pid == -1) {
+    if (errno == ESRCH) {
+      fprintf(stderr, "Error: process not found.\n");
+    } else if (errno == ETIMEDOUT) {
+      fprintf(stderr, "Error: pmanager did not reply in time.\n");
+    } else {
+      fprintf(stderr, "Error: failed to obtain information about process \"%s\".\n",
+              proc_name);
+    }
     exit(EXIT_FAILURE);
   }
 
-  // Convert string to pid_t.
-  pid_t pid = atol(pid_str);
-  free(pid_str);
-  // Send MSG_SPAWN to process.
+  // Send MSG_SPAWN to process, with the number of clones as content, or
+  // MSG_SPAWN_TREE to clone its subtree.
   printf("Sending clonation request to %ld...\n", (long) pid);
-  if (message_send(pid, MSG_SPAWN, NULL) != 0) {
+  char count_str[16];
+  snprintf(count_str, sizeof(count_str), "%d", clones_count);
+  int status = tree_flag ? message_send(pid, MSG_SPAWN_TREE, NULL) :
+                           message_send(pid, MSG_SPAWN, count_str);
+  if (status != 0) {
     fprintf(stderr, "Error: failed to send clonation request.\n");
     exit(EXIT_FAILURE);
   }
 
   // By default, on MSG_SPAWN the process will reply with a MSG_SUCCESS.
-  message_t * response = message_wait(pid);
+  message_t * response = message_wait_timeout(pid, message_default_timeout());
+  timing_mark("clone");
+  if (response == NULL) {
+    fprintf(stderr, "Error: process %ld did not reply in time.\n", (long) pid);
+    exit(EXIT_FAILURE);
+  }
   message_deinit(response);
 
   exit(EXIT_SUCCESS);
@@ -111,12 +114,15 @@ void main(int argc, char ** argv) {
 //
 // Returns: the process name passed as argument, or NULL if not present.
 char * parse_args(int argc, char ** argv) {
-  if (argc != 2) {
-    return NULL;
-  }
   char option;
   while ((option = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
     switch (option) {
+      case 'c':
+        clones_count = atoi(optarg);
+        break;
+      case 't':
+        tree_flag = 1;
+        break;
       case 'h':
         help_flag = 1;
         break;
@@ -132,22 +138,19 @@ char * parse_args(int argc, char ** argv) {
 // Prints help about this command. Called on -h (--help) option.
 void print_help() {
   printf("Usage:\n");
-  printf(" pspawn <NAME>\n");
-  printf(" Clone process with name <NAME>. The name of the child will be <NAME_i>, where\n");
-  printf(" i is an integer incremented by one on each clonation.\n");
+  printf(" pspawn [OPTIONS] <NAME>\n");
+  printf(" Clone process with name <NAME>. The name of each clone will be <NAME_i>,\n");
+  printf(" where i is an integer assigned by pmanager, incremented on each clonation.\n");
   printf("\n");
   printf("Options:\n");
+  printf(" -c, --count=N       create N clones at once (default: 1)\n");
+  printf(" -t, --tree          clone the whole subtree rooted at <NAME>, keeping its\n");
+  printf("                     shape. Each new process is named after its new parent.\n");
   printf(" -h, --help          show this help\n");
 }
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
-  // Close pinfo output stream.
-  if (pinfo_output != NULL) {
-    pclose(pinfo_output);
-  }
+  // Close and remove inbox.
+  message_teardown();
 }
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "common.h"
+#include "message.h"
+#include "timing.h"
+
+// Prints the statistics kept by pmanager for each type of message: number of
+// messages and their rate, bytes sent by the handlers, and percentiles of the
+// time spent in the inbox of pmanager (QUEUE) and in the handler (HANDLER).
+
+// Represents the statistics of a type of message.
+typedef struct type_entry {
+  char name[32];
+  unsigned long long count;
+  unsigned long long bytes;
+  // Percentiles 50, 99 and 99.9 of queue and handler times, in nanoseconds.
+  long long queue[3];
+  long long handler[3];
+} type_entry;
+
+// Global variables.
+// Flag for --help
+int help_flag = 0;
+// Flag for --reset
+int reset_flag = 0;
+// Entries received from pmanager, and their number.
+type_entry * entries = NULL;
+int entries_count = 0;
+
+// Option arguments.
+const char * short_options = "rh";
+const struct option long_options[] = {
+    {"reset", no_argument, NULL, 'r'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0}
+};
+
+// Utility functions.
+// Performs cleanup operations on exit.
+void cleanup();
+// Parses arguments and sets global flags.
+void parse_args(int argc, char ** argv);
+// Prints help about this command.
+void print_help();
+// Adds an entry received from pmanager.
+int add_entry(const char * entry_str);
+// Prints the entries as a table.
+void print_entries(double window);
+
+void main(int argc, char ** argv) {
+
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
+  // Check argv options.
+  parse_args(argc, argv);
+
+  // If help_flag was set by parse_args(), print help and exit.
+  if (help_flag) {
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+
+  // Register cleanup function to be called at process termination.
+  atexit(cleanup);
+
+  // Setup process communication.
+  if (message_setup() != 0) {
+    fprintf(stderr, "Error: failed to setup process communication.\n");
+    exit(EXIT_FAILURE);
+  }
+  timing_mark("setup");
+
+  // Request statistics from pmanager (the parent process), which sends an entry
+  // for each type of message and then the time they cover.
+  pid_t pmanager = message_pmanager_pid();
+  if (message_send(pmanager, MSG_STATS, reset_flag ? MSG_STATS_RESET : NULL) != 0) {
+    fprintf(stderr, "Error: failed to send message.\n");
+    exit(EXIT_FAILURE);
+  }
+  int error = 0;
+  while (1) {
+    message_t * response = message_wait_timeout(pmanager, message_default_timeout());
+    if (response == NULL) {
+      error = 1;
+      break;
+    }
+    int done = 1;
+    if (strcmp(response->type, MSG_INFO) == 0) {
+      error = add_entry(response->content) != 0;
+      done = error;
+    } else if (strcmp(response->type, MSG_SUCCESS) == 0) {
+      print_entries(atoll(response->content) / 1e9);
+    } else {
+      error = 1;
+    }
+    message_deinit(response);
+    if (done) {
+      break;
+    }
+  }
+  timing_mark("stats");
+  if (error) {
+    fprintf(stderr, "Error: failed to get statistics.\n");
+  } else if (reset_flag) {
+    printf("Statistics reset.\n");
+  }
+
+  exit(error ? EXIT_FAILURE : EXIT_SUCCESS);
+
+}
+
+// Adds an entry received from pmanager, formatted as
+// <name>;<count>;<bytes>;<queue p50>;<queue p99>;<queue p999>;<handler p50>;
+// <handler p99>;<handler p999>.
+//
+// entry_str: the content of the message
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int add_entry(const char * entry_str) {
+  type_entry * tmp = realloc(entries, sizeof(type_entry) * (entries_count + 1));
+  if (tmp == NULL) {
+    return -1;
+  }
+  entries = tmp;
+  type_entry * entry = &entries[entries_count];
+  if (sscanf(entry_str, "%31[^;];%llu;%llu;%lld;%lld;%lld;%lld;%lld;%lld",
+             entry->name, &entry->count, &entry->bytes,
+             &entry->queue[0], &entry->queue[1], &entry->queue[2],
+             &entry->handler[0], &entry->handler[1], &entry->handler[2]) != 9) {
+    return -1;
+  }
+  entries_count++;
+  return 0;
+}
+
+// Prints the entries as a table, with times in microseconds.
+//
+// window: the time covered by the statistics, in seconds
+void print_entries(double window) {
+  printf("Messages handled in the last %.2f s.\n\n", window);
+  printf("%-10s %9s %9s %11s | %24s | %24s\n", "", "", "", "",
+         "QUEUE (us)", "HANDLER (us)");
+  printf("%-10s %9s %9s %11s | %7s %8s %7s | %7s %8s %7s\n", "TYPE", "COUNT",
+         "RATE/s", "BYTES", "p50", "p99", "p999", "p50", "p99", "p999");
+  int i;
+  for (i = 0; i < entries_count; i++) {
+    const type_entry * entry = &entries[i];
+    printf("%-10s %9llu %9.1f %11llu | %7.1f %8.1f %7.1f | %7.1f %8.1f %7.1f\n",
+           entry->name, entry->count, (window > 0) ? entry->count / window : 0.0,
+           entry->bytes, entry->queue[0] / 1e3, entry->queue[1] / 1e3,
+           entry->queue[2] / 1e3, entry->handler[0] / 1e3,
+           entry->handler[1] / 1e3, entry->handler[2] / 1e3);
+  }
+}
+
+// Parses arguments from main()'s argv and sets global flags.
+//
+// argc: the number of arguments
+// argv: the array of strings containing arguments
+void parse_args(int argc, char ** argv) {
+  char option;
+  while ((option = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (option) {
+      case 'r':
+        reset_flag = 1;
+        break;
+      case 'h':
+      default:
+        help_flag = 1;
+        break;
+    }
+  }
+  if (optind != argc) {
+    help_flag = 1;
+  }
+}
+
+// Prints help about this command. Called on -h (--help) option.
+void print_help() {
+  printf("Usage:\n");
+  printf(" pstats [OPTIONS]\n");
+  printf(" Print statistics about the messages handled by pmanager: count, rate,\n");
+  printf(" bytes sent in reply, and percentiles of the time spent waiting in the\n");
+  printf(" inbox (QUEUE) and in the handler (HANDLER).\n");
+  printf("\n");
+  printf("Options:\n");
+  printf(" -r, --reset         reset the statistics after printing them\n");
+  printf(" -h, --help          show this help\n");
+}
+
+// Performs cleanup operations.
+void cleanup() {
+  // Close and remove inbox.
+  message_teardown();
+  free(entries);
+}
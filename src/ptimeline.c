@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "message.h"
+
+// Merges the event rings written by processes started with pmanager --trace
+// DIR into a single timeline, in the JSON format of Chrome traces (loaded by
+// chrome://tracing or Perfetto). Events are sorted by time, which is shared by
+// all the processes (CLOCK_MONOTONIC). A message_wait() still blocked when the
+// rings were read appears as a slice without end.
+//
+// Usage: ptimeline [-o FILE] DIR
+
+// Represents an event read from a ring, with the process that recorded it.
+typedef struct timeline_event {
+  trace_event event;
+  pid_t pid;
+} timeline_event;
+
+// Names of message types, used to label events.
+const char * const type_names[][2] = {
+  {MSG_ADD, "add"}, {MSG_REMOVE, "remove"}, {MSG_INFO, "info"},
+  {MSG_ERROR, "error"}, {MSG_SUCCESS, "success"}, {MSG_LIST, "list"},
+  {MSG_SPAWN, "spawn"}, {MSG_ADD_BATCH, "add_batch"},
+  {MSG_SPAWN_TREE, "spawn_tree"}, {MSG_ZYGOTE, "zygote"}, {MSG_CLAIM, "claim"},
+  {MSG_NAME, "name"}, {MSG_PRUNE, "prune"}, {MSG_STATS, "stats"},
+  {MSG_TIMING, "timing"}, {MSG_TIMEOUT, "timeout"}, {NULL, NULL}
+};
+
+// Global variables.
+// Events read from all the rings.
+timeline_event * events = NULL;
+int events_count = 0;
+int events_size = 0;
+// Number of entries printed in the JSON array.
+int entries_printed = 0;
+
+// Utility functions.
+// Reads the events of a ring file, and prints the name of its process.
+int read_ring(const char * path, FILE * output);
+// Adds an event read from a ring.
+int add_event(const trace_event * event, pid_t pid);
+// Starts a new entry of the JSON array.
+void open_entry(FILE * output);
+// Prints an event in the JSON format of Chrome traces.
+void print_event(const timeline_event * entry, long long origin, FILE * output);
+// Returns the name of a message type.
+const char * type_name(char type);
+// Comparison function for qsort(), sorting events by time.
+int compare_time(const void * a, const void * b);
+// Prints help about this command.
+void print_help();
+
+void main(int argc, char ** argv) {
+
+  const char * output_path = NULL;
+  struct option long_options[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0}
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "o:h", long_options, NULL)) != -1) {
+    switch (option) {
+      case 'o':
+        output_path = optarg;
+        break;
+      default:
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc - 1) {
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+
+  FILE * output = (output_path == NULL) ? stdout : fopen(output_path, "w");
+  if (output == NULL) {
+    fprintf(stderr, "Error: cannot open \"%s\" for writing.\n", output_path);
+    exit(EXIT_FAILURE);
+  }
+  DIR * dir = opendir(argv[optind]);
+  if (dir == NULL) {
+    fprintf(stderr, "Error: cannot open directory \"%s\".\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Process names are printed as metadata events while reading the rings.
+  fprintf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  int rings = 0;
+  struct dirent * file;
+  while ((file = readdir(dir)) != NULL) {
+    size_t len = strlen(file->d_name);
+    if (len < 5 || strcmp(file->d_name + len - 5, ".ring") != 0) {
+      continue;
+    }
+    char * path;
+    if (asprintf(&path, "%s/%s", argv[optind], file->d_name) == -1) {
+      continue;
+    }
+    if (read_ring(path, output) == 0) {
+      rings++;
+    } else {
+      fprintf(stderr, "Warning: skipping invalid ring \"%s\".\n", path);
+    }
+    free(path);
+  }
+  closedir(dir);
+
+  // Print the events of all the processes in chronological order, with times
+  // relative to the first one.
+  qsort(events, events_count, sizeof(timeline_event), compare_time);
+  long long origin = (events_count > 0) ? events[0].event.time : 0;
+  int i;
+  for (i = 0; i < events_count; i++) {
+    print_event(&events[i], origin, output);
+  }
+  fprintf(output, "\n]}\n");
+  if (output != stdout) {
+    fclose(output);
+  }
+  fprintf(stderr, "%d events from %d processes.\n", events_count, rings);
+  free(events);
+
+  exit(EXIT_SUCCESS);
+}
+
+// Reads the valid events of a ring file, i.e. those not overwritten or being
+// written, and prints the name of its process as a metadata event.
+//
+// path: the path of the ring file
+// output: the stream of the timeline
+//
+// Returns: on success, 0 is returned; on failure (e.g. invalid ring), -1 is
+// returned.
+int read_ring(const char * path, FILE * output) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  void * map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(trace_header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  const trace_header * header = map;
+  const trace_event * ring = (const trace_event *) (header + 1);
+  int status = -1;
+  if (header->magic == TRACE_MAGIC && header->capacity > 0 &&
+      st.st_size >= sizeof(trace_header) + sizeof(trace_event) * header->capacity) {
+    status = 0;
+    // Characters that would need escaping in JSON are replaced.
+    char name[sizeof(header->name) + 1];
+    memcpy(name, header->name, sizeof(header->name));
+    name[sizeof(header->name)] = '\0';
+    char * c;
+    for (c = name; *c != '\0'; c++) {
+      if (*c == '"' || *c == '\\' || (unsigned char) *c < ' ') {
+        *c = '_';
+      }
+    }
+    open_entry(output);
+    fprintf(output, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"%s (%d)\"}}", header->pid, name, header->pid);
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    uint64_t first = (head > header->capacity) ? head - header->capacity : 0;
+    uint64_t i;
+    for (i = first; i < head && status == 0; i++) {
+      const trace_event * event = &ring[i % header->capacity];
+      if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) == (uint32_t) (i + 1)) {
+        status = add_event(event, header->pid);
+      }
+    }
+  }
+  munmap(map, st.st_size);
+  return status;
+}
+
+// Adds an event read from a ring to events.
+//
+// event: the event
+// pid: the PID of the process that recorded it
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int add_event(const trace_event * event, pid_t pid) {
+  if (events_count == events_size) {
+    int size = (events_size == 0) ? 1024 : events_size * 2;
+    timeline_event * tmp = realloc(events, sizeof(timeline_event) * size);
+    if (tmp == NULL) {
+      return -1;
+    }
+    events = tmp;
+    events_size = size;
+  }
+  events[events_count].event = *event;
+  events[events_count].pid = pid;
+  events_count++;
+  return 0;
+}
+
+// Prints an event in the JSON format of Chrome traces. Handlers are complete
+// events with a duration, waits are begin/end pairs, and the other events are
+// instants.
+//
+// entry: the event
+// origin: the time corresponding to 0 in the timeline
+// output: the stream of the timeline
+void print_event(const timeline_event * entry, long long origin, FILE * output) {
+  const trace_event * event = &entry->event;
+  double ts = (event->time - origin) / 1000.0;
+  open_entry(output);
+  fprintf(output, "{\"pid\":%d,\"tid\":%d,\"ts\":%.3f,", entry->pid, event->tid, ts);
+  switch (event->kind) {
+    case TRACE_SEND:
+      fprintf(output, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"send %s\","
+              "\"args\":{\"to\":%d,\"bytes\":%u}", type_name(event->msg_type),
+              event->peer, event->arg);
+      break;
+    case TRACE_RECV:
+      fprintf(output, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"recv %s\","
+              "\"args\":{\"from\":%d,\"latency_us\":%u}",
+              type_name(event->msg_type), event->peer, event->arg);
+      break;
+    case TRACE_SIGNAL_SEND:
+      fprintf(output, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"kill %u\","
+              "\"args\":{\"to\":%d}", event->arg, event->peer);
+      break;
+    case TRACE_SIGNAL_RECV:
+      fprintf(output, "\"ph\":\"i\",\"s\":\"p\",\"name\":\"signal %u\","
+              "\"args\":{\"from\":%d}", event->arg, event->peer);
+      break;
+    case TRACE_HANDLER:
+      fprintf(output, "\"ph\":\"X\",\"dur\":%.3f,\"name\":\"handle %s\","
+              "\"args\":{\"from\":%d}", event->arg / 1000.0,
+              type_name(event->msg_type), event->peer);
+      break;
+    case TRACE_WAIT_BEGIN:
+      fprintf(output, "\"ph\":\"B\",\"name\":\"message_wait\",\"args\":{\"from\":%d}",
+              event->peer);
+      break;
+    case TRACE_WAIT_END:
+      fprintf(output, "\"ph\":\"E\"");
+      break;
+    default:
+      fprintf(output, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"unknown %d\"", event->kind);
+  }
+  fprintf(output, "}");
+}
+
+// Starts a new entry of the JSON array, separating it from the previous one.
+//
+// output: the stream of the timeline
+void open_entry(FILE * output) {
+  if (entries_printed++ > 0) {
+    fprintf(output, ",\n");
+  }
+}
+
+// Returns the name of a message type, e.g. "add" for MSG_ADD.
+//
+// type: the first character of the type
+const char * type_name(char type) {
+  int i;
+  for (i = 0; type_names[i][0] != NULL; i++) {
+    if (type_names[i][0][0] == type) {
+      return type_names[i][1];
+    }
+  }
+  return "?";
+}
+
+// Comparison function for qsort(), sorting events by time, and then by PID.
+int compare_time(const void * a, const void * b) {
+  const timeline_event * x = a;
+  const timeline_event * y = b;
+  if (x->event.time != y->event.time) {
+    return (x->event.time > y->event.time) - (x->event.time < y->event.time);
+  }
+  return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+// Prints help about this command.
+void print_help() {
+  printf("Usage:\n");
+  printf(" ptimeline [OPTIONS] <DIR>\n");
+  printf(" Merge the event rings written in <DIR> by pmanager --trace <DIR> and by\n");
+  printf(" its processes into a timeline in Chrome trace format (JSON).\n");
+  printf("\n");
+  printf("Options:\n");
+  printf(" -o, --output=FILE   write the timeline to FILE instead of stdout\n");
+  printf(" -h, --help          show this help\n");
+}
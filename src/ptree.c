@@ -2,15 +2,16 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include "message.h"
+#include "timing.h"
+#include "shm_tree.h"
 #include "proc_tree.h"
 #include "common.h"
 
 // Global variables accessed by cleanup().
-// File descriptor of FIFO.
-int fifo_fd = -1;
 // Process tree.
 proc_node * proc_tree_root = NULL;
 // Flag for --help
@@ -31,10 +32,13 @@ void print_help();
 // Performs cleanup operations on exit.
 void cleanup();
 // Adds process to local process tree for later print.
-void add_process_to_tree(proc_node ** root, const char * proc_str);
+void add_process_to_tree(const char * proc_str, void * root);
 
 void main(int argc, char ** argv) {
 
+  // Mark the end of exec(), for pmanager --timing.
+  timing_mark("exec");
+
   // Check argv options.
   parse_args(argc, argv);
 
@@ -47,56 +51,23 @@ void main(int argc, char ** argv) {
   // Register cleanup function to be called at process termination.
   atexit(cleanup);
 
-  // Open FIFO.
-  if ((fifo_fd = open(FIFO_NAME, O_RDWR | O_NONBLOCK)) == -1) {
-    fprintf(stderr, "Error: failed to open FIFO.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Setup process communication.
-  if (message_setup(fifo_fd) != 0) {
-    fprintf(stderr, "Error: failed to setup process communication.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Ask pmanager to send information about *all* processes started by pmanager.
-  if (message_send(getppid(), MSG_LIST, "pmanager") != 0) {
-    fprintf(stderr, "Error: failed to send message.\n");
-    exit(EXIT_FAILURE);
+  // Populate proc_tree_root with processes read from the tree published by
+  // pmanager. If it is not available, ask pmanager.
+  int list_end = shm_tree_list(message_pmanager_pid(), "pmanager", add_process_to_tree,
+                               &proc_tree_root) == 0;
+  if (!list_end) {
+    // Setup process communication.
+    if (message_setup() != 0) {
+      fprintf(stderr, "Error: failed to setup process communication.\n");
+      exit(EXIT_FAILURE);
+    }
+    timing_mark("setup");
+    list_end = message_list(message_pmanager_pid(), "pmanager", add_process_to_tree,
+                            &proc_tree_root) == 0;
   }
-
-  int list_end = 0;
-  int error = 0;
-
-  // Populate proc_tree_root with processes received from pmanager, until
-  // there are no more processes left or an error is encountered.
-  while (!list_end && !error) {
-      // Wait response from pmanager.
-      message_t * response = message_wait(getppid());
-
-      // Check response type.
-      if (response == NULL) {
-        fprintf(stderr, "Error: failed to read message.\n");
-        error = 1;
-      } else if (strcmp(response->type, MSG_INFO) == 0) {
-        // Add received process to process tree.
-        add_process_to_tree(&proc_tree_root, response->content);
-        // Inform pmanager that message was received.
-        if (message_send(getppid(), MSG_SUCCESS, NULL) != 0) {
-          fprintf(stderr, "Error: failed to send message.\n");
-          error = 1;
-        }
-      } else if (strcmp(response->type, MSG_SUCCESS) == 0) {
-        // MSG_SUCCESS means pmanager has finished sending processes, so end loop.
-        list_end = 1;
-      } else if (strcmp(response->type, MSG_ERROR) == 0) {
-        fprintf(stderr, "Error: %s.\n", response->content);
-        error = 1;
-      } else {
-        fprintf(stderr, "Error: unrecognized message.\n");
-        error = 1;
-      }
-      message_deinit(response);
+  timing_mark("list");
+  if (!list_end) {
+    fprintf(stderr, "Error: failed to get process list.\n");
   }
 
   // If end of list was reached, print process tree.
@@ -111,9 +82,10 @@ void main(int argc, char ** argv) {
 
 // Add process represented by proc_str to process tree pointed by *root.
 //
-// root: a pointer to the proc_node* to which the process is added
 // proc_str: the string representation of the process to add
-void add_process_to_tree(proc_node **root, const char * proc_str) {
+// root_ptr: a pointer to the proc_node* to which the process is added
+void add_process_to_tree(const char * proc_str, void * root_ptr) {
+  proc_node ** root = root_ptr;
   proc_node *new_node = proc_node_fromstr(proc_str);
   if(*root == NULL)
     *root = new_node;
@@ -154,10 +126,8 @@ void print_help() {
 
 // Performs cleanup operations.
 void cleanup() {
-  // Close FIFO.
-  if (fifo_fd != -1) {
-    close(fifo_fd);
-  }
+  // Close and remove inbox.
+  message_teardown();
   // Free process tree.
   proc_node_deinit(proc_tree_root);
 }
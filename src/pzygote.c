@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "message.h"
+#include "child.h"
+
+// Helper started by pmanager when the pool of zygotes is enabled. It keeps
+// size idle zygotes, i.e. processes already waiting in child_zygote() for a
+// name, and forks a replacement each time pmanager reports that one of them
+// was claimed. Claimed zygotes remain children of this process, which reaps
+// them when they terminate. On SIGTERM, idle zygotes are killed.
+//
+// Usage: pzygote SIZE
+
+// PID of pmanager.
+pid_t pmanager = -1;
+// PIDs of the idle zygotes.
+pid_t * idle = NULL;
+// Number of idle zygotes.
+int idle_count = 0;
+// Flags set by signal handlers.
+volatile sig_atomic_t term_flag = 0;
+volatile sig_atomic_t chld_flag = 0;
+
+// Utility functions.
+// Forks a new zygote and adds it to the idle ones.
+void fork_zygote();
+// Removes pid from the idle zygotes.
+int remove_idle(pid_t pid);
+// Reaps terminated children.
+void reap_children();
+// Kills the idle zygotes and exits.
+void shutdown_pool();
+// Handler for SIGTERM and SIGCHLD.
+void signal_handler(int signum);
+
+void main(int argc, char ** argv) {
+
+  int size = (argc == 2) ? atoi(argv[1]) : 0;
+  if (size <= 0) {
+    fprintf(stderr, "Usage: pzygote SIZE\n");
+    exit(EXIT_FAILURE);
+  }
+  pmanager = getppid();
+  idle = malloc(sizeof(pid_t) * size);
+
+  if (idle == NULL || message_setup() != 0) {
+    fprintf(stderr, "Error: failed to setup process communication.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Signals are blocked, and only delivered while waiting in ppoll(). Zygotes
+  // inherit the mask, so SIGTERM stays blocked until they are claimed.
+  struct sigaction action;
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = signal_handler;
+  action.sa_flags = 0;
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGCHLD, &action, NULL);
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &blocked, NULL);
+  sigset_t mask;
+  sigemptyset(&mask);
+
+  // Flush output before forking, so that it is not written again by zygotes.
+  fflush(NULL);
+  int i;
+  for (i = 0; i < size; i++) {
+    fork_zygote();
+  }
+
+  while (1) {
+    struct pollfd pfd;
+    pfd.fd = message_fd();
+    pfd.events = POLLIN;
+    ppoll(&pfd, 1, NULL, &mask);
+    if (term_flag) {
+      shutdown_pool();
+    }
+    if (chld_flag) {
+      chld_flag = 0;
+      reap_children();
+    }
+    // pmanager reports each claimed zygote, whose place is taken by a new one.
+    message_t * msg;
+    while ((msg = message_read()) != NULL) {
+      if (strcmp(msg->type, MSG_ZYGOTE) == 0 && msg->pid_sender == pmanager &&
+          remove_idle(atol(msg->content)) == 0) {
+        fork_zygote();
+      }
+      message_deinit(msg);
+    }
+  }
+}
+
+// Forks a new zygote, which announces itself to pmanager.
+void fork_zygote() {
+  pid_t pid = fork();
+  if (pid == 0) {
+    free(idle);
+    child_zygote(pmanager);
+  } else if (pid == -1) {
+    fprintf(stderr, "Error: failed to fork zygote.\n");
+  } else {
+    idle[idle_count++] = pid;
+  }
+}
+
+// Removes pid from the idle zygotes.
+//
+// pid: the PID of the zygote
+//
+// Returns: 0 if pid was an idle zygote, -1 otherwise.
+int remove_idle(pid_t pid) {
+  int i;
+  for (i = 0; i < idle_count; i++) {
+    if (idle[i] == pid) {
+      idle[i] = idle[--idle_count];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Reaps terminated children: claimed zygotes that were closed, or idle ones
+// that failed. Failed zygotes are not replaced, so that a persistent failure
+// does not cause a loop of forks.
+void reap_children() {
+  pid_t pid;
+  while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+    if (remove_idle(pid) == 0) {
+      message_discard(pid);
+    }
+  }
+}
+
+// Kills the idle zygotes, removing their inboxes, and exits. Claimed zygotes
+// are terminated by pmanager as any other process.
+void shutdown_pool() {
+  int i;
+  for (i = 0; i < idle_count; i++) {
+    kill(idle[i], SIGKILL);
+  }
+  for (i = 0; i < idle_count; i++) {
+    waitpid(idle[i], NULL, 0);
+    message_discard(idle[i]);
+  }
+  free(idle);
+  message_teardown();
+  exit(EXIT_SUCCESS);
+}
+
+// Handler for SIGTERM and SIGCHLD. It only sets the corresponding flag.
+//
+// signum: the signal number
+void signal_handler(int signum) {
+  if (signum == SIGTERM) {
+    term_flag = 1;
+  } else {
+    chld_flag = 1;
+  }
+}
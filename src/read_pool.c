@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "read_pool.h"
+#include "handlers.h"
+#include "stats.h"
+#include "trace.h"
+#include "common.h"
+
+// Time given to each thread to terminate on stop, in milliseconds. A thread
+// still blocked sending a reply (e.g. to a stopped process) is canceled.
+#define STOP_TIMEOUT_MS 100
+
+// Represents a request queued for the threads.
+typedef struct read_request {
+  message_t msg;
+  struct read_request * next;
+} read_request;
+
+// Lock protecting the tree. Writers are preferred, so that a steady stream of
+// readers cannot delay the registration of new processes.
+pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+// Flag set while the main thread holds tree_lock for writing.
+int tree_write_locked = 0;
+
+// Threads of the pool, and their number.
+pthread_t * readers = NULL;
+int readers_count = 0;
+// Root of the tree read by the threads.
+const proc_node * readers_root = NULL;
+// Queue of requests, protected by queue_mutex.
+pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+read_request * queue_head = NULL;
+read_request * queue_tail = NULL;
+// Flag set when the threads must terminate, protected by queue_mutex.
+int readers_stopping = 0;
+
+// Private functions.
+// Main function of the threads.
+void * read_pool_worker(void * arg);
+// Frees a queued request.
+void read_request_deinit(read_request * request);
+
+// Starts count threads, which wait for requests queued by read_pool_submit().
+// Signals are blocked in the threads, so that they are always delivered to
+// the main thread.
+//
+// count: the number of threads
+// root: the root of the process tree
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned and no thread
+// is left running.
+int read_pool_start(int count, const proc_node * root) {
+  readers = malloc(sizeof(pthread_t) * count);
+  if (readers == NULL) {
+    return -1;
+  }
+  readers_root = root;
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  while (readers_count < count &&
+         pthread_create(&readers[readers_count], NULL, read_pool_worker, NULL) == 0) {
+    readers_count++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (readers_count < count) {
+    read_pool_stop();
+    return -1;
+  }
+  return 0;
+}
+
+// Stops the threads once the queued requests are served, and frees the pool.
+// Called on exit, possibly from a signal handler interrupting the main thread
+// while it holds the lock for writing: in that case, the lock is released
+// first.
+void read_pool_stop() {
+  if (readers == NULL) {
+    return;
+  }
+  if (tree_write_locked) {
+    tree_write_unlock();
+  }
+  pthread_mutex_lock(&queue_mutex);
+  readers_stopping = 1;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += STOP_TIMEOUT_MS * 1000000L;
+  deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+  deadline.tv_nsec %= 1000000000L;
+  int i;
+  for (i = 0; i < readers_count; i++) {
+    if (pthread_timedjoin_np(readers[i], NULL, &deadline) != 0) {
+      pthread_cancel(readers[i]);
+      pthread_join(readers[i], NULL);
+    }
+  }
+  while (queue_head != NULL) {
+    read_request * next = queue_head->next;
+    read_request_deinit(queue_head);
+    queue_head = next;
+  }
+  queue_tail = NULL;
+  free(readers);
+  readers = NULL;
+  readers_count = 0;
+  readers_stopping = 0;
+}
+
+// Returns true if the pool is running and msg only reads the tree.
+//
+// msg: the message received
+int read_pool_accepts(const message_t * msg) {
+  return readers_count > 0 &&
+         (strcmp(msg->type, MSG_INFO) == 0 || strcmp(msg->type, MSG_LIST) == 0);
+}
+
+// Queues a copy of msg, waking up one of the threads.
+//
+// msg: the message received
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned and the
+// message must be handled by the caller.
+int read_pool_submit(const message_t * msg) {
+  read_request * request = calloc(1, sizeof(read_request));
+  if (request == NULL) {
+    return -1;
+  }
+  request->msg.pid_sender = msg->pid_sender;
+  request->msg.time_sent = msg->time_sent;
+  request->msg.type = strdup(msg->type);
+  request->msg.content = (msg->content == NULL) ? NULL : strdup(msg->content);
+  if (request->msg.type == NULL || (msg->content != NULL && request->msg.content == NULL)) {
+    read_request_deinit(request);
+    return -1;
+  }
+  pthread_mutex_lock(&queue_mutex);
+  if (queue_tail == NULL) {
+    queue_head = request;
+  } else {
+    queue_tail->next = request;
+  }
+  queue_tail = request;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+  return 0;
+}
+
+// Main function of the threads: serves queued requests until the pool is
+// stopped. Threads can be canceled only while handling a request, when they
+// may block sending the reply.
+//
+// arg: unused
+//
+// Returns: NULL.
+void * read_pool_worker(void * arg) {
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  while (1) {
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_head == NULL && !readers_stopping) {
+      pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    read_request * request = queue_head;
+    if (request != NULL) {
+      queue_head = request->next;
+      if (queue_head == NULL) {
+        queue_tail = NULL;
+      }
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    if (request == NULL) {
+      break;
+    }
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    long long start = time_ns();
+    unsigned long long bytes = message_bytes_sent();
+    if (strcmp(request->msg.type, MSG_INFO) == 0) {
+      msg_info_handler(&request->msg, readers_root);
+    } else {
+      msg_list_handler(&request->msg, readers_root);
+    }
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    long long end = time_ns();
+    // Statistics are reset while the tree is locked for writing.
+    tree_read_lock();
+    stats_record(&request->msg, start, end, message_bytes_sent() - bytes);
+    tree_read_unlock();
+    trace_record_at(start, TRACE_HANDLER, request->msg.pid_sender,
+                    request->msg.type[0], end - start);
+    read_request_deinit(request);
+  }
+  return NULL;
+}
+
+// Frees a queued request.
+//
+// request: the request
+void read_request_deinit(read_request * request) {
+  free(request->msg.type);
+  free(request->msg.content);
+  free(request);
+}
+
+// Locks the tree for reading. Read-only handlers take the lock only while
+// they access the tree, and release it before sending replies.
+void tree_read_lock() {
+  pthread_rwlock_rdlock(&tree_lock);
+}
+
+// Releases the lock taken by tree_read_lock().
+void tree_read_unlock() {
+  pthread_rwlock_unlock(&tree_lock);
+}
+
+// Locks the tree for writing. Only the main thread of pmanager changes the
+// tree.
+void tree_write_lock() {
+  pthread_rwlock_wrlock(&tree_lock);
+  tree_write_locked = 1;
+}
+
+// Releases the lock taken by tree_write_lock().
+void tree_write_unlock() {
+  tree_write_locked = 0;
+  pthread_rwlock_unlock(&tree_lock);
+}
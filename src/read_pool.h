@@ -0,0 +1,31 @@
+#ifndef READ_POOL_H
+#define READ_POOL_H
+
+#include "message.h"
+#include "proc_tree.h"
+
+// Pool of threads serving the requests that only read the process tree
+// (MSG_INFO and MSG_LIST) in parallel with the main thread of pmanager, which
+// remains the only one reading the inbox and changing the tree. The tree is
+// protected by a reader-writer lock: the main thread takes it for writing
+// around handlers that change the tree, while read-only handlers take it for
+// reading. Without a pool, read-only handlers run on the main thread.
+
+// Starts count threads serving read-only requests on the tree rooted at root.
+int read_pool_start(int count, const proc_node * root);
+// Stops the threads, waiting for the requests already queued.
+void read_pool_stop();
+// Returns true if msg can be served by the pool.
+int read_pool_accepts(const message_t * msg);
+// Queues a copy of msg, to be handled by one of the threads.
+int read_pool_submit(const message_t * msg);
+// Locks the tree for reading.
+void tree_read_lock();
+// Releases the lock taken by tree_read_lock().
+void tree_read_unlock();
+// Locks the tree for writing.
+void tree_write_lock();
+// Releases the lock taken by tree_write_lock().
+void tree_write_unlock();
+
+#endif
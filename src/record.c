@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "record.h"
+#include "histogram.h"
+#include "common.h"
+
+// Maximum length of the command names compared.
+#define RECORD_NAME_MAX 32
+
+// Latencies of a command name, in the recorded session and in the replay.
+typedef struct record_entry {
+  char name[RECORD_NAME_MAX];
+  histogram recorded;
+  histogram replayed;
+  // Commands that did not exit with status 0.
+  unsigned long long recorded_failed;
+  unsigned long long replayed_failed;
+} record_entry;
+
+// A command read from a record.
+typedef struct record_line {
+  long long start;
+  long long duration;
+  int status;
+  int background;
+  char * command;
+  // Position in the record, to keep the order of commands started together.
+  int index;
+} record_line;
+
+// Stream of the session being recorded, and time of its beginning.
+FILE * record_stream = NULL;
+long long record_origin = 0;
+// Results of the replay, if any: one entry per command name, plus "other".
+record_entry * record_entries = NULL;
+int record_entries_count = 0;
+// Path of the session replayed, its duration when recorded and when replayed.
+char * replay_path = NULL;
+long long recorded_time = 0;
+long long replayed_time = 0;
+
+// Private functions.
+// Reads the lines of a record.
+int read_record(const char * path, record_line ** lines_ptr);
+// Frees the lines read by read_record().
+void free_lines(record_line * lines, int count);
+// Comparison function for qsort(), sorting lines by start time.
+int compare_start(const void * a, const void * b);
+// Returns the entry of a command name, adding it if needed.
+record_entry * find_entry(const char * command);
+
+// Starts recording the commands executed to path, which is truncated. Times
+// are relative to now.
+//
+// path: the path of the record
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int record_start(const char * path) {
+  record_stream = fopen(path, "w");
+  if (record_stream == NULL) {
+    return -1;
+  }
+  fprintf(record_stream, "# <start us> <duration us> <status> <command>\n");
+  record_origin = time_ns();
+  return 0;
+}
+
+// Returns true if commands are recorded, or replayed: only then, callers need
+// to build the command lines passed to record_command().
+int record_active() {
+  return record_stream != NULL || record_entries != NULL;
+}
+
+// Records a command that completed now: a line is written to the record, and
+// during a replay, its latency is added to the results.
+//
+// command: the command line, without "&"
+// background: if true, the command was executed in background
+// start: the time the command was started (see time_ns())
+// status: the status of the command (see record_status())
+void record_command(const char * command, int background, long long start, int status) {
+  long long end = time_ns();
+  if (record_stream != NULL) {
+    fprintf(record_stream, "%lld %lld %d %s%s\n", (start - record_origin) / 1000,
+            (end - start) / 1000, status, command, background ? " &" : "");
+  }
+  if (record_entries != NULL) {
+    record_entry * entry = find_entry(command);
+    histogram_record(&entry->replayed, end - start);
+    if (status != 0) {
+      entry->replayed_failed++;
+    }
+  }
+}
+
+// Converts a status returned by waitpid() into the status recorded: the exit
+// status of the process, or 128 + N if it was killed by signal N, as shells
+// do.
+//
+// wait_status: the status returned by waitpid()
+int record_status(int wait_status) {
+  if (WIFSIGNALED(wait_status)) {
+    return 128 + WTERMSIG(wait_status);
+  }
+  return WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 0;
+}
+
+// Executes again the commands recorded in path, in order of start time, since
+// lines are written as commands complete. Without timed, each command is
+// started as soon as the previous one completed (or started, if it ran in
+// background); with timed, each command is started at its original time since
+// the beginning of the session, and idle is called in the meantime. The
+// latencies of the commands are compared by record_summary().
+//
+// path: the path of the record
+// timed: if true, the original times of the commands are kept
+// exec: the function executing a command
+// idle: the function called while waiting for the time of a command
+//
+// Returns: on success, 0 is returned; on failure (e.g. invalid record), -1 is
+// returned.
+int record_replay(const char * path, int timed, record_exec exec, record_idle idle) {
+  record_line * lines;
+  int count = read_record(path, &lines);
+  if (count == -1) {
+    return -1;
+  }
+  record_entries = calloc(RECORD_COMMANDS + 1, sizeof(record_entry));
+  replay_path = strdup(path);
+  if (record_entries == NULL || replay_path == NULL) {
+    free_lines(lines, count);
+    return -1;
+  }
+  qsort(lines, count, sizeof(record_line), compare_start);
+
+  long long origin = time_ns();
+  int quit = 0;
+  int i;
+  for (i = 0; i < count && !quit; i++) {
+    const record_line * line = &lines[i];
+    record_entry * entry = find_entry(line->command);
+    histogram_record(&entry->recorded, line->duration * 1000);
+    if (line->status != 0) {
+      entry->recorded_failed++;
+    }
+    if (line->start + line->duration > recorded_time) {
+      recorded_time = line->start + line->duration;
+    }
+    char ** argv;
+    int argc = tokenize(line->command, &argv, " \t");
+    if (argc <= 0) {
+      continue;
+    }
+    argv = realloc(argv, sizeof(char *) * (argc + 1));
+    argv[argc] = NULL;
+
+    // Keep serving pmanager until the time of the command.
+    long long now;
+    while (timed && (now = time_ns()) < origin + line->start * 1000) {
+      idle((origin + line->start * 1000 - now + 999999) / 1000000);
+    }
+    quit = exec(argv, line->background) == 1;
+    int j;
+    for (j = 0; j < argc; j++) {
+      free(argv[j]);
+    }
+    free(argv);
+  }
+  replayed_time = (time_ns() - origin) / 1000;
+  free_lines(lines, count);
+  return 0;
+}
+
+// Reads the lines of a record, skipping comments.
+//
+// path: the path of the record
+// lines_ptr: set to the array of lines read
+//
+// Returns: the number of lines read, or -1 on failure (e.g. invalid line).
+int read_record(const char * path, record_line ** lines_ptr) {
+  FILE * input = fopen(path, "r");
+  if (input == NULL) {
+    return -1;
+  }
+  record_line * lines = NULL;
+  int count = 0;
+  int size = 0;
+  int error = 0;
+  char * buffer = NULL;
+  size_t buffer_size = 0;
+  while (!error && getline(&buffer, &buffer_size, input) != -1) {
+    if (buffer[0] == '#') {
+      continue;
+    }
+    if (count == size) {
+      size = (size == 0) ? 256 : 2 * size;
+      record_line * tmp = realloc(lines, sizeof(record_line) * size);
+      if (tmp == NULL) {
+        error = 1;
+        break;
+      }
+      lines = tmp;
+    }
+    record_line * line = &lines[count];
+    int offset;
+    if (sscanf(buffer, "%lld %lld %d %n", &line->start, &line->duration, &line->status,
+               &offset) != 3 || line->start < 0 || line->duration < 0) {
+      fprintf(stderr, "Error: invalid record line \"%.*s\".\n",
+              (int) strcspn(buffer, "\n"), buffer);
+      error = 1;
+      break;
+    }
+    // The command line ends with " &" if it ran in background.
+    char * command = buffer + offset;
+    command[strcspn(command, "\n")] = '\0';
+    size_t len = strlen(command);
+    line->background = len >= 2 && strcmp(command + len - 2, " &") == 0;
+    if (line->background) {
+      command[len - 2] = '\0';
+    }
+    line->index = count;
+    line->command = strdup(command);
+    error = line->command == NULL;
+    count += !error;
+  }
+  free(buffer);
+  fclose(input);
+  if (error) {
+    free_lines(lines, count);
+    return -1;
+  }
+  *lines_ptr = lines;
+  return count;
+}
+
+// Frees the lines read by read_record().
+//
+// lines: the array of lines
+// count: the number of lines
+void free_lines(record_line * lines, int count) {
+  int i;
+  for (i = 0; i < count; i++) {
+    free(lines[i].command);
+  }
+  free(lines);
+}
+
+// Comparison function for qsort(), sorting lines by start time, and then in
+// the order of the record.
+int compare_start(const void * a, const void * b) {
+  const record_line * x = a;
+  const record_line * y = b;
+  if (x->start != y->start) {
+    return (x->start > y->start) - (x->start < y->start);
+  }
+  return x->index - y->index;
+}
+
+// Prints, for each command name, the percentiles of the latencies of the
+// replay next to the recorded ones, the change of the median, and the number
+// of commands that failed in each. Commands still running in background are
+// not included.
+//
+// stream: the stream where the table is printed
+void record_summary(FILE * stream) {
+  if (record_entries == NULL) {
+    return;
+  }
+  fprintf(stream, "Replay of \"%s\": %.3f s (recorded: %.3f s).\n\n", replay_path,
+          replayed_time / 1e6, recorded_time / 1e6);
+  fprintf(stream, "%-10s %7s | %21s | %21s | %8s | %15s\n", "", "",
+          "RECORDED (ms)", "REPLAYED (ms)", "", "FAILED");
+  fprintf(stream, "%-10s %7s | %10s %10s | %10s %10s | %8s | %7s %7s\n", "COMMAND",
+          "COUNT", "p50", "p99", "p50", "p99", "p50 DIFF", "REC", "REPLAY");
+  int i;
+  for (i = 0; i <= RECORD_COMMANDS; i++) {
+    const record_entry * entry = &record_entries[i];
+    if (entry->recorded.total == 0 && entry->replayed.total == 0) {
+      continue;
+    }
+    long long recorded_p50 = histogram_percentile(&entry->recorded, 0.5);
+    long long replayed_p50 = histogram_percentile(&entry->replayed, 0.5);
+    char diff[16] = "-";
+    if (recorded_p50 > 0 && entry->replayed.total > 0) {
+      snprintf(diff, sizeof(diff), "%+.1f%%",
+               100.0 * (replayed_p50 - recorded_p50) / recorded_p50);
+    }
+    fprintf(stream, "%-10s %7llu | %10.3f %10.3f | %10.3f %10.3f | %8s | %7llu %7llu\n",
+            entry->name, entry->recorded.total, recorded_p50 / 1e6,
+            histogram_percentile(&entry->recorded, 0.99) / 1e6, replayed_p50 / 1e6,
+            histogram_percentile(&entry->replayed, 0.99) / 1e6, diff,
+            entry->recorded_failed, entry->replayed_failed);
+  }
+}
+
+// Stops recording, flushing the record, and frees the results of the replay.
+void record_stop() {
+  if (record_stream != NULL) {
+    fclose(record_stream);
+    record_stream = NULL;
+  }
+  free(record_entries);
+  record_entries = NULL;
+  free(replay_path);
+  replay_path = NULL;
+}
+
+// Returns the entry of the name of a command, i.e. its first word, adding it
+// if needed. Names beyond RECORD_COMMANDS share the last entry, "other".
+//
+// command: the command line
+record_entry * find_entry(const char * command) {
+  size_t len = strcspn(command, " \t");
+  if (len >= RECORD_NAME_MAX) {
+    len = RECORD_NAME_MAX - 1;
+  }
+  int i;
+  for (i = 0; i < record_entries_count; i++) {
+    if (strncmp(record_entries[i].name, command, len) == 0 && record_entries[i].name[len] == '\0') {
+      return &record_entries[i];
+    }
+  }
+  if (record_entries_count == RECORD_COMMANDS) {
+    strcpy(record_entries[RECORD_COMMANDS].name, "other");
+    return &record_entries[RECORD_COMMANDS];
+  }
+  memcpy(record_entries[record_entries_count].name, command, len);
+  record_entries[record_entries_count].name[len] = '\0';
+  return &record_entries[record_entries_count++];
+}
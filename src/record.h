@@ -0,0 +1,47 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+
+// Session record and replay. With --record FILE, pmanager writes a line for
+// each command it executes, when the command completes:
+// <start> <duration> <status> <command line>
+// where start is the time since the beginning of the session and duration the
+// time to completion, both in microseconds, and status is the exit status of
+// the command (128 + N if killed by signal N, 126 if it could not be started,
+// 127 if not found). Commands run in background end with " &". Lines are
+// written as commands complete, so they are not sorted by start.
+// With --replay FILE, the commands of a recorded session are executed again,
+// one after the other or, with --timed, at their original times since the
+// beginning, and their latencies are compared to the recorded ones.
+
+// Maximum number of command names compared separately. Further names are
+// compared as "other".
+#define RECORD_COMMANDS 64
+// Exit statuses recorded for commands that could not be started or found.
+#define RECORD_NOT_STARTED 126
+#define RECORD_NOT_FOUND 127
+
+// Executes a command during a replay, as read from a command line. Returns 1
+// for the quit command.
+typedef int (*record_exec)(char ** argv, int background);
+// Serves pmanager for up to timeout milliseconds while a timed replay waits
+// for the time of the next command.
+typedef void (*record_idle)(int timeout);
+
+// Starts recording the commands executed to path.
+int record_start(const char * path);
+// Returns true if commands are recorded, or replayed.
+int record_active();
+// Records a command that completed now.
+void record_command(const char * command, int background, long long start, int status);
+// Converts a status returned by waitpid() into the status recorded.
+int record_status(int wait_status);
+// Executes again the commands of a recorded session.
+int record_replay(const char * path, int timed, record_exec exec, record_idle idle);
+// Prints the latencies of the commands replayed, compared to the recording.
+void record_summary(FILE * stream);
+// Stops recording and frees the results of the replay.
+void record_stop();
+
+#endif
@@ -0,0 +1,469 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_tree.h"
+
+// Value of shm_tree_header.magic once the object is initialized.
+#define SHM_TREE_MAGIC 0x43534854
+// Initial size of the shared memory object.
+#define SHM_TREE_INITIAL_SIZE 65536
+// Maximum number of attempts to read a consistent copy of the tree.
+#define SHM_TREE_RETRIES 1000
+
+// Header of the shared memory object. It is followed by count nodes, in
+// pre-order, and by the names, terminated by null bytes.
+typedef struct shm_tree_header {
+  uint32_t magic;
+  // Sequence number, odd while the tree is being written.
+  uint32_t seq;
+  // Number of nodes.
+  int32_t count;
+  // Total size of the names.
+  uint32_t names_size;
+} shm_tree_header;
+
+// A process in the shared memory object. The subtree of node i is made of
+// nodes i ... i + subtree_size - 1.
+typedef struct shm_tree_node {
+  pid_t pid;
+  pid_t ppid;
+  int32_t subtree_size;
+  // Offset of the name from the start of the names.
+  uint32_t name;
+} shm_tree_node;
+
+// Private copy of the tree read from the shared memory object.
+typedef struct shm_tree_copy {
+  int count;
+  shm_tree_node * nodes;
+  char * names;
+  uint32_t names_size;
+} shm_tree_copy;
+
+// Shared memory object of pmanager (writer side).
+int shm_fd = -1;
+shm_tree_header * shm_header = NULL;
+size_t shm_size = 0;
+// Nodes and names of the tree being written, with their sizes.
+shm_tree_node * shm_nodes = NULL;
+char * shm_names = NULL;
+int shm_count = 0;
+uint32_t shm_names_size = 0;
+// Flag set when the tree changed since it was last published.
+int shm_changed = 0;
+
+// Shared memory object of pmanager mapped by a reader, kept between reads.
+pid_t reader_pmanager = -1;
+int reader_fd = -1;
+const shm_tree_header * reader_header = NULL;
+size_t reader_mapped = 0;
+
+// Private functions.
+// Returns the name of the shared memory object of pmanager.
+void shm_tree_name(pid_t pmanager, char * name, size_t size);
+// Computes the number of nodes and the size of the names of the tree.
+void shm_tree_measure(const proc_node * node, int * count, size_t * names_size);
+// Writes the subtree rooted at node, returning its size.
+int shm_tree_write(const proc_node * node);
+// Maps the shared memory object of pmanager for reading.
+int shm_tree_map(pid_t pmanager);
+// Copies the tree published by pmanager.
+int shm_tree_read(pid_t pmanager, shm_tree_copy * copy);
+// Finds a process by name in a copy of the tree.
+int shm_tree_find(const shm_tree_copy * copy, const char * name);
+// Formats a node of a copy as <pid>;<ppid>;<name>.
+char * shm_tree_tostr(const shm_tree_copy * copy, int index);
+
+// Returns the name of the shared memory object of pmanager.
+//
+// pmanager: the PID of pmanager
+// name: the buffer where the name is written
+// size: the size of name
+void shm_tree_name(pid_t pmanager, char * name, size_t size) {
+  snprintf(name, size, "%s%ld", SHM_TREE_PREFIX, (long) pmanager);
+}
+
+// Creates and maps the shared memory object of the calling process, which
+// must be pmanager. An object left by a terminated process with the same PID
+// is replaced. The tree is empty until shm_tree_publish() is called.
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int shm_tree_init() {
+  char name[64];
+  shm_tree_name(getpid(), name, sizeof(name));
+  shm_unlink(name);
+  shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (shm_fd == -1) {
+    return -1;
+  }
+  shm_size = SHM_TREE_INITIAL_SIZE;
+  if (ftruncate(shm_fd, shm_size) != 0) {
+    shm_tree_deinit();
+    return -1;
+  }
+  shm_header = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  if (shm_header == MAP_FAILED) {
+    shm_header = NULL;
+    shm_tree_deinit();
+    return -1;
+  }
+  shm_header->count = 0;
+  shm_header->names_size = 0;
+  __atomic_store_n(&shm_header->magic, SHM_TREE_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Unmaps and removes the shared memory object of the calling process.
+void shm_tree_deinit() {
+  if (shm_header != NULL) {
+    munmap(shm_header, shm_size);
+    shm_header = NULL;
+  }
+  if (shm_fd != -1) {
+    char name[64];
+    shm_tree_name(getpid(), name, sizeof(name));
+    shm_unlink(name);
+    close(shm_fd);
+    shm_fd = -1;
+  }
+}
+
+// Computes the number of nodes of the tree rooted at node, and the size of
+// their names including the terminating null bytes.
+//
+// node: the root of the tree
+// count: incremented by the number of nodes
+// names_size: incremented by the size of the names
+void shm_tree_measure(const proc_node * node, int * count, size_t * names_size) {
+  (*count)++;
+  *names_size += strlen(node->name) + 1;
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    shm_tree_measure(node->children[i], count, names_size);
+  }
+}
+
+// Marks the tree as changed since it was last published. Every change to the
+// tree of pmanager, by a message handler or by a plugin, must be marked, so
+// that readers do not act on processes that no longer exist.
+void shm_tree_changed() {
+  shm_changed = 1;
+}
+
+// Publishes the tree rooted at root if it changed since it was last published.
+//
+// root: the root of the tree
+//
+// Returns: on success (or if nothing changed), 0 is returned; on failure, -1
+// is returned.
+int shm_tree_sync(const proc_node * root) {
+  if (!shm_changed) {
+    return 0;
+  }
+  shm_changed = 0;
+  return shm_tree_publish(root);
+}
+
+// Copies the tree rooted at root into the shared memory object, growing it if
+// needed. Readers that started copying before or during the update notice it
+// from the sequence number and retry.
+//
+// root: the root of the tree
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int shm_tree_publish(const proc_node * root) {
+  if (shm_header == NULL) {
+    return -1;
+  }
+  int count = 0;
+  size_t names_size = 0;
+  shm_tree_measure(root, &count, &names_size);
+  size_t needed = sizeof(shm_tree_header) + sizeof(shm_tree_node) * count + names_size;
+  if (needed > shm_size) {
+    // The object only grows, so mappings of readers stay valid.
+    size_t size = shm_size;
+    while (size < needed) {
+      size *= 2;
+    }
+    if (ftruncate(shm_fd, size) != 0) {
+      return -1;
+    }
+    void * header = mremap(shm_header, shm_size, size, MREMAP_MAYMOVE);
+    if (header == MAP_FAILED) {
+      return -1;
+    }
+    shm_header = header;
+    shm_size = size;
+  }
+
+  uint32_t seq = __atomic_load_n(&shm_header->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&shm_header->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  shm_nodes = (shm_tree_node *) (shm_header + 1);
+  shm_names = (char *) (shm_nodes + count);
+  shm_count = 0;
+  shm_names_size = 0;
+  shm_tree_write(root);
+  shm_header->count = shm_count;
+  shm_header->names_size = shm_names_size;
+  __atomic_store_n(&shm_header->seq, seq + 2, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Writes the subtree rooted at node in pre-order, after the nodes already
+// written.
+//
+// node: the root of the subtree
+//
+// Returns: the number of nodes of the subtree.
+int shm_tree_write(const proc_node * node) {
+  int index = shm_count++;
+  shm_nodes[index].pid = node->pid;
+  shm_nodes[index].ppid = node->ppid;
+  shm_nodes[index].name = shm_names_size;
+  size_t len = strlen(node->name) + 1;
+  memcpy(shm_names + shm_names_size, node->name, len);
+  shm_names_size += len;
+  int size = 1;
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    size += shm_tree_write(node->children[i]);
+  }
+  shm_nodes[index].subtree_size = size;
+  return size;
+}
+
+// Maps the shared memory object of pmanager for reading, with its current
+// size. The object stays open, so that following reads only map it again if
+// it grew.
+//
+// pmanager: the PID of pmanager
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int shm_tree_map(pid_t pmanager) {
+  if (reader_pmanager != pmanager && reader_fd != -1) {
+    close(reader_fd);
+    reader_fd = -1;
+  }
+  if (reader_header != NULL) {
+    munmap((void *) reader_header, reader_mapped);
+    reader_header = NULL;
+  }
+  if (reader_fd == -1) {
+    char name[64];
+    shm_tree_name(pmanager, name, sizeof(name));
+    reader_fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (reader_fd == -1) {
+      return -1;
+    }
+    reader_pmanager = pmanager;
+  }
+  struct stat st;
+  if (fstat(reader_fd, &st) != 0 || st.st_size < sizeof(shm_tree_header)) {
+    return -1;
+  }
+  void * header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, reader_fd, 0);
+  if (header == MAP_FAILED) {
+    return -1;
+  }
+  reader_header = header;
+  reader_mapped = st.st_size;
+  return 0;
+}
+
+// Copies the tree published by pmanager into private memory. The copy is
+// retried while pmanager is updating the tree, or if it changed during the
+// copy.
+//
+// pmanager: the PID of pmanager
+// copy: where the copy is stored. Its buffers must be freed by the caller.
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned (e.g. if
+// pmanager did not publish its tree).
+int shm_tree_read(pid_t pmanager, shm_tree_copy * copy) {
+  memset(copy, 0, sizeof(shm_tree_copy));
+  if ((reader_header == NULL || reader_pmanager != pmanager) &&
+      shm_tree_map(pmanager) != 0) {
+    return -1;
+  }
+  size_t nodes_capacity = 0;
+  size_t names_capacity = 0;
+  int status = -1;
+  int attempt;
+  for (attempt = 0; attempt < SHM_TREE_RETRIES; attempt++) {
+    const shm_tree_header * header = reader_header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_TREE_MAGIC) {
+      break;
+    }
+    uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+    if (seq % 2 == 1) {
+      sched_yield();
+      continue;
+    }
+    int count = header->count;
+    uint32_t names_size = header->names_size;
+    size_t needed = sizeof(shm_tree_header) + sizeof(shm_tree_node) * count + names_size;
+    if (count < 0 || needed > reader_mapped) {
+      // The object grew: map it again if the size is valid, i.e. the header
+      // was not being written.
+      if (__atomic_load_n(&header->seq, __ATOMIC_ACQUIRE) == seq &&
+          shm_tree_map(pmanager) != 0) {
+        break;
+      }
+      continue;
+    }
+    if (count > nodes_capacity) {
+      free(copy->nodes);
+      copy->nodes = malloc(sizeof(shm_tree_node) * count);
+      nodes_capacity = count;
+    }
+    if (names_size > names_capacity) {
+      free(copy->names);
+      copy->names = malloc(names_size);
+      names_capacity = names_size;
+    }
+    if ((count > 0 && copy->nodes == NULL) || (names_size > 0 && copy->names == NULL)) {
+      break;
+    }
+    const shm_tree_node * nodes = (const shm_tree_node *) (header + 1);
+    memcpy(copy->nodes, nodes, sizeof(shm_tree_node) * count);
+    memcpy(copy->names, nodes + count, names_size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->seq, __ATOMIC_RELAXED) == seq) {
+      copy->count = count;
+      copy->names_size = names_size;
+      status = 0;
+      break;
+    }
+  }
+  if (status != 0) {
+    free(copy->nodes);
+    free(copy->names);
+    memset(copy, 0, sizeof(shm_tree_copy));
+    errno = EAGAIN;
+  }
+  return status;
+}
+
+// Finds a process by name in a copy of the tree.
+//
+// copy: the copy of the tree
+// name: the name of the process
+//
+// Returns: the index of the process, or -1 if not found.
+int shm_tree_find(const shm_tree_copy * copy, const char * name) {
+  int i;
+  for (i = 0; i < copy->count; i++) {
+    if (strcmp(copy->names + copy->nodes[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Formats a node of a copy of the tree as proc_node_tostr() does:
+// <pid>;<ppid>;<name>.
+//
+// copy: the copy of the tree
+// index: the index of the node
+//
+// Returns: the new string, or NULL on failure.
+char * shm_tree_tostr(const shm_tree_copy * copy, int index) {
+  char * str;
+  if (asprintf(&str, "%ld;%ld;%s", (long) copy->nodes[index].pid,
+               (long) copy->nodes[index].ppid,
+               copy->names + copy->nodes[index].name) == -1) {
+    return NULL;
+  }
+  return str;
+}
+
+// Calls callback for each process in the subtree rooted at name, as
+// message_list() does, reading the tree published by pmanager. The callback is
+// called only once a consistent copy was obtained, so on failure the caller
+// can fall back to message_list().
+//
+// pmanager: the PID of pmanager
+// name: the name of the root of the subtree
+// callback: the function called with the string representation of each
+//           process, formatted as <pid>;<ppid>;<name>
+// arg: passed to callback
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned. If the
+// process does not exist, errno is set to ESRCH.
+int shm_tree_list(pid_t pmanager, const char * name,
+                  void (*callback)(const char * proc_str, void * arg), void * arg) {
+  shm_tree_copy copy;
+  if (shm_tree_read(pmanager, &copy) != 0) {
+    return -1;
+  }
+  int index = shm_tree_find(&copy, name);
+  int status = 0;
+  if (index == -1) {
+    status = -1;
+  } else {
+    int i;
+    for (i = index; i < index + copy.nodes[index].subtree_size; i++) {
+      char * proc_str = shm_tree_tostr(&copy, i);
+      if (proc_str != NULL) {
+        callback(proc_str, arg);
+        free(proc_str);
+      }
+    }
+  }
+  free(copy.nodes);
+  free(copy.names);
+  if (index == -1) {
+    errno = ESRCH;
+  }
+  return status;
+}
+
+// Returns the string representation of the process with the given name,
+// reading the tree published by pmanager.
+//
+// pmanager: the PID of pmanager
+// name: the name of the process
+//
+// Returns: the string, formatted as <pid>;<ppid>;<name>, or NULL on failure.
+// If the process does not exist, errno is set to ESRCH.
+char * shm_tree_info(pid_t pmanager, const char * name) {
+  shm_tree_copy copy;
+  if (shm_tree_read(pmanager, &copy) != 0) {
+    return NULL;
+  }
+  int index = shm_tree_find(&copy, name);
+  char * proc_str = (index == -1) ? NULL : shm_tree_tostr(&copy, index);
+  free(copy.nodes);
+  free(copy.names);
+  if (index == -1) {
+    errno = ESRCH;
+  }
+  return proc_str;
+}
+
+// Resolves the name of a process into its PID, reading the tree published by
+// pmanager.
+//
+// pmanager: the PID of pmanager
+// name: the name of the process
+//
+// Returns: the PID of the process, or -1 on failure. If the process does not
+// exist, errno is set to ESRCH.
+pid_t shm_tree_lookup_pid(pid_t pmanager, const char * name) {
+  char * proc_str = shm_tree_info(pmanager, name);
+  if (proc_str == NULL) {
+    return -1;
+  }
+  pid_t pid = atol(proc_str);
+  free(proc_str);
+  return pid;
+}
@@ -0,0 +1,33 @@
+#ifndef SHM_TREE_H
+#define SHM_TREE_H
+
+#include <sys/types.h>
+#include "proc_tree.h"
+
+// Read-only copy of the process tree, published by pmanager in a shared memory
+// object named SHM_TREE_PREFIX<pid of pmanager>. Readers (plist, ptree, pinfo,
+// ...) map it and copy the tree without exchanging messages with pmanager.
+// Updates are protected by a sequence lock: the sequence number is odd while
+// pmanager writes, and readers retry if it changed during their copy.
+#define SHM_TREE_PREFIX "/customshell."
+
+// Creates the shared memory object of the calling process (pmanager).
+int shm_tree_init();
+// Copies the tree rooted at root into the shared memory object.
+int shm_tree_publish(const proc_node * root);
+// Marks the tree as changed since it was last published.
+void shm_tree_changed();
+// Publishes the tree rooted at root if it was marked as changed.
+int shm_tree_sync(const proc_node * root);
+// Removes the shared memory object.
+void shm_tree_deinit();
+// Calls callback for each process in the subtree rooted at name, reading the
+// tree published by pmanager.
+int shm_tree_list(pid_t pmanager, const char * name,
+                  void (*callback)(const char * proc_str, void * arg), void * arg);
+// Returns the string representation of the process with the given name.
+char * shm_tree_info(pid_t pmanager, const char * name);
+// Resolves the name of a process into its PID.
+pid_t shm_tree_lookup_pid(pid_t pmanager, const char * name);
+
+#endif
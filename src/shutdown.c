@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "shutdown.h"
+#include "child.h"
+#include "message.h"
+#include "jobs.h"
+#include "trace.h"
+#include "common.h"
+
+// Maximum number of events returned by a single epoll_wait().
+#define SHUTDOWN_EVENTS 256
+// Interval in milliseconds used to check processes without pidfd.
+#define SHUTDOWN_POLL_MS 10
+// Value of epoll_event.data.u32 identifying the inbox.
+#define INBOX_EVENT UINT32_MAX
+
+// A process being terminated.
+typedef struct victim {
+  pid_t pid;
+  // File descriptor referring to the process, or -1 if not available.
+  int pidfd;
+  // True once the process terminated.
+  int done;
+} victim;
+
+// Private functions.
+// Adds the processes in the subtree rooted at node to victims.
+void collect_victims(const proc_node * node, victim * victims, int * count);
+// Counts the processes in the subtree rooted at node.
+int count_procs(const proc_node * node);
+// Sends SIGTERM to all the processes in the tree, marked as a shutdown.
+void signal_victims(const victim * victims, int count);
+// Replies to the messages received while terminating processes.
+void serve_shutdown();
+// Raises the limit on open files up to the hard limit.
+void raise_nofile_limit();
+
+// Terminates all the processes in the tree rooted at root, except root itself
+// (pmanager). Unlike prmall, processes are not terminated leaf first: SIGTERM
+// is sent in bulk, marked as a shutdown, and a child receiving it exits
+// without requesting its removal, so all the processes exit at the same time.
+// Terminations are awaited through pidfds. Processes still alive after half of
+// timeout_ms, e.g. because they were stopped by pstop, receive SIGCONT; those
+// still alive after timeout_ms milliseconds are killed with SIGKILL. SIGCONT
+// is not sent to whole groups upfront, as it would wake every process twice.
+//
+// root: the root of the tree
+// timeout_ms: the time given to processes to terminate
+// killed: where the number of processes killed with SIGKILL is stored
+//
+// Returns: the number of processes in the tree, or -1 on failure.
+int shutdown_tree(const proc_node * root, int timeout_ms, int * killed) {
+  *killed = 0;
+  victim * victims = malloc(sizeof(victim) * count_procs(root));
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (victims == NULL || epoll_fd == -1) {
+    free(victims);
+    return -1;
+  }
+
+  // One pidfd is opened for each process.
+  raise_nofile_limit();
+  int count = 0;
+  int i;
+  for (i = 0; i < root->children_count; i++) {
+    collect_victims(root->children[i], victims, &count);
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u32 = INBOX_EVENT;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, message_fd(), &event);
+  int remaining = count;
+  int unwatched = 0;
+  for (i = 0; i < count; i++) {
+    victims[i].pidfd = pidfd_open_pid(victims[i].pid);
+    if (victims[i].pidfd == -1 && errno == ESRCH) {
+      // Already terminated.
+      victims[i].done = 1;
+      remaining--;
+      continue;
+    }
+    event.data.u32 = i;
+    if (victims[i].pidfd == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, victims[i].pidfd, &event) != 0) {
+      unwatched++;
+    }
+  }
+
+  signal_victims(victims, count);
+
+  // Serve MSG_REMOVE requests and wait for terminations.
+  long long deadline = time_ns() / 1000000 + timeout_ms;
+  int continued = 0;
+  struct epoll_event events[SHUTDOWN_EVENTS];
+  while (remaining > 0) {
+    long long left = deadline - time_ns() / 1000000;
+    if (left <= 0) {
+      break;
+    }
+    // Resume stopped processes, which cannot handle SIGTERM.
+    if (!continued && left <= timeout_ms / 2) {
+      for (i = 0; i < count; i++) {
+        if (!victims[i].done) {
+          kill(victims[i].pid, SIGCONT);
+        }
+      }
+      continued = 1;
+    }
+    // Wake up in time for SIGCONT.
+    if (!continued) {
+      left -= timeout_ms / 2;
+    }
+    int wait_ms = (unwatched > 0 && left > SHUTDOWN_POLL_MS) ? SHUTDOWN_POLL_MS : left;
+    int ready = epoll_wait(epoll_fd, events, SHUTDOWN_EVENTS, wait_ms);
+    if (ready == -1 && errno != EINTR) {
+      break;
+    }
+    for (i = 0; i < ready; i++) {
+      uint32_t index = events[i].data.u32;
+      if (index == INBOX_EVENT) {
+        serve_shutdown();
+      } else if (!victims[index].done) {
+        victims[index].done = 1;
+        remaining--;
+      }
+    }
+    // Processes without pidfd are checked periodically.
+    if (unwatched > 0) {
+      for (i = 0; i < count; i++) {
+        if (!victims[i].done && victims[i].pidfd == -1 &&
+            kill(victims[i].pid, 0) == -1 && errno == ESRCH) {
+          victims[i].done = 1;
+          remaining--;
+          unwatched--;
+        }
+      }
+    }
+  }
+
+  // Kill the processes that did not terminate in time.
+  for (i = 0; i < count; i++) {
+    if (!victims[i].done) {
+      kill(victims[i].pid, SIGKILL);
+      (*killed)++;
+    }
+    if (victims[i].pidfd != -1) {
+      close(victims[i].pidfd);
+    }
+  }
+  close(epoll_fd);
+  free(victims);
+  return count;
+}
+
+// Adds node and its descendants to victims.
+//
+// node: the root of the subtree
+// victims: the array where processes are added
+// count: the number of processes in the array, updated by this function
+void collect_victims(const proc_node * node, victim * victims, int * count) {
+  victims[*count].pid = node->pid;
+  victims[*count].pidfd = -1;
+  victims[*count].done = 0;
+  (*count)++;
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    collect_victims(node->children[i], victims, count);
+  }
+}
+
+// Counts the processes in the subtree rooted at node, including node itself.
+//
+// node: the root of the subtree
+//
+// Returns: the number of processes.
+int count_procs(const proc_node * node) {
+  int count = 1;
+  int i;
+  for (i = 0; i < node->children_count; i++) {
+    count += count_procs(node->children[i]);
+  }
+  return count;
+}
+
+// Sends SIGTERM to all the processes in the tree with sigqueue(), carrying
+// CHILD_SHUTDOWN_VALUE: only a SIGTERM marked this way lets a child exit
+// without requesting its removal, unlike one sent with kill() by a plugin
+// running in pmanager. Since sigqueue() cannot signal a process group, each
+// process is signaled on its own.
+//
+// victims: the processes of the tree
+// count: the number of processes
+void signal_victims(const victim * victims, int count) {
+  union sigval value;
+  value.sival_int = CHILD_SHUTDOWN_VALUE;
+  int i;
+  for (i = 0; i < count; i++) {
+    if (!victims[i].done) {
+      trace_record(TRACE_SIGNAL_SEND, victims[i].pid, 0, SIGTERM);
+      sigqueue(victims[i].pid, SIGTERM, value);
+    }
+  }
+}
+
+// Handles the messages received while terminating processes, e.g. from a
+// process that was already terminating on request of pclose: MSG_REMOVE is
+// always accepted, because the tree is going to be freed. At most
+// SHUTDOWN_EVENTS messages are handled, so that terminations are checked even
+// if messages keep arriving.
+void serve_shutdown() {
+  message_t * msg;
+  int handled = 0;
+  while (handled++ < SHUTDOWN_EVENTS && (msg = message_read()) != NULL) {
+    if (strcmp(msg->type, MSG_REMOVE) == 0) {
+      message_send(msg->pid_sender, MSG_SUCCESS, NULL);
+    } else if (strcmp(msg->type, MSG_SUCCESS) != 0) {
+      message_send(msg->pid_sender, MSG_ERROR, "shutting down");
+    }
+    message_deinit(msg);
+  }
+}
+
+// Raises the soft limit on open files up to the hard limit, so that a pidfd can
+// be opened for each process.
+void raise_nofile_limit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef SHUTDOWN_H
+#define SHUTDOWN_H
+
+#include "proc_tree.h"
+
+// Terminates all the processes in the tree, escalating to SIGKILL after
+// timeout_ms milliseconds.
+int shutdown_tree(const proc_node * root, int timeout_ms, int * killed);
+
+#endif
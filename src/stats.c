@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+#include "histogram.h"
+#include "common.h"
+#include "read_pool.h"
+
+// Represents the statistics of a type of message.
+typedef struct type_stats {
+  // The type of message, and the name reported to pstats.
+  const char * type;
+  const char * name;
+  // Number of messages handled, and bytes sent by their handlers.
+  unsigned long long count;
+  unsigned long long bytes;
+  // Time spent in the inbox and in the handler, in nanoseconds, and the total
+  // time spent in the handler.
+  histogram queue;
+  histogram handler;
+  unsigned long long handler_sum;
+} type_stats;
+
+// Statistics of each type of message. The last entry collects unknown types.
+type_stats stats[] = {
+  {MSG_ADD, "add"}, {MSG_ADD_BATCH, "add_batch"}, {MSG_REMOVE, "remove"},
+  {MSG_INFO, "info"}, {MSG_LIST, "list"}, {MSG_PRUNE, "prune"},
+  {MSG_ZYGOTE, "zygote"}, {MSG_CLAIM, "claim"}, {MSG_STATS, "stats"},
+  {MSG_TIMING, "timing"}, {MSG_TIMEOUT, "timeout"}, {MSG_SUCCESS, "success"},
+  {MSG_ERROR, "error"}, {NULL, "other"}
+};
+// Number of entries of stats.
+#define STATS_COUNT (sizeof(stats) / sizeof(stats[0]))
+// Bounds of the buckets of handler times exported as metrics, in nanoseconds.
+// Each one is exported as the upper edge of the histogram bucket containing
+// it, so that the count of each Prometheus bucket is exact.
+const long long metrics_buckets[] = {
+  1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+  2500000, 5000000, 10000000, 100000000
+};
+// Time of the last reset (or of the first message), see time_ns().
+long long stats_since = 0;
+
+// Records a message handled between start and end. Called by the main thread
+// of pmanager and by the threads serving read-only requests, so counters are
+// updated atomically; the threads hold the tree for reading, so that a reset
+// does not run concurrently.
+//
+// msg: the message handled
+// start: the time at which the handler started
+// end: the time at which the handler returned
+// bytes: the number of bytes sent by the handler
+void stats_record(const message_t * msg, long long start, long long end,
+                  unsigned long long bytes) {
+  type_stats * entry = stats;
+  while (entry->type != NULL && strcmp(entry->type, msg->type) != 0) {
+    entry++;
+  }
+  if (stats_since == 0) {
+    stats_since = start;
+  }
+  __atomic_fetch_add(&entry->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&entry->bytes, bytes, __ATOMIC_RELAXED);
+  // Messages of older senders carry no send time.
+  if (msg->time_sent > 0) {
+    histogram_record(&entry->queue, start - msg->time_sent);
+  }
+  histogram_record(&entry->handler, end - start);
+  __atomic_fetch_add(&entry->handler_sum, end - start, __ATOMIC_RELAXED);
+}
+
+// Writes the statistics of each type of message in the text format of
+// Prometheus: messages handled, bytes sent, and a histogram of handler times.
+// It can be called by any thread. Statistics reset by pstats -r appear as
+// counter resets.
+//
+// output: the stream where metrics are written
+void stats_write_metrics(FILE * output) {
+  fprintf(output, "# HELP pmanager_messages_total Messages handled by type.\n");
+  fprintf(output, "# TYPE pmanager_messages_total counter\n");
+  int i;
+  for (i = 0; i < STATS_COUNT; i++) {
+    fprintf(output, "pmanager_messages_total{type=\"%s\"} %llu\n", stats[i].name,
+            __atomic_load_n(&stats[i].count, __ATOMIC_RELAXED));
+  }
+  fprintf(output, "# HELP pmanager_message_bytes_total Bytes sent by handlers by type.\n");
+  fprintf(output, "# TYPE pmanager_message_bytes_total counter\n");
+  for (i = 0; i < STATS_COUNT; i++) {
+    fprintf(output, "pmanager_message_bytes_total{type=\"%s\"} %llu\n", stats[i].name,
+            __atomic_load_n(&stats[i].bytes, __ATOMIC_RELAXED));
+  }
+  fprintf(output, "# HELP pmanager_handler_seconds Time spent in handlers by type.\n");
+  fprintf(output, "# TYPE pmanager_handler_seconds histogram\n");
+  for (i = 0; i < STATS_COUNT; i++) {
+    const type_stats * entry = &stats[i];
+    int j;
+    for (j = 0; j < sizeof(metrics_buckets) / sizeof(metrics_buckets[0]); j++) {
+      long long bound = histogram_bucket_max(metrics_buckets[j]);
+      fprintf(output, "pmanager_handler_seconds_bucket{type=\"%s\",le=\"%.9g\"} %llu\n",
+              entry->name, bound / 1e9, histogram_count_below(&entry->handler, bound));
+    }
+    unsigned long long total = __atomic_load_n(&entry->handler.total, __ATOMIC_RELAXED);
+    fprintf(output, "pmanager_handler_seconds_bucket{type=\"%s\",le=\"+Inf\"} %llu\n",
+            entry->name, total);
+    fprintf(output, "pmanager_handler_seconds_sum{type=\"%s\"} %.9f\n", entry->name,
+            __atomic_load_n(&entry->handler_sum, __ATOMIC_RELAXED) / 1e9);
+    fprintf(output, "pmanager_handler_seconds_count{type=\"%s\"} %llu\n", entry->name,
+            total);
+  }
+}
+
+void msg_stats_handler(const message_t * msg) {
+
+  // Send an entry for each type of message handled, formatted as
+  // <name>;<count>;<bytes>;<queue p50>;<queue p99>;<queue p999>;<handler p50>;
+  // <handler p99>;<handler p999>, with times in nanoseconds.
+  int i;
+  for (i = 0; i < STATS_COUNT; i++) {
+    const type_stats * entry = &stats[i];
+    if (entry->count == 0) {
+      continue;
+    }
+    char entry_str[256];
+    snprintf(entry_str, sizeof(entry_str), "%s;%llu;%llu;%lld;%lld;%lld;%lld;%lld;%lld",
+             entry->name, entry->count, entry->bytes,
+             histogram_percentile(&entry->queue, 0.5),
+             histogram_percentile(&entry->queue, 0.99),
+             histogram_percentile(&entry->queue, 0.999),
+             histogram_percentile(&entry->handler, 0.5),
+             histogram_percentile(&entry->handler, 0.99),
+             histogram_percentile(&entry->handler, 0.999));
+    if (message_send(msg->pid_sender, MSG_INFO, entry_str) != 0) {
+      fprintf(stderr, "Error: failed to send message.\n");
+      return;
+    }
+  }
+
+  // The reply ends with the time covered by the statistics, in nanoseconds.
+  long long now = time_ns();
+  char window_str[24];
+  snprintf(window_str, sizeof(window_str), "%lld",
+           (stats_since == 0) ? 0 : now - stats_since);
+  if (message_send(msg->pid_sender, MSG_SUCCESS, window_str) != 0) {
+    fprintf(stderr, "Error: failed to send message.\n");
+  }
+
+  // The threads serving read-only requests record their statistics holding
+  // the tree for reading, so holding it for writing excludes them.
+  if (strcmp(msg->content, MSG_STATS_RESET) == 0) {
+    tree_write_lock();
+    for (i = 0; i < STATS_COUNT; i++) {
+      stats[i].count = 0;
+      stats[i].bytes = 0;
+      histogram_reset(&stats[i].queue);
+      histogram_reset(&stats[i].handler);
+      stats[i].handler_sum = 0;
+    }
+    stats_since = now;
+    tree_write_unlock();
+  }
+
+}
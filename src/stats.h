@@ -0,0 +1,21 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "message.h"
+
+// Statistics kept by pmanager for each type of message handled: number of
+// messages, bytes sent by the handlers, and histograms of the time spent in
+// the inbox (from message_send() to the start of the handler) and in the
+// handler. They are reported to pstats with MSG_STATS.
+
+// Records a message handled between start and end (see time_ns()), whose
+// handler sent bytes bytes.
+void stats_record(const message_t * msg, long long start, long long end,
+                  unsigned long long bytes);
+// Writes the statistics as Prometheus metrics.
+void stats_write_metrics(FILE * output);
+// Replies to MSG_STATS with the statistics of each type of message.
+void msg_stats_handler(const message_t * msg);
+
+#endif
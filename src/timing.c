@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "timing.h"
+#include "message.h"
+#include "common.h"
+
+// Represents the end of a phase.
+typedef struct timing_phase {
+  char name[TIMING_NAME_MAX];
+  long long time;
+} timing_phase;
+
+// 1 if timing is enabled, 0 if it is not, -1 before the first mark.
+int timing_enabled = -1;
+// Process whose phases are marked. Forked children do not report them.
+pid_t timing_pid = -1;
+// Phases marked, and their number.
+timing_phase timing_phases[TIMING_PHASES];
+int timing_count = 0;
+
+// Private functions.
+// Sends the phases marked to pmanager.
+void timing_report();
+
+// Marks the end of a phase of the command, if TIMING_ENV is set. The phases
+// are sent to pmanager (the parent process) on exit.
+//
+// phase: the name of the phase, e.g. "setup"
+void timing_mark(const char * phase) {
+  if (timing_enabled == -1) {
+    timing_enabled = getenv(TIMING_ENV) != NULL;
+    if (timing_enabled) {
+      timing_pid = getpid();
+      atexit(timing_report);
+    }
+  }
+  if (!timing_enabled || timing_count == TIMING_PHASES) {
+    return;
+  }
+  timing_phase * entry = &timing_phases[timing_count++];
+  snprintf(entry->name, sizeof(entry->name), "%s", phase);
+  entry->time = time_ns();
+}
+
+// Sends the phases marked to pmanager with MSG_TIMING. Called on exit.
+void timing_report() {
+  if (getpid() != timing_pid || timing_count == 0) {
+    return;
+  }
+  char content[TIMING_PHASES * (TIMING_NAME_MAX + 22)];
+  size_t len = 0;
+  int i;
+  for (i = 0; i < timing_count; i++) {
+    len += snprintf(content + len, sizeof(content) - len, (i == 0) ? "%s=%lld" : ",%s=%lld",
+                    timing_phases[i].name, timing_phases[i].time);
+  }
+  message_send(getppid(), MSG_TIMING, content);
+}
@@ -0,0 +1,17 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+// Timing of commands. When pmanager runs with --timing, it sets TIMING_ENV,
+// and commands mark the end of each phase of their execution (e.g. "setup"
+// once the inbox is created). On exit, the marks are sent to pmanager with
+// MSG_TIMING, formatted as <phase>=<time>,<phase>=<time>,... (see time_ns()).
+#define TIMING_ENV "CUSTOMSHELL_TIMING"
+// Maximum number of phases of a command.
+#define TIMING_PHASES 16
+// Maximum length of the name of a phase.
+#define TIMING_NAME_MAX 16
+
+// Marks the end of a phase of the command, if timing is enabled.
+void timing_mark(const char * phase);
+
+#endif
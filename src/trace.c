@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "trace.h"
+#include "common.h"
+
+// States of tracing in this process.
+#define TRACE_UNKNOWN 0
+#define TRACE_ENABLED 1
+#define TRACE_DISABLED -1
+#define TRACE_OPENING 2
+
+// State of tracing, checked before each event. The ring is opened on the
+// first event, according to TRACE_ENV.
+int trace_state = TRACE_UNKNOWN;
+// Ring of this process, and its events.
+trace_header * trace_ring = NULL;
+trace_event * trace_events = NULL;
+// Flag set once trace_after_fork() is registered.
+int trace_fork_handler = 0;
+// Thread ID of the calling thread, cached.
+__thread pid_t trace_tid = 0;
+
+// Private functions.
+// Opens the ring of this process, if tracing is enabled.
+void trace_open();
+// Forgets the ring of the parent in a forked child.
+void trace_after_fork();
+// Returns the size of a ring file.
+size_t trace_size();
+// Writes an event to the ring, which must be open.
+void trace_write(long long time, int kind, pid_t peer, char msg_type, unsigned int arg);
+
+// Returns the size of a ring file, i.e. of its header and events.
+size_t trace_size() {
+  return sizeof(trace_header) + sizeof(trace_event) * TRACE_EVENTS;
+}
+
+// Creates and maps the ring of this process if TRACE_ENV is set, or disables
+// tracing otherwise. Only the first caller opens the ring: events recorded
+// meanwhile by other threads are dropped.
+void trace_open() {
+  int expected = TRACE_UNKNOWN;
+  if (!__atomic_compare_exchange_n(&trace_state, &expected, TRACE_OPENING, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  if (!trace_fork_handler) {
+    pthread_atfork(NULL, NULL, trace_after_fork);
+    trace_fork_handler = 1;
+  }
+  int state = TRACE_DISABLED;
+  const char * dir = getenv(TRACE_ENV);
+  char path[PATH_MAX];
+  if (dir != NULL && *dir != '\0' &&
+      snprintf(path, sizeof(path), "%s/%ld.ring", dir, (long) getpid()) < sizeof(path)) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd != -1) {
+      void * ring = MAP_FAILED;
+      if (ftruncate(fd, trace_size()) == 0) {
+        ring = mmap(NULL, trace_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      close(fd);
+      if (ring != MAP_FAILED) {
+        trace_ring = ring;
+        trace_events = (trace_event *) (trace_ring + 1);
+        trace_ring->capacity = TRACE_EVENTS;
+        trace_ring->pid = getpid();
+        strncpy(trace_ring->name, program_invocation_short_name,
+                sizeof(trace_ring->name) - 1);
+        __atomic_store_n(&trace_ring->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+        state = TRACE_ENABLED;
+      }
+    }
+  }
+  __atomic_store_n(&trace_state, state, __ATOMIC_RELEASE);
+}
+
+// Called in the child after fork(): the ring of the parent is unmapped, and
+// the child opens its own ring on its first event, or in message_setup().
+void trace_after_fork() {
+  if (trace_ring != NULL) {
+    munmap(trace_ring, trace_size());
+  }
+  trace_ring = NULL;
+  trace_events = NULL;
+  trace_tid = 0;
+  trace_state = TRACE_UNKNOWN;
+}
+
+// Enables tracing for the calling process and for its children, which inherit
+// TRACE_ENV. The directory is created if it does not exist.
+//
+// dir: the directory containing the rings
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int trace_start(const char * dir) {
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    return -1;
+  }
+  // Processes may change their working directory.
+  char path[PATH_MAX];
+  if (realpath(dir, path) == NULL || setenv(TRACE_ENV, path, 1) != 0) {
+    return -1;
+  }
+  trace_state = TRACE_UNKNOWN;
+  return 0;
+}
+
+// Opens the ring of the calling process now, if tracing is enabled and the
+// ring is not open yet. Called when the process sets up its inbox, so that
+// the ring is open before any signal handler records an event: opening it is
+// not async-signal-safe.
+void trace_init() {
+  if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) == TRACE_UNKNOWN) {
+    trace_open();
+  }
+}
+
+// Sets the name of the process stored in its ring, e.g. the name given to a
+// process created by pnew.
+//
+// name: the name of the process
+void trace_set_name(const char * name) {
+  if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) == TRACE_UNKNOWN) {
+    trace_open();
+  }
+  if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) == TRACE_ENABLED) {
+    strncpy(trace_ring->name, name, sizeof(trace_ring->name) - 1);
+  }
+}
+
+// Records an event happening now. See trace_record_at().
+void trace_record(int kind, pid_t peer, char msg_type, unsigned int arg) {
+  if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) == TRACE_DISABLED) {
+    return;
+  }
+  trace_record_at(time_ns(), kind, peer, msg_type, arg);
+}
+
+// Records an event in the ring of this process, overwriting the oldest one if
+// the ring is full. Threads reserve a position with an atomic increment, and
+// no lock is taken. The ring is opened on the first event if needed, which
+// signal handlers must not do: they use trace_record_async().
+//
+// time: the time of the event (see time_ns())
+// kind: the kind of event (see TRACE_SEND and following macros)
+// peer: the other process involved
+// msg_type: the type of message, or 0 for events not about messages
+// arg: a value depending on kind
+void trace_record_at(long long time, int kind, pid_t peer, char msg_type,
+                     unsigned int arg) {
+  int state = __atomic_load_n(&trace_state, __ATOMIC_ACQUIRE);
+  if (state == TRACE_UNKNOWN) {
+    trace_open();
+    state = __atomic_load_n(&trace_state, __ATOMIC_ACQUIRE);
+  }
+  if (state == TRACE_ENABLED) {
+    trace_write(time, kind, peer, msg_type, arg);
+  }
+}
+
+// Records an event happening now, only if the ring is already open (see
+// trace_init()): the ring is never opened, so it can be called from signal
+// handlers.
+void trace_record_async(int kind, pid_t peer, char msg_type, unsigned int arg) {
+  if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) == TRACE_ENABLED) {
+    trace_write(time_ns(), kind, peer, msg_type, arg);
+  }
+}
+
+// Writes an event to the ring of this process, which must be open.
+//
+// time: the time of the event (see time_ns())
+// kind: the kind of event
+// peer: the other process involved
+// msg_type: the type of message, or 0
+// arg: a value depending on kind
+void trace_write(long long time, int kind, pid_t peer, char msg_type, unsigned int arg) {
+  if (trace_tid == 0) {
+    trace_tid = syscall(SYS_gettid);
+  }
+  uint64_t index = __atomic_fetch_add(&trace_ring->head, 1, __ATOMIC_RELAXED);
+  trace_event * event = &trace_events[index % TRACE_EVENTS];
+  event->time = time;
+  event->peer = peer;
+  event->arg = arg;
+  event->tid = trace_tid;
+  event->kind = kind;
+  event->msg_type = msg_type;
+  __atomic_store_n(&event->seq, (uint32_t) (index + 1), __ATOMIC_RELEASE);
+}
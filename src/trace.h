@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Event tracing. When TRACE_ENV is set to a directory (pmanager --trace DIR),
+// every process linking message.c records its events in DIR/<pid>.ring: a
+// file mapped in memory and used as a ring of TRACE_EVENTS events, so that it
+// survives the process and can be read while the process runs. ptimeline
+// merges the rings of a directory into a single timeline.
+#define TRACE_ENV "CUSTOMSHELL_TRACE"
+// Number of events kept by each ring, a power of two.
+#define TRACE_EVENTS 16384
+// Value of trace_header.magic once the ring is initialized.
+#define TRACE_MAGIC 0x54524331
+
+// Kinds of event.
+// TRACE_SEND: a message sent to peer (arg: its length).
+// TRACE_RECV: a message received from peer (arg: microseconds since it was
+// sent).
+// TRACE_SIGNAL_SEND: signal arg sent to peer (a negative peer is a group).
+// TRACE_SIGNAL_RECV: signal arg received from peer.
+// TRACE_HANDLER: a message from peer handled by pmanager (arg: duration in
+// nanoseconds, starting at the time of the event).
+// TRACE_WAIT_BEGIN, TRACE_WAIT_END: message_wait() for a message from peer.
+#define TRACE_SEND 1
+#define TRACE_RECV 2
+#define TRACE_SIGNAL_SEND 3
+#define TRACE_SIGNAL_RECV 4
+#define TRACE_HANDLER 5
+#define TRACE_WAIT_BEGIN 6
+#define TRACE_WAIT_END 7
+
+// Header of a ring file, followed by TRACE_EVENTS events.
+typedef struct trace_header {
+  uint32_t magic;
+  uint32_t capacity;
+  int32_t pid;
+  // Name of the program that created the ring.
+  char name[20];
+  // Number of events recorded. Event i is stored at index i % capacity.
+  uint64_t head;
+} trace_header;
+
+// An event of a ring. seq is written last, and is valid only if it matches the
+// position of the event (low 32 bits of its index + 1).
+typedef struct trace_event {
+  // Time of the event (see time_ns()).
+  long long time;
+  uint32_t seq;
+  int32_t peer;
+  uint32_t arg;
+  // Thread that recorded the event.
+  int32_t tid;
+  uint8_t kind;
+  // Type of the message, for events about messages.
+  char msg_type;
+  uint8_t padding[6];
+} trace_event;
+
+// Enables tracing into dir for the calling process and its children.
+int trace_start(const char * dir);
+// Opens the ring of the calling process now, if tracing is enabled.
+void trace_init();
+// Sets the name of the process shown in the timeline.
+void trace_set_name(const char * name);
+// Records an event, if tracing is enabled.
+void trace_record(int kind, pid_t peer, char msg_type, unsigned int arg);
+// Records an event that happened at time.
+void trace_record_at(long long time, int kind, pid_t peer, char msg_type,
+                     unsigned int arg);
+// Records an event only if the ring is already open. Safe in signal handlers.
+void trace_record_async(int kind, pid_t peer, char msg_type, unsigned int arg);
+
+#endif
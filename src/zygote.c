@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "zygote.h"
+#include "common.h"
+
+extern char ** environ;
+
+// PID of pzygote, or -1 if the pool is disabled.
+pid_t zygote_helper = -1;
+// Idle zygotes, in order of announcement. The oldest one is claimed first,
+// being the most likely to be already waiting for its name.
+pid_t * zygotes = NULL;
+// Number of idle zygotes and size of zygotes.
+int zygotes_count = 0;
+int zygotes_size = 0;
+
+// Starts pzygote, which forks size zygotes. Each of them announces itself with
+// MSG_ZYGOTE once it is ready to be claimed. ZYGOTE_ENV is set, so that pnew
+// tries to claim a zygote before forking.
+//
+// size: the number of idle zygotes
+//
+// Returns: on success, 0 is returned; on failure, -1 is returned.
+int zygote_pool_start(int size) {
+  zygotes = malloc(sizeof(pid_t) * size);
+  if (zygotes == NULL) {
+    return -1;
+  }
+  zygotes_size = size;
+  char size_str[12];
+  snprintf(size_str, sizeof(size_str), "%d", size);
+  char * argv[] = { "pzygote", size_str, NULL };
+  if (posix_spawn(&zygote_helper, ZYGOTE_PATH, NULL, NULL, argv, environ) != 0) {
+    zygote_helper = -1;
+    return -1;
+  }
+  return setenv(ZYGOTE_ENV, "1", 1);
+}
+
+// Stops pzygote, which kills the idle zygotes, and waits for its termination.
+// Claimed zygotes are normal processes of the tree, so they must be terminated
+// before.
+void zygote_pool_stop() {
+  if (zygote_helper != -1) {
+    kill(zygote_helper, SIGTERM);
+    waitpid(zygote_helper, NULL, 0);
+    zygote_helper = -1;
+  }
+  free(zygotes);
+  zygotes = NULL;
+  zygotes_count = 0;
+  zygotes_size = 0;
+}
+
+void msg_zygote_handler(const message_t * msg) {
+  if (zygotes_count == zygotes_size) {
+    pid_t * tmp = realloc(zygotes, sizeof(pid_t) * (zygotes_size * 2 + 1));
+    if (tmp == NULL) {
+      return;
+    }
+    zygotes = tmp;
+    zygotes_size = zygotes_size * 2 + 1;
+  }
+  zygotes[zygotes_count++] = msg->pid_sender;
+}
+
+void msg_claim_handler(const message_t * msg, proc_node * root) {
+
+  if (proc_node_find_by_name(root, msg->content) != NULL) {
+    message_send(msg->pid_sender, MSG_ERROR, MSG_ERROR_EXISTS);
+    return;
+  }
+
+  // Zygotes that terminated since their announcement cannot receive their
+  // name, and are skipped.
+  while (zygotes_count > 0) {
+    pid_t pid = zygotes[0];
+    zygotes_count--;
+    memmove(zygotes, zygotes + 1, sizeof(pid_t) * zygotes_count);
+
+    // pzygote replaces the zygote in the background.
+    char pid_str[12];
+    snprintf(pid_str, sizeof(pid_str), "%ld", (long) pid);
+    message_send(zygote_helper, MSG_ZYGOTE, pid_str);
+
+    if (message_send(pid, MSG_NAME, msg->content) != 0) {
+      continue;
+    }
+    // The zygote is a child of pzygote, but it is shown as created by
+    // pmanager, as processes started by pnew.
+    proc_node * node = proc_node_init(pid, root->pid, msg->content);
+    if (node == NULL || proc_node_add(root, node) != 0) {
+      fprintf(stderr, "Error: failed to add new process to the process tree.\n");
+      proc_node_deinit(node);
+      kill(pid, SIGKILL);
+      break;
+    }
+    proc_node_deinit(node);
+    message_send(msg->pid_sender, MSG_SUCCESS, pid_str);
+    return;
+  }
+
+  message_send(msg->pid_sender, MSG_ERROR, MSG_ERROR_NO_ZYGOTE);
+
+}
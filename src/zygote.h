@@ -0,0 +1,16 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "message.h"
+#include "proc_tree.h"
+
+// Starts pzygote, which keeps size idle zygotes for pnew.
+int zygote_pool_start(int size);
+// Stops pzygote, killing the idle zygotes.
+void zygote_pool_stop();
+// Adds the sender of MSG_ZYGOTE to the idle zygotes.
+void msg_zygote_handler(const message_t * msg);
+// Names and registers an idle zygote on behalf of pnew.
+void msg_claim_handler(const message_t * msg, proc_node * root);
+
+#endif